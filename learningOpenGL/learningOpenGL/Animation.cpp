@@ -0,0 +1,142 @@
+#include "Animation.h"
+#include "ThreadPool.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// Index of the last key at or before time (keys are sorted)
+	template<typename Key>
+	size_t findKey(const std::vector<Key> &keys, float time)
+	{
+		auto next = std::upper_bound(keys.begin(), keys.end(), time, [](float t, const Key &key) { return t < key.time; });
+		return next == keys.begin() ? 0 : (size_t)(next - keys.begin()) - 1;
+	}
+
+	float blendFactor(float from, float to, float time)
+	{
+		return to > from ? glm::clamp((time - from) / (to - from), 0.0f, 1.0f) : 0.0f;
+	}
+
+	glm::vec3 interpolate(const std::vector<VectorKey> &keys, float time, const glm::vec3 &fallback)
+	{
+		if (keys.empty())
+			return fallback;
+		size_t i = findKey(keys, time);
+		if (i + 1 >= keys.size())
+			return keys[i].value;
+		return glm::mix(keys[i].value, keys[i + 1].value, blendFactor(keys[i].time, keys[i + 1].time, time));
+	}
+
+	glm::quat interpolate(const std::vector<RotationKey> &keys, float time)
+	{
+		if (keys.empty())
+			return glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		size_t i = findKey(keys, time);
+		if (i + 1 >= keys.size())
+			return keys[i].value;
+		return glm::normalize(glm::slerp(keys[i].value, keys[i + 1].value, blendFactor(keys[i].time, keys[i + 1].time, time)));
+	}
+}
+
+int Skeleton::FindBone(unsigned int node) const
+{
+	for (unsigned int i = 0; i < bones.size(); i++)
+	{
+		if (bones[i].node == node)
+			return (int)i;
+	}
+	return -1;
+}
+
+Animator::Animator(const Skeleton &skeleton, const NodeHierarchy &hierarchy)
+	: skeleton(&skeleton), hierarchy(&hierarchy), worlds(hierarchy.NodeCount())
+{
+}
+
+void Animator::Play(unsigned int clip, float startTime, bool loop)
+{
+	this->clip = clip < skeleton->clips.size() ? (int)clip : -1;
+	this->time = startTime;
+	this->loop = loop;
+}
+
+float Animator::clipTicks() const
+{
+	const AnimationClip &current = skeleton->clips[clip];
+	float ticks = time * (current.ticksPerSecond > 0.0f ? current.ticksPerSecond : 25.0f);
+	if (current.duration <= 0.0f)
+		return 0.0f;
+	return loop ? std::fmod(ticks, current.duration) : std::min(ticks, current.duration);
+}
+
+void Animator::Sample(glm::mat4 *palette)
+{
+	unsigned int nodeCount = hierarchy->NodeCount();
+
+	// Start from the bind pose, then replace the local transform of every animated node
+	for (unsigned int i = 0; i < nodeCount; i++)
+		worlds[i] = hierarchy->LocalTransform(i);
+	if (clip >= 0)
+	{
+		float ticks = clipTicks();
+		for (const AnimationChannel &channel : skeleton->clips[clip].channels)
+		{
+			glm::mat4 local = glm::translate(glm::mat4(1.0f), interpolate(channel.positions, ticks, glm::vec3(0.0f)));
+			local = local * glm::mat4_cast(interpolate(channel.rotations, ticks));
+			worlds[channel.node] = glm::scale(local, interpolate(channel.scales, ticks, glm::vec3(1.0f)));
+		}
+	}
+
+	// Nodes are in pre-order so parents are always resolved before their children, in place
+	for (unsigned int i = 0; i < nodeCount; i++)
+	{
+		int parent = hierarchy->Parent(i);
+		if (parent >= 0)
+			worlds[i] = worlds[parent] * worlds[i];
+	}
+
+	// Skinned vertices are in the space of the model's root
+	glm::mat4 rootInverse = glm::inverse(hierarchy->LocalTransform(0));
+	for (unsigned int b = 0; b < skeleton->bones.size(); b++)
+		palette[b] = rootInverse * worlds[skeleton->bones[b].node] * skeleton->bones[b].offset;
+}
+
+void Animator::SampleAll(const std::vector<Animator*> &animators, std::vector<glm::mat4> &palettes)
+{
+	unsigned int total = 0;
+	for (Animator *animator : animators)
+	{
+		animator->paletteOffset = total;
+		total += animator->BoneCount();
+	}
+	palettes.resize(total);
+
+	ThreadPool::Shared().ParallelFor((unsigned int)animators.size(), [&](unsigned int i)
+	{
+		animators[i]->Sample(palettes.data() + animators[i]->paletteOffset);
+	});
+}
+
+void BonePaletteBuffer::Upload(const std::vector<glm::mat4> &palettes)
+{
+	if (!buffer)
+		buffer = GpuBuffer::Create(GPU_MEMORY_STORAGE_BUFFERS);
+	size_t bytes = palettes.size() * sizeof(glm::mat4);
+	if (bytes > capacity)
+		capacity = bytes;
+	// Re-specifying the storage lets the driver hand us fresh memory instead of waiting on last frame's draws
+	GpuBufferData(buffer, GL_SHADER_STORAGE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, palettes.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BONE_PALETTE_BINDING, buffer);
+}
+
+void BonePaletteBuffer::Release()
+{
+	buffer.Reset();
+	capacity = 0;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "NodeHierarchy.h"
+#include "GpuResource.h"
+
+#include <string>
+#include <vector>
+
+// Shader storage binding of the bone palettes read by shaders/skinning.vert
+const unsigned int BONE_PALETTE_BINDING = 5;
+
+struct Bone
+{
+	unsigned int node;		// node of the model's hierarchy driving this bone
+	glm::mat4 offset;		// mesh space to bone space in bind pose (Assimp's mOffsetMatrix)
+};
+
+struct VectorKey
+{
+	float time;
+	glm::vec3 value;
+};
+
+struct RotationKey
+{
+	float time;
+	glm::quat value;
+};
+
+// Keyframes of one node, keys are sorted by time
+struct AnimationChannel
+{
+	unsigned int node;
+	std::vector<VectorKey> positions;
+	std::vector<RotationKey> rotations;
+	std::vector<VectorKey> scales;
+};
+
+struct AnimationClip
+{
+	std::string name;
+	float duration;			// in ticks
+	float ticksPerSecond;
+	std::vector<AnimationChannel> channels;
+};
+
+// Bones and animation clips of a skinned Model
+struct Skeleton
+{
+	std::vector<Bone> bones;
+	std::vector<AnimationClip> clips;
+
+	bool empty() const { return bones.empty(); }
+	/// Index of the bone with that node, -1 if the node isn't a bone
+	int FindBone(unsigned int node) const;
+};
+
+// Plays one clip on one character. Animators of all characters are sampled together on the worker pool by
+// SampleAll, which lays their palettes out back to back in a single array ready to upload in one SSBO.
+class Animator
+{
+public:
+	Animator(const Skeleton &skeleton, const NodeHierarchy &hierarchy);
+
+	void Play(unsigned int clip, float startTime = 0.0f, bool loop = true);
+	void Advance(float deltaTime) { time += deltaTime; }
+
+	unsigned int BoneCount() const { return (unsigned int)skeleton->bones.size(); }
+	/// First matrix of this animator's palette in the array filled by SampleAll, the shader's paletteOffset
+	unsigned int PaletteOffset() const { return paletteOffset; }
+
+	/// Samples the current pose into palette (BoneCount() matrices)
+	void Sample(glm::mat4 *palette);
+	/// Samples every animator in parallel into palettes, resized to hold them all
+	static void SampleAll(const std::vector<Animator*> &animators, std::vector<glm::mat4> &palettes);
+
+private:
+	const Skeleton *skeleton;
+	const NodeHierarchy *hierarchy;
+	int clip = -1;
+	float time = 0.0f;
+	bool loop = true;
+	unsigned int paletteOffset = 0;
+	std::vector<glm::mat4> worlds;	// scratch, one per node
+
+	float clipTicks() const;
+};
+
+// Single shader storage buffer holding the bone palettes of every animated character
+class BonePaletteBuffer
+{
+public:
+	/// Uploads all palettes (orphaning last frame's storage) and binds the buffer at BONE_PALETTE_BINDING
+	void Upload(const std::vector<glm::mat4> &palettes);
+	void Release();
+
+private:
+	GpuBuffer buffer;
+	size_t capacity = 0;
+};
@@ -0,0 +1,536 @@
+#include "ClusterLOD.h"
+#include "MeshSimplifier.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <unordered_map>
+
+namespace
+{
+	const uint64_t CLUSTER_ALIGNMENT = 16;
+
+	uint64_t alignUp(uint64_t offset)
+	{
+		return (offset + CLUSTER_ALIGNMENT - 1) & ~(CLUSTER_ALIGNMENT - 1);
+	}
+
+	void writePadding(std::ofstream &out, uint64_t from, uint64_t to)
+	{
+		static const char zeros[CLUSTER_ALIGNMENT] = { 0 };
+		out.write(zeros, (std::streamsize)(to - from));
+	}
+
+	struct BuildCluster
+	{
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;	// into vertices
+		uint32_t group = CLUSTER_NONE, generatingGroup = CLUSTER_NONE;
+		uint32_t level = 0;
+		float selfError = 0.0f, parentError = FLT_MAX;
+		glm::vec4 selfSphere, parentSphere;
+		glm::vec3 center;					// of the cluster's own bounds, orders clusters into groups
+	};
+
+	struct BuildGroup
+	{
+		float error;
+		glm::vec4 sphere;
+		std::vector<uint32_t> children, outputs;
+	};
+
+	struct GroupResult
+	{
+		bool simplified = false;
+		float error = 0.0f;
+		std::vector<BuildCluster> outputs;
+	};
+
+	// Copies of a vertex in neighbouring clusters are bitwise identical, which is what welding and adjacency look for
+	template<typename T>
+	struct BytesHash
+	{
+		size_t operator()(const T &value) const
+		{
+			const unsigned char *bytes = (const unsigned char*)&value;
+			uint64_t hash = 14695981039346656037ull;
+			for (size_t i = 0; i < sizeof(T); i++)
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			return (size_t)hash;
+		}
+	};
+	template<typename T>
+	struct BytesEqual
+	{
+		bool operator()(const T &a, const T &b) const { return std::memcmp(&a, &b, sizeof(T)) == 0; }
+	};
+
+	// Spreads the low 10 bits of v so there are two zero bits between each
+	uint32_t spreadBits(uint32_t v)
+	{
+		v &= 0x3FF;
+		v = (v | (v << 16)) & 0x030000FF;
+		v = (v | (v << 8)) & 0x0300F00F;
+		v = (v | (v << 4)) & 0x030C30C3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	}
+
+	// Order of the points along a Morton curve through their bounds, consecutive points are close in space
+	std::vector<uint32_t> mortonOrder(const std::vector<glm::vec3> &points)
+	{
+		glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+		for (const glm::vec3 &p : points)
+		{
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+		glm::vec3 scale = 1023.0f / glm::max(hi - lo, glm::vec3(1e-20f));
+		std::vector<std::pair<uint32_t, uint32_t>> keyed(points.size());
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			glm::vec3 q = (points[i] - lo) * scale;
+			keyed[i] = { spreadBits((uint32_t)q.x) | (spreadBits((uint32_t)q.y) << 1) | (spreadBits((uint32_t)q.z) << 2), (uint32_t)i };
+		}
+		std::sort(keyed.begin(), keyed.end());
+		std::vector<uint32_t> order(points.size());
+		for (size_t i = 0; i < keyed.size(); i++)
+			order[i] = keyed[i].second;
+		return order;
+	}
+
+	glm::vec4 boundingSphere(const std::vector<Vertex> &vertices)
+	{
+		glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+		for (const Vertex &v : vertices)
+		{
+			lo = glm::min(lo, v.Position);
+			hi = glm::max(hi, v.Position);
+		}
+		glm::vec3 center = (lo + hi) * 0.5f;
+		float radius = 0.0f;
+		for (const Vertex &v : vertices)
+			radius = std::max(radius, glm::length(v.Position - center));
+		return glm::vec4(center, radius);
+	}
+
+	glm::vec4 mergeSpheres(const glm::vec4 &a, const glm::vec4 &b)
+	{
+		glm::vec3 d = glm::vec3(b) - glm::vec3(a);
+		float distance = glm::length(d);
+		if (distance + b.w <= a.w)
+			return a;
+		if (distance + a.w <= b.w)
+			return b;
+		float radius = (distance + a.w + b.w) * 0.5f;
+		return glm::vec4(glm::vec3(a) + d * ((radius - a.w) / distance), radius);
+	}
+
+	// Cluster of the triangles order[begin, end) of indices, with its own compacted copy of the vertices they use
+	BuildCluster makeCluster(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, const std::vector<uint32_t> &order,
+		size_t begin, size_t end)
+	{
+		BuildCluster cluster;
+		std::unordered_map<unsigned int, unsigned int> remap;
+		for (size_t i = begin; i < end; i++)
+		{
+			for (int corner = 0; corner < 3; corner++)
+			{
+				unsigned int index = indices[order[i] * 3 + corner];
+				auto inserted = remap.emplace(index, (unsigned int)cluster.vertices.size());
+				if (inserted.second)
+					cluster.vertices.push_back(vertices[index]);
+				cluster.indices.push_back(inserted.first->second);
+			}
+		}
+		cluster.selfSphere = boundingSphere(cluster.vertices);
+		cluster.center = glm::vec3(cluster.selfSphere);
+		return cluster;
+	}
+
+	// Splits triangles into clusters of at most CLUSTER_MAX_TRIANGLES triangles that are close along a Morton curve
+	std::vector<BuildCluster> splitIntoClusters(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, bool parallel)
+	{
+		size_t triangleCount = indices.size() / 3;
+		std::vector<glm::vec3> centroids(triangleCount);
+		for (size_t t = 0; t < triangleCount; t++)
+			centroids[t] = (vertices[indices[t * 3]].Position + vertices[indices[t * 3 + 1]].Position + vertices[indices[t * 3 + 2]].Position) / 3.0f;
+		std::vector<uint32_t> order = mortonOrder(centroids);
+
+		std::vector<BuildCluster> clusters((triangleCount + CLUSTER_MAX_TRIANGLES - 1) / CLUSTER_MAX_TRIANGLES);
+		auto build = [&](unsigned int c)
+		{
+			clusters[c] = makeCluster(vertices, indices, order, c * CLUSTER_MAX_TRIANGLES, std::min(triangleCount, (size_t)(c + 1) * CLUSTER_MAX_TRIANGLES));
+		};
+		if (parallel)
+			ThreadPool::Shared().ParallelFor((unsigned int)clusters.size(), build);
+		else
+		{
+			for (unsigned int c = 0; c < clusters.size(); c++)
+				build(c);
+		}
+		return clusters;
+	}
+
+	// Groups of up to CLUSTER_GROUP_SIZE clusters, each grown from a seed by adding the neighbour sharing the most
+	// positions with the group, so groups are compact and the borders locked while simplifying them stay short.
+	// Seeds follow the Morton order of the cluster centers.
+	std::vector<std::vector<uint32_t>> groupClusters(const std::vector<BuildCluster> &clusters, const std::vector<uint32_t> &current)
+	{
+		std::unordered_map<glm::vec3, std::vector<uint32_t>, BytesHash<glm::vec3>, BytesEqual<glm::vec3>> touching;
+		for (uint32_t i = 0; i < current.size(); i++)
+		{
+			for (const Vertex &vertex : clusters[current[i]].vertices)
+			{
+				std::vector<uint32_t> &list = touching[vertex.Position];
+				if (list.empty() || list.back() != i)
+					list.push_back(i);
+			}
+		}
+		std::vector<std::unordered_map<uint32_t, uint32_t>> shared(current.size());
+		for (const auto &entry : touching)
+		{
+			for (uint32_t a : entry.second)
+			{
+				for (uint32_t b : entry.second)
+				{
+					if (a != b)
+						shared[a][b]++;
+				}
+			}
+		}
+
+		std::vector<glm::vec3> centers(current.size());
+		for (size_t i = 0; i < current.size(); i++)
+			centers[i] = clusters[current[i]].center;
+		std::vector<unsigned char> grouped(current.size(), 0);
+		std::vector<std::vector<uint32_t>> groups;
+		for (uint32_t seed : mortonOrder(centers))
+		{
+			if (grouped[seed])
+				continue;
+			std::vector<uint32_t> group = { seed };
+			grouped[seed] = 1;
+			std::unordered_map<uint32_t, uint32_t> candidates; // ungrouped neighbour and positions it shares with the group
+			while (group.size() < CLUSTER_GROUP_SIZE)
+			{
+				for (const auto &neighbour : shared[group.back()])
+				{
+					if (!grouped[neighbour.first])
+						candidates[neighbour.first] += neighbour.second;
+				}
+				uint32_t best = CLUSTER_NONE;
+				for (const auto &candidate : candidates)
+				{
+					if (best == CLUSTER_NONE || candidate.second > candidates[best] || (candidate.second == candidates[best] && candidate.first < best))
+						best = candidate.first;
+				}
+				if (best == CLUSTER_NONE)
+					break;
+				candidates.erase(best);
+				group.push_back(best);
+				grouped[best] = 1;
+			}
+			for (uint32_t &member : group)
+				member = current[member];
+			groups.push_back(std::move(group));
+		}
+		return groups;
+	}
+
+	// Welds the members back into one mesh, halves its triangles and splits the result into new clusters. The
+	// simplifier finds adjacency through positions, so only the group's outer border is open and locked: UV and
+	// normal seams inside the group stay split vertices that collapse along the seam.
+	GroupResult simplifyGroup(const std::vector<BuildCluster> &clusters, const uint32_t *members, size_t memberCount)
+	{
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		std::unordered_map<Vertex, unsigned int, BytesHash<Vertex>, BytesEqual<Vertex>> welded;
+		for (size_t m = 0; m < memberCount; m++)
+		{
+			const BuildCluster &cluster = clusters[members[m]];
+			for (unsigned int index : cluster.indices)
+			{
+				auto inserted = welded.emplace(cluster.vertices[index], (unsigned int)vertices.size());
+				if (inserted.second)
+					vertices.push_back(cluster.vertices[index]);
+				indices.push_back(inserted.first->second);
+			}
+		}
+
+		GroupResult result;
+		size_t sourceTriangles = indices.size() / 3;
+		result.error = MeshSimplifier::Simplify(vertices, indices, (unsigned int)(sourceTriangles / 2));
+		// Groups whose border blocks most collapses stop here, their clusters become roots of the DAG
+		if (indices.empty() || indices.size() / 3 > sourceTriangles * 0.85f)
+			return result;
+		result.simplified = true;
+		result.outputs = splitIntoClusters(vertices, indices, false);
+		return result;
+	}
+
+	void copySphere(float *out, const glm::vec4 &sphere)
+	{
+		out[0] = sphere.x;
+		out[1] = sphere.y;
+		out[2] = sphere.z;
+		out[3] = sphere.w;
+	}
+}
+
+bool ClusterLODBuilder::Cook(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, const std::string &path)
+{
+	if (indices.size() < 3 || vertices.empty())
+	{
+		std::cout << "ERROR::CLUSTER_LOD::EMPTY_MESH " << path << std::endl;
+		return false;
+	}
+
+	// Level 0, then one pass over the current clusters at a time until a single cluster is left or no group simplifies
+	std::vector<BuildCluster> clusters = splitIntoClusters(vertices, indices, true);
+	std::vector<BuildGroup> groups;
+	std::vector<uint32_t> current(clusters.size());
+	std::iota(current.begin(), current.end(), 0);
+	while (current.size() > 1)
+	{
+		std::vector<std::vector<uint32_t>> members = groupClusters(clusters, current);
+		std::vector<GroupResult> results(members.size());
+		ThreadPool::Shared().ParallelFor((unsigned int)members.size(), [&](unsigned int g)
+		{
+			results[g] = simplifyGroup(clusters, members[g].data(), members[g].size());
+		});
+
+		std::vector<uint32_t> next;
+		bool simplified = false;
+		for (size_t g = 0; g < members.size(); g++)
+		{
+			// Clusters of a group that didn't simplify try again with other neighbours in the next pass
+			if (!results[g].simplified)
+			{
+				next.insert(next.end(), members[g].begin(), members[g].end());
+				continue;
+			}
+			simplified = true;
+
+			// Errors and spheres include the members' own so they only grow towards the roots
+			BuildGroup group;
+			group.error = results[g].error;
+			group.sphere = clusters[members[g][0]].selfSphere;
+			uint32_t level = 0;
+			for (uint32_t member : members[g])
+			{
+				group.error = std::max(group.error, clusters[member].selfError);
+				group.sphere = mergeSpheres(group.sphere, clusters[member].selfSphere);
+				level = std::max(level, clusters[member].level + 1);
+			}
+
+			uint32_t groupIndex = (uint32_t)groups.size();
+			for (uint32_t member : members[g])
+			{
+				BuildCluster &child = clusters[member];
+				child.group = groupIndex;
+				child.parentError = group.error;
+				child.parentSphere = group.sphere;
+				group.children.push_back(member);
+			}
+			for (BuildCluster &output : results[g].outputs)
+			{
+				output.generatingGroup = groupIndex;
+				output.selfError = group.error;
+				output.selfSphere = group.sphere;
+				output.level = level;
+				group.outputs.push_back((uint32_t)clusters.size());
+				next.push_back((uint32_t)clusters.size());
+				clusters.push_back(std::move(output));
+			}
+			groups.push_back(std::move(group));
+		}
+		// What is left when no group simplifies anymore are the roots of the DAG
+		if (!simplified)
+			break;
+		current.swap(next);
+	}
+	for (BuildCluster &cluster : clusters)
+	{
+		if (cluster.group == CLUSTER_NONE)
+			cluster.parentSphere = cluster.selfSphere;
+	}
+
+	// Roots first, then coarse to fine levels with the children of a group next to each other
+	std::vector<uint32_t> sorted(clusters.size());
+	std::iota(sorted.begin(), sorted.end(), 0);
+	std::stable_sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b)
+	{
+		const BuildCluster &ca = clusters[a], &cb = clusters[b];
+		bool rootA = ca.group == CLUSTER_NONE, rootB = cb.group == CLUSTER_NONE;
+		if (rootA != rootB)
+			return rootA;
+		if (ca.level != cb.level)
+			return ca.level > cb.level;
+		return ca.group < cb.group;
+	});
+	std::vector<uint32_t> newIndex(clusters.size());
+	for (size_t i = 0; i < sorted.size(); i++)
+		newIndex[sorted[i]] = (uint32_t)i;
+
+	// Pack into pages, moving a group's children to a fresh page rather than splitting them when they fit in one
+	std::vector<ClusterRecord> records(clusters.size());
+	std::vector<ClusterPageRecord> pages;
+	uint32_t pageVertices = 0, pageTriangles = 0;
+	auto startPage = [&](uint32_t firstCluster)
+	{
+		pages.push_back({ 0, 0, 0, firstCluster, 0 });
+		pageVertices = pageTriangles = 0;
+	};
+	auto fits = [&](uint32_t vertexCount, uint32_t triangleCount)
+	{
+		return pageVertices + vertexCount <= CLUSTER_PAGE_VERTICES && pageTriangles + triangleCount <= CLUSTER_PAGE_TRIANGLES;
+	};
+	for (size_t i = 0; i < sorted.size();)
+	{
+		uint32_t group = clusters[sorted[i]].group;
+		size_t end = i + 1;
+		uint32_t runVertices = (uint32_t)clusters[sorted[i]].vertices.size(), runTriangles = (uint32_t)clusters[sorted[i]].indices.size() / 3;
+		while (group != CLUSTER_NONE && end < sorted.size() && clusters[sorted[end]].group == group)
+		{
+			runVertices += (uint32_t)clusters[sorted[end]].vertices.size();
+			runTriangles += (uint32_t)clusters[sorted[end]].indices.size() / 3;
+			end++;
+		}
+		if (pages.empty() || (!fits(runVertices, runTriangles) && pageTriangles > 0))
+			startPage((uint32_t)i);
+
+		for (; i < end; i++)
+		{
+			const BuildCluster &cluster = clusters[sorted[i]];
+			uint32_t vertexCount = (uint32_t)cluster.vertices.size(), triangleCount = (uint32_t)cluster.indices.size() / 3;
+			if (!fits(vertexCount, triangleCount))
+				startPage((uint32_t)i);
+
+			ClusterRecord &record = records[i];
+			record.page = (uint32_t)pages.size() - 1;
+			record.firstVertex = pageVertices;
+			record.vertexCount = vertexCount;
+			record.firstIndex = pageTriangles * 3;
+			record.triangleCount = triangleCount;
+			record.group = cluster.group;
+			record.generatingGroup = cluster.generatingGroup;
+			record.level = cluster.level;
+			record.selfError = cluster.selfError;
+			record.parentError = cluster.parentError;
+			copySphere(record.selfSphere, cluster.selfSphere);
+			copySphere(record.parentSphere, cluster.parentSphere);
+
+			pageVertices += vertexCount;
+			pageTriangles += triangleCount;
+			ClusterPageRecord &page = pages.back();
+			page.vertexCount = pageVertices;
+			page.indexCount = pageTriangles * 3;
+			page.clusterCount++;
+		}
+	}
+
+	// Group table, with the outputs and the children's pages in one list
+	std::vector<ClusterGroupRecord> groupRecords(groups.size());
+	std::vector<uint32_t> groupList;
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		ClusterGroupRecord &record = groupRecords[g];
+		record.error = groups[g].error;
+		copySphere(record.sphere, groups[g].sphere);
+		record.firstOutput = (uint32_t)groupList.size();
+		for (uint32_t output : groups[g].outputs)
+			groupList.push_back(newIndex[output]);
+		record.outputCount = (uint32_t)groupList.size() - record.firstOutput;
+
+		std::vector<uint32_t> childPages;
+		for (uint32_t child : groups[g].children)
+			childPages.push_back(records[newIndex[child]].page);
+		std::sort(childPages.begin(), childPages.end());
+		childPages.erase(std::unique(childPages.begin(), childPages.end()), childPages.end());
+		record.firstPage = (uint32_t)groupList.size();
+		groupList.insert(groupList.end(), childPages.begin(), childPages.end());
+		record.pageCount = (uint32_t)childPages.size();
+	}
+
+	ClusterLODHeader header = {};
+	header.magic = CLUSTER_LOD_MAGIC;
+	header.version = CLUSTER_LOD_VERSION;
+	header.vertexSize = sizeof(Vertex);
+	header.clusterCount = (uint32_t)records.size();
+	header.groupCount = (uint32_t)groupRecords.size();
+	header.groupListCount = (uint32_t)groupList.size();
+	header.pageCount = (uint32_t)pages.size();
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	for (const Vertex &v : vertices)
+	{
+		boundsMin = glm::min(boundsMin, v.Position);
+		boundsMax = glm::max(boundsMax, v.Position);
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		header.boundsMin[i] = boundsMin[i];
+		header.boundsMax[i] = boundsMax[i];
+	}
+	uint64_t offset = alignUp(sizeof(header));
+	header.clusterTableOffset = offset;
+	offset = alignUp(offset + records.size() * sizeof(ClusterRecord));
+	header.groupTableOffset = offset;
+	offset = alignUp(offset + groupRecords.size() * sizeof(ClusterGroupRecord));
+	header.groupListOffset = offset;
+	offset = alignUp(offset + groupList.size() * sizeof(uint32_t));
+	header.pageTableOffset = offset;
+	offset = alignUp(offset + pages.size() * sizeof(ClusterPageRecord));
+	for (ClusterPageRecord &page : pages)
+	{
+		page.offset = offset;
+		offset = alignUp(alignUp(offset + (uint64_t)page.vertexCount * sizeof(Vertex)) + (uint64_t)page.indexCount * sizeof(uint16_t));
+	}
+
+	// Write to a temporary file and rename it so a crash never leaves a half written file behind
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		uint64_t written = 0;
+		auto writeSection = [&](uint64_t at, const void *data, uint64_t bytes)
+		{
+			writePadding(out, written, at);
+			out.write((const char*)data, (std::streamsize)bytes);
+			written = at + bytes;
+		};
+		writeSection(0, &header, sizeof(header));
+		writeSection(header.clusterTableOffset, records.data(), records.size() * sizeof(ClusterRecord));
+		writeSection(header.groupTableOffset, groupRecords.data(), groupRecords.size() * sizeof(ClusterGroupRecord));
+		writeSection(header.groupListOffset, groupList.data(), groupList.size() * sizeof(uint32_t));
+		writeSection(header.pageTableOffset, pages.data(), pages.size() * sizeof(ClusterPageRecord));
+
+		std::vector<Vertex> pageVertexData;
+		std::vector<uint16_t> pageIndexData;
+		for (const ClusterPageRecord &page : pages)
+		{
+			pageVertexData.clear();
+			pageIndexData.clear();
+			for (uint32_t i = page.firstCluster; i < page.firstCluster + page.clusterCount; i++)
+			{
+				const BuildCluster &cluster = clusters[sorted[i]];
+				pageVertexData.insert(pageVertexData.end(), cluster.vertices.begin(), cluster.vertices.end());
+				for (unsigned int index : cluster.indices)
+					pageIndexData.push_back((uint16_t)(records[i].firstVertex + index));
+			}
+			writeSection(page.offset, pageVertexData.data(), pageVertexData.size() * sizeof(Vertex));
+			writeSection(alignUp(written), pageIndexData.data(), pageIndexData.size() * sizeof(uint16_t));
+		}
+		writePadding(out, written, offset);
+		if (!out)
+			return false;
+	}
+	std::remove(path.c_str());
+	return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "Mesh.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cluster LOD files (<source>.clod) hold a mesh as a DAG of small triangle clusters at every level of detail.
+// Level 0 clusters are the source triangles. Each level then groups neighbouring clusters by CLUSTER_GROUP_SIZE,
+// simplifies every group to half its triangles with the group's border locked, and splits the result into new
+// clusters. A cluster is drawn when its own error is small enough on screen but the error of the group it was
+// simplified in isn't, which picks a crack free cut of the DAG from local decisions only.
+// Clusters are stored in pages of at most CLUSTER_PAGE_VERTICES vertices and CLUSTER_PAGE_TRIANGLES triangles,
+// the unit ClusterMesh streams into its GPU pool. Coarse levels come first and the clusters of a group share pages.
+// Layout: ClusterLODHeader, the cluster, group, group list and page tables, then every page's Vertex blob followed
+// by its 16 bit page-local indices, each section aligned to 16 bytes.
+const uint32_t CLUSTER_LOD_MAGIC = 0x444F4C43; // "CLOD"
+const uint32_t CLUSTER_LOD_VERSION = 4;
+const unsigned int CLUSTER_MAX_TRIANGLES = 128;
+const unsigned int CLUSTER_GROUP_SIZE = 4;
+const unsigned int CLUSTER_PAGE_VERTICES = 16384;
+const unsigned int CLUSTER_PAGE_TRIANGLES = 16384;
+const uint32_t CLUSTER_NONE = 0xFFFFFFFF;
+
+struct ClusterLODHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexSize;	// sizeof(Vertex) when cooked
+	uint32_t clusterCount;
+	uint32_t groupCount;
+	uint32_t groupListCount;
+	uint32_t pageCount;
+	uint32_t padding;
+	float boundsMin[3];
+	float boundsMax[3];
+	uint64_t clusterTableOffset;
+	uint64_t groupTableOffset;
+	uint64_t groupListOffset;
+	uint64_t pageTableOffset;
+};
+
+// Spheres are xyz center and w radius, in model space
+struct ClusterRecord
+{
+	uint32_t page;
+	uint32_t firstVertex;		// in its page
+	uint32_t vertexCount;
+	uint32_t firstIndex;		// in its page
+	uint32_t triangleCount;
+	uint32_t group;				// group the cluster is simplified in, CLUSTER_NONE for the roots of the DAG
+	uint32_t generatingGroup;	// group whose simplification produced the cluster, CLUSTER_NONE at level 0
+	uint32_t level;
+	float selfError;			// error of generatingGroup, 0 at level 0
+	float parentError;			// error of group, infinite for roots
+	float selfSphere[4];		// sphere of generatingGroup, the cluster's bounds at level 0
+	float parentSphere[4];		// sphere of group
+};
+
+// Errors grow and spheres enclose each other from a group to the groups of its outputs, so the projected errors
+// are monotonic along the DAG
+struct ClusterGroupRecord
+{
+	float error;
+	float sphere[4];
+	uint32_t firstOutput, outputCount;	// clusters it produced, in the group list
+	uint32_t firstPage, pageCount;		// pages holding the clusters it simplified, in the group list
+};
+
+struct ClusterPageRecord
+{
+	uint64_t offset;		// of the Vertex blob, the indices follow it aligned
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t firstCluster, clusterCount;
+};
+
+// Builds .clod files. The whole source mesh is processed in memory, only the runtime is out of core.
+class ClusterLODBuilder
+{
+public:
+	/// Builds the DAG on the worker pool and writes it to path
+	/// @return false if the mesh is empty or the file can't be written
+	static bool Cook(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices, const std::string &path);
+};
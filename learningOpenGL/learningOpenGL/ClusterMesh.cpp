@@ -0,0 +1,389 @@
+#include "ClusterMesh.h"
+#include "ModelInstances.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	bool inFile(uint64_t offset, uint64_t bytes, size_t fileSize)
+	{
+		return offset <= fileSize && bytes <= fileSize - offset;
+	}
+
+	// The indices of a page follow its vertices, aligned like every section of the file
+	uint64_t indexOffset(const ClusterPageRecord &page)
+	{
+		return (page.offset + (uint64_t)page.vertexCount * sizeof(Vertex) + 15) & ~(uint64_t)15;
+	}
+
+	// Error in pixels of a simplification of the given model space error, seen from its closest point to the camera
+	float projectedError(float error, const float *sphere, glm::vec3 camera, float pixelsPerUnit)
+	{
+		if (error == FLT_MAX)
+			return FLT_MAX;
+		float distance = glm::length(glm::vec3(sphere[0], sphere[1], sphere[2]) - camera) - sphere[3];
+		return distance > 0.0f ? error * pixelsPerUnit / distance : FLT_MAX;
+	}
+}
+
+bool ClusterMesh::Open(const std::string &path, unsigned int poolPages)
+{
+	Release();
+	file = std::make_shared<MappedFile>();
+	if (!file->open(path) || file->length() < sizeof(ClusterLODHeader))
+	{
+		std::cout << "ERROR::CLUSTER_MESH::FILE_NOT_READ " << path << std::endl;
+		file.reset();
+		return false;
+	}
+
+	const uint8_t *base = file->begin();
+	size_t size = file->length();
+	header = (const ClusterLODHeader*)base;
+	clusters = (const ClusterRecord*)(base + header->clusterTableOffset);
+	groups = (const ClusterGroupRecord*)(base + header->groupTableOffset);
+	groupList = (const uint32_t*)(base + header->groupListOffset);
+	pages = (const ClusterPageRecord*)(base + header->pageTableOffset);
+
+	// Everything Update indexes with is checked once here
+	bool valid = header->magic == CLUSTER_LOD_MAGIC && header->version == CLUSTER_LOD_VERSION && header->vertexSize == sizeof(Vertex)
+		&& inFile(header->clusterTableOffset, (uint64_t)header->clusterCount * sizeof(ClusterRecord), size)
+		&& inFile(header->groupTableOffset, (uint64_t)header->groupCount * sizeof(ClusterGroupRecord), size)
+		&& inFile(header->groupListOffset, (uint64_t)header->groupListCount * sizeof(uint32_t), size)
+		&& inFile(header->pageTableOffset, (uint64_t)header->pageCount * sizeof(ClusterPageRecord), size);
+	for (uint32_t i = 0; valid && i < header->pageCount; i++)
+	{
+		const ClusterPageRecord &page = pages[i];
+		valid = page.vertexCount <= CLUSTER_PAGE_VERTICES && page.indexCount <= CLUSTER_PAGE_TRIANGLES * 3
+			&& inFile(page.offset, (uint64_t)page.vertexCount * sizeof(Vertex), size)
+			&& inFile(indexOffset(page), (uint64_t)page.indexCount * sizeof(uint16_t), size)
+			&& (uint64_t)page.firstCluster + page.clusterCount <= header->clusterCount;
+	}
+	for (uint32_t i = 0; valid && i < header->clusterCount; i++)
+	{
+		const ClusterRecord &cluster = clusters[i];
+		valid = cluster.page < header->pageCount
+			&& (uint64_t)cluster.firstVertex + cluster.vertexCount <= pages[cluster.page].vertexCount
+			&& (uint64_t)cluster.firstIndex + (uint64_t)cluster.triangleCount * 3 <= pages[cluster.page].indexCount
+			&& (cluster.group == CLUSTER_NONE || cluster.group < header->groupCount)
+			&& (cluster.generatingGroup == CLUSTER_NONE || cluster.generatingGroup < header->groupCount);
+	}
+	for (uint32_t g = 0; valid && g < header->groupCount; g++)
+	{
+		const ClusterGroupRecord &group = groups[g];
+		valid = (uint64_t)group.firstOutput + group.outputCount <= header->groupListCount
+			&& (uint64_t)group.firstPage + group.pageCount <= header->groupListCount;
+		// Groups come before the groups their outputs are simplified in, updateRefinableGroups relies on it
+		for (uint32_t i = 0; valid && i < group.outputCount; i++)
+		{
+			uint32_t output = groupList[group.firstOutput + i];
+			valid = output < header->clusterCount && (clusters[output].group == CLUSTER_NONE || clusters[output].group > g);
+		}
+		for (uint32_t i = 0; valid && i < group.pageCount; i++)
+			valid = groupList[group.firstPage + i] < header->pageCount;
+	}
+	if (!valid)
+	{
+		std::cout << "ERROR::CLUSTER_MESH::INVALID_FILE " << path << std::endl;
+		Release();
+		return false;
+	}
+
+	std::vector<uint32_t> rootPages;
+	for (uint32_t i = 0; i < header->clusterCount; i++)
+	{
+		if (clusters[i].group == CLUSTER_NONE && (rootPages.empty() || rootPages.back() != clusters[i].page))
+			rootPages.push_back(clusters[i].page);
+	}
+	std::sort(rootPages.begin(), rootPages.end());
+	rootPages.erase(std::unique(rootPages.begin(), rootPages.end()), rootPages.end());
+	// Leave room for at least one group of finer pages next to the roots
+	poolPages = std::max(poolPages, (unsigned int)rootPages.size() + CLUSTER_GROUP_SIZE);
+
+	slots.assign(poolPages, Slot());
+	pageSlots.assign(header->pageCount, CLUSTER_NONE);
+	pageRequested.assign(header->pageCount, 0);
+	groupRefinable.assign(header->groupCount, 0);
+	selections.resize(poolPages);
+
+	VAO = GpuVertexArray::Create();
+	vertexPool = GpuBuffer::Create(GPU_MEMORY_VERTEX_BUFFERS);
+	indexPool = GpuBuffer::Create(GPU_MEMORY_INDEX_BUFFERS);
+	glBindVertexArray(VAO);
+	GpuBufferData(vertexPool, GL_ARRAY_BUFFER, (size_t)poolPages * CLUSTER_PAGE_VERTICES * sizeof(Vertex), NULL, GL_DYNAMIC_DRAW);
+	GpuBufferData(indexPool, GL_ELEMENT_ARRAY_BUFFER, (size_t)poolPages * CLUSTER_PAGE_TRIANGLES * 3 * sizeof(uint16_t), NULL, GL_DYNAMIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+	glEnableVertexAttribArray(VERTEX_TANGENT_LOCATION);
+	glVertexAttribPointer(VERTEX_TANGENT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+	glBindVertexArray(0);
+
+	// The roots are uploaded straight from the mapping, everything else streams in
+	for (uint32_t page : rootPages)
+	{
+		uint32_t slot = acquireSlot();
+		slots[slot].pinned = true;
+		upload(page, slot, base + pages[page].offset, base + indexOffset(pages[page]));
+	}
+	return true;
+}
+
+void ClusterMesh::upload(uint32_t page, uint32_t slot, const unsigned char *vertices, const unsigned char *indices)
+{
+	const ClusterPageRecord &record = pages[page];
+	glBindBuffer(GL_ARRAY_BUFFER, vertexPool);
+	glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)slot * CLUSTER_PAGE_VERTICES * sizeof(Vertex), (GLsizeiptr)record.vertexCount * sizeof(Vertex), vertices);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// The element buffer binding is VAO state, so bind it without one
+	glBindVertexArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexPool);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)slot * CLUSTER_PAGE_TRIANGLES * 3 * sizeof(uint16_t), (GLsizeiptr)record.indexCount * sizeof(uint16_t), indices);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	slots[slot].page = page;
+	slots[slot].lastUsed = frame;
+	pageSlots[page] = slot;
+	pageRequested[page] = 0;
+	residentPages++;
+	residencyChanged = true;
+}
+
+uint32_t ClusterMesh::acquireSlot()
+{
+	// A free slot, or the least recently used page the last frame's selection didn't need
+	uint32_t victim = CLUSTER_NONE;
+	for (uint32_t i = 0; i < slots.size(); i++)
+	{
+		if (slots[i].page == CLUSTER_NONE)
+			return i;
+		if (!slots[i].pinned && slots[i].lastUsed + 1 < frame && (victim == CLUSTER_NONE || slots[i].lastUsed < slots[victim].lastUsed))
+			victim = i;
+	}
+	if (victim != CLUSTER_NONE)
+	{
+		pageSlots[slots[victim].page] = CLUSTER_NONE;
+		slots[victim].page = CLUSTER_NONE;
+		residentPages--;
+		residencyChanged = true;
+	}
+	return victim;
+}
+
+bool ClusterMesh::uploadLoadedPages()
+{
+	size_t uploaded = 0;
+	while (uploaded < CLUSTER_UPLOAD_BUDGET)
+	{
+		LoadedPage loadedPage;
+		{
+			std::lock_guard<std::mutex> lock(loaded->mutex);
+			if (loaded->pages.empty())
+				break;
+			loadedPage = std::move(loaded->pages.front());
+			loaded->pages.pop_front();
+		}
+		pendingLoads--;
+
+		uint32_t slot = acquireSlot();
+		if (slot == CLUSTER_NONE)
+		{
+			// Every slot is in use, the page is requested again if the selection still misses it
+			pageRequested[loadedPage.page] = 0;
+			continue;
+		}
+		const ClusterPageRecord &page = pages[loadedPage.page];
+		size_t vertexBytes = (size_t)page.vertexCount * sizeof(Vertex);
+		upload(loadedPage.page, slot, loadedPage.bytes.data(), loadedPage.bytes.data() + vertexBytes);
+		uploaded += loadedPage.bytes.size();
+	}
+	return uploaded > 0;
+}
+
+void ClusterMesh::updateRefinableGroups()
+{
+	// A group can be replaced by its children once their pages are resident and the groups its outputs belong to
+	// are refinable too, so the cut never mixes a group's children with clusters coarser than the group's outputs.
+	// Those groups come later in the file, hence the reverse order.
+	for (uint32_t g = header->groupCount; g-- > 0;)
+	{
+		const ClusterGroupRecord &group = groups[g];
+		bool refinable = true;
+		for (uint32_t i = 0; refinable && i < group.pageCount; i++)
+			refinable = pageSlots[groupList[group.firstPage + i]] != CLUSTER_NONE;
+		for (uint32_t i = 0; refinable && i < group.outputCount; i++)
+		{
+			uint32_t parent = clusters[groupList[group.firstOutput + i]].group;
+			refinable = parent == CLUSTER_NONE || groupRefinable[parent];
+		}
+		groupRefinable[g] = refinable;
+	}
+	residencyChanged = false;
+}
+
+void ClusterMesh::requestPage(uint32_t page)
+{
+	pageRequested[page] = 1;
+	pendingLoads++;
+	std::shared_ptr<MappedFile> mapping = file;
+	std::shared_ptr<LoadQueue> queue = loaded;
+	const ClusterPageRecord record = pages[page];
+	ThreadPool::Shared().Submit([mapping, queue, page, record]
+	{
+		// Copying out of the mapping takes the page faults on the worker instead of the GL thread
+		size_t vertexBytes = (size_t)record.vertexCount * sizeof(Vertex);
+		size_t indexBytes = (size_t)record.indexCount * sizeof(uint16_t);
+		LoadedPage loadedPage = { page, std::vector<unsigned char>(vertexBytes + indexBytes) };
+		memcpy(loadedPage.bytes.data(), mapping->begin() + record.offset, vertexBytes);
+		memcpy(loadedPage.bytes.data() + vertexBytes, mapping->begin() + indexOffset(record), indexBytes);
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->pages.push_back(std::move(loadedPage));
+	});
+}
+
+void ClusterMesh::Update(const glm::mat4 &model, const glm::mat4 &viewProjection, glm::vec3 cameraPosition, float pixelsPerUnit,
+	float errorPixels)
+{
+	drawCounts.clear();
+	drawOffsets.clear();
+	drawBaseVertices.clear();
+	drawnTriangles = 0;
+	if (!IsOpen())
+		return;
+
+	frame++;
+	uploadLoadedPages();
+	if (residencyChanged)
+		updateRefinableGroups();
+
+	// Errors and spheres are in model space, so bring the camera and the frustum there
+	glm::vec3 camera = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+	glm::vec4 planes[6];
+	ModelInstances::extractFrustumPlanes(viewProjection * model, planes);
+
+	ThreadPool::Shared().ParallelFor((unsigned int)slots.size(), [&](unsigned int s)
+	{
+		SlotSelection &selection = selections[s];
+		selection.clusters.clear();
+		selection.requests.clear();
+		selection.used = false;
+		if (slots[s].page == CLUSTER_NONE)
+			return;
+
+		const ClusterPageRecord &page = pages[slots[s].page];
+		for (uint32_t c = page.firstCluster; c < page.firstCluster + page.clusterCount; c++)
+		{
+			const ClusterRecord &cluster = clusters[c];
+			float parentError = projectedError(cluster.parentError, cluster.parentSphere, camera, pixelsPerUnit);
+			if (parentError <= errorPixels)
+				continue; // too fine, a coarser cluster covers it
+			// The page holds part of the cut or of what is coarser than it
+			selection.used = true;
+			if (cluster.group != CLUSTER_NONE && !groupRefinable[cluster.group])
+				continue; // its parent group is still drawn at a coarser level
+
+			float selfError = projectedError(cluster.selfError, cluster.selfSphere, camera, pixelsPerUnit);
+			bool refinable = cluster.generatingGroup != CLUSTER_NONE && groupRefinable[cluster.generatingGroup];
+			if (selfError > errorPixels && refinable)
+				continue; // its children are drawn instead
+
+			bool visible = true;
+			for (int i = 0; visible && i < 6; i++)
+				visible = glm::dot(glm::vec3(planes[i]), glm::vec3(cluster.selfSphere[0], cluster.selfSphere[1], cluster.selfSphere[2])) + planes[i].w > -cluster.selfSphere[3];
+			if (visible)
+				selection.clusters.push_back(c);
+			// Too coarse but its children aren't resident yet, ask for them
+			if (selfError > errorPixels && cluster.generatingGroup != CLUSTER_NONE)
+			{
+				const ClusterGroupRecord &group = groups[cluster.generatingGroup];
+				for (uint32_t i = 0; i < group.pageCount; i++)
+				{
+					uint32_t needed = groupList[group.firstPage + i];
+					if (pageSlots[needed] == CLUSTER_NONE && !pageRequested[needed])
+						selection.requests.push_back({ visible ? selfError : selfError * 0.5f, needed });
+				}
+			}
+		}
+	});
+
+	std::vector<std::pair<float, uint32_t>> requests;
+	for (uint32_t s = 0; s < slots.size(); s++)
+	{
+		const SlotSelection &selection = selections[s];
+		if (selection.used)
+			slots[s].lastUsed = frame;
+		requests.insert(requests.end(), selection.requests.begin(), selection.requests.end());
+		for (uint32_t c : selection.clusters)
+		{
+			const ClusterRecord &cluster = clusters[c];
+			drawCounts.push_back((GLsizei)cluster.triangleCount * 3);
+			drawOffsets.push_back((const void*)(((size_t)s * CLUSTER_PAGE_TRIANGLES * 3 + cluster.firstIndex) * sizeof(uint16_t)));
+			drawBaseVertices.push_back((GLint)(s * CLUSTER_PAGE_VERTICES));
+			drawnTriangles += cluster.triangleCount;
+		}
+	}
+
+	// Most visible first, but not more than the pool can take without evicting pages the selection needs
+	unsigned int evictable = 0;
+	for (const Slot &slot : slots)
+	{
+		if (slot.page == CLUSTER_NONE || (!slot.pinned && slot.lastUsed < frame))
+			evictable++;
+	}
+	std::sort(requests.begin(), requests.end(), [](const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b) { return a.first > b.first; });
+	for (const std::pair<float, uint32_t> &request : requests)
+	{
+		if (pendingLoads >= CLUSTER_MAX_PENDING_LOADS || pendingLoads >= evictable)
+			break;
+		if (!pageRequested[request.second])
+			requestPage(request.second);
+	}
+}
+
+void ClusterMesh::Draw()
+{
+	if (drawCounts.empty())
+		return;
+	glBindVertexArray(VAO);
+	glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_SHORT, drawOffsets.data(), (GLsizei)drawCounts.size(),
+		drawBaseVertices.data());
+	glBindVertexArray(0);
+}
+
+void ClusterMesh::Release()
+{
+	VAO.Reset();
+	vertexPool.Reset();
+	indexPool.Reset();
+	slots.clear();
+	pageSlots.clear();
+	pageRequested.clear();
+	groupRefinable.clear();
+	selections.clear();
+	drawCounts.clear();
+	drawOffsets.clear();
+	drawBaseVertices.clear();
+	drawnTriangles = residentPages = 0;
+	// Loads still in flight land in the old queue, which they keep alive with the mapping
+	loaded = std::make_shared<LoadQueue>();
+	pendingLoads = 0;
+	residencyChanged = true;
+	header = nullptr;
+	file.reset();
+}
+
+void ClusterMesh::PrintStats() const
+{
+	if (!IsOpen())
+		return;
+	std::cout << "Cluster LOD: " << DrawnClusters() << " of " << header->clusterCount << " clusters, " << drawnTriangles << " triangles, "
+		<< residentPages << " of " << header->pageCount << " pages resident in " << slots.size() << " slots, " << pendingLoads << " loading" << std::endl;
+}
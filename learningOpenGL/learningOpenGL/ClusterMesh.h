@@ -0,0 +1,112 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "ClusterLOD.h"
+#include "GpuResource.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Pages the GPU pool holds by default, and how many bytes of pages may be uploaded per frame
+const unsigned int CLUSTER_POOL_PAGES = 64;
+const size_t CLUSTER_UPLOAD_BUDGET = 8 * 1024 * 1024;
+// Page loads in flight on the worker pool at once
+const unsigned int CLUSTER_MAX_PENDING_LOADS = 8;
+
+// Draws a mesh cooked by ClusterLODBuilder without ever holding all of it in memory. The file is memory mapped,
+// pages are read on the worker pool and uploaded into a fixed pool of GPU page slots, and the least recently used
+// pages are evicted when the pool is full. The pages of the roots of the DAG stay resident, so there is always
+// something to draw while finer pages stream in.
+// Every frame each resident cluster is tested on its own: it is drawn if its parent group's error projects to
+// more than the threshold on screen and its own error doesn't (or the finer clusters replacing it aren't resident).
+// Groups only count as refinable once all the pages they need are resident, which keeps the cut crack free.
+class ClusterMesh
+{
+public:
+	ClusterMesh() {}
+	ClusterMesh(const ClusterMesh&) = delete;
+	ClusterMesh &operator=(const ClusterMesh&) = delete;
+
+	/// Maps a .clod file, allocates the GPU pool and uploads the root pages
+	/// @param poolPages page slots of the pool, raised if the root pages alone need more
+	bool Open(const std::string &path, unsigned int poolPages = CLUSTER_POOL_PAGES);
+	/// Uploads the pages loaded since the last call, selects the clusters to draw and requests the pages the
+	/// selection misses, most visible first. Call once per frame on the GL thread before Draw.
+	/// @param model world matrix of the mesh, errors are compared in its space
+	/// @param pixelsPerUnit pixels covered by one world unit at a distance of one unit from the camera
+	/// @param errorPixels largest error allowed on screen, in pixels
+	void Update(const glm::mat4 &model, const glm::mat4 &viewProjection, glm::vec3 cameraPosition, float pixelsPerUnit,
+		float errorPixels = 1.0f);
+	/// Draws the selected clusters with one multi-draw, with the caller's shader in use and its "model" uniform set
+	void Draw();
+	void Release();
+
+	bool IsOpen() const { return file && file->isOpen(); }
+	unsigned int DrawnClusters() const { return (unsigned int)drawCounts.size(); }
+	unsigned int DrawnTriangles() const { return drawnTriangles; }
+	unsigned int ResidentPages() const { return residentPages; }
+	void PrintStats() const;
+
+private:
+	struct Slot
+	{
+		uint32_t page = CLUSTER_NONE;
+		uint64_t lastUsed = 0;	// frame the selection last needed the page
+		bool pinned = false;	// root pages are never evicted
+	};
+	struct LoadedPage
+	{
+		uint32_t page;
+		std::vector<unsigned char> bytes;	// vertices then indices, copied out of the mapping on a worker
+	};
+	// Shared with the load jobs so they stay valid even if the jobs outlive the mesh
+	struct LoadQueue
+	{
+		std::mutex mutex;
+		std::deque<LoadedPage> pages;
+	};
+	// What the selection of one slot's clusters produced, filled in parallel
+	struct SlotSelection
+	{
+		std::vector<uint32_t> clusters;
+		std::vector<std::pair<float, uint32_t>> requests;	// projected error and page
+		bool used;
+	};
+
+	std::shared_ptr<MappedFile> file;
+	const ClusterLODHeader *header = nullptr;
+	const ClusterRecord *clusters = nullptr;
+	const ClusterGroupRecord *groups = nullptr;
+	const uint32_t *groupList = nullptr;
+	const ClusterPageRecord *pages = nullptr;
+
+	std::vector<Slot> slots;
+	std::vector<uint32_t> pageSlots;			// slot of every page, CLUSTER_NONE while not resident
+	std::vector<unsigned char> pageRequested;	// page queued or being loaded
+	std::vector<unsigned char> groupRefinable;	// every page needed to draw the group's children is resident
+	bool residencyChanged = true;
+	unsigned int pendingLoads = 0, residentPages = 0;
+	uint64_t frame = 0;
+	std::shared_ptr<LoadQueue> loaded = std::make_shared<LoadQueue>();
+	std::vector<SlotSelection> selections;
+
+	GpuVertexArray VAO;
+	GpuBuffer vertexPool, indexPool;
+	std::vector<GLsizei> drawCounts;
+	std::vector<const void*> drawOffsets;
+	std::vector<GLint> drawBaseVertices;
+	unsigned int drawnTriangles = 0;
+
+	void upload(uint32_t page, uint32_t slot, const unsigned char *vertices, const unsigned char *indices);
+	bool uploadLoadedPages();
+	uint32_t acquireSlot();
+	void updateRefinableGroups();
+	void requestPage(uint32_t page);
+};
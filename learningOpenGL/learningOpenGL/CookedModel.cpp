@@ -0,0 +1,203 @@
+#include "CookedModel.h"
+#include "StringTable.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	uint64_t alignUp(uint64_t offset)
+	{
+		return (offset + COOKED_ALIGNMENT - 1) & ~(COOKED_ALIGNMENT - 1);
+	}
+
+	void writePadding(std::ofstream &out, uint64_t from, uint64_t to)
+	{
+		static const char zeros[COOKED_ALIGNMENT] = { 0 };
+		out.write(zeros, (std::streamsize)(to - from));
+	}
+
+	bool inFile(uint64_t offset, uint64_t bytes, size_t fileSize)
+	{
+		return offset <= fileSize && bytes <= fileSize - offset;
+	}
+}
+
+bool CookedModel::Open(const std::string &cachePath, uint64_t sourceHash)
+{
+	if (!file.open(cachePath) || file.length() < sizeof(CookedModelHeader))
+		return false;
+
+	header = (const CookedModelHeader*)file.begin();
+	nodeTable = (const CookedNode*)(file.begin() + header->nodeTableOffset);
+	meshTable = (const CookedMesh*)(file.begin() + header->meshTableOffset);
+	lodTable = (const MeshLOD*)(file.begin() + header->lodTableOffset);
+	textureTable = (const CookedTexture*)(file.begin() + header->textureTableOffset);
+	strings = (const char*)(file.begin() + header->stringsOffset);
+
+	if (!validate(sourceHash))
+	{
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+bool CookedModel::validate(uint64_t sourceHash) const
+{
+	if (header->magic != COOKED_MODEL_MAGIC || header->version != COOKED_MODEL_VERSION || header->vertexSize != sizeof(Vertex))
+		return false;
+	if (header->sourceHash != sourceHash)
+		return false;
+
+	size_t size = file.length();
+	if (!inFile(header->nodeTableOffset, (uint64_t)header->nodeCount * sizeof(CookedNode), size)
+		|| !inFile(header->meshTableOffset, (uint64_t)header->meshCount * sizeof(CookedMesh), size)
+		|| !inFile(header->lodTableOffset, (uint64_t)header->lodCount * sizeof(MeshLOD), size)
+		|| !inFile(header->textureTableOffset, (uint64_t)header->textureCount * sizeof(CookedTexture), size)
+		|| !inFile(header->stringsOffset, header->stringsSize, size)
+		|| (header->stringsSize > 0 && strings[header->stringsSize - 1] != '\0'))
+		return false;
+
+	for (unsigned int i = 0; i < header->meshCount; i++)
+	{
+		const CookedMesh &mesh = meshTable[i];
+		if (!inFile(mesh.vertexOffset, (uint64_t)mesh.vertexCount * sizeof(Vertex), size)
+			|| !inFile(mesh.indexOffset, (uint64_t)mesh.indexCount * sizeof(unsigned int), size)
+			|| (uint64_t)mesh.firstLOD + mesh.lodCount > header->lodCount
+			|| (uint64_t)mesh.firstTexture + mesh.textureCount > header->textureCount
+			|| mesh.node >= header->nodeCount)
+			return false;
+
+		// The CPU side of the loader (LOD normal maps, vertex animation bakes) indexes vertices with these, a corrupt
+		// cache must not get that far
+		for (uint32_t l = mesh.firstLOD; l < mesh.firstLOD + mesh.lodCount; l++)
+		{
+			if ((uint64_t)lodTable[l].indexOffset + lodTable[l].indexCount > mesh.indexCount)
+				return false;
+		}
+		const uint32_t *indices = (const uint32_t*)(file.begin() + mesh.indexOffset);
+		for (uint32_t j = 0; j < mesh.indexCount; j++)
+		{
+			if (indices[j] >= mesh.vertexCount)
+				return false;
+		}
+	}
+	for (unsigned int i = 0; i < header->nodeCount; i++)
+	{
+		// Parents must come first for the hierarchy to be in pre-order
+		if (nodeTable[i].parent >= (int32_t)i || nodeTable[i].nameOffset >= header->stringsSize)
+			return false;
+	}
+	for (unsigned int i = 0; i < header->textureCount; i++)
+	{
+		if (textureTable[i].typeOffset >= header->stringsSize || textureTable[i].pathOffset >= header->stringsSize)
+			return false;
+	}
+	return true;
+}
+
+bool CookedModel::Write(const std::string &cachePath, uint64_t sourceHash, CookedLoader loader, uint32_t importFlags,
+	const std::vector<Mesh> &meshes, const std::vector<unsigned int> &meshNodes, const NodeHierarchy &nodes)
+{
+	// Build the tables first so every offset is known before anything is written
+	std::vector<CookedNode> cookedNodes(nodes.NodeCount());
+	std::vector<CookedMesh> cookedMeshes(meshes.size());
+	std::vector<MeshLOD> lods;
+	std::vector<CookedTexture> textures;
+	std::string strings;
+	for (unsigned int i = 0; i < nodes.NodeCount(); i++)
+	{
+		cookedNodes[i].parent = nodes.Parent(i);
+		cookedNodes[i].nameOffset = (uint32_t)strings.size();
+		strings.append(nodes.Name(i)).push_back('\0');
+		std::memcpy(cookedNodes[i].localTransform, &nodes.LocalTransform(i)[0][0], sizeof(cookedNodes[i].localTransform));
+	}
+	for (unsigned int i = 0; i < meshes.size(); i++)
+	{
+		const Mesh &mesh = meshes[i];
+		CookedMesh &cooked = cookedMeshes[i];
+		cooked.vertexCount = (uint32_t)mesh.vertices.size();
+		cooked.indexCount = (uint32_t)mesh.indices.size();
+		cooked.firstLOD = (uint32_t)lods.size();
+		cooked.lodCount = (uint32_t)mesh.lods.size();
+		lods.insert(lods.end(), mesh.lods.begin(), mesh.lods.end());
+		cooked.firstTexture = (uint32_t)textures.size();
+		cooked.textureCount = (uint32_t)mesh.textures.size();
+		cooked.node = meshNodes[i];
+		for (const Texture &texture : mesh.textures)
+		{
+			CookedTexture entry;
+			entry.typeOffset = (uint32_t)strings.size();
+			strings.append(TEXTURE_TYPE_NAMES[texture.type]).push_back('\0');
+			entry.pathOffset = (uint32_t)strings.size();
+			strings.append(StringTable::Shared().Get(texture.path)).push_back('\0');
+			textures.push_back(entry);
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			cooked.boundsMin[c] = mesh.boundsMin[c];
+			cooked.boundsMax[c] = mesh.boundsMax[c];
+		}
+	}
+
+	CookedModelHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic = COOKED_MODEL_MAGIC;
+	header.version = COOKED_MODEL_VERSION;
+	header.sourceHash = sourceHash;
+	header.loader = loader;
+	header.importFlags = importFlags;
+	header.vertexSize = sizeof(Vertex);
+	header.nodeCount = (uint32_t)cookedNodes.size();
+	header.meshCount = (uint32_t)cookedMeshes.size();
+	header.lodCount = (uint32_t)lods.size();
+	header.textureCount = (uint32_t)textures.size();
+	header.nodeTableOffset = alignUp(sizeof(CookedModelHeader));
+	header.meshTableOffset = alignUp(header.nodeTableOffset + cookedNodes.size() * sizeof(CookedNode));
+	header.lodTableOffset = alignUp(header.meshTableOffset + cookedMeshes.size() * sizeof(CookedMesh));
+	header.textureTableOffset = alignUp(header.lodTableOffset + lods.size() * sizeof(MeshLOD));
+	header.stringsOffset = alignUp(header.textureTableOffset + textures.size() * sizeof(CookedTexture));
+	header.stringsSize = strings.size();
+
+	uint64_t offset = alignUp(header.stringsOffset + header.stringsSize);
+	for (CookedMesh &cooked : cookedMeshes)
+	{
+		cooked.vertexOffset = offset;
+		offset = alignUp(offset + (uint64_t)cooked.vertexCount * sizeof(Vertex));
+		cooked.indexOffset = offset;
+		offset = alignUp(offset + (uint64_t)cooked.indexCount * sizeof(unsigned int));
+	}
+
+	// Write to a temporary file and rename it so a crash never leaves a half written cache behind
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		uint64_t written = 0;
+		auto writeSection = [&](uint64_t at, const void *data, uint64_t bytes)
+		{
+			writePadding(out, written, at);
+			out.write((const char*)data, (std::streamsize)bytes);
+			written = at + bytes;
+		};
+		writeSection(0, &header, sizeof(header));
+		writeSection(header.nodeTableOffset, cookedNodes.data(), cookedNodes.size() * sizeof(CookedNode));
+		writeSection(header.meshTableOffset, cookedMeshes.data(), cookedMeshes.size() * sizeof(CookedMesh));
+		writeSection(header.lodTableOffset, lods.data(), lods.size() * sizeof(MeshLOD));
+		writeSection(header.textureTableOffset, textures.data(), textures.size() * sizeof(CookedTexture));
+		writeSection(header.stringsOffset, strings.data(), strings.size());
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			writeSection(cookedMeshes[i].vertexOffset, meshes[i].vertices.data(), cookedMeshes[i].vertexCount * sizeof(Vertex));
+			writeSection(cookedMeshes[i].indexOffset, meshes[i].indices.data(), cookedMeshes[i].indexCount * sizeof(unsigned int));
+		}
+		writePadding(out, written, offset);
+		if (!out)
+			return false;
+	}
+	std::remove(cachePath.c_str());
+	return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include "Mesh.h"
+#include "MappedFile.h"
+#include "NodeHierarchy.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary cache of an imported Model, written next to the source file as <source>.cooked.
+// Layout: CookedModelHeader, then the node, mesh, LOD and texture tables, a blob of null terminated strings and the
+// vertex/index blobs, every section aligned to COOKED_ALIGNMENT so it can be handed to glBufferData straight
+// from the mapped pages.
+const uint32_t COOKED_MODEL_MAGIC = 0x4D4F4C47; // "GLOM"
+const uint32_t COOKED_MODEL_VERSION = 8;
+const uint64_t COOKED_ALIGNMENT = 16;
+
+// Importer a cache was made with, their outputs differ so a cache is only valid for the one the source goes through
+enum CookedLoader : uint32_t
+{
+	COOKED_LOADER_ASSIMP,
+	COOKED_LOADER_OBJ
+};
+
+struct CookedModelHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;	// hash of the source file contents and of the files it references (OBJ material libraries)
+	uint32_t loader;		// CookedLoader
+	uint32_t importFlags;	// Assimp post processing flags the data was imported with, 0 for the other loaders
+	uint32_t vertexSize;	// sizeof(Vertex) when cooked, guards against layout changes
+	uint32_t nodeCount;
+	uint32_t meshCount;
+	uint32_t lodCount;
+	uint32_t textureCount;
+	uint64_t nodeTableOffset;
+	uint64_t meshTableOffset;
+	uint64_t lodTableOffset;
+	uint64_t textureTableOffset;
+	uint64_t stringsOffset;
+	uint64_t stringsSize;
+};
+
+// Nodes are stored in the pre-order of NodeHierarchy
+struct CookedNode
+{
+	int32_t parent;				// -1 for the root
+	uint32_t nameOffset;		// offset in the string blob
+	float localTransform[16];	// column-major, like glm
+};
+
+struct CookedMesh
+{
+	uint64_t vertexOffset;	// byte offset of the Vertex blob from the start of the file
+	uint64_t indexOffset;	// byte offset of the index blob (all LODs) from the start of the file
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t firstLOD, lodCount;
+	uint32_t firstTexture, textureCount;
+	uint32_t node;			// node the mesh hangs from
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+struct CookedTexture
+{
+	uint32_t typeOffset;	// offsets in the string blob
+	uint32_t pathOffset;
+};
+
+class CookedModel
+{
+public:
+	/// Maps the cache and validates it against the current source hash. The caller checks Loader and ImportFlags.
+	/// @return false if the cache is missing, stale or corrupt
+	bool Open(const std::string &cachePath, uint64_t sourceHash);
+
+	/// Writes the meshes of a freshly imported model to the cache
+	static bool Write(const std::string &cachePath, uint64_t sourceHash, CookedLoader loader, uint32_t importFlags,
+		const std::vector<Mesh> &meshes, const std::vector<unsigned int> &meshNodes, const NodeHierarchy &nodes);
+
+	CookedLoader Loader() const { return (CookedLoader)header->loader; }
+	uint32_t ImportFlags() const { return header->importFlags; }
+
+	unsigned int NodeCount() const { return header->nodeCount; }
+	const CookedNode &GetNode(unsigned int i) const { return nodeTable[i]; }
+	const char *String(uint32_t offset) const { return strings + offset; }
+
+	unsigned int MeshCount() const { return header->meshCount; }
+	const CookedMesh &GetMesh(unsigned int i) const { return meshTable[i]; }
+	const Vertex *Vertices(const CookedMesh &mesh) const { return (const Vertex*)(file.begin() + mesh.vertexOffset); }
+	const unsigned int *Indices(const CookedMesh &mesh) const { return (const unsigned int*)(file.begin() + mesh.indexOffset); }
+	std::vector<MeshLOD> LODs(const CookedMesh &mesh) const { return std::vector<MeshLOD>(lodTable + mesh.firstLOD, lodTable + mesh.firstLOD + mesh.lodCount); }
+	const char *TextureTypeName(const CookedMesh &mesh, unsigned int i) const { return strings + textureTable[mesh.firstTexture + i].typeOffset; }
+	const char *TexturePath(const CookedMesh &mesh, unsigned int i) const { return strings + textureTable[mesh.firstTexture + i].pathOffset; }
+
+private:
+	MappedFile file;
+	const CookedModelHeader *header = nullptr;
+	const CookedNode *nodeTable = nullptr;
+	const CookedMesh *meshTable = nullptr;
+	const MeshLOD *lodTable = nullptr;
+	const CookedTexture *textureTable = nullptr;
+	const char *strings = nullptr;
+
+	bool validate(uint64_t sourceHash) const;
+};
@@ -0,0 +1,159 @@
+#ifndef CROWD_BENCHMARK_H
+#define CROWD_BENCHMARK_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Shader.h"
+#include "Model.h"
+#include "Animation.h"
+#include "VertexAnimationTexture.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// Frames timed per configuration, after a few warm up frames
+const unsigned int CROWD_BENCHMARK_WARMUP = 3;
+const unsigned int CROWD_BENCHMARK_FRAMES = 30;
+
+// Draws the same animated model as a crowd of 1k, 10k and 100k instances through the per-instance path
+// (one Animator per character sampled by Animator::SampleAll, one Model::DrawSkinned per character) and through
+// the baked vertex animation path (Model::DrawCrowd), and prints the average CPU and GPU time of a frame of each.
+class CrowdBenchmark
+{
+public:
+	/// @param skinningShader shader built from shaders/skinning.vert
+	/// @param crowdShader shader built from shaders/vat_crowd.vert
+	/// @param model transform of one character, instances are laid out on a grid of spacing units around it
+	static void Run(Model &character, Shader &skinningShader, Shader &crowdShader, const glm::mat4 &model, float spacing,
+		const glm::mat4 &view, const glm::mat4 &projection)
+	{
+		VertexAnimationTexture vat;
+		if (!character.BakeVertexAnimation(vat))
+			return;
+		cout << "CROWD::BENCHMARK baked " << vat.ClipCount() << " clips into " << vat.Bytes() / (1024 * 1024) << " MB" << endl;
+
+		GLint maxPaletteBytes;
+		glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxPaletteBytes);
+		GLuint query;
+		glGenQueries(1, &query);
+
+		const unsigned int counts[] = { 1000, 10000, 100000 };
+		for (unsigned int count : counts)
+		{
+			vector<glm::mat4> transforms = gridTransforms(count, model, spacing);
+			unsigned int clipCount = (unsigned int)character.GetSkeleton().clips.size();
+
+			// Per-instance path: every character is animated on the CPU and drawn on its own
+			vector<unique_ptr<Animator>> animators;
+			vector<Animator*> animatorList;
+			for (unsigned int i = 0; i < count; i++)
+			{
+				animators.emplace_back(new Animator(character.GetSkeleton(), character.Nodes()));
+				if (clipCount)
+					animators.back()->Play(i % clipCount, i * 0.37f);
+				animatorList.push_back(animators.back().get());
+			}
+			BonePaletteBuffer paletteBuffer;
+			vector<glm::mat4> palettes;
+			if ((uint64_t)count * character.GetSkeleton().bones.size() * sizeof(glm::mat4) > (uint64_t)maxPaletteBytes)
+			{
+				cout << "CROWD::BENCHMARK instances=" << count << " path=skinned skipped, the bone palettes exceed GL_MAX_SHADER_STORAGE_BLOCK_SIZE" << endl;
+			}
+			else
+			{
+				report(count, "skinned", time(query, [&]
+				{
+					for (Animator *animator : animatorList)
+						animator->Advance(1.0f / 60.0f);
+					Animator::SampleAll(animatorList, palettes);
+					paletteBuffer.Upload(palettes);
+					skinningShader.Use();
+					skinningShader.setMat4("view", view);
+					skinningShader.setMat4("projection", projection);
+					for (unsigned int i = 0; i < count; i++)
+						character.DrawSkinned(skinningShader, transforms[i], *animatorList[i]);
+				}));
+			}
+			paletteBuffer.Release();
+			animators.clear();
+
+			// Baked path: the instances only hold their transform, clip and time offset
+			vector<CrowdInstance> instances(count);
+			for (unsigned int i = 0; i < count; i++)
+				instances[i] = { transforms[i], i % vat.ClipCount(), i * 0.37f, 1.0f, 0.0f };
+			CrowdInstances crowd;
+			crowd.SetInstances(instances);
+			float seconds = 0.0f;
+			report(count, "vat", time(query, [&]
+			{
+				seconds += 1.0f / 60.0f;
+				crowdShader.Use();
+				crowdShader.setMat4("view", view);
+				crowdShader.setMat4("projection", projection);
+				character.DrawCrowd(crowdShader, vat, crowd, seconds);
+			}));
+			crowd.Release();
+		}
+
+		glDeleteQueries(1, &query);
+		vat.Release();
+	}
+
+private:
+	struct Timing
+	{
+		double cpuMs;
+		double gpuMs;
+	};
+
+	static vector<glm::mat4> gridTransforms(unsigned int count, const glm::mat4 &model, float spacing)
+	{
+		unsigned int side = (unsigned int)std::ceil(std::sqrt((float)count));
+		vector<glm::mat4> transforms(count);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			glm::vec3 offset((float)(i % side) - side * 0.5f, 0.0f, -(float)(i / side));
+			transforms[i] = glm::translate(glm::mat4(1.0f), offset * spacing) * model;
+		}
+		return transforms;
+	}
+
+	// Average CPU time to issue a frame and GPU time to execute it, frames don't overlap so they don't skew each other
+	template<typename F>
+	static Timing time(GLuint query, F frame)
+	{
+		Timing total = { 0.0, 0.0 };
+		for (unsigned int i = 0; i < CROWD_BENCHMARK_WARMUP + CROWD_BENCHMARK_FRAMES; i++)
+		{
+			glFinish();
+			auto start = std::chrono::high_resolution_clock::now();
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			frame();
+			glEndQuery(GL_TIME_ELAPSED);
+			auto end = std::chrono::high_resolution_clock::now();
+
+			GLuint64 gpuNs;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &gpuNs);
+			if (i >= CROWD_BENCHMARK_WARMUP)
+			{
+				total.cpuMs += std::chrono::duration<double, std::milli>(end - start).count();
+				total.gpuMs += gpuNs / 1e6;
+			}
+		}
+		total.cpuMs /= CROWD_BENCHMARK_FRAMES;
+		total.gpuMs /= CROWD_BENCHMARK_FRAMES;
+		return total;
+	}
+
+	static void report(unsigned int count, const char *path, Timing timing)
+	{
+		cout << "CROWD::BENCHMARK instances=" << count << " path=" << path << " cpu=" << timing.cpuMs << "ms gpu=" << timing.gpuMs << "ms" << endl;
+	}
+};
+#endif
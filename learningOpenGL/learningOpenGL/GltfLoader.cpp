@@ -0,0 +1,557 @@
+#include "GltfLoader.h"
+#include "TangentSpace.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cfloat>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	const uint32_t GLB_MAGIC = 0x46546C67;		// "glTF"
+	const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;	// "JSON"
+	const uint32_t GLB_CHUNK_BIN = 0x004E4942;	// "BIN\0"
+
+	const int GLTF_BYTE = 5120, GLTF_UNSIGNED_BYTE = 5121, GLTF_SHORT = 5122, GLTF_UNSIGNED_SHORT = 5123,
+		GLTF_UNSIGNED_INT = 5125, GLTF_FLOAT = 5126;
+	const int GLTF_TRIANGLES = 4;
+
+	// Just enough JSON for glTF documents: values are parsed into a tree, strings don't decode \u escapes
+	struct Json
+	{
+		enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+		double number = 0.0;
+		std::string string;
+		std::vector<Json> items;
+		std::vector<std::pair<std::string, Json>> members;
+
+		const Json &operator[](const char *key) const
+		{
+			static const Json missing;
+			for (const auto &member : members)
+			{
+				if (member.first == key)
+					return member.second;
+			}
+			return missing;
+		}
+		const Json &operator[](size_t i) const
+		{
+			static const Json missing;
+			return i < items.size() ? items[i] : missing;
+		}
+		const Json &operator[](int i) const { return (*this)[i < 0 ? items.size() : (size_t)i]; }
+		size_t size() const { return items.size(); }
+		bool has(const char *key) const { return (*this)[key].type != Null; }
+		int asInt(int fallback = -1) const { return type == Number ? (int)number : fallback; }
+		float asFloat(float fallback = 0.0f) const { return type == Number ? (float)number : fallback; }
+	};
+
+	class JsonParser
+	{
+	public:
+		JsonParser(const char *begin, const char *end) : p(begin), end(end) {}
+
+		bool Parse(Json &value)
+		{
+			return parseValue(value, 0) && (skipBlanks(), p == end || *p == '\0');
+		}
+
+	private:
+		const char *p, *end;
+
+		void skipBlanks()
+		{
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+				p++;
+		}
+
+		bool literal(const char *word)
+		{
+			size_t length = std::strlen(word);
+			if ((size_t)(end - p) < length || std::strncmp(p, word, length) != 0)
+				return false;
+			p += length;
+			return true;
+		}
+
+		bool parseString(std::string &out)
+		{
+			if (p >= end || *p != '"')
+				return false;
+			for (p++; p < end && *p != '"'; p++)
+			{
+				if (*p == '\\')
+				{
+					if (++p >= end)
+						return false;
+					switch (*p)
+					{
+					case 'n': out.push_back('\n'); break;
+					case 't': out.push_back('\t'); break;
+					case 'r': out.push_back('\r'); break;
+					case 'b': out.push_back('\b'); break;
+					case 'f': out.push_back('\f'); break;
+					case 'u': out.push_back('?'); p += std::min<ptrdiff_t>(4, end - p - 1); break;
+					default: out.push_back(*p); break;
+					}
+				}
+				else
+					out.push_back(*p);
+			}
+			if (p >= end)
+				return false;
+			p++;
+			return true;
+		}
+
+		bool parseValue(Json &value, int depth)
+		{
+			if (depth > 64)
+				return false;
+			skipBlanks();
+			if (p >= end)
+				return false;
+			if (*p == '{')
+			{
+				value.type = Json::Object;
+				p++;
+				skipBlanks();
+				if (p < end && *p == '}')
+				{
+					p++;
+					return true;
+				}
+				for (;;)
+				{
+					skipBlanks();
+					std::pair<std::string, Json> member;
+					if (!parseString(member.first))
+						return false;
+					skipBlanks();
+					if (p >= end || *p++ != ':' || !parseValue(member.second, depth + 1))
+						return false;
+					value.members.push_back(std::move(member));
+					skipBlanks();
+					if (p < end && *p == ',')
+						p++;
+					else if (p < end && *p == '}')
+					{
+						p++;
+						return true;
+					}
+					else
+						return false;
+				}
+			}
+			if (*p == '[')
+			{
+				value.type = Json::Array;
+				p++;
+				skipBlanks();
+				if (p < end && *p == ']')
+				{
+					p++;
+					return true;
+				}
+				for (;;)
+				{
+					value.items.emplace_back();
+					if (!parseValue(value.items.back(), depth + 1))
+						return false;
+					skipBlanks();
+					if (p < end && *p == ',')
+						p++;
+					else if (p < end && *p == ']')
+					{
+						p++;
+						return true;
+					}
+					else
+						return false;
+				}
+			}
+			if (*p == '"')
+			{
+				value.type = Json::String;
+				return parseString(value.string);
+			}
+			if (literal("true") || literal("false"))
+			{
+				value.type = Json::Bool;
+				value.number = p[-1] == 'e' && p[-2] == 'u' ? 1.0 : 0.0; // "true" is the only literal ending in "ue"
+				return true;
+			}
+			if (literal("null"))
+				return true;
+
+			// strtod needs a terminated string, numbers are short so copy them
+			char number[64];
+			size_t length = 0;
+			while (p < end && length + 1 < sizeof(number) && (std::strchr("+-.eE", *p) || (*p >= '0' && *p <= '9')))
+				number[length++] = *p++;
+			number[length] = '\0';
+			char *parsedEnd;
+			value.type = Json::Number;
+			value.number = std::strtod(number, &parsedEnd);
+			return length > 0 && parsedEnd == number + length;
+		}
+	};
+
+	// Validated view of an accessor's elements within the binary chunk
+	struct Accessor
+	{
+		const unsigned char *data;
+		size_t count;
+		unsigned int stride;
+		int componentType;
+		unsigned int components;
+		bool normalized;
+	};
+
+	unsigned int componentSize(int componentType)
+	{
+		switch (componentType)
+		{
+		case GLTF_BYTE: case GLTF_UNSIGNED_BYTE: return 1;
+		case GLTF_SHORT: case GLTF_UNSIGNED_SHORT: return 2;
+		case GLTF_UNSIGNED_INT: case GLTF_FLOAT: return 4;
+		default: return 0;
+		}
+	}
+
+	unsigned int componentCount(const std::string &type)
+	{
+		if (type == "SCALAR") return 1;
+		if (type == "VEC2") return 2;
+		if (type == "VEC3") return 3;
+		if (type == "VEC4") return 4;
+		if (type == "MAT4") return 16;
+		return 0;
+	}
+
+	// Checks the accessor and its buffer view fit in the binary chunk and are aligned like GL needs
+	bool readAccessor(const Json &document, int index, const unsigned char *bin, size_t binSize, Accessor &out)
+	{
+		const Json &accessor = document["accessors"][index];
+		if (index < 0 || accessor.type != Json::Object || accessor.has("sparse"))
+			return false;
+		const Json &view = document["bufferViews"][accessor["bufferView"].asInt()];
+		if (view.type != Json::Object || view["buffer"].asInt() != 0)
+			return false;
+
+		if (accessor["count"].number < 1.0 || accessor["count"].number > (double)INT32_MAX)
+			return false;
+		out.componentType = accessor["componentType"].asInt();
+		out.components = componentCount(accessor["type"].string);
+		out.count = (size_t)accessor["count"].asInt();
+		out.normalized = accessor["normalized"].number != 0.0;
+		unsigned int size = componentSize(out.componentType);
+		unsigned int elementSize = size * out.components;
+		out.stride = view.has("byteStride") ? (unsigned int)view["byteStride"].asInt() : elementSize;
+		if (elementSize == 0 || out.stride < elementSize)
+			return false;
+
+		size_t viewOffset = (size_t)view["byteOffset"].asInt(0), viewLength = (size_t)view["byteLength"].asInt(0);
+		size_t offset = (size_t)accessor["byteOffset"].asInt(0);
+		if (viewOffset > binSize || viewLength > binSize - viewOffset
+			|| offset > viewLength || (uint64_t)out.stride * (out.count - 1) + elementSize > viewLength - offset)
+			return false;
+		if ((viewOffset + offset) % size != 0 || out.stride % size != 0)
+			return false;
+		out.data = bin + viewOffset + offset;
+		return true;
+	}
+
+	bool isFloatVector(const Accessor &accessor, unsigned int components)
+	{
+		return accessor.componentType == GLTF_FLOAT && accessor.components == components;
+	}
+
+	// Reads component c of element i as a float, applying the normalization of integer components
+	float readComponent(const Accessor &accessor, size_t i, unsigned int c)
+	{
+		const unsigned char *element = accessor.data + accessor.stride * i;
+		switch (accessor.componentType)
+		{
+		case GLTF_FLOAT: { float v; std::memcpy(&v, element + c * 4, 4); return v; }
+		case GLTF_UNSIGNED_BYTE: return accessor.normalized ? element[c] / 255.0f : element[c];
+		case GLTF_BYTE: return accessor.normalized ? std::max(((const signed char*)element)[c] / 127.0f, -1.0f) : ((const signed char*)element)[c];
+		case GLTF_UNSIGNED_SHORT: { uint16_t v; std::memcpy(&v, element + c * 2, 2); return accessor.normalized ? v / 65535.0f : v; }
+		case GLTF_SHORT: { int16_t v; std::memcpy(&v, element + c * 2, 2); return accessor.normalized ? std::max(v / 32767.0f, -1.0f) : v; }
+		default: return 0.0f;
+		}
+	}
+
+	glm::mat4 nodeTransform(const Json &node)
+	{
+		const Json &matrix = node["matrix"];
+		if (matrix.size() == 16)
+		{
+			glm::mat4 m;
+			for (int i = 0; i < 16; i++)
+				m[i / 4][i % 4] = matrix[i].asFloat(); // column-major, like glm
+			return m;
+		}
+		const Json &t = node["translation"], &r = node["rotation"], &s = node["scale"];
+		glm::mat4 m(1.0f);
+		if (t.size() == 3)
+			m = glm::translate(m, glm::vec3(t[0].asFloat(), t[1].asFloat(), t[2].asFloat()));
+		if (r.size() == 4)
+			m = m * glm::mat4_cast(glm::quat(r[3].asFloat(1.0f), r[0].asFloat(), r[1].asFloat(), r[2].asFloat()));
+		if (s.size() == 3)
+			m = glm::scale(m, glm::vec3(s[0].asFloat(1.0f), s[1].asFloat(1.0f), s[2].asFloat(1.0f)));
+		return m;
+	}
+}
+
+bool GltfLoader::Load(const std::string &path)
+{
+	file = std::make_shared<MappedFile>(path);
+	if (!file->isOpen() || file->length() < 20)
+	{
+		std::cout << "ERROR::GLTF::FILE_NOT_FOUND " << path << std::endl;
+		return false;
+	}
+
+	// 12 byte header, then a JSON chunk and an optional binary chunk
+	const unsigned char *bytes = file->begin();
+	uint32_t header[3], jsonChunk[2];
+	std::memcpy(header, bytes, sizeof(header));
+	std::memcpy(jsonChunk, bytes + 12, sizeof(jsonChunk));
+	if (header[0] != GLB_MAGIC || header[1] != 2 || header[2] > file->length() || jsonChunk[1] != GLB_CHUNK_JSON
+		|| jsonChunk[0] > header[2] - 20)
+	{
+		std::cout << "ERROR::GLTF::NOT_A_GLB_2_FILE " << path << std::endl;
+		return false;
+	}
+	const char *json = (const char*)bytes + 20;
+	const unsigned char *bin = nullptr;
+	size_t binSize = 0;
+	size_t binChunk = 20 + ((jsonChunk[0] + 3) & ~3u);
+	if (binChunk + 8 <= header[2])
+	{
+		uint32_t chunk[2];
+		std::memcpy(chunk, bytes + binChunk, sizeof(chunk));
+		if (chunk[1] == GLB_CHUNK_BIN && chunk[0] <= header[2] - binChunk - 8)
+		{
+			bin = bytes + binChunk + 8;
+			binSize = chunk[0];
+		}
+	}
+
+	Json document;
+	if (!JsonParser(json, json + jsonChunk[0]).Parse(document) || document.type != Json::Object)
+	{
+		std::cout << "ERROR::GLTF::INVALID_JSON " << path << std::endl;
+		return false;
+	}
+	if (document.has("skins") || document.has("animations"))
+	{
+		std::cout << "WARNING::GLTF::ANIMATED_MODELS_GO_THROUGH_ASSIMP " << path << std::endl;
+		return false;
+	}
+
+	const Json &images = document["images"];
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		GltfImage image = { nullptr, 0, images[i]["uri"].string };
+		const Json &view = document["bufferViews"][images[i]["bufferView"].asInt()];
+		if (view.type == Json::Object)
+		{
+			size_t offset = (size_t)view["byteOffset"].asInt(0), length = (size_t)view["byteLength"].asInt(0);
+			if (offset <= binSize && length <= binSize - offset)
+			{
+				image.bytes = bin + offset;
+				image.size = length;
+			}
+		}
+		this->images.push_back(image);
+	}
+	const Json &textures = document["textures"];
+	const Json &materials = document["materials"];
+	auto textureImage = [&](const Json &textureInfo)
+	{
+		int texture = textureInfo["index"].asInt();
+		int image = textures[texture].type == Json::Object ? textures[texture]["source"].asInt() : -1;
+		return image >= 0 && image < (int)this->images.size() ? image : -1;
+	};
+	for (size_t i = 0; i < materials.size(); i++)
+		this->materials.push_back({ textureImage(materials[i]["pbrMetallicRoughness"]["baseColorTexture"]), textureImage(materials[i]["normalTexture"]) });
+
+	// Pre-order walk of the default scene under a root node for the file, each node visited once
+	const Json &documentNodes = document["nodes"];
+	const Json &scene = document["scenes"][document["scene"].asInt(0)];
+	nodes.push_back({ -1, glm::mat4(1.0f), path.substr(path.find_last_of('/') + 1) });
+	std::vector<bool> visited(documentNodes.size(), false);
+	std::vector<std::pair<int, int>> stack; // (glTF node, parent in nodes)
+	for (size_t i = scene["nodes"].size(); i-- > 0;)
+		stack.push_back(std::make_pair(scene["nodes"][i].asInt(), 0));
+	bool valid = true;
+	while (!stack.empty() && valid)
+	{
+		int source = stack.back().first, parent = stack.back().second;
+		stack.pop_back();
+		if (source < 0 || source >= (int)documentNodes.size() || visited[source])
+		{
+			valid = false;
+			break;
+		}
+		visited[source] = true;
+		const Json &node = documentNodes[source];
+		unsigned int index = (unsigned int)nodes.size();
+		nodes.push_back({ parent, nodeTransform(node), node["name"].string });
+		const Json &children = node["children"];
+		for (size_t c = children.size(); c-- > 0;)
+			stack.push_back(std::make_pair(children[c].asInt(), (int)index));
+
+		const Json &mesh = document["meshes"][node["mesh"].asInt()];
+		const Json &meshPrimitives = mesh["primitives"];
+		for (size_t p = 0; p < meshPrimitives.size() && valid; p++)
+		{
+			const Json &primitive = meshPrimitives[p];
+			if (primitive["mode"].asInt(GLTF_TRIANGLES) != GLTF_TRIANGLES)
+				continue; // points and lines aren't drawn
+			if (primitive.has("targets"))
+			{
+				valid = false;
+				break;
+			}
+
+			const Json &attributes = primitive["attributes"];
+			Accessor positions, normals, texCoords, tangents, indices;
+			bool hasNormals = attributes.has("NORMAL"), hasTexCoords = attributes.has("TEXCOORD_0"), hasTangents = attributes.has("TANGENT");
+			if (!readAccessor(document, attributes["POSITION"].asInt(), bin, binSize, positions) || !isFloatVector(positions, 3)
+				|| (hasNormals && (!readAccessor(document, attributes["NORMAL"].asInt(), bin, binSize, normals) || normals.count != positions.count || normals.components != 3))
+				|| (hasTexCoords && (!readAccessor(document, attributes["TEXCOORD_0"].asInt(), bin, binSize, texCoords) || texCoords.count != positions.count || texCoords.components != 2))
+				|| (hasTangents && (!readAccessor(document, attributes["TANGENT"].asInt(), bin, binSize, tangents) || tangents.count != positions.count || !isFloatVector(tangents, 4))))
+			{
+				valid = false;
+				break;
+			}
+
+			GltfPrimitive out;
+			out.node = index;
+			out.material = primitive["material"].asInt();
+			if (out.material >= (int)this->materials.size())
+				out.material = -1;
+			size_t vertexCount = positions.count;
+
+			// Float normals and texture coordinates already have the layout of the shaders' attributes
+			out.streamed = hasNormals && hasTexCoords && isFloatVector(normals, 3) && isFloatVector(texCoords, 2);
+			if (out.streamed)
+			{
+				out.streams = { vertexCount, positions.data, normals.data, texCoords.data, hasTangents ? tangents.data : nullptr,
+					positions.stride, normals.stride, texCoords.stride, hasTangents ? tangents.stride : (unsigned int)sizeof(glm::vec4) };
+			}
+			else
+			{
+				out.vertices.resize(vertexCount);
+				for (size_t v = 0; v < vertexCount; v++)
+				{
+					Vertex &vertex = out.vertices[v];
+					vertex.Position = glm::vec3(readComponent(positions, v, 0), readComponent(positions, v, 1), readComponent(positions, v, 2));
+					vertex.Normal = hasNormals ? glm::vec3(readComponent(normals, v, 0), readComponent(normals, v, 1), readComponent(normals, v, 2)) : glm::vec3(0.0f);
+					vertex.TexCoords = hasTexCoords ? glm::vec2(readComponent(texCoords, v, 0), readComponent(texCoords, v, 1)) : glm::vec2(0.0f);
+					vertex.Tangent = hasTangents ? glm::vec4(readComponent(tangents, v, 0), readComponent(tangents, v, 1), readComponent(tangents, v, 2),
+						readComponent(tangents, v, 3)) : glm::vec4(0.0f);
+				}
+			}
+
+			// 32 bit indices are used from the file, smaller ones are widened as Mesh draws GL_UNSIGNED_INT
+			out.fileIndices = nullptr;
+			if (primitive.has("indices"))
+			{
+				if (!readAccessor(document, primitive["indices"].asInt(), bin, binSize, indices) || indices.components != 1
+					|| indices.stride != componentSize(indices.componentType))
+				{
+					valid = false;
+					break;
+				}
+				out.indexCount = indices.count;
+				if (indices.componentType == GLTF_UNSIGNED_INT)
+					out.fileIndices = (const unsigned int*)indices.data;
+				else if (indices.componentType == GLTF_UNSIGNED_SHORT || indices.componentType == GLTF_UNSIGNED_BYTE)
+				{
+					out.widenedIndices.resize(indices.count);
+					for (size_t i = 0; i < indices.count; i++)
+						out.widenedIndices[i] = (unsigned int)readComponent(indices, i, 0);
+				}
+				else
+				{
+					valid = false;
+					break;
+				}
+			}
+			else
+			{
+				out.indexCount = vertexCount;
+				out.widenedIndices.resize(vertexCount);
+				for (size_t i = 0; i < vertexCount; i++)
+					out.widenedIndices[i] = (unsigned int)i;
+			}
+			const unsigned int *indexData = out.Indices();
+			for (size_t i = 0; i < out.indexCount; i++)
+			{
+				if (indexData[i] >= vertexCount)
+				{
+					valid = false;
+					break;
+				}
+			}
+
+			// POSITION must carry min/max, only scan the vertices when an exporter left them out
+			const Json &accessor = document["accessors"][attributes["POSITION"].asInt()];
+			if (accessor["min"].size() == 3 && accessor["max"].size() == 3)
+			{
+				out.boundsMin = glm::vec3(accessor["min"][0].asFloat(), accessor["min"][1].asFloat(), accessor["min"][2].asFloat());
+				out.boundsMax = glm::vec3(accessor["max"][0].asFloat(), accessor["max"][1].asFloat(), accessor["max"][2].asFloat());
+			}
+			else
+			{
+				out.boundsMin = glm::vec3(FLT_MAX);
+				out.boundsMax = glm::vec3(-FLT_MAX);
+				for (size_t v = 0; v < vertexCount; v++)
+				{
+					glm::vec3 position(readComponent(positions, v, 0), readComponent(positions, v, 1), readComponent(positions, v, 2));
+					out.boundsMin = glm::min(out.boundsMin, position);
+					out.boundsMax = glm::max(out.boundsMax, position);
+				}
+			}
+			if (!valid)
+				break;
+
+			// Files without tangents get them generated, glTF asks for MikkTSpace which TangentSpace follows
+			if (!hasTangents && out.streamed)
+			{
+				out.tangents.resize(vertexCount);
+				TangentSpace::Generate(out.streams, out.Indices(), out.indexCount, out.tangents.data());
+			}
+			else if (!hasTangents)
+			{
+				// Vertices on mirror lines are split, which rewrites indices: take them out of the file first
+				if (out.fileIndices)
+				{
+					out.widenedIndices.assign(out.fileIndices, out.fileIndices + out.indexCount);
+					out.fileIndices = nullptr;
+				}
+				TangentSpace::Generate(out.vertices, out.widenedIndices);
+			}
+			primitives.push_back(std::move(out));
+			if (!primitives.back().tangents.empty())
+				primitives.back().streams.tangents = primitives.back().tangents.data();
+		}
+	}
+	if (!valid)
+	{
+		std::cout << "ERROR::GLTF::INVALID_OR_UNSUPPORTED_DATA " << path << std::endl;
+		nodes.clear();
+		primitives.clear();
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "Mesh.h"
+#include "MappedFile.h"
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Nodes are listed in pre-order, under a root node standing for the file
+struct GltfNode
+{
+	int parent;
+	glm::mat4 local;
+	std::string name;
+};
+
+// One triangle primitive of a glTF mesh, placed by a node. Its data points into the mapped file whenever the
+// buffer views already have the layout the shaders read, and into the primitive's own arrays otherwise.
+struct GltfPrimitive
+{
+	unsigned int node;
+	int material;				// -1 without material
+	bool streamed;				// true to upload streams as they are, false for the interleaved vertices
+	VertexStreams streams;
+	std::vector<Vertex> vertices;
+	std::vector<glm::vec4> tangents;			// generated for streamed primitives when the file has none
+	const unsigned int *fileIndices;			// 32 bit indices in the file, null when widenedIndices are used
+	std::vector<unsigned int> widenedIndices;	// when the file holds 8/16 bit indices or none
+	size_t indexCount;
+	glm::vec3 boundsMin, boundsMax;
+
+	const unsigned int *Indices() const { return fileIndices ? fileIndices : widenedIndices.data(); }
+};
+
+// An image, either embedded in the binary chunk or an external file
+struct GltfImage
+{
+	const unsigned char *bytes;	// null for external images
+	size_t size;
+	std::string uri;			// relative to the .glb file
+};
+
+struct GltfMaterial
+{
+	int baseColorImage;			// -1 without base color texture
+	int normalImage;			// -1 without normal map
+};
+
+// glTF 2.0 binary (.glb) loader used by Model in place of Assimp.
+// The file stays mapped for as long as the loader (or an image decode holding File()) lives. Accessors are validated
+// against the binary chunk before anything points at it, so the GPU never reads outside the file.
+// Skins, animations, morph targets and sparse accessors aren't supported, the caller falls back to Assimp.
+class GltfLoader
+{
+public:
+	std::vector<GltfNode> nodes;
+	std::vector<GltfPrimitive> primitives;
+	std::vector<GltfImage> images;
+	std::vector<GltfMaterial> materials;
+
+	/// @return false if the file isn't a valid .glb this loader supports
+	bool Load(const std::string &path);
+
+	/// Mapping of the file, to keep alive while embedded images are decoded
+	std::shared_ptr<const MappedFile> File() const { return file; }
+
+private:
+	std::shared_ptr<MappedFile> file;
+};
@@ -0,0 +1,43 @@
+#include "GpuResource.h"
+
+#include <iostream>
+
+std::atomic<size_t> GpuMemory::bytes[GPU_MEMORY_CATEGORY_COUNT];
+std::atomic<int> GpuMemory::objects[GPU_MEMORY_CATEGORY_COUNT];
+
+void GpuMemory::Allocate(GpuMemoryCategory category, size_t bytes, int objects)
+{
+	GpuMemory::bytes[category] += bytes;
+	GpuMemory::objects[category] += objects;
+}
+
+void GpuMemory::Free(GpuMemoryCategory category, size_t bytes, int objects)
+{
+	GpuMemory::bytes[category] -= bytes;
+	GpuMemory::objects[category] -= objects;
+}
+
+GpuMemory::Stats GpuMemory::Get(GpuMemoryCategory category)
+{
+	return { bytes[category].load(), (unsigned int)objects[category].load() };
+}
+
+size_t GpuMemory::TotalBytes()
+{
+	size_t total = 0;
+	for (int i = 0; i < GPU_MEMORY_CATEGORY_COUNT; i++)
+		total += bytes[i];
+	return total;
+}
+
+void GpuMemory::PrintStats()
+{
+	static const char *const names[GPU_MEMORY_CATEGORY_COUNT] =
+		{ "vertex buffers", "index buffers", "storage buffers", "staging buffers", "textures", "vertex arrays", "programs", "framebuffers" };
+	std::cout << "GPU_MEMORY:: " << TotalBytes() / 1024 << " KB total" << std::endl;
+	for (int i = 0; i < GPU_MEMORY_CATEGORY_COUNT; i++)
+	{
+		Stats stats = Get((GpuMemoryCategory)i);
+		std::cout << "  " << names[i] << ": " << stats.objects << " objects, " << stats.bytes / 1024 << " KB" << std::endl;
+	}
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <atomic>
+#include <cstddef>
+
+// What a GPU allocation is used for, each category has its own counters in GpuMemory
+enum GpuMemoryCategory
+{
+	GPU_MEMORY_VERTEX_BUFFERS,
+	GPU_MEMORY_INDEX_BUFFERS,
+	GPU_MEMORY_STORAGE_BUFFERS,	// shader storage and indirect command buffers
+	GPU_MEMORY_STAGING_BUFFERS,	// pixel unpack buffers used for uploads
+	GPU_MEMORY_TEXTURES,
+	GPU_MEMORY_VERTEX_ARRAYS,	// objects only, they hold no memory of their own
+	GPU_MEMORY_PROGRAMS,		// objects only
+	GPU_MEMORY_FRAMEBUFFERS,	// objects only, their attachments are textures
+	GPU_MEMORY_CATEGORY_COUNT
+};
+
+// Live counts of the GPU objects and bytes the application owns, per category.
+// Bytes are what the application asked for (e.g. glBufferData sizes), the driver may round them up.
+class GpuMemory
+{
+public:
+	struct Stats
+	{
+		size_t bytes;
+		unsigned int objects;
+	};
+
+	/// Records an object holding bytes, or a change in the bytes of an existing object when objects is 0
+	static void Allocate(GpuMemoryCategory category, size_t bytes, int objects = 1);
+	static void Free(GpuMemoryCategory category, size_t bytes, int objects = 1);
+
+	static Stats Get(GpuMemoryCategory category);
+	static size_t TotalBytes();
+	static void PrintStats();
+
+private:
+	static std::atomic<size_t> bytes[GPU_MEMORY_CATEGORY_COUNT];
+	static std::atomic<int> objects[GPU_MEMORY_CATEGORY_COUNT];
+};
+
+// How each kind of GL object is created and deleted, and the category it is counted under by default
+struct GpuBufferTraits
+{
+	static const GpuMemoryCategory Category = GPU_MEMORY_VERTEX_BUFFERS;
+	static GLuint Create() { GLuint id; glGenBuffers(1, &id); return id; }
+	static void Delete(GLuint id) { glDeleteBuffers(1, &id); }
+};
+struct GpuVertexArrayTraits
+{
+	static const GpuMemoryCategory Category = GPU_MEMORY_VERTEX_ARRAYS;
+	static GLuint Create() { GLuint id; glGenVertexArrays(1, &id); return id; }
+	static void Delete(GLuint id) { glDeleteVertexArrays(1, &id); }
+};
+struct GpuTextureTraits
+{
+	static const GpuMemoryCategory Category = GPU_MEMORY_TEXTURES;
+	static GLuint Create() { GLuint id; glGenTextures(1, &id); return id; }
+	static void Delete(GLuint id) { glDeleteTextures(1, &id); }
+};
+struct GpuProgramTraits
+{
+	static const GpuMemoryCategory Category = GPU_MEMORY_PROGRAMS;
+	static GLuint Create() { return glCreateProgram(); }
+	static void Delete(GLuint id) { glDeleteProgram(id); }
+};
+struct GpuFramebufferTraits
+{
+	static const GpuMemoryCategory Category = GPU_MEMORY_FRAMEBUFFERS;
+	static GLuint Create() { GLuint id; glGenFramebuffers(1, &id); return id; }
+	static void Delete(GLuint id) { glDeleteFramebuffers(1, &id); }
+};
+// Renderbuffers hold image memory like textures do, so they are counted with them
+struct GpuRenderbufferTraits
+{
+	static const GpuMemoryCategory Category = GPU_MEMORY_TEXTURES;
+	static GLuint Create() { GLuint id; glGenRenderbuffers(1, &id); return id; }
+	static void Delete(GLuint id) { glDeleteRenderbuffers(1, &id); }
+};
+
+// Move-only owner of one GL object, deleted (and its bytes given back to GpuMemory) when the handle is destroyed.
+// Converts to the GLuint name so it can be passed to GL calls as it is. The GL context must still be current
+// when the handle is destroyed.
+template<typename Traits>
+class GpuHandle
+{
+public:
+	GpuHandle() {}
+	/// Takes ownership of an existing object
+	explicit GpuHandle(GLuint id, GpuMemoryCategory category = Traits::Category) : id(id), category(category)
+	{
+		if (id)
+			GpuMemory::Allocate(category, 0);
+	}
+	/// Creates a new object
+	static GpuHandle Create(GpuMemoryCategory category = Traits::Category) { return GpuHandle(Traits::Create(), category); }
+
+	GpuHandle(const GpuHandle &) = delete;
+	GpuHandle &operator=(const GpuHandle &) = delete;
+	GpuHandle(GpuHandle &&other) noexcept : id(other.id), bytes(other.bytes), category(other.category)
+	{
+		other.id = 0;
+		other.bytes = 0;
+	}
+	GpuHandle &operator=(GpuHandle &&other) noexcept
+	{
+		if (this != &other)
+		{
+			Reset();
+			id = other.id;
+			bytes = other.bytes;
+			category = other.category;
+			other.id = 0;
+			other.bytes = 0;
+		}
+		return *this;
+	}
+	~GpuHandle() { Reset(); }
+
+	operator GLuint() const { return id; }
+	GLuint Get() const { return id; }
+	size_t Bytes() const { return bytes; }
+
+	/// Records the memory the object now holds, after e.g. glBufferData or glTexImage2D
+	void SetBytes(size_t bytes)
+	{
+		if (!id)
+			return;
+		if (bytes > this->bytes)
+			GpuMemory::Allocate(category, bytes - this->bytes, 0);
+		else
+			GpuMemory::Free(category, this->bytes - bytes, 0);
+		this->bytes = bytes;
+	}
+
+	/// Deletes the object
+	void Reset()
+	{
+		if (!id)
+			return;
+		GpuMemory::Free(category, bytes);
+		Traits::Delete(id);
+		id = 0;
+		bytes = 0;
+	}
+	/// Gives up ownership without deleting the object, its memory is no longer counted
+	GLuint Release()
+	{
+		GLuint released = id;
+		if (id)
+			GpuMemory::Free(category, bytes);
+		id = 0;
+		bytes = 0;
+		return released;
+	}
+
+private:
+	GLuint id = 0;
+	size_t bytes = 0;
+	GpuMemoryCategory category = Traits::Category;
+};
+
+typedef GpuHandle<GpuBufferTraits> GpuBuffer;
+typedef GpuHandle<GpuVertexArrayTraits> GpuVertexArray;
+typedef GpuHandle<GpuTextureTraits> GpuTexture;
+typedef GpuHandle<GpuProgramTraits> GpuProgram;
+typedef GpuHandle<GpuFramebufferTraits> GpuFramebuffer;
+typedef GpuHandle<GpuRenderbufferTraits> GpuRenderbuffer;
+
+/// glBufferData on buffer bound to target, recording its new size
+inline void GpuBufferData(GpuBuffer &buffer, GLenum target, size_t bytes, const void *data, GLenum usage)
+{
+	glBindBuffer(target, buffer);
+	glBufferData(target, bytes, data, usage);
+	buffer.SetBytes(bytes);
+}
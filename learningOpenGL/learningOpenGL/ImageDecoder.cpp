@@ -0,0 +1,168 @@
+#include "ImageDecoder.h"
+#include "MappedFile.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace
+{
+	const size_t ARENA_ALIGNMENT = 16;
+
+	// Bump allocator over a list of blocks. Only the last allocation can be freed or grown in place, which is how
+	// stb_image uses the memory it reallocates (its inflate and PNG data buffers); anything else waits for Reset.
+	class DecodeArena
+	{
+	public:
+		void *Allocate(size_t bytes)
+		{
+			bytes = (bytes + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+			while (current < blocks.size() && blocks[current].size - blocks[current].used < bytes)
+				current++;
+			if (current == blocks.size())
+			{
+				Block block;
+				block.size = std::max(bytes, IMAGE_ARENA_BLOCK_BYTES);
+				block.data.reset(new uint8_t[block.size]);
+				blocks.push_back(std::move(block));
+			}
+			Block &block = blocks[current];
+			last = block.data.get() + block.used;
+			block.used += bytes;
+			return last;
+		}
+
+		void *Reallocate(void *pointer, size_t oldBytes, size_t newBytes)
+		{
+			if (pointer && pointer == last)
+			{
+				Block &block = blocks[current];
+				size_t offset = (uint8_t*)pointer - block.data.get();
+				size_t bytes = (newBytes + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+				if (block.size - offset >= bytes)
+				{
+					block.used = offset + bytes;
+					return pointer;
+				}
+			}
+			void *moved = Allocate(newBytes);
+			if (pointer)
+				memcpy(moved, pointer, std::min(oldBytes, newBytes));
+			return moved;
+		}
+
+		void Free(void *pointer)
+		{
+			if (pointer != last)
+				return;
+			blocks[current].used = (uint8_t*)pointer - blocks[current].data.get();
+			last = nullptr;
+		}
+
+		bool Owns(const void *pointer) const
+		{
+			for (const Block &block : blocks)
+			{
+				if (pointer >= block.data.get() && pointer < block.data.get() + block.size)
+					return true;
+			}
+			return false;
+		}
+
+		/// Frees everything at once, keeping up to IMAGE_ARENA_RETAINED_BYTES of blocks for the next image
+		void Reset()
+		{
+			size_t retained = 0;
+			for (size_t i = 0; i < blocks.size(); i++)
+			{
+				blocks[i].used = 0;
+				retained += blocks[i].size;
+				if (retained > IMAGE_ARENA_RETAINED_BYTES)
+				{
+					blocks.resize(i);
+					break;
+				}
+			}
+			current = 0;
+			last = nullptr;
+		}
+
+	private:
+		struct Block
+		{
+			std::unique_ptr<uint8_t[]> data;
+			size_t size = 0;
+			size_t used = 0;
+		};
+		std::vector<Block> blocks;
+		size_t current = 0;
+		void *last = nullptr;	// most recent allocation, the only one Free and Reallocate act on in place
+	};
+
+	thread_local DecodeArena threadArena;
+	thread_local bool arenaActive = false;
+
+	// Routes the thread's stb_image allocations to its arena while alive, and resets the arena when done
+	struct ArenaScope
+	{
+		ArenaScope() { arenaActive = true; }
+		~ArenaScope()
+		{
+			threadArena.Reset();
+			arenaActive = false;
+		}
+	};
+}
+
+void *ImageDecoder::Allocate(size_t bytes)
+{
+	return arenaActive ? threadArena.Allocate(bytes) : malloc(bytes);
+}
+
+void *ImageDecoder::Reallocate(void *pointer, size_t oldBytes, size_t newBytes)
+{
+	if (arenaActive && (!pointer || threadArena.Owns(pointer)))
+		return threadArena.Reallocate(pointer, oldBytes, newBytes);
+	return realloc(pointer, newBytes);
+}
+
+void ImageDecoder::Free(void *pointer)
+{
+	if (!pointer)
+		return;
+	if (arenaActive && threadArena.Owns(pointer))
+		threadArena.Free(pointer);
+	else
+		free(pointer);
+}
+
+bool ImageDecoder::Decode(const uint8_t *bytes, size_t size, std::vector<uint8_t> &pixels, int &width, int &height, int &components,
+	int desiredComponents)
+{
+	pixels.clear();
+	if (!bytes || size > INT_MAX)
+		return false;
+	ArenaScope scope;
+	int imageComponents;
+	unsigned char *decoded = stbi_load_from_memory(bytes, (int)size, &width, &height, &imageComponents, desiredComponents);
+	if (!decoded)
+		return false;
+	components = desiredComponents ? desiredComponents : imageComponents;
+	pixels.assign(decoded, decoded + (size_t)width * height * components);
+	return true;
+}
+
+bool ImageDecoder::DecodeFile(const std::string &path, std::vector<uint8_t> &pixels, int &width, int &height, int &components,
+	int desiredComponents)
+{
+	MappedFile file;
+	if (!file.open(path))
+	{
+		pixels.clear();
+		return false;
+	}
+	return Decode(file.begin(), file.length(), pixels, width, height, components, desiredComponents);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Size of the blocks the decode arenas grow by, and how many bytes of blocks an arena keeps between two images.
+// Bigger images still decode, their extra blocks are freed once they are done.
+const size_t IMAGE_ARENA_BLOCK_BYTES = 4 * 1024 * 1024;
+const size_t IMAGE_ARENA_RETAINED_BYTES = 64 * 1024 * 1024;
+
+// Decodes PNG / JPEG images with stb_image without going through stdio or the heap. Files are read through a memory
+// mapping (see MappedFile), and everything stb_image allocates while decoding (inflate buffers, scanlines, the
+// image itself) comes from an arena owned by the calling thread, reset in one go once the pixels are copied into
+// the caller's buffer. The arena keeps its blocks for the thread's next image, so the worker pool decoding
+// thousands of textures reuses the same memory instead of churning the heap.
+// stb_image can't decode into memory it didn't allocate, so the pixels are copied out of the arena once, while
+// still in cache. Callers that decode several images can keep passing the same buffer.
+class ImageDecoder
+{
+public:
+	/// Decodes an image already in memory
+	/// @param pixels resized to width * height * components bytes, rows top to bottom; emptied if decoding fails
+	/// @param components channels of pixels, those of the image unless desiredComponents converts them
+	/// @param desiredComponents 1 to 4 to convert the image to, 0 to keep its channels
+	static bool Decode(const uint8_t *bytes, size_t size, std::vector<uint8_t> &pixels, int &width, int &height, int &components,
+		int desiredComponents = 0);
+	/// Same for a file, mapped for the time of the decode
+	static bool DecodeFile(const std::string &path, std::vector<uint8_t> &pixels, int &width, int &height, int &components,
+		int desiredComponents = 0);
+
+	/// stb_image's allocator (see stb_image.cpp): the calling thread's arena while it decodes, the heap otherwise
+	static void *Allocate(size_t bytes);
+	static void *Reallocate(void *pointer, size_t oldBytes, size_t newBytes);
+	static void Free(void *pointer);
+};
@@ -0,0 +1,190 @@
+#include "Impostor.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+	// Direction of the view at uv in [0,1]^2 of the octahedral grid, the same mapping as octDecode in shaders/impostor.frag
+	glm::vec3 octDecode(glm::vec2 uv, bool hemisphere)
+	{
+		glm::vec2 p = uv * 2.0f - 1.0f;
+		glm::vec3 d;
+		if (hemisphere)
+		{
+			d.x = (p.x + p.y) * 0.5f;
+			d.z = (p.x - p.y) * 0.5f;
+			d.y = 1.0f - std::abs(d.x) - std::abs(d.z);
+		}
+		else
+		{
+			d = glm::vec3(p.x, 1.0f - std::abs(p.x) - std::abs(p.y), p.y);
+			if (d.y < 0.0f)
+			{
+				float x = d.x, z = d.z;
+				d.x = (1.0f - std::abs(z)) * (x >= 0.0f ? 1.0f : -1.0f);
+				d.z = (1.0f - std::abs(x)) * (z >= 0.0f ? 1.0f : -1.0f);
+			}
+		}
+		return glm::normalize(d);
+	}
+
+	// Views straight from above or below need another up vector, the shaders pick it the same way
+	glm::vec3 upFor(glm::vec3 direction)
+	{
+		return std::abs(direction.y) > 0.999f ? glm::vec3(0.0f, 0.0f, -1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	}
+
+	GpuTexture createAtlasTexture(unsigned int size, unsigned int maxLevel)
+	{
+		GpuTexture texture = GpuTexture::Create();
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		// Coarser mips would blend neighbouring views together
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		texture.SetBytes((size_t)size * size * 4 * 4 / 3);
+		return texture;
+	}
+}
+
+bool ImpostorAtlas::Bake(const std::function<void(Shader &)> &drawModel, Shader &bakeShader, glm::vec3 boundsMin, glm::vec3 boundsMax,
+	const ImpostorSettings &settings)
+{
+	Release();
+	if (settings.framesPerSide < 2 || settings.frameResolution < 4)
+	{
+		std::cout << "ERROR::IMPOSTOR::INVALID_SETTINGS" << std::endl;
+		return false;
+	}
+
+	unsigned int size = settings.framesPerSide * settings.frameResolution;
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if (size > (unsigned int)maxSize)
+	{
+		std::cout << "ERROR::IMPOSTOR::ATLAS_TOO_LARGE " << size << std::endl;
+		return false;
+	}
+
+	this->settings = settings;
+	center = (boundsMin + boundsMax) * 0.5f;
+	radius = glm::max(glm::length(boundsMax - boundsMin) * 0.5f, 1e-4f);
+
+	// Keep mips down to 4x4 pixels per view
+	unsigned int maxLevel = 0;
+	while ((settings.frameResolution >> (maxLevel + 1)) >= 4)
+		maxLevel++;
+	albedo = createAtlasTexture(size, maxLevel);
+	normalDepth = createAtlasTexture(size, maxLevel);
+
+	// The framebuffer and its depth buffer only live for the bake
+	GpuRenderbuffer depthBuffer = GpuRenderbuffer::Create();
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+	depthBuffer.SetBytes((size_t)size * size * 4);
+	GpuFramebuffer framebuffer = GpuFramebuffer::Create();
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedo, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalDepth, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	if (complete)
+	{
+		GLint viewport[4];
+		GLfloat clearColor[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+
+		// Empty texels have a zero alpha, which the runtime shader uses as coverage
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		// Every view is an orthographic projection of the bounding sphere, with the depth range spanning it
+		glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius);
+		bakeShader.Use();
+		bakeShader.setMat4("projection", projection);
+		for (unsigned int y = 0; y < settings.framesPerSide; y++)
+		{
+			for (unsigned int x = 0; x < settings.framesPerSide; x++)
+			{
+				glm::vec3 direction = octDecode(glm::vec2(x, y) / (float)(settings.framesPerSide - 1), settings.hemisphere);
+				glm::mat4 view = glm::lookAt(center + direction * radius, center, upFor(direction));
+				glViewport(x * settings.frameResolution, y * settings.frameResolution, settings.frameResolution, settings.frameResolution);
+				bakeShader.Use();
+				bakeShader.setMat4("view", view);
+				drawModel(bakeShader);
+			}
+		}
+
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+	}
+	else
+		std::cout << "ERROR::IMPOSTOR::FRAMEBUFFER_INCOMPLETE" << std::endl;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	framebuffer.Reset();
+	depthBuffer.Reset();
+	if (!complete)
+	{
+		Release();
+		return false;
+	}
+
+	for (GLuint texture : { albedo.Get(), normalDepth.Get() })
+	{
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	quadVAO = GpuVertexArray::Create();
+	instanceBuffer = GpuBuffer::Create(GPU_MEMORY_STORAGE_BUFFERS);
+	return true;
+}
+
+void ImpostorAtlas::Draw(Shader &shader, const std::vector<glm::mat4> &transforms)
+{
+	if (!IsBaked() || transforms.empty())
+		return;
+
+	// Orphaned every call, the instances further than the switch distance change as the camera moves
+	GpuBufferData(instanceBuffer, GL_SHADER_STORAGE_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, IMPOSTOR_INSTANCE_BINDING, instanceBuffer);
+
+	glActiveTexture(GL_TEXTURE0 + IMPOSTOR_ALBEDO_UNIT);
+	glBindTexture(GL_TEXTURE_2D, albedo);
+	glActiveTexture(GL_TEXTURE0 + IMPOSTOR_NORMAL_DEPTH_UNIT);
+	glBindTexture(GL_TEXTURE_2D, normalDepth);
+	glActiveTexture(GL_TEXTURE0);
+	shader.setInt("impostorAlbedo", IMPOSTOR_ALBEDO_UNIT);
+	shader.setInt("impostorNormalDepth", IMPOSTOR_NORMAL_DEPTH_UNIT);
+	shader.setUInt("framesPerSide", settings.framesPerSide);
+	shader.setBool("hemisphere", settings.hemisphere);
+	shader.setVec3("impostorCenter", center);
+	shader.setFloat("impostorRadius", radius);
+
+	glBindVertexArray(quadVAO);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)transforms.size());
+	glBindVertexArray(0);
+}
+
+void ImpostorAtlas::Release()
+{
+	albedo.Reset();
+	normalDepth.Reset();
+	instanceBuffer.Reset();
+	quadVAO.Reset();
+	radius = 0.0f;
+}
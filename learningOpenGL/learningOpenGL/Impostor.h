@@ -0,0 +1,56 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "GpuResource.h"
+
+#include <functional>
+#include <vector>
+
+// Texture units of the atlas, below the ones taken by the vertex animation textures
+const unsigned int IMPOSTOR_ALBEDO_UNIT = 12;
+const unsigned int IMPOSTOR_NORMAL_DEPTH_UNIT = 13;
+// Shader storage binding of the instance transforms read by shaders/impostor.vert
+const unsigned int IMPOSTOR_INSTANCE_BINDING = 8;
+
+struct ImpostorSettings
+{
+	unsigned int framesPerSide = 8;		// the atlas holds framesPerSide^2 views
+	unsigned int frameResolution = 128;	// pixels per side of each view
+	bool hemisphere = false;			// only views from above, for models always seen from the ground
+};
+
+// A model rendered ahead of time from a grid of view directions laid out on an octahedron, stored as an atlas of
+// albedo and of model space normal + depth. At runtime each instance is one camera facing quad: the fragment
+// shader reprojects the quad onto the three baked views closest to the view direction and blends them, and
+// rebuilds the surface depth so impostors intersect the scene correctly.
+class ImpostorAtlas
+{
+public:
+	/// Renders the views with bakeShader (shaders/impostor_bake.vert and .frag) into a new atlas
+	/// @param drawModel draws the model in model space with the given shader, its textures must be loaded
+	/// @param boundsMin, boundsMax model space bounds of the model
+	bool Bake(const std::function<void(Shader &)> &drawModel, Shader &bakeShader, glm::vec3 boundsMin, glm::vec3 boundsMax,
+		const ImpostorSettings &settings = ImpostorSettings());
+
+	/// Draws every instance as a quad with one instanced draw
+	/// @param shader shader built from shaders/impostor.vert and .frag, in use with view, projection and viewPos set
+	/// @param transforms world matrix of each instance
+	void Draw(Shader &shader, const std::vector<glm::mat4> &transforms);
+	void Release();
+
+	bool IsBaked() const { return albedo != 0; }
+	/// Model space bounding sphere the views were framed on
+	glm::vec3 Center() const { return center; }
+	float Radius() const { return radius; }
+
+private:
+	GpuTexture albedo, normalDepth;
+	GpuBuffer instanceBuffer;
+	GpuVertexArray quadVAO; // no attributes, the quad's corners come from gl_VertexID
+	ImpostorSettings settings;
+	glm::vec3 center;
+	float radius = 0.0f;
+};
@@ -0,0 +1,347 @@
+#include "KtxTexture.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+	const uint8_t KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	// Layout of the file up to the level index, all little endian
+	struct KtxHeader
+	{
+		uint8_t identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth, pixelHeight, pixelDepth;
+		uint32_t layerCount, faceCount, levelCount;
+		uint32_t supercompressionScheme;
+		uint32_t dfdByteOffset, dfdByteLength;
+		uint32_t kvdByteOffset, kvdByteLength;
+		uint64_t sgdByteOffset, sgdByteLength;
+	};
+	struct KtxLevelIndex
+	{
+		uint64_t byteOffset, byteLength, uncompressedByteLength;
+	};
+
+	struct FormatInfo
+	{
+		uint32_t vkFormat;
+		GLenum internalFormat, format;
+		unsigned int bytes;	// per 4x4 block when compressed, per pixel otherwise
+		bool compressed;
+		// What the data format descriptor of a written file says about it: the color model and the channel
+		// of each 64 bit half of a block (or of each byte of a pixel), 0xFF past the last one
+		uint8_t colorModel, channels[4];
+	};
+	const uint8_t NONE = 0xFF;
+	const FormatInfo FORMATS[] =
+	{
+		{ KTX_FORMAT_R8_UNORM, GL_R8, GL_RED, 1, false, 1, { 0, NONE } },
+		{ KTX_FORMAT_R8G8_UNORM, GL_RG8, GL_RG, 2, false, 1, { 0, 1, NONE } },
+		{ KTX_FORMAT_R8G8B8A8_UNORM, GL_RGBA8, GL_RGBA, 4, false, 1, { 0, 1, 2, 15 } },
+		{ KTX_FORMAT_R8G8B8A8_SRGB, GL_SRGB8_ALPHA8, GL_RGBA, 4, false, 1, { 0, 1, 2, 15 } },
+		{ KTX_FORMAT_BC1_RGB_UNORM, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 0, 8, true, 128, { 0, NONE } },
+		{ KTX_FORMAT_BC1_RGB_SRGB, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 0, 8, true, 128, { 0, NONE } },
+		{ KTX_FORMAT_BC1_RGBA_UNORM, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 0, 8, true, 128, { 1, NONE } },
+		{ KTX_FORMAT_BC1_RGBA_SRGB, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 0, 8, true, 128, { 1, NONE } },
+		{ KTX_FORMAT_BC2_UNORM, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 0, 16, true, 129, { 15, 0, NONE } },
+		{ KTX_FORMAT_BC2_SRGB, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 0, 16, true, 129, { 15, 0, NONE } },
+		{ KTX_FORMAT_BC3_UNORM, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 0, 16, true, 130, { 15, 0, NONE } },
+		{ KTX_FORMAT_BC3_SRGB, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 0, 16, true, 130, { 15, 0, NONE } },
+		{ KTX_FORMAT_BC4_UNORM, GL_COMPRESSED_RED_RGTC1, 0, 8, true, 131, { 0, NONE } },
+		{ KTX_FORMAT_BC4_SNORM, GL_COMPRESSED_SIGNED_RED_RGTC1, 0, 8, true, 131, { 0, NONE } },
+		{ KTX_FORMAT_BC5_UNORM, GL_COMPRESSED_RG_RGTC2, 0, 16, true, 132, { 0, 1, NONE } },
+		{ KTX_FORMAT_BC5_SNORM, GL_COMPRESSED_SIGNED_RG_RGTC2, 0, 16, true, 132, { 0, 1, NONE } },
+		{ KTX_FORMAT_BC6H_UFLOAT, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 0, 16, true, 133, { 0, NONE } },
+		{ KTX_FORMAT_BC6H_SFLOAT, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, 0, 16, true, 133, { 0, NONE } },
+		{ KTX_FORMAT_BC7_UNORM, GL_COMPRESSED_RGBA_BPTC_UNORM, 0, 16, true, 134, { 0, NONE } },
+		{ KTX_FORMAT_BC7_SRGB, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 0, 16, true, 134, { 0, NONE } },
+	};
+
+	bool isS3tc(uint32_t vkFormat)
+	{
+		return vkFormat >= KTX_FORMAT_BC1_RGB_UNORM && vkFormat <= KTX_FORMAT_BC3_SRGB;
+	}
+
+	// Whether the driver takes BC1 to BC3. glad sets its flag when the context is loaded, before anything streams.
+	bool s3tcSupported()
+	{
+#ifdef GL_EXT_texture_compression_s3tc
+		return GLAD_GL_EXT_texture_compression_s3tc != 0;
+#else
+		return false; // the loader was generated without the extension, the enums are ours (see KtxTexture.h)
+#endif
+	}
+
+	const FormatInfo *findFormat(uint32_t vkFormat)
+	{
+		for (const FormatInfo &info : FORMATS)
+		{
+			if (info.vkFormat == vkFormat)
+				return &info;
+		}
+		return nullptr;
+	}
+
+	bool isSrgb(uint32_t vkFormat)
+	{
+		return vkFormat == KTX_FORMAT_R8G8B8A8_SRGB || vkFormat == KTX_FORMAT_BC1_RGB_SRGB || vkFormat == KTX_FORMAT_BC1_RGBA_SRGB
+			|| vkFormat == KTX_FORMAT_BC2_SRGB || vkFormat == KTX_FORMAT_BC3_SRGB || vkFormat == KTX_FORMAT_BC7_SRGB;
+	}
+
+	bool isSigned(uint32_t vkFormat)
+	{
+		return vkFormat == KTX_FORMAT_BC4_SNORM || vkFormat == KTX_FORMAT_BC5_SNORM || vkFormat == KTX_FORMAT_BC6H_SFLOAT;
+	}
+
+	// Basic data format descriptor (Khronos Data Format 1.3), which KTX2 requires even though the format says it all
+	std::vector<uint32_t> dataFormatDescriptor(const FormatInfo &info)
+	{
+		unsigned int samples = 0;
+		while (samples < 4 && info.channels[samples] != NONE)
+			samples++;
+		unsigned int blockSize = 24 + 16 * samples;
+		std::vector<uint32_t> words;
+		words.push_back(4 + blockSize);				// dfdTotalSize
+		words.push_back(0);							// vendor 0 (Khronos), descriptor type 0 (basic)
+		words.push_back(2 | (blockSize << 16));		// version 1.3
+		// Color model, BT.709 primaries, linear or sRGB transfer, straight alpha
+		words.push_back(info.colorModel | (1u << 8) | ((isSrgb(info.vkFormat) ? 2u : 1u) << 16));
+		words.push_back(info.compressed ? 3 | (3 << 8) : 0);	// texel block dimensions minus one
+		words.push_back(info.bytes);				// bytes of plane 0
+		words.push_back(0);
+		unsigned int sampleBits = info.compressed ? 8 * info.bytes / samples : 8;
+		for (unsigned int i = 0; i < samples; i++)
+		{
+			uint32_t channel = info.channels[i] | (isSigned(info.vkFormat) ? 0x40u : 0u);
+			words.push_back((i * sampleBits) | ((sampleBits - 1) << 16) | (channel << 24));
+			words.push_back(0);						// sample position
+			words.push_back(0);						// lower
+			words.push_back(info.compressed ? 0xFFFFFFFFu : 0xFFu);	// upper
+		}
+		return words;
+	}
+
+	void writePadding(std::ofstream &out, uint64_t from, uint64_t to)
+	{
+		static const char zeros[16] = { 0 };
+		out.write(zeros, (std::streamsize)(to - from));
+	}
+}
+
+bool KtxTexture::Open(const std::string &path)
+{
+	if (!file.open(path))
+		return false;
+	return Parse(nullptr, file.begin(), file.length(), path);
+}
+
+bool KtxTexture::IsKtx(const uint8_t *bytes, size_t size)
+{
+	return size >= sizeof(KTX_IDENTIFIER) && std::memcmp(bytes, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) == 0;
+}
+
+std::string KtxTexture::CookedPath(const std::string &path)
+{
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return path + KTX_EXTENSION;
+	return path.substr(0, dot) + KTX_EXTENSION;
+}
+
+bool KtxTexture::Parse(std::shared_ptr<const void> owner, const uint8_t *bytes, size_t size, const std::string &name)
+{
+	this->owner = std::move(owner);
+	levels.clear();
+	KtxHeader header;
+	if (!IsKtx(bytes, size) || size < sizeof(KtxHeader))
+	{
+		std::cout << "ERROR::KTX::NOT_A_KTX2_FILE " << name << std::endl;
+		return false;
+	}
+	std::memcpy(&header, bytes, sizeof(KtxHeader));
+	const FormatInfo *info = findFormat(header.vkFormat);
+	if (!info)
+	{
+		std::cout << "ERROR::KTX::UNSUPPORTED_FORMAT " << header.vkFormat << " " << name << std::endl;
+		return false;
+	}
+	if (isS3tc(header.vkFormat) && !s3tcSupported())
+	{
+		std::cout << "WARNING::KTX::S3TC_NOT_SUPPORTED " << name << std::endl;
+		return false;
+	}
+	if (header.supercompressionScheme != 0)
+	{
+		std::cout << "ERROR::KTX::SUPERCOMPRESSION_NOT_SUPPORTED " << name << std::endl;
+		return false;
+	}
+	if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth > 1 || header.layerCount > 1
+		|| (header.faceCount != 1 && header.faceCount != 6))
+	{
+		std::cout << "ERROR::KTX::ONLY_2D_TEXTURES_AND_CUBEMAPS " << name << std::endl;
+		return false;
+	}
+
+	// A level count of 0 asks the loader to build the mips, which can't be done for compressed formats: the
+	// texture is then drawn from its base level only
+	unsigned int levelCount = std::max(1u, header.levelCount);
+	unsigned int fullChain = 1;
+	while ((std::max(header.pixelWidth, header.pixelHeight) >> fullChain) > 0)
+		fullChain++;
+	if (levelCount > fullChain)
+	{
+		std::cout << "ERROR::KTX::TOO_MANY_LEVELS " << name << std::endl;
+		return false;
+	}
+	if (sizeof(KtxHeader) + levelCount * sizeof(KtxLevelIndex) > size)
+	{
+		std::cout << "ERROR::KTX::TRUNCATED " << name << std::endl;
+		return false;
+	}
+	faceCount = header.faceCount;
+	internalFormat = info->internalFormat;
+	format = info->format;
+	compressed = info->compressed;
+	for (unsigned int level = 0; level < levelCount; level++)
+	{
+		KtxLevelIndex index;
+		std::memcpy(&index, bytes + sizeof(KtxHeader) + level * sizeof(KtxLevelIndex), sizeof(KtxLevelIndex));
+		Level mip;
+		mip.width = std::max(1u, header.pixelWidth >> level);
+		mip.height = std::max(1u, header.pixelHeight >> level);
+		mip.faceBytes = compressed ? (size_t)((mip.width + 3) / 4) * ((mip.height + 3) / 4) * info->bytes
+			: (size_t)mip.width * mip.height * info->bytes;
+		if (index.byteOffset > size || index.byteLength > size - index.byteOffset || index.byteLength < mip.faceBytes * faceCount)
+		{
+			std::cout << "ERROR::KTX::BAD_LEVEL " << level << " " << name << std::endl;
+			levels.clear();
+			return false;
+		}
+		mip.data = bytes + index.byteOffset;
+		levels.push_back(mip);
+	}
+	return true;
+}
+
+size_t KtxTexture::Bytes() const
+{
+	size_t bytes = 0;
+	for (const Level &level : levels)
+		bytes += level.faceBytes * faceCount;
+	return bytes;
+}
+
+void KtxTexture::AllocateStorage(GLenum target) const
+{
+	AllocateLevels(target, 0, LevelCount());
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, LevelCount() - 1);
+	// One channel textures (e.g. specular maps cooked to BC4 from grey images) read as grey, not red
+	if (internalFormat == GL_R8 || internalFormat == GL_COMPRESSED_RED_RGTC1 || internalFormat == GL_COMPRESSED_SIGNED_RED_RGTC1)
+	{
+		glTexParameteri(target, GL_TEXTURE_SWIZZLE_G, GL_RED);
+		glTexParameteri(target, GL_TEXTURE_SWIZZLE_B, GL_RED);
+	}
+}
+
+void KtxTexture::AllocateLevels(GLenum target, unsigned int first, unsigned int count) const
+{
+	unsigned int faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+	for (unsigned int face = 0; face < faces; face++)
+	{
+		GLenum faceTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+		for (unsigned int level = first; level < first + count && level < LevelCount(); level++)
+		{
+			const Level &mip = levels[level];
+			if (compressed)
+				glCompressedTexImage2D(faceTarget, level, internalFormat, mip.width, mip.height, 0, (GLsizei)mip.faceBytes, NULL);
+			else
+				glTexImage2D(faceTarget, level, internalFormat, mip.width, mip.height, 0, format, GL_UNSIGNED_BYTE, NULL);
+		}
+	}
+}
+
+void KtxTexture::UploadLevel(GLenum target, unsigned int level, const void *pixels) const
+{
+	const Level &mip = levels[level];
+	if (compressed)
+		glCompressedTexSubImage2D(target, level, 0, 0, mip.width, mip.height, internalFormat, (GLsizei)mip.faceBytes, pixels);
+	else
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of one and two channel levels aren't 4 byte aligned
+		glTexSubImage2D(target, level, 0, 0, mip.width, mip.height, format, GL_UNSIGNED_BYTE, pixels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+}
+
+bool KtxTexture::Write(const std::string &path, KtxFormat format, unsigned int width, unsigned int height,
+	const std::vector<std::vector<uint8_t>> &levels)
+{
+	const FormatInfo *info = findFormat(format);
+	if (!info || levels.empty())
+	{
+		std::cout << "ERROR::KTX::CANNOT_WRITE_FORMAT " << format << " " << path << std::endl;
+		return false;
+	}
+	std::vector<uint32_t> dfd = dataFormatDescriptor(*info);
+
+	KtxHeader header = {};
+	std::memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+	header.vkFormat = format;
+	header.typeSize = 1;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.faceCount = 1;
+	header.levelCount = (uint32_t)levels.size();
+	header.dfdByteOffset = (uint32_t)(sizeof(KtxHeader) + levels.size() * sizeof(KtxLevelIndex));
+	header.dfdByteLength = (uint32_t)(dfd.size() * sizeof(uint32_t));
+
+	// Levels are stored smallest first, each aligned to the size of a block (a pixel rounded up to 4 bytes)
+	uint64_t alignment = info->compressed ? info->bytes : 4;
+	std::vector<KtxLevelIndex> index(levels.size());
+	uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+	for (size_t level = levels.size(); level-- > 0;)
+	{
+		offset = (offset + alignment - 1) / alignment * alignment;
+		index[level].byteOffset = offset;
+		index[level].byteLength = levels[level].size();
+		index[level].uncompressedByteLength = levels[level].size();
+		offset += levels[level].size();
+	}
+
+	// Write to a temporary file and rename it so a crash never leaves a half written texture behind
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			std::cout << "ERROR::KTX::CANNOT_WRITE " << path << std::endl;
+			return false;
+		}
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)index.data(), (std::streamsize)(index.size() * sizeof(KtxLevelIndex)));
+		out.write((const char*)dfd.data(), (std::streamsize)header.dfdByteLength);
+		uint64_t written = header.dfdByteOffset + header.dfdByteLength;
+		for (size_t level = levels.size(); level-- > 0;)
+		{
+			writePadding(out, written, index[level].byteOffset);
+			out.write((const char*)levels[level].data(), (std::streamsize)levels[level].size());
+			written = index[level].byteOffset + levels[level].size();
+		}
+		if (!out)
+		{
+			std::cout << "ERROR::KTX::CANNOT_WRITE " << path << std::endl;
+			out.close();
+			std::remove(tempPath.c_str());
+			return false;
+		}
+	}
+	std::remove(path.c_str());
+	return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
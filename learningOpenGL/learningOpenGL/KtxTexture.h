@@ -0,0 +1,111 @@
+#pragma once
+#include <glad/glad.h>
+
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// S3TC (BC1-BC3) is an extension rather than core, loaders generated without it lack its enums
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// Extension of the cooked textures, and the Vulkan formats (VkFormat) KtxTexture can upload
+const char *const KTX_EXTENSION = ".ktx2";
+enum KtxFormat
+{
+	KTX_FORMAT_R8_UNORM = 9,
+	KTX_FORMAT_R8G8_UNORM = 16,
+	KTX_FORMAT_R8G8B8A8_UNORM = 37,
+	KTX_FORMAT_R8G8B8A8_SRGB = 43,
+	KTX_FORMAT_BC1_RGB_UNORM = 131,
+	KTX_FORMAT_BC1_RGB_SRGB = 132,
+	KTX_FORMAT_BC1_RGBA_UNORM = 133,
+	KTX_FORMAT_BC1_RGBA_SRGB = 134,
+	KTX_FORMAT_BC2_UNORM = 135,
+	KTX_FORMAT_BC2_SRGB = 136,
+	KTX_FORMAT_BC3_UNORM = 137,
+	KTX_FORMAT_BC3_SRGB = 138,
+	KTX_FORMAT_BC4_UNORM = 139,
+	KTX_FORMAT_BC4_SNORM = 140,
+	KTX_FORMAT_BC5_UNORM = 141,
+	KTX_FORMAT_BC5_SNORM = 142,
+	KTX_FORMAT_BC6H_UFLOAT = 143,
+	KTX_FORMAT_BC6H_SFLOAT = 144,
+	KTX_FORMAT_BC7_UNORM = 145,
+	KTX_FORMAT_BC7_SRGB = 146
+};
+
+// A KTX 2.0 container holding a 2D texture or a cubemap with its mips already built, in a format the GPU samples
+// as it is: BC1 to BC7, or plain 8 bit channels. Levels point straight into the file (or the in-memory image),
+// so uploading a level copies it once, into a pixel buffer or the driver. Supercompressed files (BasisLZ, zstd)
+// and arrays aren't supported. Rows are stored top to bottom like every other image the repo loads.
+class KtxTexture
+{
+public:
+	struct Level
+	{
+		const uint8_t *data;	// every face of the level, one after the other
+		size_t faceBytes;
+		unsigned int width, height;
+	};
+
+	/// Maps a .ktx2 file. Returns false quietly if the file doesn't exist, with an error if it can't be uploaded
+	/// (BC1 to BC3 without EXT_texture_compression_s3tc among others), callers then fall back to the source image.
+	bool Open(const std::string &path);
+	/// Same for a file already in memory
+	/// @param owner kept alive as long as the texture, the bytes must stay valid while it lives
+	/// @param name reported in errors
+	bool Parse(std::shared_ptr<const void> owner, const uint8_t *bytes, size_t size, const std::string &name);
+	/// Whether the bytes start with the KTX 2.0 identifier
+	static bool IsKtx(const uint8_t *bytes, size_t size);
+	/// The cooked texture of an image, next to it with the extension replaced ("textures/wall.png" -> "textures/wall.ktx2")
+	static std::string CookedPath(const std::string &path);
+	/// Writes a 2D texture, through a temporary file so a failed write never leaves a broken texture behind
+	/// @param format one of the block compressed formats, or an 8 bit one
+	/// @param levels data of every level, full resolution first
+	static bool Write(const std::string &path, KtxFormat format, unsigned int width, unsigned int height,
+		const std::vector<std::vector<uint8_t>> &levels);
+
+	unsigned int Width() const { return levels.empty() ? 0 : levels[0].width; }
+	unsigned int Height() const { return levels.empty() ? 0 : levels[0].height; }
+	unsigned int LevelCount() const { return (unsigned int)levels.size(); }
+	unsigned int FaceCount() const { return faceCount; }
+	/// Level 0 is the full resolution one
+	const Level &GetLevel(unsigned int level) const { return levels[level]; }
+	GLenum InternalFormat() const { return internalFormat; }
+	bool IsCompressed() const { return compressed; }
+	/// Bytes of every level and face, what the texture takes on the GPU
+	size_t Bytes() const;
+
+	/// Allocates every level on the bound texture (GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP), one channel formats are
+	/// swizzled to grey. The levels are mutable so TextureResidency can free the finest ones and allocate them again.
+	void AllocateStorage(GLenum target) const;
+	/// Allocates levels [first, first + count) of a texture set up by AllocateStorage, without their contents
+	void AllocateLevels(GLenum target, unsigned int first, unsigned int count) const;
+	/// Uploads one face of one level into storage allocated by AllocateStorage
+	/// @param target GL_TEXTURE_2D, or GL_TEXTURE_CUBE_MAP_POSITIVE_X + face
+	/// @param pixels the level's face, or its offset in the bound GL_PIXEL_UNPACK_BUFFER
+	void UploadLevel(GLenum target, unsigned int level, const void *pixels) const;
+
+private:
+	MappedFile file;
+	std::shared_ptr<const void> owner;
+	std::vector<Level> levels;
+	unsigned int faceCount = 0;
+	GLenum internalFormat = 0, format = 0; // format is only used by uncompressed textures
+	bool compressed = false;
+};
@@ -0,0 +1,384 @@
+#include "MaterialBatch.h"
+#include "ModelInstances.h"
+#include "TextureStreamer.h"
+#include "TextureResidency.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+
+namespace
+{
+	const TextureType SLOT_TYPES[BATCH_SLOT_COUNT] = { TEXTURE_DIFFUSE, TEXTURE_NORMAL, TEXTURE_MASK };
+	const char *const SLOT_SAMPLERS[BATCH_SLOT_COUNT] = { "material.diffuseLayers", "material.normalLayers", "material.maskLayers" };
+
+	// glTexImage2D was given the unsized format of the image's channels (see TextureStreamer), storage needs a size
+	GLenum sizedFormat(GLenum format)
+	{
+		switch (format)
+		{
+		case GL_RED: return GL_R8;
+		case GL_RG: return GL_RG8;
+		case GL_RGB: return GL_RGB8;
+		case GL_RGBA: return GL_RGBA8;
+		default: return format;
+		}
+	}
+	// Bytes per texel of the uncompressed formats textures are loaded with
+	size_t texelBytes(GLenum format)
+	{
+		switch (format)
+		{
+		case GL_R8: return 1;
+		case GL_RG8: return 2;
+		case GL_RGB8: return 3;
+		default: return 4;
+		}
+	}
+}
+
+MaterialBatch::~MaterialBatch()
+{
+	releaseArrays();
+}
+
+unsigned int MaterialBatch::AddMesh(const Mesh &mesh)
+{
+	if (!mesh.IsInterleaved())
+	{
+		std::cout << "WARNING::MATERIAL_BATCH::MESH_NOT_INTERLEAVED, left out of the batch" << std::endl;
+		return MATERIAL_BATCH_NONE;
+	}
+	BatchMesh added = {};
+	added.vertexBuffer = mesh.VertexBuffer();
+	added.indexBuffer = mesh.IndexBuffer();
+	added.lods = mesh.lods;
+	// The first texture of each slot, the one Mesh::Draw binds to material.texture_<type>1
+	for (unsigned int s = 0; s < BATCH_SLOT_COUNT; s++)
+	{
+		for (const Texture &texture : mesh.textures)
+		{
+			if (texture.type != SLOT_TYPES[s])
+				continue;
+			added.textures[s] = texture.id;
+			if (texture.type == TEXTURE_MASK)
+				added.maskChannels = texture.maskChannels;
+			break;
+		}
+	}
+	added.lodNormalMap = mesh.LODNormalMap();
+	added.lodNormalMapFrom = mesh.LODNormalMapFrom();
+	meshes.push_back(std::move(added));
+	built = false;
+	return (unsigned int)meshes.size() - 1;
+}
+
+void MaterialBatch::Submit(unsigned int mesh, const glm::mat4 &model, unsigned int lod)
+{
+	if (mesh < meshes.size())
+		submitted.push_back({ mesh, lod, model });
+}
+
+void MaterialBatch::Draw(Shader &shader)
+{
+	drawCalls = 0;
+	if (!built)
+		submitted.clear();
+	if (submitted.empty())
+		return;
+
+	// Lay the draws out group after group, so each group's commands are contiguous
+	std::vector<unsigned int> groupStart(groups.size() + 1, 0);
+	std::vector<unsigned int> drawGroups(submitted.size());
+	std::vector<unsigned char> bakedNormals(submitted.size());
+	for (unsigned int i = 0; i < submitted.size(); i++)
+	{
+		// From lodNormalMapFrom on the baked normal map replaces the material's, like in Mesh::Draw
+		const BatchMesh &mesh = meshes[submitted[i].mesh];
+		bakedNormals[i] = mesh.lodNormalMap && submitted[i].lod >= mesh.lodNormalMapFrom;
+		drawGroups[i] = bakedNormals[i] ? mesh.lodGroup : mesh.group;
+		groupStart[drawGroups[i] + 1]++;
+	}
+	for (unsigned int g = 0; g < groups.size(); g++)
+		groupStart[g + 1] += groupStart[g];
+
+	std::vector<DrawElementsIndirectCommand> commands(submitted.size());
+	std::vector<BatchDraw> draws(submitted.size());
+	std::vector<unsigned int> next(groupStart.begin(), groupStart.end() - 1);
+	for (unsigned int i = 0; i < submitted.size(); i++)
+	{
+		const Submitted &draw = submitted[i];
+		const BatchMesh &mesh = meshes[draw.mesh];
+		const MeshLOD &range = mesh.lods[draw.lod < mesh.lods.size() ? draw.lod : mesh.lods.size() - 1];
+		unsigned int slot = next[drawGroups[i]]++;
+		// baseInstance is the draw's own record, read through the instanced attributes
+		commands[slot] = { range.indexCount, 1, mesh.firstIndex + range.indexOffset, mesh.baseVertex, slot };
+		draws[slot].model = draw.model;
+		draws[slot].material[0] = mesh.layers[BATCH_SLOT_DIFFUSE];
+		draws[slot].material[1] = bakedNormals[i] ? mesh.lodNormalLayer : mesh.layers[BATCH_SLOT_NORMAL];
+		draws[slot].material[2] = mesh.layers[BATCH_SLOT_MASK];
+		draws[slot].material[3] = (GLint)mesh.maskChannels;
+	}
+	submitted.clear();
+
+	GpuBufferData(drawBuffer, GL_ARRAY_BUFFER, draws.size() * sizeof(BatchDraw), draws.data(), GL_STREAM_DRAW);
+	GpuBufferData(commandBuffer, GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	for (unsigned int s = 0; s < BATCH_SLOT_COUNT; s++)
+		shader.setInt(SLOT_SAMPLERS[s], s);
+	glBindVertexArray(VAO);
+	for (unsigned int g = 0; g < groups.size(); g++)
+	{
+		GLsizei count = (GLsizei)(groupStart[g + 1] - groupStart[g]);
+		if (count == 0)
+			continue;
+		for (unsigned int s = 0; s < BATCH_SLOT_COUNT; s++)
+		{
+			// Slots the group doesn't have are never sampled, whatever is bound there stays
+			if (groups[g][s] < 0)
+				continue;
+			glActiveTexture(GL_TEXTURE0 + s);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[groups[g][s]].texture);
+		}
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(groupStart[g] * sizeof(DrawElementsIndirectCommand)), count, 0);
+		drawCalls++;
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void MaterialBatch::PrintStats() const
+{
+	unsigned int layers = 0;
+	size_t bytes = 0;
+	for (const LayerArray &array : arrays)
+	{
+		layers += (unsigned int)array.sources.size();
+		bytes += array.texture.Bytes();
+	}
+	std::cout << "MATERIAL_BATCH:: " << meshes.size() << " meshes, " << arrays.size() << " texture arrays (" << layers << " layers, "
+		<< bytes / 1024 << " KB), " << groups.size() << " draw groups" << std::endl;
+}
+
+bool MaterialBatch::Build()
+{
+	// The arrays copy the textures' final levels, not their placeholders nor what TextureResidency left of them:
+	// touching a texture missing levels queues their reload
+	if (TextureStreamer::Shared().PendingCount() > 0)
+		return false;
+	for (const BatchMesh &mesh : meshes)
+	{
+		for (unsigned int s = 0; s < BATCH_SLOT_COUNT; s++)
+			TextureResidency::Shared().Touch(mesh.textures[s]);
+		TextureResidency::Shared().Touch(mesh.lodNormalMap);
+	}
+	if (TextureStreamer::Shared().PendingCount() > 0)
+		return false;
+
+	releaseArrays();
+	groups.clear();
+	for (BatchMesh &mesh : meshes)
+	{
+		int slotArrays[BATCH_SLOT_COUNT];
+		for (unsigned int s = 0; s < BATCH_SLOT_COUNT; s++)
+			slotArrays[s] = placeTexture(mesh.textures[s], (BatchSlot)s, mesh.layers[s]);
+		mesh.group = findGroup(glm::ivec3(slotArrays[0], slotArrays[1], slotArrays[2]));
+		mesh.lodGroup = mesh.group;
+		mesh.lodNormalLayer = -1;
+		if (mesh.lodNormalMap)
+		{
+			int lodArray = placeTexture(mesh.lodNormalMap, BATCH_SLOT_NORMAL, mesh.lodNormalLayer);
+			mesh.lodGroup = findGroup(glm::ivec3(slotArrays[0], lodArray, slotArrays[2]));
+		}
+	}
+	copyTextures();
+	mergeGeometry();
+	built = true;
+	PrintStats();
+	return true;
+}
+
+void MaterialBatch::releaseArrays()
+{
+	for (const LayerArray &array : arrays)
+		TextureResidency::Shared().Forget(array.texture);
+	arrays.clear();
+}
+
+int MaterialBatch::placeTexture(GLuint texture, BatchSlot slot, int &layer)
+{
+	layer = -1;
+	if (!texture)
+		return -1;
+	for (unsigned int a = 0; a < arrays.size(); a++)
+	{
+		for (unsigned int l = 0; l < arrays[a].sources.size(); l++)
+		{
+			if (arrays[a].slot == slot && arrays[a].sources[l] == texture)
+			{
+				layer = (int)l;
+				return (int)a;
+			}
+		}
+	}
+
+	// What the array needs to match, read back from the texture since streamed and cooked ones differ
+	GLint width, height, format, swizzle[4];
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	// Levels past the last one the texture has read back a width of 0
+	int levels = 1;
+	for (GLint levelWidth; levels < 16; levels++)
+	{
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, levels, GL_TEXTURE_WIDTH, &levelWidth);
+		if (levelWidth == 0)
+			break;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	GLenum internalFormat = sizedFormat((GLenum)format);
+
+	for (unsigned int a = 0; a < arrays.size(); a++)
+	{
+		LayerArray &array = arrays[a];
+		if (array.slot == slot && array.internalFormat == internalFormat && array.width == width && array.height == height && array.levels == levels
+			&& std::equal(swizzle, swizzle + 4, array.swizzle))
+		{
+			layer = (int)array.sources.size();
+			array.sources.push_back(texture);
+			return (int)a;
+		}
+	}
+	LayerArray array;
+	array.slot = slot;
+	array.internalFormat = internalFormat;
+	array.width = width;
+	array.height = height;
+	array.levels = levels;
+	std::copy(swizzle, swizzle + 4, array.swizzle);
+	array.sources.push_back(texture);
+	arrays.push_back(std::move(array));
+	layer = 0;
+	return (int)arrays.size() - 1;
+}
+
+unsigned int MaterialBatch::findGroup(const glm::ivec3 &group)
+{
+	for (unsigned int g = 0; g < groups.size(); g++)
+	{
+		if (groups[g] == group)
+			return g;
+	}
+	groups.push_back(group);
+	return (unsigned int)groups.size() - 1;
+}
+
+void MaterialBatch::copyTextures()
+{
+	for (LayerArray &array : arrays)
+	{
+		GLsizei layers = (GLsizei)array.sources.size();
+		array.texture = GpuTexture::Create();
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, array.levels, array.internalFormat, array.width, array.height, layers);
+		glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, array.swizzle);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, array.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		// Every level of every source, copied as it is: compressed blocks stay compressed
+		size_t bytes = 0;
+		int width = array.width, height = array.height;
+		for (int level = 0; level < array.levels; level++)
+		{
+			for (GLsizei layer = 0; layer < layers; layer++)
+				glCopyImageSubData(array.sources[layer], GL_TEXTURE_2D, level, 0, 0, 0, array.texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1);
+
+			GLint compressed = GL_FALSE, compressedBytes = 0;
+			glBindTexture(GL_TEXTURE_2D, array.sources[0]);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+			if (compressed)
+				glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressedBytes);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			bytes += (compressed ? (size_t)compressedBytes : (size_t)width * height * texelBytes(array.internalFormat)) * layers;
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+		array.texture.SetBytes(bytes);
+		TextureResidency::Shared().Pin(array.texture, bytes);
+	}
+}
+
+void MaterialBatch::mergeGeometry()
+{
+	// Sizes come from the meshes' buffers, which may no longer have a CPU copy
+	size_t vertexCount = 0, indexCount = 0;
+	for (BatchMesh &mesh : meshes)
+	{
+		GLint64 vertexBytes, indexBytes;
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh.vertexBuffer);
+		glGetBufferParameteri64v(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &vertexBytes);
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh.indexBuffer);
+		glGetBufferParameteri64v(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &indexBytes);
+		mesh.vertexCount = (size_t)vertexBytes / sizeof(Vertex);
+		mesh.indexCount = (size_t)indexBytes / sizeof(unsigned int);
+		mesh.baseVertex = (unsigned int)vertexCount;
+		mesh.firstIndex = (unsigned int)indexCount;
+		vertexCount += mesh.vertexCount;
+		indexCount += mesh.indexCount;
+	}
+
+	if (!VAO)
+	{
+		VAO = GpuVertexArray::Create();
+		vertexBuffer = GpuBuffer::Create(GPU_MEMORY_VERTEX_BUFFERS);
+		indexBuffer = GpuBuffer::Create(GPU_MEMORY_INDEX_BUFFERS);
+		drawBuffer = GpuBuffer::Create(GPU_MEMORY_VERTEX_BUFFERS);
+		commandBuffer = GpuBuffer::Create(GPU_MEMORY_STORAGE_BUFFERS);
+	}
+	GpuBufferData(vertexBuffer, GL_COPY_WRITE_BUFFER, vertexCount * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+	for (const BatchMesh &mesh : meshes)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh.vertexBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, mesh.baseVertex * sizeof(Vertex), mesh.vertexCount * sizeof(Vertex));
+	}
+	GpuBufferData(indexBuffer, GL_COPY_WRITE_BUFFER, indexCount * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+	for (const BatchMesh &mesh : meshes)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh.indexBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, mesh.firstIndex * sizeof(unsigned int), mesh.indexCount * sizeof(unsigned int));
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	// Same vertex layout as Mesh, plus the per-draw record as instanced attributes
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+	glEnableVertexAttribArray(VERTEX_TANGENT_LOCATION);
+	glVertexAttribPointer(VERTEX_TANGENT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+	glBindBuffer(GL_ARRAY_BUFFER, drawBuffer);
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		glEnableVertexAttribArray(3 + i);
+		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(BatchDraw), (void*)(i * sizeof(glm::vec4)));
+		glVertexAttribDivisor(3 + i, 1);
+	}
+	glEnableVertexAttribArray(BATCH_MATERIAL_LOCATION);
+	glVertexAttribIPointer(BATCH_MATERIAL_LOCATION, 4, GL_INT, sizeof(BatchDraw), (void*)offsetof(BatchDraw, material));
+	glVertexAttribDivisor(BATCH_MATERIAL_LOCATION, 1);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
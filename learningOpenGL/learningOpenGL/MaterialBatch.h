@@ -0,0 +1,120 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "GpuResource.h"
+#include "Mesh.h"
+#include "Shader.h"
+
+#include <vector>
+
+// Attribute location of the per-draw material (see BatchDraw), after the tangent at 9
+const unsigned int BATCH_MATERIAL_LOCATION = 10;
+// Returned by MaterialBatch::AddMesh for meshes it can't merge
+const unsigned int MATERIAL_BATCH_NONE = ~0u;
+
+// Material slots the batch keeps in texture arrays, sampled by shaders/model_batched.frag
+enum BatchSlot
+{
+	BATCH_SLOT_DIFFUSE,
+	BATCH_SLOT_NORMAL,
+	BATCH_SLOT_MASK,
+	BATCH_SLOT_COUNT
+};
+
+// Draws the meshes of any number of models with one glMultiDrawElementsIndirect, without a texture bind between them.
+// Their vertices and indices are copied into one vertex and one index buffer, and the first diffuse, normal and mask
+// texture of each mesh into a layer of a GL_TEXTURE_2D_ARRAY shared by every texture of the same size, format and
+// number of mips. Each draw reads its transform and its layers as instanced attributes, from the record its
+// command's baseInstance points at.
+// Meshes whose textures fall into different arrays can't share a draw: they are grouped by the arrays they use,
+// and each group is one multi-draw after binding its arrays. Models whose textures all have the same size (and
+// are all cooked, or all not) are a single group.
+// Everything is copied on the GPU (glCopyBufferSubData, glCopyImageSubData) by Build, once the textures finished
+// streaming. The arrays are copies: the textures stay in the TextureCache for the meshes' own draws, and the models
+// must outlive the batch. The arrays are pinned in TextureResidency, so while only the batch draws the meshes their
+// own textures go cold and give their finest levels back instead of staying resident twice.
+class MaterialBatch
+{
+public:
+	MaterialBatch() {}
+	~MaterialBatch();
+	MaterialBatch(const MaterialBatch&) = delete;
+	MaterialBatch &operator=(const MaterialBatch&) = delete;
+
+	/// Registers a mesh, merged into the batch at the next Build
+	/// @return index of the mesh in the batch, MATERIAL_BATCH_NONE if it isn't made of interleaved Vertex records
+	unsigned int AddMesh(const Mesh &mesh);
+	/// Merges the meshes added so far into the arrays and buffers. Call it at load once TextureStreamer::PendingCount()
+	/// is 0, the arrays copy the textures' final levels.
+	/// @return false if a texture was still streaming or had levels to reload, try again on a later frame
+	bool Build();
+	bool IsBuilt() const { return built; }
+	/// Queues a draw of a mesh for the next Draw, meshes AddMesh left out are ignored
+	/// @param model world matrix of the mesh
+	void Submit(unsigned int mesh, const glm::mat4 &model, unsigned int lod = 0);
+	/// Draws everything submitted since the last call, one multi-draw per group of meshes sharing their arrays.
+	/// The shader (shaders/model_batched.vert and .frag) must be in use with its view, projection and lights set.
+	/// Draws nothing until the batch is built.
+	void Draw(Shader &shader);
+
+	unsigned int MeshCount() const { return (unsigned int)meshes.size(); }
+	/// Multi-draws issued by the last Draw
+	unsigned int DrawCalls() const { return drawCalls; }
+	void PrintStats() const;
+
+private:
+	struct BatchMesh
+	{
+		GLuint vertexBuffer, indexBuffer;	// the mesh's own buffers, copied at build
+		size_t vertexCount, indexCount;
+		unsigned int baseVertex, firstIndex;	// where the copies start in the merged buffers
+		std::vector<MeshLOD> lods;
+		GLuint textures[BATCH_SLOT_COUNT];	// 0 for the slots the material doesn't have
+		unsigned int maskChannels;
+		GLuint lodNormalMap;				// baked normal map drawn from lodNormalMapFrom on, 0 without
+		unsigned int lodNormalMapFrom;
+		int layers[BATCH_SLOT_COUNT], lodNormalLayer;
+		unsigned int group, lodGroup;		// group drawn with the material's normal map and with the baked one
+	};
+	// Same size, format, mips and swizzle, which is what glCopyImageSubData and sampling through one array need
+	struct LayerArray
+	{
+		GpuTexture texture;
+		BatchSlot slot;
+		GLenum internalFormat;
+		int width, height, levels;
+		GLint swizzle[4];
+		std::vector<GLuint> sources;	// texture copied into each layer
+	};
+	struct Submitted
+	{
+		unsigned int mesh;
+		unsigned int lod;
+		glm::mat4 model;
+	};
+	// What a draw reads at its baseInstance: its transform, then the diffuse, normal and mask layers (-1 for none)
+	// and the channels packed in the mask
+	struct BatchDraw
+	{
+		glm::mat4 model;
+		GLint material[4];
+	};
+
+	std::vector<BatchMesh> meshes;
+	std::vector<LayerArray> arrays;
+	std::vector<glm::ivec3> groups;	// array of each slot, -1 for none
+	std::vector<Submitted> submitted;
+	bool built = false;
+	unsigned int drawCalls = 0;
+
+	GpuVertexArray VAO;
+	GpuBuffer vertexBuffer, indexBuffer, drawBuffer, commandBuffer;
+
+	void releaseArrays();
+	int placeTexture(GLuint texture, BatchSlot slot, int &layer);
+	unsigned int findGroup(const glm::ivec3 &group);
+	void copyTextures();
+	void mergeGeometry();
+};
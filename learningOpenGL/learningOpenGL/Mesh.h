@@ -5,13 +5,17 @@
 #include <glm/glm.hpp>
 
 #include "Shader.h"
+#include "GpuResource.h"
+#include "MeshResidency.h"
+#include "TexturePacker.h"
+#include "TextureResidency.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <vector>
-#include <assimp/types.h>
+#include <cstring>
 
 using namespace std;
 struct Vertex
@@ -19,13 +23,101 @@ struct Vertex
 	glm::vec3 Position;
 	glm::vec3 Normal;
 	glm::vec2 TexCoords;
+	glm::vec4 Tangent;	// xyz along increasing u, w the sign of the bitangent: B = w * cross(Normal, Tangent.xyz)
 };
 
+// Up to 4 bone influences of a skinned vertex, kept in a separate vertex stream so static meshes don't pay for it
+const unsigned int MAX_BONE_INFLUENCES = 4;
+struct SkinVertex
+{
+	unsigned char Joints[MAX_BONE_INFLUENCES];	// indices in the model's skeleton
+	unsigned char Weights[MAX_BONE_INFLUENCES];	// normalized to 0-255, summing to 255
+};
+
+// Material slot of a texture, TEXTURE_TYPE_NAMES gives its sampler's name in the shaders' Material struct
+enum TextureType : unsigned char
+{
+	TEXTURE_DIFFUSE,
+	TEXTURE_SPECULAR,
+	TEXTURE_AMBIENT,
+	TEXTURE_NORMAL,		// tangent space normal map
+	TEXTURE_GLOSS,
+	TEXTURE_OCCLUSION,
+	TEXTURE_HEIGHT,
+	TEXTURE_MASK,		// specular, gloss, occlusion and height maps packed at import (see TexturePacker), which meshes
+						// bind instead of them
+	TEXTURE_TYPE_COUNT
+};
+const char *const TEXTURE_TYPE_NAMES[TEXTURE_TYPE_COUNT] = { "texture_diffuse", "texture_specular", "texture_ambient", "texture_normal",
+	"texture_gloss", "texture_occlusion", "texture_height", "texture_mask" };
+
+/// Type named name (e.g. "texture_diffuse"), false if there is none
+inline bool TextureTypeFromName(const string &name, TextureType &type)
+{
+	for (unsigned int i = 0; i < TEXTURE_TYPE_COUNT; i++)
+	{
+		if (name == TEXTURE_TYPE_NAMES[i])
+		{
+			type = (TextureType)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Small handle copied into every mesh using the texture, the path is only needed when cooking a model
 struct Texture
 {
 	unsigned int id;
-	string type;
-	aiString path;  // we store the path of the texture to compare with other textures
+	TextureType type;
+	unsigned char maskChannels;	// for TEXTURE_MASK, bit i set if MaskChannel i is packed in it
+	unsigned int path;	// id of the path in StringTable::Shared()
+};
+
+// Highest N of the material.texture_<type>N samplers a mesh sets, extra textures of a type share the last one
+const unsigned int MAX_MATERIAL_TEXTURES = 8;
+
+// Level of detail limits used when building LOD chains at import
+const unsigned int MAX_MESH_LODS = 5;
+const unsigned int MIN_LOD_TRIANGLES = 16;
+
+// A range of the mesh's index buffer drawing the mesh at a reduced level of detail
+struct MeshLOD
+{
+	unsigned int indexOffset;	// first index of this LOD in the mesh's index buffer
+	unsigned int indexCount;
+	float error;				// maximum geometric deviation from LOD 0 in model units
+};
+
+// CPU side geometry of a mesh, built on worker threads during import before the Mesh is created on the GL thread
+struct MeshData
+{
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	vector<MeshLOD> lods;
+	glm::vec3 boundsMin, boundsMax;
+	vector<SkinVertex> skin; // empty unless the mesh is skinned
+};
+
+// Vertex attributes living in separate, possibly strided arrays (e.g. the buffer views of a .glb file), uploaded
+// to the GPU as they are instead of being interleaved into Vertex first
+struct VertexStreams
+{
+	size_t vertexCount;
+	const void *positions;		// vec3 of floats
+	const void *normals;		// vec3 of floats
+	const void *texCoords;		// vec2 of floats
+	const void *tangents;		// vec4 of floats, laid out like Vertex::Tangent
+	unsigned int positionStride, normalStride, texCoordStride, tangentStride; // bytes between consecutive elements
+};
+
+// Attribute location of Vertex::Tangent, 3 to 6 are taken by the instance matrix and 7, 8 by the bone influences
+const unsigned int VERTEX_TANGENT_LOCATION = 9;
+
+// Position kept by CPU_COMPACT meshes, quantized to 16 bits per axis within the mesh's bounding box
+struct CompactPosition
+{
+	unsigned short x, y, z;
 };
 
 class Mesh
@@ -35,69 +127,290 @@ public:
 	vector<Vertex> vertices;
 	vector<unsigned int> indices;
 	vector<Texture> textures;
+	vector<MeshLOD> lods; // LOD 0 is the full resolution mesh, each following LOD is coarser
+	glm::vec3 boundsMin, boundsMax;
+	vector<SkinVertex> skin; // bone influences of skinned meshes, kept to bake vertex animation textures
+	vector<CompactPosition> compactPositions; // positions of CPU_COMPACT meshes, which have no vertices
 
 	/* Funcitons */
 	/// Constructor
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	/// @param lods ranges of indices for each LOD, if empty the whole index buffer is LOD 0
+	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, vector<MeshLOD> lods = vector<MeshLOD>())
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->lods = lods;
+		if (this->lods.empty())
+			this->lods.push_back({ 0, (unsigned int)indices.size(), 0.0f });
+
+		// Compute the model space bounding box, used to select the LOD from the camera's distance
+		boundsMin = boundsMax = vertices.empty() ? glm::vec3(0.0f) : vertices[0].Position;
+		for (unsigned int i = 1; i < vertices.size(); i++)
+		{
+			boundsMin = glm::min(boundsMin, vertices[i].Position);
+			boundsMax = glm::max(boundsMax, vertices[i].Position);
+		}
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
 	}
-	void Draw(Shader shader)
+	/// Constructor taking over geometry that was already processed (LODs and bounds included)
+	Mesh(MeshData data, vector<Texture> textures)
+		: vertices(std::move(data.vertices)), indices(std::move(data.indices)), textures(std::move(textures)), lods(std::move(data.lods)),
+		  boundsMin(data.boundsMin), boundsMax(data.boundsMax), skin(std::move(data.skin))
 	{
-		unsigned int diffuseNr = 1;
-		unsigned int specularNr = 1;
-		unsigned int ambientNr = 1;
-		for(unsigned int i = 0; i < textures.size(); i++)
-		{
-			glActiveTexture(GL_TEXTURE0 + i); // Activate proper texture before binding
-			// Retrieve texture number (The N in diffuse_textureN or specular_textureN)
-			stringstream ss;
-			string number;
-			string name = textures[i].type;
-			if (name == "texture_diffuse")
-				ss << diffuseNr++; // Transfer unsigned int to stream
-			else if (name == "texture_specular")
-				ss << specularNr++; // Transfer unsinged int to stream
-			else if (name == "texture_ambient")
-				ss << ambientNr++; // Transfer unsinged int to stream
-			number = ss.str();
+		if (this->lods.empty())
+			this->lods.push_back({ 0, (unsigned int)this->indices.size(), 0.0f });
+		setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+		if (!skin.empty())
+			setupSkin(skin);
+	}
+	/// Constructor uploading straight from memory the mesh doesn't own (e.g. a mapped cooked model)
+	/// @param residency CPU copy of the vertices and indices to keep, none by default
+	Mesh(const Vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount, vector<Texture> textures,
+		vector<MeshLOD> lods, glm::vec3 boundsMin, glm::vec3 boundsMax, MeshResidency residency = MESH_RESIDENCY_GPU_ONLY)
+		: textures(textures), lods(lods), boundsMin(boundsMin), boundsMax(boundsMax)
+	{
+		if (this->lods.empty())
+			this->lods.push_back({ 0, (unsigned int)indexCount, 0.0f });
+		setupMesh(vertices, vertexCount, indices, indexCount);
+		VertexStreams streams = {};
+		streams.vertexCount = vertexCount;
+		if (vertexCount > 0)
+			streams = { vertexCount, &vertices->Position, &vertices->Normal, &vertices->TexCoords, &vertices->Tangent,
+				sizeof(Vertex), sizeof(Vertex), sizeof(Vertex), sizeof(Vertex) };
+		keepGeometry(residency, streams, indices, indexCount);
+	}
+	/// Constructor uploading each attribute stream into its own range of the vertex buffer, without interleaving.
+	/// The mesh only has LOD 0.
+	/// @param residency CPU copy of the vertices and indices to keep, none by default
+	Mesh(const VertexStreams &streams, const unsigned int *indices, size_t indexCount, vector<Texture> textures, glm::vec3 boundsMin, glm::vec3 boundsMax,
+		MeshResidency residency = MESH_RESIDENCY_GPU_ONLY)
+		: textures(textures), boundsMin(boundsMin), boundsMax(boundsMax)
+	{
+		lods.push_back({ 0, (unsigned int)indexCount, 0.0f });
+		setupStreams(streams, indices, indexCount);
+		keepGeometry(residency, streams, indices, indexCount);
+	}
+	bool IsSkinned() const { return skinVBO != 0; }
+	/// Tangent space normal map baked from LOD 0 onto a coarser LOD (see NormalMapBaker), drawn instead of the
+	/// material's normal maps by that LOD and the coarser ones
+	void SetLODNormalMap(GpuTexture texture, unsigned int fromLOD)
+	{
+		lodNormalMap = std::move(texture);
+		lodNormalMapFrom = fromLOD;
+	}
+	GLuint LODNormalMap() const { return lodNormalMap; }
+	unsigned int LODNormalMapFrom() const { return lodNormalMapFrom; }
+	/// Vertex buffer of interleaved Vertex records and index buffer of unsigned ints, read by MaterialBatch to merge
+	/// meshes. Meshes built from VertexStreams aren't interleaved.
+	GLuint VertexBuffer() const { return VBO; }
+	GLuint IndexBuffer() const { return EBO; }
+	bool IsInterleaved() const { return interleaved; }
+	/// Bytes of the vertex, index and skin buffers and of the baked normal map on the GPU
+	size_t GpuBytes() const { return VBO.Bytes() + EBO.Bytes() + skinVBO.Bytes() + lodNormalMap.Bytes(); }
+	/// Bytes of host memory held by the mesh's CPU side data
+	size_t HostBytes() const
+	{
+		return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int) + textures.capacity() * sizeof(Texture)
+			+ lods.capacity() * sizeof(MeshLOD) + skin.capacity() * sizeof(SkinVertex) + compactPositions.capacity() * sizeof(CompactPosition);
+	}
 
-			// Set the material id uniform
-			shader.setInt(("material." + name + number).c_str(), i);
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+	MeshResidency Residency() const { return residency; }
+	/// Drops the CPU copies the policy doesn't keep. The residency can only be lowered, dropped data doesn't come back.
+	void SetResidency(MeshResidency policy)
+	{
+		if (policy >= residency)
+			return;
+		if (policy == MESH_RESIDENCY_CPU_COMPACT)
+			quantizePositions(vertices.empty() ? nullptr : &vertices[0].Position, sizeof(Vertex), vertices.size());
+		else
+		{
+			vector<CompactPosition>().swap(compactPositions);
+			vector<unsigned int>().swap(indices);
 		}
+		vector<Vertex>().swap(vertices);
+		vector<SkinVertex>().swap(skin);
+		residency = policy;
+	}
+	/// Number of vertices whose position is kept on the CPU, 0 for GPU_ONLY meshes
+	size_t CpuVertexCount() const { return residency == MESH_RESIDENCY_CPU_COMPACT ? compactPositions.size() : vertices.size(); }
+	/// Model space position of vertex i, from whichever CPU copy the residency keeps
+	glm::vec3 Position(size_t i) const
+	{
+		if (residency != MESH_RESIDENCY_CPU_COMPACT)
+			return vertices[i].Position;
+		const CompactPosition &q = compactPositions[i];
+		return boundsMin + glm::vec3(q.x, q.y, q.z) * ((boundsMax - boundsMin) / 65535.0f);
+	}
+
+	void Draw(Shader &shader, unsigned int lod = 0)
+	{
+		bindTextures(shader, lod);
 
 		// draw mesh
+		const MeshLOD &range = lods[lod < lods.size() ? lod : lods.size() - 1];
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		glDrawElements(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, (void*)(range.indexOffset * sizeof(unsigned int)));
 		glBindVertexArray(0);
 
 		// Set everything back to defaults
 		glActiveTexture(GL_TEXTURE0);
 	}
+	/// Draws instanceCount instances, the shader reads each instance's data itself by gl_InstanceID
+	void DrawInstanced(Shader &shader, unsigned int instanceCount, unsigned int lod = 0)
+	{
+		bindTextures(shader, lod);
+
+		const MeshLOD &range = lods[lod < lods.size() ? lod : lods.size() - 1];
+		glBindVertexArray(VAO);
+		glDrawElementsInstanced(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, (void*)(range.indexOffset * sizeof(unsigned int)), instanceCount);
+		glBindVertexArray(0);
+
+		glActiveTexture(GL_TEXTURE0);
+	}
+	/// Points the per-instance attribute at locations 3 to 6 at a buffer of mat4 transforms. Kept in the VAO, so it
+	/// only needs to be called when the buffer changes (see Model::DrawInstanced).
+	void AttachInstanceBuffer(GLuint instanceBuffer)
+	{
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		for (unsigned int i = 0; i < 4; i++)
+		{
+			glEnableVertexAttribArray(3 + i);
+			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
+			glVertexAttribDivisor(3 + i, 1);
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		attachedInstanceBuffer = instanceBuffer;
+	}
+	/// Draws the instances left by the GPU culling pass. Every instance is drawn at LOD 0: the cull pass only
+	/// compacts visible instances into one command per mesh and doesn't pick a level.
+	/// @param instanceBuffer buffer of mat4 transforms read as the per-instance attribute, attached again only if it
+	/// isn't the one the VAO already reads
+	/// @param commandOffset byte offset of this mesh's command in the bound GL_DRAW_INDIRECT_BUFFER
+	void DrawIndirect(Shader &shader, GLuint instanceBuffer, GLintptr commandOffset)
+	{
+		if (instanceBuffer != attachedInstanceBuffer)
+			AttachInstanceBuffer(instanceBuffer);
+		bindTextures(shader, 0);
+
+		glBindVertexArray(VAO);
+		glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commandOffset);
+		glBindVertexArray(0);
+
+		glActiveTexture(GL_TEXTURE0);
+	}
 
 private:
 	/* Render Data */
-	unsigned int VAO, VBO, EBO;
+	// Owned, so a Mesh can only be moved and frees its buffers when destroyed
+	GpuVertexArray VAO;
+	GpuBuffer VBO, EBO;
+	GpuBuffer skinVBO;
+	GpuTexture lodNormalMap;
+	unsigned int lodNormalMapFrom = ~0u;
+	GLuint attachedInstanceBuffer = 0;	// read at locations 3 to 6 by DrawIndirect
+	MeshResidency residency = MESH_RESIDENCY_FULL;
+	bool interleaved = true;
 	/* Functions */
-	void setupMesh()
+	void bindTextures(Shader &shader, unsigned int lod)
+	{
+		// From lodNormalMapFrom on the baked normal map replaces the material's, which was made for LOD 0
+		bool bakedNormals = lodNormalMap != 0 && lod >= lodNormalMapFrom;
+		unsigned int numbers[TEXTURE_TYPE_COUNT] = { 0 }; // The N in texture_diffuseN or texture_specularN
+		unsigned int unit = 0, maskChannels = 0;
+		for(unsigned int i = 0; i < textures.size(); i++)
+		{
+			if (bakedNormals && textures[i].type == TEXTURE_NORMAL)
+				continue;
+			glActiveTexture(GL_TEXTURE0 + unit); // Activate proper texture before binding
+			// Set the material id uniform
+			shader.setInt(materialUniform(textures[i].type, numbers[textures[i].type]++), unit);
+			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			TextureResidency::Shared().Touch(textures[i].id);
+			unit++;
+			if (textures[i].type == TEXTURE_MASK)
+				maskChannels = textures[i].maskChannels;
+		}
+		if (bakedNormals)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			shader.setInt(materialUniform(TEXTURE_NORMAL, numbers[TEXTURE_NORMAL]++), unit);
+			glBindTexture(GL_TEXTURE_2D, lodNormalMap);
+		}
+		shader.setBool("material.hasNormalMap", numbers[TEXTURE_NORMAL] > 0);
+
+		// Where the packed maps sit in the mask texture, and the values of the ones it doesn't hold
+		glm::mat4 channelMatrix;
+		glm::vec4 defaults;
+		TexturePacker::MaskChannelMatrix(maskChannels, &channelMatrix[0][0]);
+		TexturePacker::MaskChannelDefaults(maskChannels, &defaults[0]);
+		shader.setBool("material.hasMask", numbers[TEXTURE_MASK] > 0);
+		shader.setMat4("material.maskChannels", channelMatrix);
+		shader.setVec4("material.maskDefaults", defaults);
+	}
+	// "material.texture_diffuseN" and the like, built once rather than for every texture of every draw
+	static const string &materialUniform(TextureType type, unsigned int index)
+	{
+		static const vector<string> names = []
+		{
+			vector<string> all;
+			for (unsigned int t = 0; t < TEXTURE_TYPE_COUNT; t++)
+			{
+				for (unsigned int n = 1; n <= MAX_MATERIAL_TEXTURES; n++)
+					all.push_back(string("material.") + TEXTURE_TYPE_NAMES[t] + to_string(n));
+			}
+			return all;
+		}();
+		return names[type * MAX_MATERIAL_TEXTURES + (index < MAX_MATERIAL_TEXTURES ? index : MAX_MATERIAL_TEXTURES - 1)];
+	}
+	// Copies what the policy keeps of geometry uploaded from memory the mesh doesn't own
+	void keepGeometry(MeshResidency policy, const VertexStreams &streams, const unsigned int *indexData, size_t indexCount)
 	{
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
+		residency = policy;
+		if (policy == MESH_RESIDENCY_GPU_ONLY)
+			return;
+		indices.assign(indexData, indexData + indexCount);
+		if (policy == MESH_RESIDENCY_CPU_COMPACT)
+		{
+			quantizePositions(streams.positions, streams.positionStride, streams.vertexCount);
+			return;
+		}
+		vertices.resize(streams.vertexCount);
+		for (size_t i = 0; i < streams.vertexCount; i++)
+		{
+			memcpy(&vertices[i].Position, (const char*)streams.positions + i * streams.positionStride, sizeof(glm::vec3));
+			memcpy(&vertices[i].Normal, (const char*)streams.normals + i * streams.normalStride, sizeof(glm::vec3));
+			memcpy(&vertices[i].TexCoords, (const char*)streams.texCoords + i * streams.texCoordStride, sizeof(glm::vec2));
+			memcpy(&vertices[i].Tangent, (const char*)streams.tangents + i * streams.tangentStride, sizeof(glm::vec4));
+		}
+	}
+	// Fills compactPositions from vec3 positions stride bytes apart, quantized within the bounds
+	void quantizePositions(const void *positions, unsigned int stride, size_t count)
+	{
+		glm::vec3 scale = 65535.0f / glm::max(boundsMax - boundsMin, glm::vec3(1e-20f));
+		compactPositions.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			glm::vec3 position;
+			memcpy(&position, (const char*)positions + i * stride, sizeof(glm::vec3));
+			glm::vec3 q = glm::min(glm::max((position - boundsMin) * scale + 0.5f, glm::vec3(0.0f)), glm::vec3(65535.0f));
+			compactPositions[i] = { (unsigned short)q.x, (unsigned short)q.y, (unsigned short)q.z };
+		}
+	}
+	void setupMesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount)
+	{
+		VAO = GpuVertexArray::Create();
+		VBO = GpuBuffer::Create(GPU_MEMORY_VERTEX_BUFFERS);
+		EBO = GpuBuffer::Create(GPU_MEMORY_INDEX_BUFFERS);
 
 		glBindVertexArray(VAO);
 		
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		GpuBufferData(VBO, GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
+		GpuBufferData(EBO, GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
 
 		// vertex positions
 		glEnableVertexAttribArray(0);
@@ -108,11 +421,61 @@ private:
 		// vertex tex coords
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+		// vertex tangents, at location 9 after the instance matrix and the bone influences
+		glEnableVertexAttribArray(VERTEX_TANGENT_LOCATION);
+		glVertexAttribPointer(VERTEX_TANGENT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
 		
 		glBindVertexArray(0);
 	}
+	void setupStreams(const VertexStreams &streams, const unsigned int *indexData, size_t indexCount)
+	{
+		// Every stream gets a 4 byte aligned range of one buffer, the strides are kept as they are in the source
+		const void *data[4] = { streams.positions, streams.normals, streams.texCoords, streams.tangents };
+		unsigned int strides[4] = { streams.positionStride, streams.normalStride, streams.texCoordStride, streams.tangentStride };
+		const unsigned int components[4] = { 3, 3, 2, 4 };
+		const unsigned int locations[4] = { 0, 1, 2, VERTEX_TANGENT_LOCATION };
+		size_t offsets[4], sizes[4], total = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			sizes[i] = streams.vertexCount ? strides[i] * (streams.vertexCount - 1) + components[i] * sizeof(float) : 0;
+			offsets[i] = total;
+			total = (total + sizes[i] + 3) & ~(size_t)3;
+		}
+
+		VAO = GpuVertexArray::Create();
+		VBO = GpuBuffer::Create(GPU_MEMORY_VERTEX_BUFFERS);
+		EBO = GpuBuffer::Create(GPU_MEMORY_INDEX_BUFFERS);
+		interleaved = false;
+
+		glBindVertexArray(VAO);
+		GpuBufferData(VBO, GL_ARRAY_BUFFER, total, NULL, GL_STATIC_DRAW);
+		for (unsigned int i = 0; i < 4; i++)
+		{
+			glBufferSubData(GL_ARRAY_BUFFER, offsets[i], sizes[i], data[i]);
+			glEnableVertexAttribArray(locations[i]);
+			glVertexAttribPointer(locations[i], components[i], GL_FLOAT, GL_FALSE, strides[i], (void*)offsets[i]);
+		}
+
+		GpuBufferData(EBO, GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
+
+		glBindVertexArray(0);
+	}
+	// Bone indices and weights go to attribute locations 7 and 8 (3 to 6 are taken by the instance matrix)
+	void setupSkin(const vector<SkinVertex> &skin)
+	{
+		skinVBO = GpuBuffer::Create(GPU_MEMORY_VERTEX_BUFFERS);
+		glBindVertexArray(VAO);
+		GpuBufferData(skinVBO, GL_ARRAY_BUFFER, skin.size() * sizeof(SkinVertex), skin.data(), GL_STATIC_DRAW);
 
-	
+		// bone indices, read as integers
+		glEnableVertexAttribArray(7);
+		glVertexAttribIPointer(7, 4, GL_UNSIGNED_BYTE, sizeof(SkinVertex), (void*)offsetof(SkinVertex, Joints));
+		// bone weights, normalized to [0,1]
+		glEnableVertexAttribArray(8);
+		glVertexAttribPointer(8, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SkinVertex), (void*)offsetof(SkinVertex, Weights));
+
+		glBindVertexArray(0);
+	}
 };
 #endif
 
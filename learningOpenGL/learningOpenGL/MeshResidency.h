@@ -0,0 +1,11 @@
+#pragma once
+
+// What a mesh keeps in host memory once its geometry is on the GPU
+enum MeshResidency
+{
+	MESH_RESIDENCY_GPU_ONLY,	// nothing, the CPU copies are dropped after upload
+	MESH_RESIDENCY_CPU_COMPACT,	// 16 bit quantized positions and the indices, enough for picking and physics
+	MESH_RESIDENCY_FULL,		// every vertex attribute, needed to re-process the mesh (e.g. bake vertex animation)
+	MESH_RESIDENCY_COUNT
+};
+const char *const MESH_RESIDENCY_NAMES[MESH_RESIDENCY_COUNT] = { "gpu-only", "cpu-compact", "full" };
@@ -0,0 +1,368 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+
+namespace
+{
+	// Symmetric 4x4 matrix stored as its upper triangle: a2 ab ac ad b2 bc bd c2 cd d2, and the sum of the weights
+	// of its planes
+	struct Quadric
+	{
+		double m[10] = { 0.0 };
+		double weight = 0.0;
+
+		void addPlane(double a, double b, double c, double d, double planeWeight)
+		{
+			m[0] += planeWeight * a * a; m[1] += planeWeight * a * b; m[2] += planeWeight * a * c; m[3] += planeWeight * a * d;
+			m[4] += planeWeight * b * b; m[5] += planeWeight * b * c; m[6] += planeWeight * b * d;
+			m[7] += planeWeight * c * c; m[8] += planeWeight * c * d;
+			m[9] += planeWeight * d * d;
+			weight += planeWeight;
+		}
+		void add(const Quadric &other)
+		{
+			for (int i = 0; i < 10; i++)
+				m[i] += other.m[i];
+			weight += other.weight;
+		}
+		// Squared distance (weighted by area) of p to all planes accumulated in the quadric
+		double evaluate(const glm::vec3 &p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+				+ m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+				+ m[7] * z * z + 2 * m[8] * z
+				+ m[9];
+		}
+		// Distance of p to the planes, averaged by area. Unlike evaluate, which grows with the area, this is in
+		// model units whatever the size of the triangles.
+		double distance(const glm::vec3 &p) const
+		{
+			return weight > 0.0 ? std::sqrt(std::max(evaluate(p), 0.0) / weight) : 0.0;
+		}
+	};
+
+	struct Collapse
+	{
+		double cost;
+		unsigned int from, to;	// points
+		unsigned int fromVersion, toVersion;
+		bool operator>(const Collapse &other) const { return cost > other.cost; }
+	};
+
+	struct PositionHash
+	{
+		size_t operator()(const glm::vec3 &p) const
+		{
+			uint32_t bits[3];
+			std::memcpy(bits, &p, sizeof(bits));
+			return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+		}
+	};
+
+	// Keeps the collapse state alive between LOD levels so each level continues from the previous one.
+	// Collapses work on points, the distinct positions of the mesh: the vertices of a UV or normal seam share a point
+	// and move together, each onto the vertex of the target point it shares a triangle with, so seams stay split
+	// without being treated as holes.
+	class Simplifier
+	{
+	public:
+		Simplifier(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices)
+			: pointOf(vertices.size()), vertexTris(vertices.size()), tris(indices), triAlive(indices.size() / 3, true),
+			  aliveTris((unsigned int)(indices.size() / 3))
+		{
+			std::unordered_map<glm::vec3, unsigned int, PositionHash> points;
+			points.reserve(vertices.size());
+			for (size_t i = 0; i < vertices.size(); i++)
+			{
+				auto inserted = points.emplace(vertices[i].Position, (unsigned int)pointPositions.size());
+				if (inserted.second)
+				{
+					pointPositions.push_back(vertices[i].Position);
+					pointVertices.emplace_back();
+				}
+				pointOf[i] = inserted.first->second;
+				pointVertices[pointOf[i]].push_back((unsigned int)i);
+			}
+			quadrics.resize(pointPositions.size());
+			version.assign(pointPositions.size(), 0);
+			collapsed.assign(pointPositions.size(), false);
+			locked.assign(pointPositions.size(), false);
+
+			// Accumulate the area weighted plane of every triangle into its three corners
+			std::unordered_map<unsigned long long, unsigned int> edgeUse;
+			edgeUse.reserve(indices.size());
+			for (unsigned int t = 0; t < triAlive.size(); t++)
+			{
+				const unsigned int *tri = &tris[t * 3];
+				unsigned int p[3] = { pointOf[tri[0]], pointOf[tri[1]], pointOf[tri[2]] };
+				if (p[0] == p[1] || p[1] == p[2] || p[2] == p[0])
+				{
+					// Two corners on the same point, the triangle has no area and collapses can't handle it
+					triAlive[t] = false;
+					aliveTris--;
+					continue;
+				}
+				glm::vec3 n = glm::cross(pointPositions[p[1]] - pointPositions[p[0]], pointPositions[p[2]] - pointPositions[p[0]]);
+				float doubleArea = glm::length(n);
+				if (doubleArea > 0.0f)
+					n /= doubleArea;
+				double d = -glm::dot(n, pointPositions[p[0]]);
+				for (int c = 0; c < 3; c++)
+				{
+					quadrics[p[c]].addPlane(n.x, n.y, n.z, d, 0.5 * doubleArea);
+					vertexTris[tri[c]].push_back(t);
+					edgeUse[edgeKey(p[c], p[(c + 1) % 3])]++;
+				}
+			}
+
+			// Points on open edges (mesh borders, and the border of a cluster group) are locked so LODs don't tear or
+			// pull away from neighbouring surfaces. So are non-manifold edges, shared by more than two triangles.
+			for (auto &edge : edgeUse)
+			{
+				if (edge.second != 2)
+				{
+					locked[(unsigned int)(edge.first >> 32)] = true;
+					locked[(unsigned int)(edge.first & 0xFFFFFFFFu)] = true;
+				}
+			}
+
+			for (unsigned int t = 0; t < triAlive.size(); t++)
+			{
+				if (!triAlive[t])
+					continue;
+				for (int c = 0; c < 3; c++)
+				{
+					unsigned int a = pointOf[tris[t * 3 + c]], b = pointOf[tris[t * 3 + (c + 1) % 3]];
+					pushCollapse(a, b);
+					pushCollapse(b, a);
+				}
+			}
+		}
+
+		// Collapses edges until at most targetTris triangles remain. Returns false if no collapse was possible.
+		bool simplify(unsigned int targetTris)
+		{
+			unsigned int startTris = aliveTris;
+			std::vector<std::pair<unsigned int, unsigned int>> moves;
+			while (aliveTris > targetTris && !heap.empty())
+			{
+				Collapse c = heap.top();
+				heap.pop();
+				if (collapsed[c.from] || collapsed[c.to] || version[c.from] != c.fromVersion || version[c.to] != c.toVersion)
+					continue; // stale entry
+				if (!matchVertices(c.from, c.to, moves) || flipsTriangle(c.to, moves))
+					continue;
+				// The area weighted cost orders the collapses, the error reported is a distance
+				Quadric q = quadrics[c.from];
+				q.add(quadrics[c.to]);
+				maxError = std::max(maxError, q.distance(pointPositions[c.to]));
+				collapse(c.from, c.to, moves);
+			}
+			return aliveTris < startTris;
+		}
+
+		unsigned int triangleCount() const { return aliveTris; }
+		// Largest geometric deviation (in model units) introduced so far
+		float error() const { return (float)maxError; }
+
+		void appendIndices(std::vector<unsigned int> &out) const
+		{
+			for (size_t t = 0; t < triAlive.size(); t++)
+			{
+				if (!triAlive[t])
+					continue;
+				out.insert(out.end(), tris.begin() + t * 3, tris.begin() + t * 3 + 3);
+			}
+		}
+
+	private:
+		std::vector<unsigned int> pointOf;						// point of every vertex
+		std::vector<glm::vec3> pointPositions;
+		std::vector<std::vector<unsigned int>> pointVertices;	// vertices of every point, more than one along seams
+		std::vector<Quadric> quadrics;							// of every point
+		std::vector<std::vector<unsigned int>> vertexTris;
+		std::vector<unsigned int> version;
+		std::vector<bool> collapsed;
+		std::vector<bool> locked;
+		std::vector<unsigned int> tris;
+		std::vector<bool> triAlive;
+		unsigned int aliveTris;
+		double maxError = 0.0;
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+
+		static unsigned long long edgeKey(unsigned int a, unsigned int b)
+		{
+			if (a > b)
+				std::swap(a, b);
+			return ((unsigned long long)a << 32) | b;
+		}
+
+		void pushCollapse(unsigned int from, unsigned int to)
+		{
+			if (locked[from] || from == to)
+				return;
+			Quadric q = quadrics[from];
+			q.add(quadrics[to]);
+			heap.push({ q.evaluate(pointPositions[to]), from, to, version[from], version[to] });
+		}
+
+		bool hasPoint(const unsigned int *tri, unsigned int point) const
+		{
+			return pointOf[tri[0]] == point || pointOf[tri[1]] == point || pointOf[tri[2]] == point;
+		}
+
+		// Pairs every vertex of 'from' still in use with a vertex of 'to' it shares a triangle with. Fails if one has
+		// none, e.g. a seam vertex when the edge runs across the seam instead of along it: moving it would tear the seam.
+		bool matchVertices(unsigned int from, unsigned int to, std::vector<std::pair<unsigned int, unsigned int>> &moves) const
+		{
+			moves.clear();
+			for (unsigned int v : pointVertices[from])
+			{
+				unsigned int target = ~0u;
+				bool used = false;
+				for (unsigned int t : vertexTris[v])
+				{
+					if (!triAlive[t])
+						continue;
+					used = true;
+					const unsigned int *tri = &tris[t * 3];
+					for (int c = 0; c < 3 && target == ~0u; c++)
+					{
+						if (pointOf[tri[c]] == to)
+							target = tri[c];
+					}
+					if (target != ~0u)
+						break;
+				}
+				if (!used)
+					continue;
+				if (target == ~0u)
+					return false;
+				moves.push_back({ v, target });
+			}
+			return !moves.empty();
+		}
+
+		// Rejects collapses that would turn any of the surviving triangles around the moved vertices upside down
+		bool flipsTriangle(unsigned int to, const std::vector<std::pair<unsigned int, unsigned int>> &moves) const
+		{
+			for (const auto &move : moves)
+			{
+				for (unsigned int t : vertexTris[move.first])
+				{
+					if (!triAlive[t])
+						continue;
+					const unsigned int *tri = &tris[t * 3];
+					if (hasPoint(tri, to))
+						continue; // this one becomes degenerate and is removed
+					glm::vec3 p[3], q[3];
+					for (int c = 0; c < 3; c++)
+					{
+						p[c] = pointPositions[pointOf[tri[c]]];
+						q[c] = tri[c] == move.first ? pointPositions[to] : p[c];
+					}
+					glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+					glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+					if (glm::dot(before, after) <= 0.0f)
+						return true;
+				}
+			}
+			return false;
+		}
+
+		void collapse(unsigned int from, unsigned int to, const std::vector<std::pair<unsigned int, unsigned int>> &moves)
+		{
+			for (const auto &move : moves)
+			{
+				for (unsigned int t : vertexTris[move.first])
+				{
+					if (!triAlive[t])
+						continue;
+					unsigned int *tri = &tris[t * 3];
+					if (hasPoint(tri, to))
+					{
+						triAlive[t] = false;
+						aliveTris--;
+						continue;
+					}
+					for (int c = 0; c < 3; c++)
+					{
+						if (tri[c] == move.first)
+							tri[c] = move.second;
+					}
+					vertexTris[move.second].push_back(t);
+				}
+				vertexTris[move.first].clear();
+			}
+			collapsed[from] = true;
+			quadrics[to].add(quadrics[from]);
+			version[to]++;
+
+			// The quadric of 'to' changed, so re-evaluate every edge leaving or entering it
+			for (unsigned int v : pointVertices[to])
+			{
+				for (unsigned int t : vertexTris[v])
+				{
+					if (!triAlive[t])
+						continue;
+					for (int c = 0; c < 3; c++)
+					{
+						unsigned int n = pointOf[tris[t * 3 + c]];
+						if (n == to)
+							continue;
+						pushCollapse(to, n);
+						pushCollapse(n, to);
+					}
+				}
+			}
+		}
+	};
+}
+
+std::vector<MeshLOD> MeshSimplifier::BuildLODChain(const std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
+	unsigned int maxLODs, float reductionRatio)
+{
+	std::vector<MeshLOD> lods;
+	lods.push_back({ 0, (unsigned int)indices.size(), 0.0f });
+	if (indices.size() < 3 || maxLODs == 0)
+		return lods;
+
+	Simplifier simplifier(vertices, std::vector<unsigned int>(indices));
+	for (unsigned int level = 0; level < maxLODs; level++)
+	{
+		unsigned int previousTris = simplifier.triangleCount();
+		unsigned int targetTris = (unsigned int)(previousTris * reductionRatio);
+		if (targetTris < MIN_LOD_TRIANGLES)
+			break;
+		simplifier.simplify(targetTris);
+
+		// Stop the chain once collapses are blocked (e.g. by locked seams) and a level would barely differ
+		if (simplifier.triangleCount() > previousTris * 0.9f)
+			break;
+
+		MeshLOD lod;
+		lod.indexOffset = (unsigned int)indices.size();
+		simplifier.appendIndices(indices);
+		lod.indexCount = (unsigned int)indices.size() - lod.indexOffset;
+		lod.error = simplifier.error();
+		lods.push_back(lod);
+	}
+	return lods;
+}
+
+float MeshSimplifier::Simplify(const std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, unsigned int targetTriangles)
+{
+	if (indices.size() < 3)
+		return 0.0f;
+	Simplifier simplifier(vertices, indices);
+	simplifier.simplify(targetTriangles);
+	indices.clear();
+	simplifier.appendIndices(indices);
+	return simplifier.error();
+}
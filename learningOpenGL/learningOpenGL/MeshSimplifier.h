@@ -0,0 +1,20 @@
+#pragma once
+#include "Mesh.h"
+
+#include <vector>
+
+// Builds LOD chains for a Mesh using quadric error metric (Garland-Heckbert) half-edge collapses.
+// Collapsed vertices always land on an existing vertex, so every LOD can share the vertex buffer of LOD 0
+// and only needs its own range of indices. Adjacency comes from positions, not vertex indices: the split vertices
+// of UV and normal seams move together along the seam, only edges open in space lock their vertices.
+class MeshSimplifier
+{
+public:
+	// Appends the index lists of up to maxLODs simplified levels to the end of indices and returns the LOD table
+	// (LOD 0 being the original indices). Each level targets reductionRatio of the previous level's triangles.
+	static std::vector<MeshLOD> BuildLODChain(const std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
+		unsigned int maxLODs = MAX_MESH_LODS - 1, float reductionRatio = 0.5f);
+	// Simplifies indices in place down to at most targetTriangles (fewer collapses happen if open edges block them)
+	// and returns the largest geometric deviation introduced. Vertices on edges open in space never move.
+	static float Simplify(const std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, unsigned int targetTriangles);
+};
@@ -0,0 +1,344 @@
+#include "MipGenerator.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MIP_GENERATOR_SSE2
+#endif
+
+namespace
+{
+	const double PI = 3.14159265358979323846;
+	// Rows of a level filtered by one job of the worker pool
+	const unsigned int ROWS_PER_JOB = 16;
+	// Reach of every filter each side, in pixels of the smaller level
+	const float FILTER_RADII[MIP_FILTER_COUNT] = { 0.5f, 3.0f, 3.0f };
+	const double KAISER_ALPHA = 4.0;
+
+	// A level being filtered, RGBA floats whatever the number of components
+	struct FloatImage
+	{
+		std::vector<float> pixels;
+		unsigned int width, height;
+	};
+
+	// Pixels of the larger level contributing to every pixel of the smaller one along an axis, and their weights.
+	// Every pixel has the same number of taps, unused ones weigh 0.
+	struct FilterTaps
+	{
+		unsigned int count;
+		std::vector<unsigned int> sources;
+		std::vector<float> weights;
+	};
+
+	double sinc(double x)
+	{
+		if (std::abs(x) < 1e-6)
+			return 1.0;
+		return std::sin(PI * x) / (PI * x);
+	}
+
+	// Modified Bessel function of the first kind, order 0, from its series
+	double besselI0(double x)
+	{
+		double sum = 1.0, term = 1.0, quarter = x * x / 4.0;
+		for (int k = 1; term > sum * 1e-12; k++)
+		{
+			term *= quarter / ((double)k * k);
+			sum += term;
+		}
+		return sum;
+	}
+
+	// Weight of a pixel t pixels of the smaller level away from the center of the one being filtered
+	double filterWeight(MipFilter filter, double t)
+	{
+		double radius = FILTER_RADII[filter];
+		if (std::abs(t) >= radius)
+			return 0.0;
+		if (filter == MIP_FILTER_LANCZOS)
+			return sinc(t) * sinc(t / radius);
+		double window = t / radius;
+		return sinc(t) * besselI0(KAISER_ALPHA * std::sqrt(1.0 - window * window)) / besselI0(KAISER_ALPHA);
+	}
+
+	FilterTaps computeTaps(MipFilter filter, unsigned int sourceSize, unsigned int size, bool wrap)
+	{
+		double scale = (double)sourceSize / size;
+		double reach = FILTER_RADII[filter] * scale;
+		FilterTaps taps;
+		taps.count = (unsigned int)std::ceil(2.0 * reach) + 2;
+		taps.sources.assign((size_t)size * taps.count, 0);
+		taps.weights.assign((size_t)size * taps.count, 0.0f);
+		std::vector<double> weights(taps.count);
+		for (unsigned int x = 0; x < size; x++)
+		{
+			double center = (x + 0.5) * scale;
+			int first = (int)std::floor(center - reach);
+			double sum = 0.0;
+			for (unsigned int k = 0; k < taps.count; k++)
+			{
+				int source = first + (int)k;
+				if (filter == MIP_FILTER_BOX)
+				{
+					// Exactly the area of the pixel the box covers
+					double low = std::max((double)source, center - reach), high = std::min(source + 1.0, center + reach);
+					weights[k] = std::max(0.0, high - low);
+				}
+				else
+					weights[k] = filterWeight(filter, (source + 0.5 - center) / scale);
+				sum += weights[k];
+
+				int last = (int)sourceSize;
+				if (wrap)
+					source = (source % last + last) % last;
+				else
+					source = std::min(std::max(source, 0), last - 1);
+				taps.sources[(size_t)x * taps.count + k] = (unsigned int)source;
+			}
+			for (unsigned int k = 0; k < taps.count; k++)
+				taps.weights[(size_t)x * taps.count + k] = (float)(weights[k] / sum);
+		}
+		return taps;
+	}
+
+	// sum += weight * pixel, four channels at once
+	inline void accumulate(float *sum, const float *pixel, float weight)
+	{
+#ifdef MIP_GENERATOR_SSE2
+		_mm_storeu_ps(sum, _mm_add_ps(_mm_loadu_ps(sum), _mm_mul_ps(_mm_loadu_ps(pixel), _mm_set1_ps(weight))));
+#else
+		for (int c = 0; c < 4; c++)
+			sum[c] += pixel[c] * weight;
+#endif
+	}
+
+	// Same for a whole row
+	void accumulateRow(float *sum, const float *row, float weight, unsigned int width)
+	{
+		unsigned int i = 0;
+#ifdef MIP_GENERATOR_SSE2
+		__m128 w = _mm_set1_ps(weight);
+		for (; i + 4 <= width * 4; i += 4)
+			_mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i), _mm_mul_ps(_mm_loadu_ps(row + i), w)));
+#endif
+		for (; i < width * 4; i++)
+			sum[i] += row[i] * weight;
+	}
+
+	const float *srgbToLinearTable()
+	{
+		static const std::vector<float> table = []
+		{
+			std::vector<float> values(256);
+			for (int i = 0; i < 256; i++)
+			{
+				double v = i / 255.0;
+				values[i] = (float)(v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4));
+			}
+			return values;
+		}();
+		return table.data();
+	}
+
+	const float *unormTable()
+	{
+		static const std::vector<float> table = []
+		{
+			std::vector<float> values(256);
+			for (int i = 0; i < 256; i++)
+				values[i] = i / 255.0f;
+			return values;
+		}();
+		return table.data();
+	}
+
+	// The linear value halfway between every two consecutive sRGB values, encoding is a search in it so the
+	// result is exactly the closest 8 bit value
+	const std::vector<float> &srgbThresholds()
+	{
+		static const std::vector<float> thresholds = []
+		{
+			std::vector<float> values(255);
+			for (int i = 0; i < 255; i++)
+			{
+				double v = (i + 0.5) / 255.0;
+				values[i] = (float)(v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4));
+			}
+			return values;
+		}();
+		return thresholds;
+	}
+
+	uint8_t encodeUnorm(float value)
+	{
+		return (uint8_t)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+
+	uint8_t encodeSrgb(float value)
+	{
+		const std::vector<float> &thresholds = srgbThresholds();
+		return (uint8_t)(std::upper_bound(thresholds.begin(), thresholds.end(), value) - thresholds.begin());
+	}
+
+	// Fraction of the pixels whose alpha, scaled, passes the test
+	float alphaCoverage(const FloatImage &image, unsigned int alpha, float scale, float cutoff)
+	{
+		size_t passing = 0, count = (size_t)image.width * image.height;
+		for (size_t i = 0; i < count; i++)
+			passing += image.pixels[i * 4 + alpha] * scale >= cutoff;
+		return (float)passing / count;
+	}
+}
+
+unsigned int MipGenerator::LevelCount(unsigned int width, unsigned int height)
+{
+	unsigned int levels = 1;
+	for (unsigned int size = std::max(width, height); size > 1; size /= 2)
+		levels++;
+	return levels;
+}
+
+std::vector<std::vector<uint8_t>> MipGenerator::Build(const uint8_t *pixels, unsigned int width, unsigned int height,
+	unsigned int components, const MipSettings &settings)
+{
+	std::vector<std::vector<uint8_t>> mips;
+	unsigned int levels = LevelCount(width, height);
+	if (levels < 2 || components < 1 || components > 4)
+		return mips;
+
+	// Every channel but alpha is color, decoded to linear light if it's sRGB
+	unsigned int alpha = components == 4 ? 3 : components == 2 ? 1 : 4;
+	const float *decode[4];
+	for (unsigned int c = 0; c < 4; c++)
+		decode[c] = settings.srgb && c != alpha ? srgbToLinearTable() : unormTable();
+	bool normalMap = settings.normalMap && components >= 3;
+	bool alphaTest = settings.alphaCutoff > 0.0f && alpha < 4;
+
+	float targetCoverage = 0.0f;
+	if (alphaTest)
+	{
+		size_t passing = 0;
+		for (size_t i = 0; i < (size_t)width * height; i++)
+			passing += pixels[i * components + alpha] / 255.0f >= settings.alphaCutoff;
+		targetCoverage = (float)passing / ((size_t)width * height);
+	}
+
+	FloatImage source, level;
+	source.width = width;
+	source.height = height;
+	for (unsigned int index = 1; index < levels; index++)
+	{
+		level.width = std::max(1u, source.width / 2);
+		level.height = std::max(1u, source.height / 2);
+		FilterTaps columns = computeTaps(settings.filter, source.width, level.width, settings.wrap);
+		FilterTaps rows = computeTaps(settings.filter, source.height, level.height, settings.wrap);
+
+		// Rows first: every row of the larger level shrunk to the new width
+		FloatImage narrow;
+		narrow.width = level.width;
+		narrow.height = source.height;
+		narrow.pixels.assign((size_t)narrow.width * narrow.height * 4, 0.0f);
+		ThreadPool::Shared().ParallelFor((source.height + ROWS_PER_JOB - 1) / ROWS_PER_JOB, [&](unsigned int job)
+		{
+			std::vector<float> decoded(index == 1 ? (size_t)source.width * 4 : 0);
+			unsigned int end = std::min(source.height, (job + 1) * ROWS_PER_JOB);
+			for (unsigned int y = job * ROWS_PER_JOB; y < end; y++)
+			{
+				// The full resolution level is read straight from the 8 bit pixels
+				const float *row;
+				if (index == 1)
+				{
+					const uint8_t *bytes = &pixels[(size_t)y * width * components];
+					for (unsigned int x = 0; x < width; x++)
+					{
+						for (unsigned int c = 0; c < 4; c++)
+							decoded[(size_t)x * 4 + c] = c < components ? decode[c][bytes[x * components + c]] : 0.0f;
+					}
+					row = decoded.data();
+				}
+				else
+					row = &source.pixels[(size_t)y * source.width * 4];
+
+				float *out = &narrow.pixels[(size_t)y * narrow.width * 4];
+				for (unsigned int x = 0; x < narrow.width; x++)
+				{
+					const unsigned int *sources = &columns.sources[(size_t)x * columns.count];
+					const float *weights = &columns.weights[(size_t)x * columns.count];
+					for (unsigned int k = 0; k < columns.count; k++)
+						accumulate(&out[x * 4], &row[(size_t)sources[k] * 4], weights[k]);
+				}
+			}
+		});
+
+		// Then columns, whole rows at a time
+		level.pixels.assign((size_t)level.width * level.height * 4, 0.0f);
+		ThreadPool::Shared().ParallelFor((level.height + ROWS_PER_JOB - 1) / ROWS_PER_JOB, [&](unsigned int job)
+		{
+			unsigned int end = std::min(level.height, (job + 1) * ROWS_PER_JOB);
+			for (unsigned int y = job * ROWS_PER_JOB; y < end; y++)
+			{
+				float *out = &level.pixels[(size_t)y * level.width * 4];
+				for (unsigned int k = 0; k < rows.count; k++)
+				{
+					float weight = rows.weights[(size_t)y * rows.count + k];
+					if (weight != 0.0f)
+						accumulateRow(out, &narrow.pixels[(size_t)rows.sources[(size_t)y * rows.count + k] * narrow.width * 4], weight, level.width);
+				}
+			}
+		});
+
+		// Smallest scale of alpha keeping the coverage, found by bisection since coverage only grows with it. The
+		// next level is filtered from the unscaled alpha.
+		float alphaScale = 1.0f;
+		if (alphaTest)
+		{
+			float low = 0.0f, high = 4.0f;
+			for (int step = 0; step < 16; step++)
+			{
+				float middle = (low + high) * 0.5f;
+				if (alphaCoverage(level, alpha, middle, settings.alphaCutoff) < targetCoverage)
+					low = middle;
+				else
+					high = middle;
+			}
+			alphaScale = high;
+		}
+
+		std::vector<uint8_t> bytes((size_t)level.width * level.height * components);
+		ThreadPool::Shared().ParallelFor((level.height + ROWS_PER_JOB - 1) / ROWS_PER_JOB, [&](unsigned int job)
+		{
+			size_t first = (size_t)job * ROWS_PER_JOB * level.width;
+			size_t last = (size_t)std::min(level.height, (job + 1) * ROWS_PER_JOB) * level.width;
+			for (size_t i = first; i < last; i++)
+			{
+				float pixel[4] = { level.pixels[i * 4], level.pixels[i * 4 + 1], level.pixels[i * 4 + 2], level.pixels[i * 4 + 3] };
+				if (normalMap)
+				{
+					float n[3] = { pixel[0] * 2.0f - 1.0f, pixel[1] * 2.0f - 1.0f, pixel[2] * 2.0f - 1.0f };
+					float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+					if (length > 1e-6f)
+					{
+						for (int c = 0; c < 3; c++)
+							pixel[c] = n[c] / length * 0.5f + 0.5f;
+					}
+					else
+					{
+						pixel[0] = pixel[1] = 0.5f; // no average direction left, points straight out
+						pixel[2] = 1.0f;
+					}
+				}
+				if (alpha < 4)
+					pixel[alpha] *= alphaScale;
+				for (unsigned int c = 0; c < components; c++)
+					bytes[i * components + c] = settings.srgb && c != alpha ? encodeSrgb(pixel[c]) : encodeUnorm(pixel[c]);
+			}
+		});
+		mips.push_back(std::move(bytes));
+		std::swap(source, level);
+	}
+	return mips;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Filters shrinking one level of a mip chain into the next, from the blurriest to the sharpest
+enum MipFilter
+{
+	MIP_FILTER_BOX,		// average of the pixels each one covers, what glGenerateMipmap does
+	MIP_FILTER_KAISER,	// Kaiser windowed sinc, 3 pixels of the smaller level each side: sharp with little ringing
+	MIP_FILTER_LANCZOS,	// Lanczos 3, sharper still but rings a bit more around hard edges
+	MIP_FILTER_COUNT
+};
+const char *const MIP_FILTER_NAMES[MIP_FILTER_COUNT] = { "box", "kaiser", "lanczos" };
+
+struct MipSettings
+{
+	MipFilter filter = MIP_FILTER_KAISER;
+	bool srgb = false;		// color channels hold sRGB encoded values, filtered in linear light (alpha never is)
+	bool wrap = false;		// the filter reaches across the edges to the opposite side, for repeating textures
+	bool normalMap = false;	// RGB holds unit vectors as 0.5 + 0.5 * n, renormalized in every level
+	float alphaCutoff = 0.0f;	// above 0, alpha of every level is scaled so as many pixels pass an alpha test
+								// against it as in the full resolution image, or alpha tested foliage thins out
+};
+
+// Builds mip chains on the CPU instead of glGenerateMipmap, which averages sRGB images as if they were linear and
+// only has a box filter. Levels are filtered in floating point from the previous one, separably (rows then columns)
+// four channels at once with SSE, and in bands of rows on the worker pool. Sizes that aren't powers of two are
+// handled: every level is half the previous one rounded down, the filter just covers a bit more than 2 pixels.
+class MipGenerator
+{
+public:
+	/// Levels of a full chain down to 1x1, the full resolution one included
+	static unsigned int LevelCount(unsigned int width, unsigned int height);
+
+	/// @param pixels 8 bit channels, rows tightly packed
+	/// @param components 1 to 4, the channel of 2 component images (grey, alpha) and 4 component ones is alpha
+	/// @return every level below the given one, each with the same number of components
+	static std::vector<std::vector<uint8_t>> Build(const uint8_t *pixels, unsigned int width, unsigned int height,
+		unsigned int components, const MipSettings &settings);
+};
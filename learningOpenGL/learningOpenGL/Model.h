@@ -9,6 +9,27 @@
 #include "stb_image.h"
 #include "Shader.h"
 #include "Mesh.h"
+#include "MeshSimplifier.h"
+#include "TangentSpace.h"
+#include "NormalMapBaker.h"
+#include "ImageDecoder.h"
+#include "Camera.h"
+#include "ModelInstances.h"
+#include "MaterialBatch.h"
+#include "CookedModel.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+#include "TexturePacker.h"
+#include "NodeHierarchy.h"
+#include "Animation.h"
+#include "VertexAnimationTexture.h"
+#include "Impostor.h"
+#include "ClusterLOD.h"
+#include "ObjLoader.h"
+#include "GltfLoader.h"
+#include "StringTable.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -19,191 +40,922 @@
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <cstring>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
 
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+GpuTexture TextureFromFile(const char *path, const string &directory, bool gamma = false);
+
+// Assimp post processing applied on import, part of the cooked cache key
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_LimitBoneWeights;
+
+// A coarser LOD is only used while its geometric error projects to less than this many pixels on screen
+const float LOD_ERROR_PIXELS = 1.0f;
 
 
 class Model
 {
 public:
 	/* Functions */
-	Model(char *path)
+	/// @param residency what the meshes keep in host memory once uploaded, FULL is needed to bake vertex animation
+	Model(const char *path, MeshResidency residency = MESH_RESIDENCY_FULL) : residency(residency)
 	{
 		loadModel(path);
+		for (Mesh &mesh : meshes)
+			mesh.SetResidency(residency);
+	}
+	~Model()
+	{
+		for (unsigned int i = 0; i < textures_loaded.size(); i++)
+			TextureCache::Shared().Release(textures_loaded[i].id);
+	}
+	Model(const Model&) = delete;
+	Model &operator=(const Model&) = delete;
+	/// Bytes of the meshes' vertex and index buffers, textures are counted by the TextureCache
+	size_t GpuBytes() const
+	{
+		size_t bytes = 0;
+		for (const Mesh &mesh : meshes)
+			bytes += mesh.GpuBytes();
+		return bytes;
+	}
+	/// Bytes of host memory held by the meshes under the model's residency policy
+	size_t HostBytes() const
+	{
+		size_t bytes = 0;
+		for (const Mesh &mesh : meshes)
+			bytes += mesh.HostBytes();
+		return bytes;
+	}
+	MeshResidency Residency() const { return residency; }
+	void PrintMemory() const
+	{
+		cout << "MODEL:: " << directory << " (" << MESH_RESIDENCY_NAMES[residency] << "): " << meshes.size() << " meshes, "
+			<< HostBytes() / 1024 << " KB host, " << GpuBytes() / 1024 << " KB GPU" << endl;
+	}
+	/// Draws every mesh with the "model" uniform already set on the shader, ignoring the node transforms
+	void Draw(Shader &shader)
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].Draw(shader);
+	}
+	/// Draws every mesh at full detail, setting the "model" uniform to model * the transform of the mesh's node
+	void Draw(Shader &shader, const glm::mat4 &model)
+	{
+		nodes.UpdateWorldTransforms();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			shader.setMat4("model", model * nodes.WorldTransform(meshNodes[i]));
+			meshes[i].Draw(shader);
+		}
+	}
+	/// Draws every mesh at the coarsest LOD whose error stays under LOD_ERROR_PIXELS once projected on screen
+	/// @param model world matrix of the model, combined with each mesh's node transform and set as the "model" uniform
+	/// @param viewportHeight height of the viewport in pixels
+	void Draw(Shader &shader, const glm::mat4 &model, const Camera &camera, float viewportHeight)
+	{
+		// Pixels covered by one world unit at a distance of one unit from the camera
+		float pixelsPerUnit = viewportHeight / (2.0f * tan(glm::radians(camera.Zoom) * 0.5f));
+
+		nodes.UpdateWorldTransforms();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			glm::mat4 meshModel = model * nodes.WorldTransform(meshNodes[i]);
+			shader.setMat4("model", meshModel);
+			meshes[i].Draw(shader, selectLOD(meshes[i], meshModel, camera.Position, pixelsPerUnit));
+		}
+	}
+	/// Adds every mesh to a batch drawing many models without texture binds (see MaterialBatch)
+	/// @return the index of each mesh in the batch, to pass to Submit
+	vector<unsigned int> AddTo(MaterialBatch &batch) const
+	{
+		vector<unsigned int> batchMeshes(meshes.size());
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			batchMeshes[i] = batch.AddMesh(meshes[i]);
+		return batchMeshes;
+	}
+	/// Queues every mesh for the batch's next Draw, placed by its node at the LOD Draw would pick
+	/// @param batchMeshes what AddTo returned for this batch
+	void Submit(MaterialBatch &batch, const vector<unsigned int> &batchMeshes, const glm::mat4 &model, const Camera &camera, float viewportHeight)
+	{
+		float pixelsPerUnit = viewportHeight / (2.0f * tan(glm::radians(camera.Zoom) * 0.5f));
+		nodes.UpdateWorldTransforms();
+		for (unsigned int i = 0; i < meshes.size() && i < batchMeshes.size(); i++)
+		{
+			glm::mat4 meshModel = model * nodes.WorldTransform(meshNodes[i]);
+			batch.Submit(batchMeshes[i], meshModel, selectLOD(meshes[i], meshModel, camera.Position, pixelsPerUnit));
+		}
+	}
+	/// Draws every instance of the model with one indirect draw per mesh. Instances are frustum culled on the GPU
+	/// so the CPU cost doesn't depend on the number of instances. Instances are always drawn at LOD 0.
+	/// @param shader shader reading the instance transform at attribute locations 3 to 6 (shaders/model_instanced.vert)
+	/// @param cullShader compute shader built from shaders/instance_cull.comp
+	void DrawInstanced(Shader &shader, Shader &cullShader, ModelInstances &instances, const glm::mat4 &viewProjection)
+	{
+		if (!instances.IsAllocated())
+		{
+			vector<DrawElementsIndirectCommand> commands(meshes.size());
+			vector<glm::vec4> spheres(meshes.size());
+			for (unsigned int i = 0; i < meshes.size(); i++)
+			{
+				const Mesh &mesh = meshes[i];
+				commands[i] = { mesh.lods[0].indexCount, 0, mesh.lods[0].indexOffset, 0, 0 };
+				spheres[i] = glm::vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f);
+			}
+			instances.Allocate(commands, spheres);
+			for (unsigned int i = 0; i < meshes.size(); i++)
+				meshes[i].AttachInstanceBuffer(instances.VisibleBuffer());
+		}
+		// Meshes are placed by their node, so the culling shader needs the node transforms too
+		nodes.UpdateWorldTransforms();
+		if (instances.MeshTransformsVersion() != nodes.Version())
+		{
+			vector<glm::mat4> meshTransforms(meshes.size());
+			for (unsigned int i = 0; i < meshes.size(); i++)
+				meshTransforms[i] = nodes.WorldTransform(meshNodes[i]);
+			instances.SetMeshTransforms(meshTransforms, nodes.Version());
+		}
+		instances.Cull(cullShader, viewProjection);
+
+		shader.Use();
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, instances.CommandBuffer());
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].DrawIndirect(shader, instances.VisibleBuffer(), i * sizeof(DrawElementsIndirectCommand));
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 	}
-	void Draw(Shader shader)
+	/// Draws an animated character with GPU skinning (shaders/skinning.vert)
+	/// @param animator animator of this character, sampled by Animator::SampleAll into the bound BonePaletteBuffer
+	void DrawSkinned(Shader &shader, const glm::mat4 &model, const Animator &animator)
 	{
+		nodes.UpdateWorldTransforms();
+		shader.setUInt("paletteOffset", animator.PaletteOffset());
 		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			// Skinned vertices are placed by their bones, other meshes still follow their node
+			bool skinned = meshes[i].IsSkinned();
+			shader.setBool("skinned", skinned);
+			shader.setMat4("model", skinned ? model : model * nodes.WorldTransform(meshNodes[i]));
 			meshes[i].Draw(shader);
+		}
+	}
+	/// Bakes every animation clip into a vertex animation texture for crowds of this model (see DrawCrowd)
+	bool BakeVertexAnimation(VertexAnimationTexture &vat, float framesPerSecond = 30.0f)
+	{
+		nodes.UpdateWorldTransforms();
+		return vat.Bake(meshes, meshNodes, nodes, skeleton, framesPerSecond);
+	}
+	/// Draws every instance of a crowd with one instanced draw per mesh, each instance playing its own clip
+	/// from the baked vertex animation texture: the CPU cost doesn't depend on the number of instances
+	/// @param shader shader built from shaders/vat_crowd.vert
+	/// @param time in seconds, the same for every instance (they are offset by their CrowdInstance::timeOffset)
+	void DrawCrowd(Shader &shader, const VertexAnimationTexture &vat, const CrowdInstances &crowd, float time)
+	{
+		shader.Use();
+		vat.Bind(shader);
+		crowd.Bind();
+		shader.setFloat("time", time);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			shader.setUInt("vatVertexBase", vat.MeshVertexBase(i));
+			meshes[i].DrawInstanced(shader, crowd.Count());
+		}
+	}
+	/// Renders the model from every view direction of the impostor's atlas (see ImpostorAtlas::Bake).
+	/// Bake once the streamer is idle (TextureStreamer::PendingCount() is 0), the atlas captures the textures as they
+	/// are and would keep their placeholders otherwise. Until then DrawWithImpostors draws every instance in full.
+	/// @param bakeShader shader built from shaders/impostor_bake.vert and .frag
+	bool BakeImpostor(ImpostorAtlas &impostor, Shader &bakeShader, const ImpostorSettings &settings = ImpostorSettings())
+	{
+		if (meshes.empty())
+			return false;
+
+		// Bounds of the whole model, each mesh's box placed by its node
+		nodes.UpdateWorldTransforms();
+		glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			const glm::mat4 &transform = nodes.WorldTransform(meshNodes[i]);
+			for (int corner = 0; corner < 8; corner++)
+			{
+				glm::vec3 p((corner & 1) ? meshes[i].boundsMax.x : meshes[i].boundsMin.x, (corner & 2) ? meshes[i].boundsMax.y : meshes[i].boundsMin.y,
+					(corner & 4) ? meshes[i].boundsMax.z : meshes[i].boundsMin.z);
+				p = glm::vec3(transform * glm::vec4(p, 1.0f));
+				boundsMin = glm::min(boundsMin, p);
+				boundsMax = glm::max(boundsMax, p);
+			}
+		}
+		return impostor.Bake([this](Shader &shader) { Draw(shader, glm::mat4(1.0f)); }, bakeShader, boundsMin, boundsMax, settings);
+	}
+	/// Merges the full resolution geometry of every mesh, placed by its node, and cooks it into a cluster LOD file
+	/// for ClusterMesh. Materials aren't carried over. Needs the meshes' CPU copies (MESH_RESIDENCY_FULL).
+	bool CookClusterLOD(const string &path)
+	{
+		nodes.UpdateWorldTransforms();
+		vector<Vertex> vertices;
+		vector<unsigned int> indices;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			const Mesh &mesh = meshes[i];
+			if (mesh.vertices.empty() || mesh.indices.empty())
+			{
+				cout << "ERROR::MODEL::CLUSTER_LOD_NEEDS_FULL_RESIDENCY" << endl;
+				return false;
+			}
+			const glm::mat4 &transform = nodes.WorldTransform(meshNodes[i]);
+			glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+			// Tangents follow the surface like positions do, and a mirroring transform flips their handedness
+			float mirror = glm::determinant(glm::mat3(transform)) < 0.0f ? -1.0f : 1.0f;
+			unsigned int baseVertex = (unsigned int)vertices.size();
+			for (const Vertex &vertex : mesh.vertices)
+			{
+				Vertex placed = vertex;
+				placed.Position = glm::vec3(transform * glm::vec4(vertex.Position, 1.0f));
+				placed.Normal = glm::normalize(normalMatrix * vertex.Normal);
+				placed.Tangent = glm::vec4(glm::normalize(glm::mat3(transform) * glm::vec3(vertex.Tangent)), vertex.Tangent.w * mirror);
+				vertices.push_back(placed);
+			}
+			const MeshLOD &lod = mesh.lods[0];
+			for (unsigned int j = lod.indexOffset; j < lod.indexOffset + lod.indexCount; j++)
+				indices.push_back(baseVertex + mesh.indices[j]);
+		}
+		return ClusterLODBuilder::Cook(vertices, indices, path);
+	}
+	/// Bakes the detail LOD 0 has over LOD fromLOD into a normal map of each mesh, to be drawn by that LOD and the
+	/// coarser ones in place of the material's normal maps, which are composed into the bake. Meshes are baked in
+	/// parallel and need their CPU copies (MESH_RESIDENCY_FULL), meshes with fewer LODs are skipped.
+	/// The maps are written next to the model (<model>.lodnormals), keyed on the geometry, the material normal maps
+	/// and the settings, for LoadLODNormalMaps. Run offline by --cook, the bake takes seconds.
+	/// @param force bake even if the cache is up to date
+	/// @return false if the cache couldn't be written
+	bool CookLODNormalMaps(unsigned int fromLOD, bool force, const NormalMapBakeSettings &settings = NormalMapBakeSettings())
+	{
+		if (fromLOD == 0)
+			return true;
+		vector<string> normalMapPaths;
+		vector<int> meshNormalMaps;
+		uint64_t key = lodNormalMapKey(fromLOD, settings, normalMapPaths, meshNormalMaps);
+		vector<NormalMapBaker::Image> images;
+		string cachePath = sourcePath + ".lodnormals";
+		if (!force && NormalMapBaker::ReadCache(cachePath, key, images) && images.size() == meshes.size())
+			return true;
+
+		vector<NormalMapBaker::Image> normalMaps(normalMapPaths.size());
+		ThreadPool::Shared().ParallelFor((unsigned int)normalMapPaths.size(), [&](unsigned int i)
+		{
+			NormalMapBaker::Image &map = normalMaps[i];
+			int width, height, components;
+			if (ImageDecoder::DecodeFile(normalMapPaths[i], map.pixels, width, height, components, 4))
+			{
+				map.width = (unsigned int)width;
+				map.height = (unsigned int)height;
+			}
+		});
+
+		images.assign(meshes.size(), NormalMapBaker::Image());
+		ThreadPool::Shared().ParallelFor((unsigned int)meshes.size(), [&](unsigned int i)
+		{
+			const Mesh &mesh = meshes[i];
+			if (mesh.vertices.empty() || mesh.indices.empty() || mesh.lods.size() <= fromLOD)
+				return;
+			// Every LOD indexes the same vertices, only the triangles differ
+			const MeshLOD &high = mesh.lods[0], &low = mesh.lods[fromLOD];
+			const NormalMapBaker::Image *normalMap = meshNormalMaps[i] >= 0 ? &normalMaps[meshNormalMaps[i]] : nullptr;
+			if (!NormalMapBaker::Bake(mesh.vertices, &mesh.indices[high.indexOffset], high.indexCount,
+				mesh.vertices, &mesh.indices[low.indexOffset], low.indexCount, normalMap, settings, images[i]))
+				images[i] = NormalMapBaker::Image();
+		});
+		if (!NormalMapBaker::WriteCache(cachePath, key, images))
+		{
+			cout << "ERROR::MODEL::COULD_NOT_WRITE_CACHE " << cachePath << endl;
+			return false;
+		}
+		cout << "COOK:: " << sourcePath << " -> " << cachePath << endl;
+		return true;
+	}
+	/// Uploads the maps CookLODNormalMaps baked with the same arguments, LODs are drawn with the material's normal
+	/// maps if they are missing or stale
+	/// @return meshes given a baked map
+	unsigned int LoadLODNormalMaps(unsigned int fromLOD, const NormalMapBakeSettings &settings = NormalMapBakeSettings())
+	{
+		if (fromLOD == 0)
+			return 0;
+		vector<string> normalMapPaths;
+		vector<int> meshNormalMaps;
+		uint64_t key = lodNormalMapKey(fromLOD, settings, normalMapPaths, meshNormalMaps);
+		vector<NormalMapBaker::Image> images;
+		string cachePath = sourcePath + ".lodnormals";
+		if (!NormalMapBaker::ReadCache(cachePath, key, images) || images.size() != meshes.size())
+		{
+			cout << "WARNING::MODEL::LOD_NORMAL_MAPS_NOT_COOKED " << cachePath << ", run learningOpenGL --cook" << endl;
+			return 0;
+		}
+
+		unsigned int count = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			if (images[i].width == 0 || meshes[i].lods.size() <= fromLOD)
+				continue;
+			meshes[i].SetLODNormalMap(NormalMapBaker::Upload(images[i]), fromLOD);
+			count++;
+		}
+		return count;
+	}
+	/// Draws the instances closer than impostorDistance to the camera as meshes, with their LODs, and all the others
+	/// as impostors with one instanced draw
+	/// @param shader in use with its view, projection and lighting uniforms set
+	/// @param impostorShader shader built from shaders/impostor.vert and .frag, with view, projection, viewPos and lightDirection set
+	/// @param transforms world matrix of every instance
+	void DrawWithImpostors(Shader &shader, Shader &impostorShader, ImpostorAtlas &impostor, const vector<glm::mat4> &transforms,
+		const Camera &camera, float viewportHeight, float impostorDistance)
+	{
+		vector<glm::mat4> far;
+		shader.Use();
+		for (const glm::mat4 &transform : transforms)
+		{
+			glm::vec3 center = glm::vec3(transform * glm::vec4(impostor.Center(), 1.0f));
+			if (impostor.IsBaked() && glm::length(center - camera.Position) > impostorDistance)
+				far.push_back(transform);
+			else
+				Draw(shader, transform, camera, viewportHeight);
+		}
+		if (far.empty())
+			return;
+		impostorShader.Use();
+		impostor.Draw(impostorShader, far);
+		shader.Use();
 	}
+	/// Node hierarchy of the model, change a node's local transform to move the meshes below it
+	NodeHierarchy &Nodes() { return nodes; }
+	const NodeHierarchy &Nodes() const { return nodes; }
+	/// Bones and animation clips, empty for static models
+	const Skeleton &GetSkeleton() const { return skeleton; }
 private:
 	/* Model Data */
 	vector<Mesh> meshes;
+	vector<unsigned int> meshNodes; // node each mesh hangs from
+	NodeHierarchy nodes;
+	Skeleton skeleton;
 	string directory;
-	vector<Texture> textures_loaded;
+	string sourcePath;
+	MeshResidency residency;
+	vector<Texture> textures_loaded; // one entry per reference taken on the texture cache
 	/* functions */
+	// Key of the LOD normal map cache: the geometry, the settings and the material normal map of every mesh, whose
+	// files are listed in normalMapPaths and indexed by meshNormalMaps (-1 for none)
+	uint64_t lodNormalMapKey(unsigned int fromLOD, const NormalMapBakeSettings &settings, vector<string> &normalMapPaths,
+		vector<int> &meshNormalMaps) const
+	{
+		normalMapPaths.clear();
+		meshNormalMaps.assign(meshes.size(), -1);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			for (const Texture &texture : meshes[i].textures)
+			{
+				if (texture.type != TEXTURE_NORMAL)
+					continue;
+				string path = directory + '/' + StringTable::Shared().Get(texture.path);
+				auto found = std::find(normalMapPaths.begin(), normalMapPaths.end(), path);
+				meshNormalMaps[i] = (int)(found - normalMapPaths.begin());
+				if (found == normalMapPaths.end())
+					normalMapPaths.push_back(path);
+				break;
+			}
+		}
+
+		uint64_t key = HashBytes((const uint8_t*)&fromLOD, sizeof(fromLOD));
+		key = HashBytes((const uint8_t*)&settings, sizeof(settings), key);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			const Mesh &mesh = meshes[i];
+			key = HashBytes((const uint8_t*)mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex), key);
+			key = HashBytes((const uint8_t*)mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int), key);
+			key = HashBytes((const uint8_t*)mesh.lods.data(), mesh.lods.size() * sizeof(MeshLOD), key);
+			key = HashBytes((const uint8_t*)&meshNormalMaps[i], sizeof(int), key);
+		}
+		for (const string &path : normalMapPaths)
+		{
+			MappedFile file(path);
+			if (file.isOpen())
+				key = HashBytes(file.begin(), file.length(), key);
+		}
+		return key;
+	}
+	// The coarsest LOD of the mesh whose error stays under LOD_ERROR_PIXELS once projected on screen
+	static unsigned int selectLOD(const Mesh &mesh, const glm::mat4 &meshModel, glm::vec3 cameraPosition, float pixelsPerUnit)
+	{
+		// Errors are in model units, so scale them by the largest axis scale of the mesh's matrix
+		float modelScale = glm::max(glm::length(glm::vec3(meshModel[0])), glm::max(glm::length(glm::vec3(meshModel[1])), glm::length(glm::vec3(meshModel[2]))));
+		glm::vec3 center = glm::vec3(meshModel * glm::vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.0f));
+		float radius = glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f * modelScale;
+		// Use the closest point of the bounding sphere so no part of the mesh is under-tessellated
+		float distance = glm::length(center - cameraPosition) - radius;
+
+		unsigned int lod = 0;
+		if (distance > 0.0f)
+		{
+			while (lod + 1 < mesh.lods.size() && mesh.lods[lod + 1].error * modelScale * pixelsPerUnit / distance <= LOD_ERROR_PIXELS)
+				lod++;
+		}
+		return lod;
+	}
 	void loadModel(string path)
+	{
+		// retrieve the directory path of the filepath
+		sourcePath = path;
+		directory = path.substr(0, path.find_last_of('/'));
+
+		// Binary glTF is already laid out for the GPU and is uploaded straight from the mapped file, it needs no cache
+		if (hasExtension(path, ".glb") && loadGlb(path))
+			return;
+
+		// The cooked cache is keyed on the contents of the source file, so hash it before anything else
+		bool obj = hasExtension(path, ".obj");
+		uint64_t sourceHash;
+		{
+			MappedFile source(path);
+			if (!source.isOpen())
+			{
+				cout << "ERROR::MODEL::FILE_NOT_FOUND " << path << endl;
+				return;
+			}
+			sourceHash = HashBytes(source.begin(), source.length());
+
+			// An OBJ's materials and texture assignments live in its material libraries, editing one must
+			// invalidate the cache too. A missing library hashes as its name alone, so creating it does as well.
+			if (obj)
+			{
+				string sourceDirectory = path.substr(0, path.find_last_of('/') + 1);
+				for (const string &library : ObjLoader::MaterialLibraries(source.begin(), source.length()))
+				{
+					sourceHash = HashBytes((const uint8_t*)library.data(), library.size(), sourceHash);
+					MappedFile libraryFile(sourceDirectory + library);
+					if (libraryFile.isOpen())
+						sourceHash = HashBytes(libraryFile.begin(), libraryFile.length(), sourceHash);
+				}
+			}
+		}
+		string cachePath = path + ".cooked";
+		if (loadCooked(cachePath, sourceHash, obj))
+			return;
+
+		// OBJ files go through the dedicated parallel loader, everything else (or an OBJ it can't read) through Assimp
+		CookedLoader loader = COOKED_LOADER_OBJ;
+		if (!(obj && loadObj(path)))
+		{
+			loader = COOKED_LOADER_ASSIMP;
+			if (!loadAssimp(path))
+				return;
+		}
+
+		// The cooked format only holds static geometry, animated models go through Assimp every time
+		if (!skeleton.empty() || !skeleton.clips.empty())
+			return;
+		if (!CookedModel::Write(cachePath, sourceHash, loader, loader == COOKED_LOADER_ASSIMP ? MODEL_IMPORT_FLAGS : 0, meshes, meshNodes, nodes))
+			cout << "WARNING::MODEL::COULD_NOT_WRITE_CACHE " << cachePath << endl;
+	}
+	bool loadAssimp(const string &path)
 	{
 		Assimp::Importer importer;
-		const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+		const aiScene *scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
 
 		if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 		{
 			cout << "ERROR::ASSIMP::" << importer.GetErrorString() << endl;
-			return;
+			return false;
 		}
-		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		// process ASSIMP's root node recursively, then all of the meshes it references
+		vector<const aiMesh*> sceneMeshes;
+		processNode(scene->mRootNode, scene, -1, sceneMeshes);
+		unordered_map<string, unsigned int> boneIndices = importSkeleton(sceneMeshes);
+		importAnimations(scene);
+		processMeshes(sceneMeshes, scene, boneIndices);
+		return true;
+	}
+	// OBJ files have no hierarchy, every mesh hangs from a single root node
+	bool loadObj(const string &path)
+	{
+		ObjLoader obj;
+		if (!obj.Load(path))
+			return false;
+
+		nodes.AddNode(-1, glm::mat4(1.0f), path.substr(path.find_last_of('/') + 1));
+		meshes.reserve(obj.meshes.size());
+		for (ObjMesh &mesh : obj.meshes)
+		{
+			vector<Texture> textures;
+			if (mesh.material >= 0)
+				textures = loadTextures(obj.materials[mesh.material].textures);
+			meshNodes.push_back(0);
+			meshes.push_back(Mesh(std::move(mesh.data), textures));
+		}
+		return true;
+	}
+	bool loadGlb(const string &path)
+	{
+		GltfLoader gltf;
+		if (!gltf.Load(path))
+			return false;
+
+		for (const GltfNode &node : gltf.nodes)
+			nodes.AddNode(node.parent, node.local, node.name);
+
+		// Images are shared by materials, load each once
+		vector<vector<Texture>> materialTextures(gltf.materials.size());
+		for (unsigned int i = 0; i < gltf.materials.size(); i++)
+		{
+			const pair<int, TextureType> images[2] = { { gltf.materials[i].baseColorImage, TEXTURE_DIFFUSE }, { gltf.materials[i].normalImage, TEXTURE_NORMAL } };
+			for (const pair<int, TextureType> &image : images)
+			{
+				if (image.first < 0)
+					continue;
+				const GltfImage &source = gltf.images[image.first];
+				if (source.bytes)
+					materialTextures[i].push_back(loadEmbeddedTexture(gltf, path, image.first, image.second));
+				else if (!source.uri.empty() && source.uri.compare(0, 5, "data:") != 0)
+					materialTextures[i].push_back(loadTexture(source.uri.c_str(), image.second));
+			}
+		}
+
+		meshes.reserve(gltf.primitives.size());
+		for (const GltfPrimitive &primitive : gltf.primitives)
+		{
+			vector<Texture> textures;
+			if (primitive.material >= 0)
+				textures = materialTextures[primitive.material];
+			meshNodes.push_back(primitive.node);
+			if (primitive.streamed)
+				meshes.push_back(Mesh(primitive.streams, primitive.Indices(), primitive.indexCount, textures, primitive.boundsMin, primitive.boundsMax,
+					residency));
+			else
+				meshes.push_back(Mesh(primitive.vertices.data(), primitive.vertices.size(), primitive.Indices(), primitive.indexCount, textures,
+					vector<MeshLOD>(), primitive.boundsMin, primitive.boundsMax, residency));
+		}
+		return true;
+	}
+	// Images embedded in a .glb are decoded from the mapped file on the worker pool, which keeps the mapping alive
+	Texture loadEmbeddedTexture(const GltfLoader &gltf, const string &path, int image, TextureType type)
+	{
+		Texture texture;
+		texture.type = type;
+		texture.maskChannels = 0;
+		string name = path + "#image" + to_string(image);
+		texture.path = StringTable::Shared().Intern(name);
+
+		const GltfImage &source = gltf.images[image];
+		std::shared_ptr<const void> owner = gltf.File();
+		bool gamma = isColor(type);
+		texture.id = TextureCache::Shared().Acquire(TextureCache::MakeKey(name, GL_TEXTURE_2D, gamma),
+			[&](size_t &) { return TextureStreamer::Shared().Request(owner, source.bytes, source.size, name, gamma); });
+		textures_loaded.push_back(texture);
+		return texture;
+	}
+	// Diffuse and ambient maps are sRGB encoded color, the others hold data (normals, specular intensity)
+	static bool isColor(TextureType type)
+	{
+		return type == TEXTURE_DIFFUSE || type == TEXTURE_AMBIENT;
+	}
+	static bool hasExtension(const string &path, const char *extension)
+	{
+		size_t length = strlen(extension);
+		if (path.size() < length)
+			return false;
+		for (size_t i = 0; i < length; i++)
+		{
+			if (tolower((unsigned char)path[path.size() - length + i]) != extension[i])
+				return false;
+		}
+		return true;
+	}
+	// Creates the meshes from the cooked cache, uploading the vertex and index blobs straight from the mapped file
+	bool loadCooked(const string &cachePath, uint64_t sourceHash, bool obj)
+	{
+		CookedModel cooked;
+		if (!cooked.Open(cachePath, sourceHash))
+			return false;
+		// An OBJ is cooked by ObjLoader, or by Assimp when ObjLoader can't read it. Assimp's output depends on its flags.
+		bool sameImport = cooked.Loader() == COOKED_LOADER_ASSIMP ? cooked.ImportFlags() == MODEL_IMPORT_FLAGS
+			: cooked.Loader() == COOKED_LOADER_OBJ && obj;
+		if (!sameImport)
+			return false;
+
+		for (unsigned int i = 0; i < cooked.NodeCount(); i++)
+		{
+			const CookedNode &node = cooked.GetNode(i);
+			glm::mat4 local;
+			std::memcpy(&local[0][0], node.localTransform, sizeof(node.localTransform));
+			nodes.AddNode(node.parent, local, cooked.String(node.nameOffset));
+		}
+
+		meshes.reserve(cooked.MeshCount());
+		for (unsigned int i = 0; i < cooked.MeshCount(); i++)
+		{
+			const CookedMesh &mesh = cooked.GetMesh(i);
+			vector<Texture> textures;
+			for (unsigned int t = 0; t < mesh.textureCount; t++)
+			{
+				TextureType type;
+				if (TextureTypeFromName(cooked.TextureTypeName(mesh, t), type))
+					textures.push_back(loadTexture(cooked.TexturePath(mesh, t), type));
+			}
+
+			meshNodes.push_back(mesh.node);
+			meshes.push_back(Mesh(cooked.Vertices(mesh), mesh.vertexCount, cooked.Indices(mesh), mesh.indexCount, textures, cooked.LODs(mesh),
+				glm::vec3(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]), glm::vec3(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]), residency));
+		}
+		return true;
 	}
 
-	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode *node, const aiScene *scene)
+	// processes a node in a recursive fashion. Adds the node to the hierarchy, collects each individual mesh located at the node
+	// and repeats this process on its children nodes (if any). Recursing depth-first keeps the hierarchy in pre-order.
+	void processNode(aiNode *node, const aiScene *scene, int parent, vector<const aiMesh*> &sceneMeshes)
 	{
+		unsigned int nodeIndex = nodes.AddNode(parent, toGlm(node->mTransformation), node->mName.C_Str());
 		// Process all the node's meshes (if any)
 		for(unsigned int i = 0; i < node->mNumMeshes; i++)
 		{
-			aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+			meshNodes.push_back(nodeIndex);
 		}
 		// Then do the same for all the children recursively
 		for(unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, (int)nodeIndex, sceneMeshes);
 		}
 	}
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	// Assimp matrices are row-major, glm's are column-major
+	static glm::mat4 toGlm(const aiMatrix4x4 &m)
 	{
-		vector<Vertex> vertices;
-		vector<unsigned int> indices;
-		vector<Texture> textures;
+		return glm::mat4(
+			glm::vec4(m.a1, m.b1, m.c1, m.d1),
+			glm::vec4(m.a2, m.b2, m.c2, m.d2),
+			glm::vec4(m.a3, m.b3, m.c3, m.d3),
+			glm::vec4(m.a4, m.b4, m.c4, m.d4));
+	}
+	// Converts every mesh on the worker pool, then creates the GL buffers and textures on this (the context) thread
+	void processMeshes(const vector<const aiMesh*> &sceneMeshes, const aiScene *scene, const unordered_map<string, unsigned int> &boneIndices)
+	{
+		vector<MeshData> meshData(sceneMeshes.size());
+		ThreadPool::Shared().ParallelFor((unsigned int)sceneMeshes.size(), [&](unsigned int i)
+		{
+			vector<unsigned int> splitVertices;
+			processMeshGeometry(sceneMeshes[i], meshData[i], splitVertices);
+			if (sceneMeshes[i]->HasBones())
+				processMeshSkin(sceneMeshes[i], boneIndices, splitVertices, meshData[i]);
+		});
+
+		meshes.reserve(meshes.size() + sceneMeshes.size());
+		for (unsigned int i = 0; i < sceneMeshes.size(); i++)
+			meshes.push_back(Mesh(std::move(meshData[i]), processMaterial(sceneMeshes[i], scene)));
+	}
+	// Attribute conversion, index flattening, bounds and LOD generation. Runs on a worker thread.
+	// @param splitVertices receives the source vertex of each one TangentSpace appended, past mesh->mNumVertices
+	static void processMeshGeometry(const aiMesh *mesh, MeshData &data, vector<unsigned int> &splitVertices)
+	{
+		vector<Vertex> &vertices = data.vertices;
+		vector<unsigned int> &indices = data.indices;
 
 		// Retrieve Vertex data
+		vertices.resize(mesh->mNumVertices);
+		const aiVector3D *texCoords = mesh->mTextureCoords[0]; // Does the mesh contain texture coords?
 		for(unsigned int i = 0; i < mesh->mNumVertices; i++)
 		{
-			Vertex vertex;
+			Vertex &vertex = vertices[i];
 			// process vertex positions, normals and texture coordinates
-			glm::vec3 vector;
-			// positions
-			vector.x = mesh->mVertices[i].x;
-			vector.y = mesh->mVertices[i].y;
-			vector.z = mesh->mVertices[i].z;
-			vertex.Position = vector;
-			// normals
-			vector.x = mesh->mNormals[i].x;
-			vector.y = mesh->mNormals[i].y;
-			vector.z = mesh->mNormals[i].z;
-			vertex.Normal = vector;
-			// textures
-			if (mesh->mTextureCoords[0]) // Does the mesh contain texture coords?
-			{
-				glm::vec2 vec;
-				// a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
-				// use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-				vec.x = mesh->mTextureCoords[0][i].x;
-				vec.y = mesh->mTextureCoords[0][i].y;
-				vertex.TexCoords = vec;
-			}
-			else
-				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-
-			vertices.push_back(vertex); // add the Vertex data
+			vertex.Position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+			vertex.Normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+			// a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
+			// use models where a vertex can have multiple texture coordinates so we always take the first set (0).
+			vertex.TexCoords = texCoords ? glm::vec2(texCoords[i].x, texCoords[i].y) : glm::vec2(0.0f, 0.0f);
 		}
-		// Process Indices
+
+		// Process Indices, faces are all triangles thanks to aiProcess_Triangulate
+		unsigned int indexCount = 0;
+		for(unsigned int i = 0; i < mesh->mNumFaces; i++)
+			indexCount += mesh->mFaces[i].mNumIndices;
+		indices.resize(indexCount);
+		unsigned int *out = indices.data();
 		for(unsigned int i = 0; i < mesh->mNumFaces; i++)
 		{
-			aiFace face = mesh->mFaces[i]; // Get indices of each face
+			const aiFace &face = mesh->mFaces[i]; // Get indices of each face
 			for (unsigned int j = 0; j < face.mNumIndices; j++)
-				indices.push_back(face.mIndices[j]);
+				*out++ = face.mIndices[j];
 		}
 
-		// Process Material
-		if(mesh->mMaterialIndex >= 0)
+		// Computed here rather than with aiProcess_CalcTangentSpace so every loader follows the same conventions
+		TangentSpace::Generate(vertices, indices, &splitVertices);
+
+		// Model space bounds
+		data.boundsMin = data.boundsMax = vertices.empty() ? glm::vec3(0.0f) : vertices[0].Position;
+		for (unsigned int i = 1; i < vertices.size(); i++)
 		{
-			aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex]; // retrieve material from scene
-			vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-			textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-			vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-			textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-			vector<Texture> ambientMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_ambient");
-			textures.insert(textures.end(), ambientMaps.begin(), ambientMaps.end());
+			data.boundsMin = glm::min(data.boundsMin, vertices[i].Position);
+			data.boundsMax = glm::max(data.boundsMax, vertices[i].Position);
+		}
 
+		// Build the LOD chain, appending the index lists of the coarser levels after the full resolution indices
+		data.lods = MeshSimplifier::BuildLODChain(vertices, indices);
+	}
+	// Gathers the bones of every mesh into one skeleton for the whole model, shared by name between meshes
+	unordered_map<string, unsigned int> importSkeleton(const vector<const aiMesh*> &sceneMeshes)
+	{
+		unordered_map<string, unsigned int> boneIndices;
+		for (const aiMesh *mesh : sceneMeshes)
+		{
+			for (unsigned int b = 0; b < mesh->mNumBones; b++)
+			{
+				const aiBone *bone = mesh->mBones[b];
+				string name = bone->mName.C_Str();
+				int node = nodes.FindNode(name);
+				if (node < 0 || boneIndices.count(name))
+					continue;
+				boneIndices[name] = (unsigned int)skeleton.bones.size();
+				skeleton.bones.push_back({ (unsigned int)node, toGlm(bone->mOffsetMatrix) });
+			}
+		}
+		if (skeleton.bones.size() > 256)
+		{
+			// SkinVertex stores bone indices on a byte
+			cout << "WARNING::MODEL::TOO_MANY_BONES " << skeleton.bones.size() << ", the model is drawn in bind pose" << endl;
+			skeleton.bones.clear();
+			boneIndices.clear();
 		}
-		return Mesh(vertices, indices, textures);
+		return boneIndices;
 	}
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+	void importAnimations(const aiScene *scene)
 	{
-		vector<Texture> textures;
-		for(unsigned int i = 0 ; i < mat->GetTextureCount(type); i++)
+		for (unsigned int a = 0; a < scene->mNumAnimations; a++)
 		{
-			aiString str;
-			mat->GetTexture(type, i, &str); // Get texture file location
-			bool skip = false;
-			// Check if texture has already been used
-			for(unsigned int j = 0; j < textures_loaded.size(); j++)
+			const aiAnimation *animation = scene->mAnimations[a];
+			AnimationClip clip;
+			clip.name = animation->mName.C_Str();
+			clip.duration = (float)animation->mDuration;
+			clip.ticksPerSecond = (float)animation->mTicksPerSecond;
+			for (unsigned int c = 0; c < animation->mNumChannels; c++)
 			{
-				if(std::strcmp(textures_loaded[j].path.C_Str(), str.C_Str()) == 0)
+				const aiNodeAnim *source = animation->mChannels[c];
+				int node = nodes.FindNode(source->mNodeName.C_Str());
+				if (node < 0)
+					continue;
+				AnimationChannel channel;
+				channel.node = (unsigned int)node;
+				for (unsigned int k = 0; k < source->mNumPositionKeys; k++)
+				{
+					const aiVectorKey &key = source->mPositionKeys[k];
+					channel.positions.push_back({ (float)key.mTime, glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z) });
+				}
+				for (unsigned int k = 0; k < source->mNumRotationKeys; k++)
+				{
+					const aiQuatKey &key = source->mRotationKeys[k];
+					channel.rotations.push_back({ (float)key.mTime, glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z) });
+				}
+				for (unsigned int k = 0; k < source->mNumScalingKeys; k++)
 				{
-					// If it's already contained in textures_loaded, skip
-					textures.push_back(textures_loaded[j]);
-					skip = true;
-					break;
+					const aiVectorKey &key = source->mScalingKeys[k];
+					channel.scales.push_back({ (float)key.mTime, glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z) });
 				}
+				clip.channels.push_back(std::move(channel));
+			}
+			skeleton.clips.push_back(std::move(clip));
+		}
+	}
+	// Keeps the 4 strongest bone influences of every vertex, quantized to bytes. Runs on a worker thread.
+	// @param splitVertices what processMeshGeometry returned, the copies get the influences of their source
+	static void processMeshSkin(const aiMesh *mesh, const unordered_map<string, unsigned int> &boneIndices,
+		const vector<unsigned int> &splitVertices, MeshData &data)
+	{
+		struct Influence { unsigned int bone; float weight; };
+		vector<Influence> influences(mesh->mNumVertices * MAX_BONE_INFLUENCES, Influence{ 0, 0.0f });
+		for (unsigned int b = 0; b < mesh->mNumBones; b++)
+		{
+			const aiBone *bone = mesh->mBones[b];
+			auto found = boneIndices.find(bone->mName.C_Str());
+			if (found == boneIndices.end())
+				continue;
+			for (unsigned int w = 0; w < bone->mNumWeights; w++)
+			{
+				// Replace the weakest influence of the vertex if this one is stronger
+				Influence *slots = &influences[bone->mWeights[w].mVertexId * MAX_BONE_INFLUENCES];
+				Influence *weakest = std::min_element(slots, slots + MAX_BONE_INFLUENCES, [](const Influence &a, const Influence &b) { return a.weight < b.weight; });
+				if (bone->mWeights[w].mWeight > weakest->weight)
+					*weakest = { found->second, bone->mWeights[w].mWeight };
 			}
-			if(!skip)
+		}
+
+		data.skin.resize(mesh->mNumVertices);
+		for (unsigned int v = 0; v < mesh->mNumVertices; v++)
+		{
+			const Influence *slots = &influences[v * MAX_BONE_INFLUENCES];
+			SkinVertex &skin = data.skin[v];
+			float total = 0.0f;
+			for (unsigned int i = 0; i < MAX_BONE_INFLUENCES; i++)
+				total += slots[i].weight;
+			// Quantize, giving the rounding error to the strongest bone so the weights sum to exactly 255
+			unsigned int sum = 0, strongest = 0;
+			for (unsigned int i = 0; i < MAX_BONE_INFLUENCES; i++)
 			{
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), directory);
-				texture.type = typeName;
-				texture.path = str;
-				textures.push_back(texture);
-				textures_loaded.push_back(texture); // add to loaded textures
+				skin.Joints[i] = (unsigned char)slots[i].bone;
+				skin.Weights[i] = total > 0.0f ? (unsigned char)(slots[i].weight / total * 255.0f + 0.5f) : 0;
+				sum += skin.Weights[i];
+				if (slots[i].weight > slots[strongest].weight)
+					strongest = i;
 			}
+			if (total > 0.0f)
+				skin.Weights[strongest] = (unsigned char)(skin.Weights[strongest] + 255 - (int)sum);
 		}
+		for (unsigned int from : splitVertices)
+			data.skin.push_back(data.skin[from]);
+	}
+	// Loads the textures of the mesh's material. Texture uploads need the GL context so this stays on the main thread.
+	vector<Texture> processMaterial(const aiMesh *mesh, const aiScene *scene)
+	{
+		vector<pair<TextureType, string>> paths;
+		if(mesh->mMaterialIndex >= 0)
+		{
+			aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex]; // retrieve material from scene
+			addMaterialTextures(material, aiTextureType_DIFFUSE, TEXTURE_DIFFUSE, paths);
+			addMaterialTextures(material, aiTextureType_SPECULAR, TEXTURE_SPECULAR, paths);
+			addMaterialTextures(material, aiTextureType_AMBIENT, TEXTURE_AMBIENT, paths);
+			addMaterialTextures(material, aiTextureType_SHININESS, TEXTURE_GLOSS, paths);
+			addMaterialTextures(material, aiTextureType_LIGHTMAP, TEXTURE_OCCLUSION, paths);
+			addMaterialTextures(material, aiTextureType_DISPLACEMENT, TEXTURE_HEIGHT, paths);
+			// OBJ's map_Bump comes through as a height map, though exporters put tangent space normal maps there
+			if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
+				addMaterialTextures(material, aiTextureType_NORMALS, TEXTURE_NORMAL, paths);
+			else
+				addMaterialTextures(material, aiTextureType_HEIGHT, TEXTURE_NORMAL, paths);
+		}
+		return loadTextures(paths);
+	}
+	void addMaterialTextures(aiMaterial *mat, aiTextureType type, TextureType textureType, vector<pair<TextureType, string>> &paths)
+	{
+		for(unsigned int i = 0 ; i < mat->GetTextureCount(type); i++)
+		{
+			aiString str;
+			mat->GetTexture(type, i, &str); // Get texture file location
+			paths.push_back(make_pair(textureType, string(str.C_Str())));
+		}
+	}
+	// Loads a material's textures, its specular, gloss, occlusion and height maps packed into a single mask
+	// texture (the first map of each type, see TexturePacker)
+	vector<Texture> loadTextures(const vector<pair<TextureType, string>> &paths)
+	{
+		vector<Texture> textures;
+		string maskSources[MASK_CHANNEL_COUNT];
+		for (const pair<TextureType, string> &path : paths)
+		{
+			MaskChannel channel;
+			if (!maskChannelOf(path.first, channel))
+				textures.push_back(loadTexture(path.second.c_str(), path.first));
+			else if (maskSources[channel].empty())
+				maskSources[channel] = path.second;
+		}
+		string packed = TexturePacker::PackedPath(maskSources);
+		if (!packed.empty() && TexturePacker::Pack(directory, maskSources))
+			textures.push_back(loadTexture(packed.c_str(), TEXTURE_MASK));
 		return textures;
 	}
-};
-
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
-{
-	string filename = string(path);
-	filename = directory + '/' + filename;
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if(data)
+	static bool maskChannelOf(TextureType type, MaskChannel &channel)
 	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
+		const TextureType maskTypes[MASK_CHANNEL_COUNT] = { TEXTURE_SPECULAR, TEXTURE_GLOSS, TEXTURE_OCCLUSION, TEXTURE_HEIGHT };
+		for (unsigned int c = 0; c < MASK_CHANNEL_COUNT; c++)
+		{
+			if (type == maskTypes[c])
+			{
+				channel = (MaskChannel)c;
+				return true;
+			}
+		}
+		return false;
 	}
-	else
+	Texture loadTexture(const char *path, TextureType type)
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		Texture texture;
+		texture.type = type;
+		texture.maskChannels = type == TEXTURE_MASK ? (unsigned char)TexturePacker::ChannelsFromPath(path) : 0;
+		texture.path = StringTable::Shared().Intern(path);
+
+		// Textures used by several meshes (or models) are only loaded once, the process-wide cache hands back
+		// the same GL texture and counts the reference, released when the model is destroyed
+		bool gamma = isColor(type);
+		string key = TextureCache::MakeKey(directory + '/' + path, GL_TEXTURE_2D, gamma);
+		texture.id = TextureCache::Shared().Acquire(key, [&](size_t &) { return TextureFromFile(path, directory, gamma); });
+		textures_loaded.push_back(texture);
+		return texture;
 	}
+};
 
-	return textureID;
+// Returns a texture holding a placeholder right away, the file is decoded on the worker threads and uploaded
+// by TextureStreamer::Update (its size reaches the texture cache at that point). gamma marks sRGB color, whose mips
+// are averaged in linear light.
+GpuTexture TextureFromFile(const char *path, const string &directory, bool gamma)
+{
+	string filename = string(path);
+	filename = directory + '/' + filename;
+	return TextureStreamer::Shared().Request(filename, gamma);
 }
 #endif
@@ -0,0 +1,138 @@
+#ifndef MODEL_INSTANCES_H
+#define MODEL_INSTANCES_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "GpuResource.h"
+
+#include <vector>
+
+// Layout of one command read by glDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLuint baseVertex;
+	GLuint baseInstance;
+};
+
+// Work group size of shaders/instance_cull.comp
+const unsigned int CULL_GROUP_SIZE = 64;
+
+// GPU side state to draw many instances of one Model: the per-instance transforms, the per-mesh indirect
+// commands and the compacted list of transforms that survived frustum culling.
+// Visible instances of mesh i are written at [i * maxInstances, i * maxInstances + instanceCount) of the visible
+// buffer, which each mesh reads as an instanced vertex attribute starting at its command's baseInstance.
+class ModelInstances
+{
+public:
+	unsigned int maxInstances;
+	unsigned int instanceCount = 0;
+
+	ModelInstances(unsigned int maxInstances) : maxInstances(maxInstances)
+	{
+		transformsSSBO = GpuBuffer::Create(GPU_MEMORY_STORAGE_BUFFERS);
+		GpuBufferData(transformsSSBO, GL_SHADER_STORAGE_BUFFER, maxInstances * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	/// Uploads the world transform of every instance, only needs to be called when instances move
+	void SetTransforms(const std::vector<glm::mat4> &transforms)
+	{
+		instanceCount = transforms.size() < maxInstances ? (unsigned int)transforms.size() : maxInstances;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, transformsSSBO);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, instanceCount * sizeof(glm::mat4), transforms.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	/// Called by the Model the first time it draws these instances
+	/// @param commands one command per mesh, with instanceCount left at 0
+	/// @param meshSpheres model space bounding sphere (xyz center, w radius) of every mesh
+	void Allocate(const std::vector<DrawElementsIndirectCommand> &commands, const std::vector<glm::vec4> &meshSpheres)
+	{
+		this->commands = commands;
+		for (unsigned int i = 0; i < this->commands.size(); i++)
+			this->commands[i].baseInstance = i * maxInstances;
+
+		boundsSSBO = GpuBuffer::Create(GPU_MEMORY_STORAGE_BUFFERS);
+		GpuBufferData(boundsSSBO, GL_SHADER_STORAGE_BUFFER, meshSpheres.size() * sizeof(glm::vec4), meshSpheres.data(), GL_STATIC_DRAW);
+
+		visibleBuffer = GpuBuffer::Create(GPU_MEMORY_STORAGE_BUFFERS);
+		GpuBufferData(visibleBuffer, GL_SHADER_STORAGE_BUFFER, this->commands.size() * maxInstances * sizeof(glm::mat4), NULL, GL_DYNAMIC_COPY);
+
+		commandBuffer = GpuBuffer::Create(GPU_MEMORY_STORAGE_BUFFERS);
+		GpuBufferData(commandBuffer, GL_SHADER_STORAGE_BUFFER, this->commands.size() * sizeof(DrawElementsIndirectCommand), this->commands.data(), GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+	bool IsAllocated() const { return !commands.empty(); }
+
+	/// Uploads the transform of every mesh within the model (its node's world matrix)
+	/// @param version version of the node hierarchy these transforms come from
+	void SetMeshTransforms(const std::vector<glm::mat4> &meshTransforms, unsigned int version)
+	{
+		if (!meshTransformsSSBO)
+			meshTransformsSSBO = GpuBuffer::Create(GPU_MEMORY_STORAGE_BUFFERS);
+		GpuBufferData(meshTransformsSSBO, GL_SHADER_STORAGE_BUFFER, meshTransforms.size() * sizeof(glm::mat4), meshTransforms.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		meshTransformsVersion = version;
+	}
+	unsigned int MeshTransformsVersion() const { return meshTransformsVersion; }
+
+	/// Frustum culls every instance of every mesh on the GPU and fills in the instanceCount of the indirect commands
+	void Cull(Shader &cullShader, const glm::mat4 &viewProjection)
+	{
+		// Reset the instance counts the compute shader accumulates into
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		cullShader.Use();
+		cullShader.setUInt("instanceCount", instanceCount);
+		cullShader.setUInt("maxInstances", maxInstances);
+		glm::vec4 planes[6];
+		extractFrustumPlanes(viewProjection, planes);
+		for (int i = 0; i < 6; i++)
+			cullShader.setVec4("frustumPlanes[" + std::to_string(i) + "]", planes[i]);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, transformsSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, boundsSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visibleBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, meshTransformsSSBO);
+		glDispatchCompute((instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, (GLuint)commands.size(), 1);
+
+		// Make the results visible to the indirect draws and to the instanced vertex attributes
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	}
+
+	// Gribb-Hartmann extraction of the 6 clip planes from a view-projection matrix, normalized so that
+	// dot(plane.xyz, p) + plane.w is the signed distance of p to the plane
+	static void extractFrustumPlanes(const glm::mat4 &m, glm::vec4 *planes)
+	{
+		glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+		planes[0] = row3 + row0; // left
+		planes[1] = row3 - row0; // right
+		planes[2] = row3 + row1; // bottom
+		planes[3] = row3 - row1; // top
+		planes[4] = row3 + row2; // near
+		planes[5] = row3 - row2; // far
+		for (int i = 0; i < 6; i++)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	GLuint VisibleBuffer() const { return visibleBuffer; }
+	GLuint CommandBuffer() const { return commandBuffer; }
+
+private:
+	GpuBuffer transformsSSBO, boundsSSBO, visibleBuffer, commandBuffer, meshTransformsSSBO;
+	unsigned int meshTransformsVersion = ~0u;
+	std::vector<DrawElementsIndirectCommand> commands;
+};
+#endif
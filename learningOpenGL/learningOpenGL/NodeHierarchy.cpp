@@ -0,0 +1,72 @@
+#include "NodeHierarchy.h"
+
+unsigned int NodeHierarchy::AddNode(int parent, const glm::mat4 &localTransform, const std::string &name)
+{
+	unsigned int node = (unsigned int)parents.size();
+	parents.push_back(parent);
+	subtreeEnds.push_back(node + 1);
+	locals.push_back(localTransform);
+	worlds.push_back(parent >= 0 ? worlds[parent] * localTransform : localTransform);
+	dirty.push_back(0);
+	childDirty.push_back(0);
+	names.push_back(name);
+
+	// The new node extends the subtree of each of its ancestors
+	for (int ancestor = parent; ancestor >= 0; ancestor = parents[ancestor])
+		subtreeEnds[ancestor] = node + 1;
+	version++;
+	return node;
+}
+
+void NodeHierarchy::SetLocalTransform(unsigned int node, const glm::mat4 &localTransform)
+{
+	locals[node] = localTransform;
+	dirty[node] = 1;
+	// Flag the path to the root so the update pass knows which subtrees to walk into
+	for (int ancestor = parents[node]; ancestor >= 0 && !childDirty[ancestor]; ancestor = parents[ancestor])
+		childDirty[ancestor] = 1;
+}
+
+bool NodeHierarchy::UpdateWorldTransforms()
+{
+	bool changed = false;
+	unsigned int count = NodeCount();
+	unsigned int node = 0;
+	while (node < count)
+	{
+		if (dirty[node])
+		{
+			// Everything below a changed node is recomputed in one linear pass over the contiguous subtree,
+			// parents always come first so their world matrix is already up to date
+			unsigned int end = subtreeEnds[node];
+			for (unsigned int i = node; i < end; i++)
+			{
+				worlds[i] = parents[i] >= 0 ? worlds[parents[i]] * locals[i] : locals[i];
+				dirty[i] = 0;
+				childDirty[i] = 0;
+			}
+			node = end;
+			changed = true;
+		}
+		else if (childDirty[node])
+		{
+			childDirty[node] = 0;
+			node++; // walk into the subtree to find the dirty nodes
+		}
+		else
+			node = subtreeEnds[node]; // nothing changed below, skip the whole subtree
+	}
+	if (changed)
+		version++;
+	return changed;
+}
+
+int NodeHierarchy::FindNode(const std::string &name) const
+{
+	for (unsigned int i = 0; i < names.size(); i++)
+	{
+		if (names[i] == name)
+			return (int)i;
+	}
+	return -1;
+}
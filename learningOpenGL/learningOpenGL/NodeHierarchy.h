@@ -0,0 +1,45 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// Transform hierarchy of a Model's nodes, stored as flat arrays in depth-first (pre-order) traversal order.
+// A parent always comes before its children and every subtree is a contiguous range of nodes, so the world
+// matrices are refreshed with one linear pass that only visits the subtrees below a changed local transform.
+class NodeHierarchy
+{
+public:
+	/// Adds a node, nodes MUST be added in pre-order (a node, then all of its descendants, then its next sibling)
+	/// @param parent index of the parent node, -1 for the root
+	/// @return index of the new node
+	unsigned int AddNode(int parent, const glm::mat4 &localTransform, const std::string &name);
+
+	/// Changes a node's transform relative to its parent, its subtree is refreshed on the next UpdateWorldTransforms
+	void SetLocalTransform(unsigned int node, const glm::mat4 &localTransform);
+	/// Recomputes the world matrices of the dirty subtrees, returns true if anything changed
+	bool UpdateWorldTransforms();
+
+	unsigned int NodeCount() const { return (unsigned int)parents.size(); }
+	int Parent(unsigned int node) const { return parents[node]; }
+	const std::string &Name(unsigned int node) const { return names[node]; }
+	const glm::mat4 &LocalTransform(unsigned int node) const { return locals[node]; }
+	/// Transform from the node to the model's root space, valid after UpdateWorldTransforms
+	const glm::mat4 &WorldTransform(unsigned int node) const { return worlds[node]; }
+	/// Index of the first node after this node's subtree
+	unsigned int SubtreeEnd(unsigned int node) const { return subtreeEnds[node]; }
+	/// Index of the node with that name, -1 if there is none
+	int FindNode(const std::string &name) const;
+	/// Bumped every time world matrices change, lets dependent GPU data know when to re-upload
+	unsigned int Version() const { return version; }
+
+private:
+	std::vector<int> parents;
+	std::vector<unsigned int> subtreeEnds;
+	std::vector<glm::mat4> locals;
+	std::vector<glm::mat4> worlds;
+	std::vector<unsigned char> dirty;		// the local transform changed, the whole subtree must be recomputed
+	std::vector<unsigned char> childDirty;	// some node in the subtree is dirty
+	std::vector<std::string> names;
+	unsigned int version = 0;
+};
@@ -0,0 +1,481 @@
+#include "NormalMapBaker.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "MipGenerator.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	const unsigned int BVH_LEAF_TRIANGLES = 4;
+	const uint32_t NO_TRIANGLE = 0xffffffffu;
+
+	struct BvhNode
+	{
+		glm::vec3 boundsMin, boundsMax;
+		uint32_t first;	// first triangle of a leaf, or the second child of an inner node (the first one follows the node)
+		uint32_t count;	// triangles of a leaf, 0 for inner nodes
+	};
+
+	// Closest hit on a line, t is signed: negative hits are behind the origin
+	struct Hit
+	{
+		uint32_t triangle = NO_TRIANGLE;
+		float t = 0.0f, u = 0.0f, v = 0.0f;
+	};
+
+	float cross2(glm::vec2 a, glm::vec2 b)
+	{
+		return a.x * b.y - a.y * b.x;
+	}
+
+	// Bounding volume hierarchy over the triangles of a mesh, split at the median centroid of the longest axis
+	class TriangleBvh
+	{
+	public:
+		TriangleBvh(const std::vector<Vertex> &vertices, const unsigned int *indices, size_t indexCount)
+			: vertices(vertices), indices(indices)
+		{
+			uint32_t count = (uint32_t)(indexCount / 3);
+			triangles.resize(count);
+			centroids.resize(count);
+			for (uint32_t t = 0; t < count; t++)
+			{
+				triangles[t] = t;
+				centroids[t] = (corner(t, 0) + corner(t, 1) + corner(t, 2)) / 3.0f;
+			}
+			nodes.reserve(2 * count / BVH_LEAF_TRIANGLES + 1);
+			if (count > 0)
+				build(0, count);
+		}
+
+		const glm::vec3 &corner(uint32_t triangle, int k) const { return vertices[indices[triangle * 3 + k]].Position; }
+
+		/// Hit with the smallest |t| within [-maxDistance, maxDistance] of the origin
+		Hit Closest(glm::vec3 origin, glm::vec3 direction, float maxDistance) const
+		{
+			Hit hit;
+			if (nodes.empty())
+				return hit;
+			float best = maxDistance;
+			glm::vec3 inverse;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float d = direction[axis];
+				inverse[axis] = std::abs(d) > 1e-20f ? 1.0f / d : (d < 0.0f ? -1e20f : 1e20f);
+			}
+
+			uint32_t stack[64];
+			int top = 0;
+			stack[top++] = 0;
+			while (top > 0)
+			{
+				uint32_t index = stack[--top];
+				const BvhNode &node = nodes[index];
+				if (nearest(node, origin, inverse, maxDistance) >= best)
+					continue;
+				if (node.count > 0)
+				{
+					for (uint32_t i = node.first; i < node.first + node.count; i++)
+					{
+						float t, u, v;
+						if (intersect(triangles[i], origin, direction, t, u, v) && std::abs(t) < best)
+						{
+							best = std::abs(t);
+							hit.triangle = triangles[i];
+							hit.t = t;
+							hit.u = u;
+							hit.v = v;
+						}
+					}
+					continue;
+				}
+				// Nearer child on top of the stack, so the farther one is mostly culled by the time it's popped
+				uint32_t first = index + 1, second = node.first;
+				if (nearest(nodes[first], origin, inverse, maxDistance) > nearest(nodes[second], origin, inverse, maxDistance))
+					std::swap(first, second);
+				stack[top++] = second;
+				stack[top++] = first;
+			}
+			return hit;
+		}
+
+	private:
+		const std::vector<Vertex> &vertices;
+		const unsigned int *indices;
+		std::vector<uint32_t> triangles;
+		std::vector<glm::vec3> centroids;
+		std::vector<BvhNode> nodes;
+
+		void build(uint32_t begin, uint32_t end)
+		{
+			BvhNode node;
+			node.boundsMin = glm::vec3(FLT_MAX);
+			node.boundsMax = glm::vec3(-FLT_MAX);
+			glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+			for (uint32_t i = begin; i < end; i++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					node.boundsMin = glm::min(node.boundsMin, corner(triangles[i], k));
+					node.boundsMax = glm::max(node.boundsMax, corner(triangles[i], k));
+				}
+				centroidMin = glm::min(centroidMin, centroids[triangles[i]]);
+				centroidMax = glm::max(centroidMax, centroids[triangles[i]]);
+			}
+			glm::vec3 extent = centroidMax - centroidMin;
+			int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+			uint32_t index = (uint32_t)nodes.size();
+			nodes.push_back(node);
+			if (end - begin <= BVH_LEAF_TRIANGLES || extent[axis] <= 0.0f)
+			{
+				nodes[index].first = begin;
+				nodes[index].count = end - begin;
+				return;
+			}
+			uint32_t middle = begin + (end - begin) / 2;
+			std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end,
+				[this, axis](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+			nodes[index].count = 0;
+			build(begin, middle);
+			nodes[index].first = (uint32_t)nodes.size();
+			build(middle, end);
+		}
+
+		// Smallest |t| at which the line is inside the node's bounds, FLT_MAX if it misses them within maxDistance
+		static float nearest(const BvhNode &node, glm::vec3 origin, glm::vec3 inverse, float maxDistance)
+		{
+			float tNear = -maxDistance, tFar = maxDistance;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float t0 = (node.boundsMin[axis] - origin[axis]) * inverse[axis];
+				float t1 = (node.boundsMax[axis] - origin[axis]) * inverse[axis];
+				tNear = std::max(tNear, std::min(t0, t1));
+				tFar = std::min(tFar, std::max(t0, t1));
+			}
+			if (tNear > tFar)
+				return FLT_MAX;
+			if (tNear <= 0.0f && tFar >= 0.0f)
+				return 0.0f;
+			return tNear > 0.0f ? tNear : -tFar;
+		}
+
+		// Moller-Trumbore, both faces count since the high poly surface may be on either side
+		bool intersect(uint32_t triangle, glm::vec3 origin, glm::vec3 direction, float &t, float &u, float &v) const
+		{
+			glm::vec3 p0 = corner(triangle, 0);
+			glm::vec3 e1 = corner(triangle, 1) - p0, e2 = corner(triangle, 2) - p0;
+			glm::vec3 p = glm::cross(direction, e2);
+			float determinant = glm::dot(e1, p);
+			if (std::abs(determinant) < 1e-30f)
+				return false;
+			float inverseDeterminant = 1.0f / determinant;
+			glm::vec3 toOrigin = origin - p0;
+			u = glm::dot(toOrigin, p) * inverseDeterminant;
+			if (u < 0.0f || u > 1.0f)
+				return false;
+			glm::vec3 q = glm::cross(toOrigin, e1);
+			v = glm::dot(direction, q) * inverseDeterminant;
+			if (v < 0.0f || u + v > 1.0f)
+				return false;
+			t = glm::dot(e2, q) * inverseDeterminant;
+			return true;
+		}
+	};
+
+	void encode(glm::vec3 normal, unsigned char *pixel)
+	{
+		for (int k = 0; k < 3; k++)
+			pixel[k] = (unsigned char)std::lround(std::min(std::max(normal[k] * 0.5f + 0.5f, 0.0f), 1.0f) * 255.0f);
+		pixel[3] = 255;
+	}
+
+	glm::vec3 decode(const unsigned char *pixel)
+	{
+		return glm::vec3(pixel[0], pixel[1], pixel[2]) / 127.5f - glm::vec3(1.0f);
+	}
+
+	// Bilinear, repeating sample of a tangent space normal map read like the shaders do: x and y from the map and z
+	// rebuilt, as cooked normal maps only keep two channels
+	glm::vec3 sampleNormalMap(const NormalMapBaker::Image &map, glm::vec2 uv)
+	{
+		float x = uv.x * map.width - 0.5f, y = uv.y * map.height - 0.5f;
+		float fx = std::floor(x), fy = std::floor(y);
+		int x0 = (int)fx, y0 = (int)fy;
+		float tx = x - fx, ty = y - fy;
+		glm::vec2 xy(0.0f);
+		for (int k = 0; k < 4; k++)
+		{
+			int sx = x0 + (k & 1), sy = y0 + (k >> 1);
+			sx = ((sx % (int)map.width) + (int)map.width) % (int)map.width;
+			sy = ((sy % (int)map.height) + (int)map.height) % (int)map.height;
+			const unsigned char *pixel = &map.pixels[((size_t)sy * map.width + sx) * 4];
+			float weight = ((k & 1) ? tx : 1.0f - tx) * ((k >> 1) ? ty : 1.0f - ty);
+			xy += weight * (glm::vec2(pixel[0], pixel[1]) / 255.0f * 2.0f - glm::vec2(1.0f));
+		}
+		return glm::vec3(xy, std::sqrt(std::max(1.0f - glm::dot(xy, xy), 0.0f)));
+	}
+}
+
+bool NormalMapBaker::Bake(const std::vector<Vertex> &highVertices, const unsigned int *highIndices, size_t highIndexCount,
+	const std::vector<Vertex> &lowVertices, const unsigned int *lowIndices, size_t lowIndexCount,
+	const Image *highNormalMap, const NormalMapBakeSettings &settings, Image &image)
+{
+	uint32_t lowTriangles = (uint32_t)(lowIndexCount / 3);
+	if (highIndexCount < 3 || lowTriangles == 0 || settings.resolution == 0)
+		return false;
+	if (highNormalMap && (highNormalMap->width == 0 || highNormalMap->height == 0
+		|| highNormalMap->pixels.size() < (size_t)highNormalMap->width * highNormalMap->height * 4))
+		highNormalMap = nullptr;
+	unsigned int size = settings.resolution;
+	float maxDistance = settings.maxDistance;
+	if (maxDistance <= 0.0f)
+	{
+		glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+		for (size_t i = 0; i < lowIndexCount; i++)
+		{
+			boundsMin = glm::min(boundsMin, lowVertices[lowIndices[i]].Position);
+			boundsMax = glm::max(boundsMax, lowVertices[lowIndices[i]].Position);
+		}
+		maxDistance = 0.02f * glm::length(boundsMax - boundsMin);
+	}
+	TriangleBvh bvh(highVertices, highIndices, highIndexCount);
+
+	// Which low poly triangle covers each texel center, and the weights of its second and third corners there.
+	// Overlapping UVs keep the last triangle, texels no center falls in are filled by the dilation.
+	size_t texelCount = (size_t)size * size;
+	std::vector<uint32_t> texelTriangles(texelCount, NO_TRIANGLE);
+	std::vector<glm::vec2> texelWeights(texelCount);
+	for (uint32_t t = 0; t < lowTriangles; t++)
+	{
+		glm::vec2 uv[3];
+		for (int k = 0; k < 3; k++)
+			uv[k] = lowVertices[lowIndices[t * 3 + k]].TexCoords * (float)size;
+		glm::vec2 e1 = uv[1] - uv[0], e2 = uv[2] - uv[0];
+		float area = cross2(e1, e2);
+		if (std::abs(area) < 1e-12f)
+			continue;
+		glm::vec2 uvMin = glm::min(uv[0], glm::min(uv[1], uv[2])), uvMax = glm::max(uv[0], glm::max(uv[1], uv[2]));
+		int x0 = std::max(0, (int)std::ceil(uvMin.x - 0.5f)), x1 = std::min((int)size - 1, (int)std::floor(uvMax.x - 0.5f));
+		int y0 = std::max(0, (int)std::ceil(uvMin.y - 0.5f)), y1 = std::min((int)size - 1, (int)std::floor(uvMax.y - 0.5f));
+		for (int y = y0; y <= y1; y++)
+		{
+			for (int x = x0; x <= x1; x++)
+			{
+				glm::vec2 offset = glm::vec2(x + 0.5f, y + 0.5f) - uv[0];
+				float w1 = cross2(offset, e2) / area, w2 = cross2(e1, offset) / area;
+				if (w1 < -1e-5f || w2 < -1e-5f || w1 + w2 > 1.0f + 1e-5f)
+					continue;
+				size_t texel = (size_t)y * size + x;
+				texelTriangles[texel] = t;
+				texelWeights[texel] = glm::vec2(w1, w2);
+			}
+		}
+	}
+
+	image.width = size;
+	image.height = size;
+	image.pixels.assign(texelCount * 4, 0);
+	ThreadPool::Shared().ParallelFor(size, [&](unsigned int y)
+	{
+		for (unsigned int x = 0; x < size; x++)
+		{
+			size_t texel = (size_t)y * size + x;
+			uint32_t triangle = texelTriangles[texel];
+			if (triangle == NO_TRIANGLE)
+				continue;
+			const Vertex &a = lowVertices[lowIndices[triangle * 3]];
+			const Vertex &b = lowVertices[lowIndices[triangle * 3 + 1]];
+			const Vertex &c = lowVertices[lowIndices[triangle * 3 + 2]];
+			float w1 = texelWeights[texel].x, w2 = texelWeights[texel].y, w0 = 1.0f - w1 - w2;
+
+			// The frame as the fragment shader sees it: interpolated and not renormalized
+			glm::vec3 position = a.Position * w0 + b.Position * w1 + c.Position * w2;
+			glm::vec3 normal = a.Normal * w0 + b.Normal * w1 + c.Normal * w2;
+			glm::vec4 tangent4 = a.Tangent * w0 + b.Tangent * w1 + c.Tangent * w2;
+			glm::vec3 tangent = glm::vec3(tangent4);
+			glm::vec3 bitangent = tangent4.w * glm::cross(normal, tangent);
+			float normalLength = glm::length(normal);
+			if (normalLength <= 0.0f)
+				continue;
+			glm::vec3 direction = normal / normalLength;
+
+			glm::vec3 highNormal = direction;
+			Hit hit = bvh.Closest(position, direction, maxDistance);
+			if (hit.triangle != NO_TRIANGLE)
+			{
+				const Vertex &ha = highVertices[highIndices[hit.triangle * 3]];
+				const Vertex &hb = highVertices[highIndices[hit.triangle * 3 + 1]];
+				const Vertex &hc = highVertices[highIndices[hit.triangle * 3 + 2]];
+				float h0 = 1.0f - hit.u - hit.v;
+				glm::vec3 interpolated = ha.Normal * h0 + hb.Normal * hit.u + hc.Normal * hit.v;
+				glm::vec4 highTangent = ha.Tangent * h0 + hb.Tangent * hit.u + hc.Tangent * hit.v;
+				// The high poly's normal map perturbs its normal in its own frame, the same way the shader does
+				if (highNormalMap && highTangent.w != 0.0f)
+				{
+					glm::vec3 detail = sampleNormalMap(*highNormalMap, ha.TexCoords * h0 + hb.TexCoords * hit.u + hc.TexCoords * hit.v);
+					glm::vec3 highBitangent = highTangent.w * glm::cross(interpolated, glm::vec3(highTangent));
+					interpolated = detail.x * glm::vec3(highTangent) + detail.y * highBitangent + detail.z * interpolated;
+				}
+				if (glm::length(interpolated) > 0.0f)
+					highNormal = glm::normalize(interpolated);
+			}
+			else if (highNormalMap && tangent4.w != 0.0f)
+			{
+				// Nothing to project from, the texel keeps the material's detail on the low poly's own frame
+				glm::vec3 detail = sampleNormalMap(*highNormalMap, a.TexCoords * w0 + b.TexCoords * w1 + c.TexCoords * w2);
+				glm::vec3 perturbed = detail.x * tangent + detail.y * bitangent + detail.z * normal;
+				if (glm::length(perturbed) > 0.0f)
+					highNormal = glm::normalize(perturbed);
+			}
+
+			// Solve highNormal = x * tangent + y * bitangent + z * normal, the inverse of [T B N] by its cofactors
+			glm::vec3 tangentNormal(0.0f, 0.0f, 1.0f);
+			glm::vec3 bn = glm::cross(bitangent, normal), nt = glm::cross(normal, tangent), tb = glm::cross(tangent, bitangent);
+			float determinant = glm::dot(tangent, bn);
+			if (std::abs(determinant) > 1e-20f)
+			{
+				glm::vec3 solved = glm::vec3(glm::dot(bn, highNormal), glm::dot(nt, highNormal), glm::dot(tb, highNormal)) / determinant;
+				if (glm::length(solved) > 0.0f)
+					tangentNormal = glm::normalize(solved);
+			}
+			encode(tangentNormal, &image.pixels[texel * 4]);
+		}
+	});
+
+	// Grow the islands into the gutter so bilinear filtering and mipmaps don't pull in the empty texels,
+	// alpha tells covered texels apart until the end
+	std::vector<unsigned char> previous;
+	for (unsigned int pass = 0; pass < settings.dilation; pass++)
+	{
+		previous = image.pixels;
+		ThreadPool::Shared().ParallelFor(size, [&](unsigned int y)
+		{
+			for (unsigned int x = 0; x < size; x++)
+			{
+				size_t texel = (size_t)y * size + x;
+				if (previous[texel * 4 + 3] != 0)
+					continue;
+				glm::vec3 sum(0.0f);
+				bool found = false;
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int nx = (int)x + dx, ny = (int)y + dy;
+						if (nx < 0 || ny < 0 || nx >= (int)size || ny >= (int)size)
+							continue;
+						const unsigned char *neighbour = &previous[((size_t)ny * size + nx) * 4];
+						if (neighbour[3] == 0)
+							continue;
+						sum += decode(neighbour);
+						found = true;
+					}
+				}
+				if (found && glm::length(sum) > 0.0f)
+					encode(glm::normalize(sum), &image.pixels[texel * 4]);
+			}
+		});
+	}
+	// What the dilation didn't reach is flat
+	for (size_t texel = 0; texel < texelCount; texel++)
+	{
+		if (image.pixels[texel * 4 + 3] == 0)
+			encode(glm::vec3(0.0f, 0.0f, 1.0f), &image.pixels[texel * 4]);
+	}
+	return true;
+}
+
+GpuTexture NormalMapBaker::Upload(const Image &image)
+{
+	GpuTexture texture = GpuTexture::Create();
+	glBindTexture(GL_TEXTURE_2D, texture);
+	// Normals are linear data, not sRGB
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels.data());
+	// Mips renormalized, so the normals stay unit length in the distance
+	MipSettings settings;
+	settings.normalMap = true;
+	settings.wrap = true;
+	std::vector<std::vector<uint8_t>> mips = MipGenerator::Build(image.pixels.data(), image.width, image.height, 4, settings);
+	size_t bytes = image.pixels.size();
+	unsigned int width = image.width, height = image.height;
+	for (unsigned int level = 0; level < mips.size(); level++)
+	{
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+		glTexImage2D(GL_TEXTURE_2D, level + 1, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, mips[level].data());
+		bytes += mips[level].size();
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	texture.SetBytes(bytes);
+	return texture;
+}
+
+bool NormalMapBaker::ReadCache(const std::string &path, uint64_t key, std::vector<Image> &images)
+{
+	MappedFile file(path);
+	if (!file.isOpen() || file.length() < sizeof(NormalMapCacheHeader))
+		return false;
+	const NormalMapCacheHeader *header = (const NormalMapCacheHeader*)file.begin();
+	if (header->magic != NORMAL_MAP_CACHE_MAGIC || header->version != NORMAL_MAP_CACHE_VERSION || header->key != key)
+		return false;
+
+	std::vector<Image> read(header->imageCount);
+	uint64_t offset = sizeof(NormalMapCacheHeader);
+	for (Image &image : read)
+	{
+		uint32_t size[2];
+		if (file.length() - offset < sizeof(size))
+			return false;
+		std::memcpy(size, file.begin() + offset, sizeof(size));
+		offset += sizeof(size);
+		uint64_t bytes = (uint64_t)size[0] * size[1] * 4;
+		if (file.length() - offset < bytes)
+			return false;
+		image.width = size[0];
+		image.height = size[1];
+		image.pixels.assign(file.begin() + offset, file.begin() + offset + bytes);
+		offset += bytes;
+	}
+	images = std::move(read);
+	return true;
+}
+
+bool NormalMapBaker::WriteCache(const std::string &path, uint64_t key, const std::vector<Image> &images)
+{
+	NormalMapCacheHeader header = {};
+	header.magic = NORMAL_MAP_CACHE_MAGIC;
+	header.version = NORMAL_MAP_CACHE_VERSION;
+	header.key = key;
+	header.imageCount = (uint32_t)images.size();
+
+	// Write to a temporary file and rename it so a crash never leaves a half written cache behind
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		out.write((const char*)&header, sizeof(header));
+		for (const Image &image : images)
+		{
+			uint32_t size[2] = { image.width, image.height };
+			out.write((const char*)size, sizeof(size));
+			out.write((const char*)image.pixels.data(), (std::streamsize)image.pixels.size());
+		}
+		if (!out)
+			return false;
+	}
+	std::remove(path.c_str());
+	return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
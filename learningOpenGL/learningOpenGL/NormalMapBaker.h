@@ -0,0 +1,65 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "GpuResource.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cache of the maps baked for a model's meshes, written next to the model as <model>.lodnormals: a
+// NormalMapCacheHeader, then for every mesh its width and height (0 for meshes with no map) and RGBA8 pixels
+const uint32_t NORMAL_MAP_CACHE_MAGIC = 0x4D4E4F4C; // "LONM"
+const uint32_t NORMAL_MAP_CACHE_VERSION = 1;
+
+struct NormalMapCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;		// hash of everything the maps were baked from, see Model::CookLODNormalMaps
+	uint32_t imageCount;
+	uint32_t reserved;
+};
+
+struct NormalMapBakeSettings
+{
+	unsigned int resolution = 512;	// pixels per side of the map
+	float maxDistance = 0.0f;		// furthest the high poly surface is searched for, 0 for 2% of the low poly's diagonal
+	unsigned int dilation = 4;		// texels the result is grown into the gutter around the UV islands
+};
+
+// Bakes the detail a simplified mesh lost into a tangent space normal map of the simplified mesh.
+// The low poly triangles are rasterized in UV space, and from every covered texel a line along the interpolated
+// normal is cast both ways against a BVH of the high poly triangles. The high poly normal at the closest hit is
+// expressed in the low poly's tangent frame exactly the way shaders/model_loading.frag rebuilds it (MikkTSpace:
+// B = w * cross(N, T), unnormalized interpolated frame), so the lighting of the low poly matches the high poly's.
+// The high poly's own normal map, made for LOD 0, is applied at the hit the way the shader would, so the baked map
+// carries the authored detail too and replaces it on the LODs.
+// Rows of texels are traced in parallel on the worker pool.
+class NormalMapBaker
+{
+public:
+	struct Image
+	{
+		unsigned int width = 0, height = 0;
+		std::vector<unsigned char> pixels;	// RGBA8, rows bottom to top like GL textures
+	};
+
+	/// @param high, low vertices and triangles of both meshes, their positions must share the same space
+	/// and the low poly mesh needs texture coordinates and tangents (see TangentSpace)
+	/// @param highNormalMap tangent space normal map of the high poly's material (RGBA8), null if it has none
+	/// @return false if there is nothing to bake
+	static bool Bake(const std::vector<Vertex> &highVertices, const unsigned int *highIndices, size_t highIndexCount,
+		const std::vector<Vertex> &lowVertices, const unsigned int *lowIndices, size_t lowIndexCount,
+		const Image *highNormalMap, const NormalMapBakeSettings &settings, Image &image);
+
+	/// Reads the maps of a cache written with the same key, false if it is missing, stale or corrupt
+	static bool ReadCache(const std::string &path, uint64_t key, std::vector<Image> &images);
+	static bool WriteCache(const std::string &path, uint64_t key, const std::vector<Image> &images);
+
+	/// Uploads a baked map as a mipmapped linear texture, on the GL thread
+	static GpuTexture Upload(const Image &image);
+};
@@ -0,0 +1,556 @@
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include "MeshSimplifier.h"
+#include "TangentSpace.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+namespace
+{
+	// Chunks per worker thread, more chunks than threads keeps them busy when lines have uneven costs
+	const unsigned int CHUNKS_PER_THREAD = 4;
+	// Files smaller than this are parsed as a single chunk
+	const size_t MIN_CHUNK_BYTES = 64 * 1024;
+
+	// v/vt/vn indices of one face corner, 0-based, -1 when absent
+	struct ObjCorner
+	{
+		int position, texCoord, normal;
+		unsigned char relative; // bits set for indices given relative to the end of their chunk (negative in the file)
+	};
+
+	// Start of a new mesh within a chunk's corners, from a g, o or usemtl statement
+	struct ObjBreak
+	{
+		size_t corner;
+		bool setsMaterial;
+		std::string material;
+	};
+
+	struct ObjChunk
+	{
+		const char *begin, *end;
+		std::vector<glm::vec3> positions, normals;
+		std::vector<glm::vec2> texCoords;
+		std::vector<ObjCorner> corners; // 3 per triangle
+		std::vector<ObjBreak> breaks;
+		std::vector<std::string> libraries;
+		unsigned int firstPosition = 0, firstNormal = 0, firstTexCoord = 0;
+		bool error = false;
+	};
+
+	// Range of one chunk's corners belonging to a mesh
+	struct ObjSegment
+	{
+		unsigned int chunk;
+		size_t begin, end;
+	};
+
+	bool isSpace(char c) { return c == ' ' || c == '\t'; }
+	bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+	const char *skipSpaces(const char *p, const char *end)
+	{
+		while (p < end && isSpace(*p))
+			p++;
+		return p;
+	}
+
+	const char *nextLine(const char *p, const char *end)
+	{
+		const char *newline = (const char*)std::memchr(p, '\n', end - p);
+		return newline ? newline + 1 : end;
+	}
+
+	// Rest of the line without surrounding blanks
+	std::string restOfLine(const char *p, const char *end)
+	{
+		p = skipSpaces(p, end);
+		const char *last = p;
+		while (last < end && *last != '\n' && *last != '\r')
+			last++;
+		while (last > p && isSpace(last[-1]))
+			last--;
+		return std::string(p, last);
+	}
+
+	// Decimal float parser without locale or strtod overhead: integer mantissa scaled by a power of ten.
+	// Exact for the fixed point values exporters write, within an ulp or two otherwise.
+	const char *parseFloat(const char *p, const char *end, float &value)
+	{
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+		p = skipSpaces(p, end);
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		uint64_t mantissa = 0;
+		int exponent = 0, digits = 0;
+		for (; p < end && isDigit(*p); p++, digits++)
+		{
+			if (mantissa < 1000000000000000000ull)
+				mantissa = mantissa * 10 + (*p - '0');
+			else
+				exponent++;
+		}
+		if (p < end && *p == '.')
+		{
+			for (p++; p < end && isDigit(*p); p++, digits++)
+			{
+				if (mantissa < 1000000000000000000ull)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					exponent--;
+				}
+			}
+		}
+		if (digits == 0)
+			return nullptr;
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			p++;
+			bool negativeExponent = false;
+			if (p < end && (*p == '-' || *p == '+'))
+				negativeExponent = *p++ == '-';
+			int e = 0;
+			for (; p < end && isDigit(*p); p++)
+				e = e < 10000 ? e * 10 + (*p - '0') : e;
+			exponent += negativeExponent ? -e : e;
+		}
+
+		double result = (double)mantissa;
+		if (exponent < 0)
+			result = -exponent <= 22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+		else if (exponent > 0)
+			result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+		value = (float)(negative ? -result : result);
+		return p;
+	}
+
+	const char *parseInt(const char *p, const char *end, int &value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		if (p >= end || !isDigit(*p))
+			return nullptr;
+		int result = 0;
+		for (; p < end && isDigit(*p); p++)
+			result = result * 10 + (*p - '0');
+		value = negative ? -result : result;
+		return p;
+	}
+
+	// Converts a 1-based (or negative, relative) OBJ index: positive ones become global 0-based indices,
+	// negative ones become indices into the chunk, offset by the chunk's first element once that is known
+	int resolveIndex(int index, size_t chunkCount, unsigned char bit, unsigned char &relative)
+	{
+		if (index > 0)
+			return index - 1;
+		relative |= bit;
+		return (int)chunkCount + index;
+	}
+
+	const char *parseFace(const char *p, const char *end, ObjChunk &chunk)
+	{
+		ObjCorner polygon[64];
+		unsigned int count = 0;
+		for (;;)
+		{
+			p = skipSpaces(p, end);
+			if (p >= end || *p == '\n' || *p == '\r' || *p == '#')
+				break;
+
+			ObjCorner corner = { -1, -1, -1, 0 };
+			int index;
+			if (!(p = parseInt(p, end, index)) || index == 0)
+				return nullptr;
+			corner.position = resolveIndex(index, chunk.positions.size(), 1, corner.relative);
+			if (p < end && *p == '/')
+			{
+				p++;
+				if (p < end && *p != '/')
+				{
+					if (!(p = parseInt(p, end, index)) || index == 0)
+						return nullptr;
+					corner.texCoord = resolveIndex(index, chunk.texCoords.size(), 2, corner.relative);
+				}
+				if (p < end && *p == '/')
+				{
+					p++;
+					if (!(p = parseInt(p, end, index)) || index == 0)
+						return nullptr;
+					corner.normal = resolveIndex(index, chunk.normals.size(), 4, corner.relative);
+				}
+			}
+			if (count == 64)
+				return nullptr;
+			polygon[count++] = corner;
+		}
+		if (count < 3)
+			return nullptr;
+		// Fan triangulation, what aiProcess_Triangulate does for the convex polygons exporters write
+		for (unsigned int i = 1; i + 1 < count; i++)
+		{
+			chunk.corners.push_back(polygon[0]);
+			chunk.corners.push_back(polygon[i]);
+			chunk.corners.push_back(polygon[i + 1]);
+		}
+		return p;
+	}
+
+	void parseChunk(ObjChunk &chunk)
+	{
+		const char *end = chunk.end;
+		for (const char *line = chunk.begin; line < end; line = nextLine(line, end))
+		{
+			const char *p = skipSpaces(line, end);
+			if (p >= end)
+				break;
+			const char *next = p + 1;
+			bool ok = true;
+			if (p[0] == 'v' && next < end && isSpace(*next))
+			{
+				glm::vec3 position;
+				ok = (p = parseFloat(next, end, position.x)) && (p = parseFloat(p, end, position.y)) && (p = parseFloat(p, end, position.z));
+				chunk.positions.push_back(position);
+			}
+			else if (p[0] == 'v' && next < end && *next == 'n')
+			{
+				glm::vec3 normal;
+				ok = (p = parseFloat(next + 1, end, normal.x)) && (p = parseFloat(p, end, normal.y)) && (p = parseFloat(p, end, normal.z));
+				chunk.normals.push_back(normal);
+			}
+			else if (p[0] == 'v' && next < end && *next == 't')
+			{
+				glm::vec2 texCoord(0.0f, 0.0f);
+				ok = (p = parseFloat(next + 1, end, texCoord.x)) != nullptr;
+				if (ok)
+					parseFloat(p, end, texCoord.y); // v is optional
+				chunk.texCoords.push_back(glm::vec2(texCoord.x, 1.0f - texCoord.y)); // aiProcess_FlipUVs
+			}
+			else if (p[0] == 'f' && next < end && isSpace(*next))
+			{
+				ok = parseFace(next, end, chunk) != nullptr;
+			}
+			else if ((p[0] == 'g' || p[0] == 'o') && (next >= end || isSpace(*next) || *next == '\n' || *next == '\r'))
+			{
+				chunk.breaks.push_back({ chunk.corners.size(), false, std::string() });
+			}
+			else if (end - p > 7 && std::strncmp(p, "usemtl", 6) == 0 && isSpace(p[6]))
+			{
+				chunk.breaks.push_back({ chunk.corners.size(), true, restOfLine(p + 6, end) });
+			}
+			else if (end - p > 7 && std::strncmp(p, "mtllib", 6) == 0 && isSpace(p[6]))
+			{
+				chunk.libraries.push_back(restOfLine(p + 6, end));
+			}
+			// Anything else (comments, s, l, p, curves...) is ignored
+			if (!ok)
+			{
+				chunk.error = true;
+				return;
+			}
+		}
+	}
+
+	// Open addressing table from v/vt/vn triplets to the index of the vertex made from them
+	class CornerTable
+	{
+	public:
+		explicit CornerTable(size_t corners)
+		{
+			size_t capacity = 16;
+			while (capacity < corners * 2)
+				capacity *= 2;
+			slots.assign(capacity, ~0u);
+		}
+
+		/// Index of the vertex for that corner, or the next index (vertexCount) after adding it
+		unsigned int Insert(const ObjCorner &corner, const std::vector<ObjCorner> &vertexCorners, unsigned int vertexCount)
+		{
+			size_t mask = slots.size() - 1;
+			size_t slot = ((uint32_t)corner.position * 73856093u ^ (uint32_t)corner.texCoord * 19349663u ^ (uint32_t)corner.normal * 83492791u) & mask;
+			for (;; slot = (slot + 1) & mask)
+			{
+				unsigned int vertex = slots[slot];
+				if (vertex == ~0u)
+				{
+					slots[slot] = vertexCount;
+					return vertexCount;
+				}
+				const ObjCorner &other = vertexCorners[vertex];
+				if (other.position == corner.position && other.texCoord == corner.texCoord && other.normal == corner.normal)
+					return vertex;
+			}
+		}
+
+	private:
+		std::vector<unsigned int> slots;
+	};
+}
+
+bool ObjLoader::Load(const std::string &path)
+{
+	meshes.clear();
+	materials.clear();
+
+	MappedFile file(path);
+	if (!file.isOpen())
+	{
+		std::cout << "ERROR::OBJ::FILE_NOT_FOUND " << path << std::endl;
+		return false;
+	}
+	const char *text = (const char*)file.begin();
+	const char *textEnd = text + file.length();
+
+	// Split the file on line boundaries
+	ThreadPool &pool = ThreadPool::Shared();
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(pool.ThreadCount() * CHUNKS_PER_THREAD, file.length() / MIN_CHUNK_BYTES));
+	std::vector<ObjChunk> chunks(chunkCount);
+	const char *begin = text;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		const char *end = i + 1 == chunkCount ? textEnd : nextLine(std::max(begin, text + file.length() * (i + 1) / chunkCount), textEnd);
+		chunks[i].begin = begin;
+		chunks[i].end = end;
+		begin = end;
+	}
+
+	pool.ParallelFor((unsigned int)chunkCount, [&](unsigned int i) { parseChunk(chunks[i]); });
+
+	// Global attribute arrays, each chunk's elements following the previous chunk's
+	unsigned int positionCount = 0, normalCount = 0, texCoordCount = 0;
+	for (ObjChunk &chunk : chunks)
+	{
+		if (chunk.error)
+		{
+			std::cout << "ERROR::OBJ::PARSE_FAILED " << path << " in the lines starting at byte " << (chunk.begin - text) << std::endl;
+			return false;
+		}
+		chunk.firstPosition = positionCount;
+		chunk.firstNormal = normalCount;
+		chunk.firstTexCoord = texCoordCount;
+		positionCount += (unsigned int)chunk.positions.size();
+		normalCount += (unsigned int)chunk.normals.size();
+		texCoordCount += (unsigned int)chunk.texCoords.size();
+	}
+	std::vector<glm::vec3> positions(positionCount), normals(normalCount);
+	std::vector<glm::vec2> texCoords(texCoordCount);
+	pool.ParallelFor((unsigned int)chunkCount, [&](unsigned int i)
+	{
+		ObjChunk &chunk = chunks[i];
+		std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.firstPosition);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.firstNormal);
+		std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), texCoords.begin() + chunk.firstTexCoord);
+		for (ObjCorner &corner : chunk.corners)
+		{
+			if (corner.relative & 1)
+				corner.position += chunk.firstPosition;
+			if (corner.relative & 2)
+				corner.texCoord += chunk.firstTexCoord;
+			if (corner.relative & 4)
+				corner.normal += chunk.firstNormal;
+		}
+	});
+
+	// Material libraries are looked up relative to the .obj file
+	std::string directory = path.substr(0, path.find_last_of('/') + 1);
+	for (const ObjChunk &chunk : chunks)
+	{
+		for (const std::string &library : chunk.libraries)
+			loadMaterials(directory + library);
+	}
+	std::unordered_map<std::string, int> materialIndices;
+	for (unsigned int i = 0; i < materials.size(); i++)
+		materialIndices.emplace(materials[i].name, (int)i);
+
+	// Walk the breaks in file order to cut the faces into meshes, which may span several chunks
+	std::vector<std::vector<ObjSegment>> meshSegments;
+	std::vector<int> meshMaterials;
+	int material = -1;
+	bool startMesh = true;
+	for (unsigned int c = 0; c < chunkCount; c++)
+	{
+		const ObjChunk &chunk = chunks[c];
+		size_t corner = 0;
+		for (size_t b = 0; b <= chunk.breaks.size(); b++)
+		{
+			size_t until = b < chunk.breaks.size() ? chunk.breaks[b].corner : chunk.corners.size();
+			if (until > corner)
+			{
+				if (startMesh)
+				{
+					meshSegments.emplace_back();
+					meshMaterials.push_back(material);
+					startMesh = false;
+				}
+				meshSegments.back().push_back({ c, corner, until });
+				corner = until;
+			}
+			if (b < chunk.breaks.size())
+			{
+				startMesh = true;
+				if (chunk.breaks[b].setsMaterial)
+				{
+					auto found = materialIndices.find(chunk.breaks[b].material);
+					material = found != materialIndices.end() ? found->second : -1;
+				}
+			}
+		}
+	}
+
+	// Build every mesh: deduplicated vertices, indices, bounds and LODs
+	meshes.resize(meshSegments.size());
+	std::atomic<bool> outOfRange(false);
+	pool.ParallelFor((unsigned int)meshes.size(), [&](unsigned int m)
+	{
+		ObjMesh &mesh = meshes[m];
+		mesh.material = meshMaterials[m];
+		MeshData &data = mesh.data;
+
+		size_t cornerCount = 0;
+		for (const ObjSegment &segment : meshSegments[m])
+			cornerCount += segment.end - segment.begin;
+		CornerTable table(cornerCount);
+		std::vector<ObjCorner> vertexCorners;
+		vertexCorners.reserve(cornerCount / 2);
+		data.indices.reserve(cornerCount);
+		bool missingNormals = false;
+		for (const ObjSegment &segment : meshSegments[m])
+		{
+			const ObjChunk &chunk = chunks[segment.chunk];
+			for (size_t i = segment.begin; i < segment.end; i++)
+			{
+				const ObjCorner &corner = chunk.corners[i];
+				if (corner.position < 0 || corner.position >= (int)positionCount || corner.texCoord >= (int)texCoordCount
+					|| corner.normal >= (int)normalCount || corner.texCoord < -1 || corner.normal < -1)
+				{
+					outOfRange = true;
+					return;
+				}
+				unsigned int vertex = table.Insert(corner, vertexCorners, (unsigned int)vertexCorners.size());
+				if (vertex == vertexCorners.size())
+				{
+					vertexCorners.push_back(corner);
+					Vertex v;
+					v.Position = positions[corner.position];
+					v.Normal = corner.normal >= 0 ? normals[corner.normal] : glm::vec3(0.0f);
+					v.TexCoords = corner.texCoord >= 0 ? texCoords[corner.texCoord] : glm::vec2(0.0f);
+					data.vertices.push_back(v);
+					missingNormals |= corner.normal < 0;
+				}
+				data.indices.push_back(vertex);
+			}
+		}
+
+		// Vertices without a normal get the area weighted average of their faces' normals
+		if (missingNormals)
+		{
+			for (size_t i = 0; i + 2 < data.indices.size(); i += 3)
+			{
+				const unsigned int *triangle = &data.indices[i];
+				glm::vec3 faceNormal = glm::cross(data.vertices[triangle[1]].Position - data.vertices[triangle[0]].Position,
+					data.vertices[triangle[2]].Position - data.vertices[triangle[0]].Position);
+				for (int k = 0; k < 3; k++)
+				{
+					if (vertexCorners[triangle[k]].normal < 0)
+						data.vertices[triangle[k]].Normal += faceNormal;
+				}
+			}
+			for (unsigned int v = 0; v < data.vertices.size(); v++)
+			{
+				if (vertexCorners[v].normal < 0 && glm::length(data.vertices[v].Normal) > 0.0f)
+					data.vertices[v].Normal = glm::normalize(data.vertices[v].Normal);
+			}
+		}
+
+		TangentSpace::Generate(data.vertices, data.indices);
+
+		data.boundsMin = data.boundsMax = data.vertices.empty() ? glm::vec3(0.0f) : data.vertices[0].Position;
+		for (unsigned int i = 1; i < data.vertices.size(); i++)
+		{
+			data.boundsMin = glm::min(data.boundsMin, data.vertices[i].Position);
+			data.boundsMax = glm::max(data.boundsMax, data.vertices[i].Position);
+		}
+		data.lods = MeshSimplifier::BuildLODChain(data.vertices, data.indices);
+	});
+	if (outOfRange)
+	{
+		std::cout << "ERROR::OBJ::INDEX_OUT_OF_RANGE " << path << std::endl;
+		meshes.clear();
+		return false;
+	}
+	return true;
+}
+
+std::vector<std::string> ObjLoader::MaterialLibraries(const uint8_t *bytes, size_t size)
+{
+	std::vector<std::string> libraries;
+	const char *end = (const char*)bytes + size;
+	for (const char *line = (const char*)bytes; line < end; line = nextLine(line, end))
+	{
+		const char *p = skipSpaces(line, end);
+		if (end - p > 7 && std::strncmp(p, "mtllib", 6) == 0 && isSpace(p[6]))
+			libraries.push_back(restOfLine(p + 6, end));
+	}
+	return libraries;
+}
+
+bool ObjLoader::loadMaterials(const std::string &path)
+{
+	MappedFile file(path);
+	if (!file.isOpen())
+	{
+		std::cout << "WARNING::OBJ::MATERIAL_LIBRARY_NOT_FOUND " << path << std::endl;
+		return false;
+	}
+	const char *end = (const char*)file.begin() + file.length();
+	for (const char *line = (const char*)file.begin(); line < end; line = nextLine(line, end))
+	{
+		const char *p = skipSpaces(line, end);
+		const char *keyEnd = p;
+		while (keyEnd < end && !isSpace(*keyEnd) && *keyEnd != '\n' && *keyEnd != '\r')
+			keyEnd++;
+		std::string key(p, keyEnd);
+		if (key == "newmtl")
+		{
+			materials.emplace_back();
+			materials.back().name = restOfLine(keyEnd, end);
+			continue;
+		}
+		// Same texture types as Model::processMaterial gets from Assimp
+		TextureType type;
+		if (key == "map_Kd")
+			type = TEXTURE_DIFFUSE;
+		else if (key == "map_Ks")
+			type = TEXTURE_SPECULAR;
+		else if (key == "map_Ka")
+			type = TEXTURE_AMBIENT;
+		else if (key == "map_Ns")
+			type = TEXTURE_GLOSS;
+		else if (key == "disp")
+			type = TEXTURE_HEIGHT;
+		// Exporters write tangent space normal maps as bump maps, e.g. the nanosuit's *_ddn.png
+		else if (key == "map_Bump" || key == "map_bump" || key == "bump" || key == "norm")
+			type = TEXTURE_NORMAL;
+		else
+			continue;
+		if (materials.empty())
+			continue;
+		// Options (-bm 0.5, -clamp on...) come before the file name, which is the last word
+		std::string value = restOfLine(keyEnd, end);
+		size_t space = value.find_last_of(" \t");
+		std::string texture = space == std::string::npos ? value : value.substr(space + 1);
+		if (!texture.empty())
+			materials.back().textures.push_back(std::make_pair(type, texture));
+	}
+	return true;
+}
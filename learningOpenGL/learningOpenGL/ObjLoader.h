@@ -0,0 +1,41 @@
+#pragma once
+#include "Mesh.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Textures of one newmtl entry of a .mtl library
+struct ObjMaterial
+{
+	std::string name;
+	std::vector<std::pair<TextureType, std::string>> textures; // (type, path relative to the model's directory)
+};
+
+// One run of faces sharing a group and a material, converted to an indexed mesh with its LODs
+struct ObjMesh
+{
+	MeshData data;
+	int material = -1; // index in ObjLoader::materials, -1 if the faces have no material
+};
+
+// Wavefront OBJ/MTL loader used by Model in place of Assimp for .obj files.
+// The file is mapped and split into line aligned chunks parsed in parallel on the worker pool. Each run of faces
+// then becomes a mesh whose v/vt/vn triplets are deduplicated through a hash table, also in parallel.
+// Texture coordinates are flipped vertically like aiProcess_FlipUVs does and polygons are fan triangulated.
+class ObjLoader
+{
+public:
+	std::vector<ObjMesh> meshes;
+	std::vector<ObjMaterial> materials;
+
+	/// Parses the .obj file and the material libraries it references
+	/// @return false if the file is missing or malformed, the caller can fall back to Assimp
+	bool Load(const std::string &path);
+	/// Names of the material libraries (mtllib) an .obj file references, relative to its directory
+	static std::vector<std::string> MaterialLibraries(const uint8_t *bytes, size_t size);
+
+private:
+	bool loadMaterials(const std::string &path);
+};
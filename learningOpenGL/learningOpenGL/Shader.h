@@ -9,12 +9,14 @@
 
 #include <glm/glm.hpp>
 
+#include "GpuResource.h"
+
 
 class Shader //Whole class in header file for learning/portability reasons
 {
 public:
-	// The program ID
-	unsigned int ID;
+	// The program ID, owned by the shader which can be moved but not copied
+	GpuProgram ID;
 	// Constructor read and builds shader from file paths
 	Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
 	{
@@ -47,7 +49,7 @@ public:
 			vertexCode = vShaderStream.str();
 			fragmentCode = fShaderStream.str();
 		}
-		catch(std::ifstream::failure e)
+		catch (const std::ifstream::failure &)
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
@@ -87,7 +89,7 @@ public:
 		}
 
 		// Create and Set-up Shader Program
-		ID = glCreateProgram(); // Create program object and return reference
+		ID = GpuProgram::Create(); // Create program object and return reference
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
 		glLinkProgram(ID); // Links all attached shaders into one object and matches outputs and inputs of different shaders
@@ -104,6 +106,55 @@ public:
 		glDeleteShader(fragment);
 	}
 
+	// Constructor reads and builds a compute shader program from a file path
+	explicit Shader(const GLchar* computePath)
+	{
+		// 1. Retrieve the compute source code from the filePath
+		std::string computeCode;
+		std::ifstream cShaderFile;
+		cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			cShaderFile.open(computePath);
+			std::stringstream cShaderStream;
+			cShaderStream << cShaderFile.rdbuf();
+			cShaderFile.close();
+			computeCode = cShaderStream.str();
+		}
+		catch (const std::ifstream::failure &)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		}
+		const GLchar* cShaderCode = computeCode.c_str();
+
+		// 2. Compile shader
+		GLuint compute;
+		GLint success;
+		GLchar infoLog[512];
+
+		compute = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute, 1, &cShaderCode, NULL);
+		glCompileShader(compute);
+		glGetShaderiv(compute, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(compute, 512, NULL, infoLog);
+			std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+		}
+
+		// Create and Set-up Shader Program
+		ID = GpuProgram::Create();
+		glAttachShader(ID, compute);
+		glLinkProgram(ID);
+		glGetProgramiv(ID, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glGetProgramInfoLog(ID, 512, NULL, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+		}
+		glDeleteShader(compute);
+	}
+
 	// Use the program
 	void Use() { glUseProgram(ID); }
 
@@ -118,6 +169,11 @@ public:
 		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
 	}
 	// ------------------------------------------------------------------------
+	void setUInt(const std::string &name, unsigned int value) const
+	{
+		glUniform1ui(glGetUniformLocation(ID, name.c_str()), value);
+	}
+	// ------------------------------------------------------------------------
 	void setFloat(const std::string &name, float value) const
 	{
 		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
@@ -2,7 +2,7 @@
 //GLFW
 #include <GLFW/glfw3.h>
 //OTHERS
-#include "stb_image.h"
+#include "ImageDecoder.h"
 
 #include "Shader.h"
 #include "Camera.h"
@@ -11,6 +11,19 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "Terrain.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+#include "TextureResidency.h"
+#include "KtxTexture.h"
+#include "TextureCooker.h"
+#include "MipGenerator.h"
+#include "CrowdBenchmark.h"
+#include "ClusterMesh.h"
+#include "MaterialBatch.h"
+#include "VirtualTexture.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 // Prototype
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -20,7 +33,21 @@ void processInput(GLFWwindow *window);
 void setShaderLightsUniforms(Shader &containerShader, glm::vec3 *pointLightPositions);
 GLenum getTextureFormat(int nrComponents);
 unsigned int loadCubemap(vector<string> textures_faces);
-void setSkyboxVAOVBO(unsigned int &skyboxVAO, unsigned int &skyboxVBO);
+void setSkyboxVAOVBO(GpuVertexArray &skyboxVAO, GpuBuffer &skyboxVBO);
+bool cookModels(bool force);
+
+// Terminates GLFW when main returns. Declared before main's models, shaders and buffers so that their GL objects
+// are deleted first, while the context still exists.
+struct GlfwSession
+{
+	~GlfwSession() { glfwTerminate(); }
+};
+
+// The model drawn, and the cluster LOD file --cook builds from it
+const char *const MODEL_PATH = "models/nanosuit.obj";
+const char *const CLUSTER_LOD_PATH = "models/nanosuit.obj.clod";
+// First LOD of the model drawn with a baked normal map instead of the material's
+const unsigned int LOD_NORMAL_MAPS_FROM = 1;
 
 // Window dimensions
 const GLuint SCR_WIDTH = 800, SCR_HEIGHT = 600;
@@ -29,14 +56,37 @@ const GLuint SCR_WIDTH = 800, SCR_HEIGHT = 600;
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f)); // Camera with starting position
 float lastX = SCR_WIDTH/2.0f, lastY = SCR_HEIGHT/2.0f; // start at center of screen
 bool firstMouse = true; // flag for first mouse movement
+float viewportWidth = SCR_WIDTH; // current framebuffer width, used to size the virtual texture feedback
+float viewportHeight = SCR_HEIGHT; // current framebuffer height, used to pick the models' LODs
+bool crowdBenchmarkRequested = false; // set by pressing B, runs CrowdBenchmark on the loaded model
+bool clusterLODEnabled = false; // toggled by pressing C, draws the model from its streamed cluster LOD file
+bool materialBatchEnabled = false; // toggled by pressing M, draws the model lit through its MaterialBatch
+bool virtualTextureEnabled = false; // toggled by pressing V, textures the terrain through its streamed virtual texture
 
 // Timing Variables
 float deltaTime = 0.0f; // Time b/w last frame and current frame
 float lastFrame = 0.0f; 
 
-int main()
+int main(int argc, char **argv)
 {
+	// Offline cooking of the textures (see TextureCooker) and of the model's caches, without showing a window
+	if (argc > 1 && string(argv[1]) == "--cook")
+	{
+		int result = TextureCooker::RunCommandLine(argc - 2, argv + 2);
+		bool force = false;
+		for (int i = 2; i < argc; i++)
+			force |= string(argv[i]) == "--force";
+		return cookModels(force) ? result : 1;
+	}
+	// "--texture-budget <MB>" sets the texture memory TextureResidency keeps the streamed textures under
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (string(argv[i]) == "--texture-budget")
+			TextureResidency::Shared().SetBudget((size_t)atoi(argv[i + 1]) * 1024 * 1024);
+	}
+
 	glfwInit(); //initialize GLFW
+	GlfwSession session;
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);	// Specify you will be using OpenGL 4.4
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -46,7 +96,6 @@ int main()
 	if (window == nullptr)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
-		glfwTerminate();
 		return -1;
 	}
 	glfwMakeContextCurrent(window); // create the context
@@ -113,9 +162,10 @@ int main()
 	};
 
 	// Set up Skybox VAO and VBO
-	unsigned int skyboxVAO, skyboxVBO;
-	setSkyboxVAOVBO(skyboxVAO, skyboxVBO);	
-	glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+	GpuVertexArray skyboxVAO;
+	GpuBuffer skyboxVBO;
+	setSkyboxVAOVBO(skyboxVAO, skyboxVBO);
+	GpuBufferData(skyboxVBO, GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 
@@ -124,10 +174,17 @@ int main()
 	Shader ourShader("shaders/refraction.vert", "shaders/refraction.frag");
 	Shader skyboxShader("shaders/skybox.vert", "shaders/skybox.frag");
 	Shader terrainShader("shaders/light.vert", "shaders/light.frag");
+	Shader skinningShader("shaders/skinning.vert", "shaders/model_loading.frag");
+	Shader crowdShader("shaders/vat_crowd.vert", "shaders/model_loading.frag");
+	Shader impostorBakeShader("shaders/impostor_bake.vert", "shaders/impostor_bake.frag");
+	Shader impostorShader("shaders/impostor.vert", "shaders/impostor.frag");
+	Shader batchShader("shaders/model_batched.vert", "shaders/model_batched.frag");
+	Shader terrainVirtualShader("shaders/terrain_vt.vert", "shaders/terrain_vt.frag");
+	Shader terrainFeedbackShader("shaders/terrain_vt.vert", "shaders/vt_feedback.frag");
 
 	// Load models
-	Model ourModel("models/nanosuit.obj");
-	Terrain terrain(10, 10);
+	Model ourModel(MODEL_PATH);
+	Terrain terrain(10, 10, MESH_RESIDENCY_GPU_ONLY);
 
 	// Load Skybox
 	vector<std::string> faces =
@@ -140,6 +197,41 @@ int main()
 		"textures/skybox/front.jpg"
 	};
 	unsigned int cubemapTexture = loadCubemap(faces);
+	TextureCache::Shared().PrintStats();
+	// Far away, the model is drawn from views baked into an impostor atlas, once its textures have streamed in
+	ImpostorAtlas ourImpostor;
+	bool impostorBakePending = true;
+	const float impostorDistance = 25.0f;
+	// The first coarse LOD and the ones after it get the detail of LOD 0 back from a normal map baked by --cook
+	ourModel.LoadLODNormalMaps(LOD_NORMAL_MAPS_FROM);
+	// The same geometry cooked into a cluster LOD file by --cook, then streamed from it
+	ClusterMesh ourClusters;
+	if (ifstream(CLUSTER_LOD_PATH).good())
+		ourClusters.Open(CLUSTER_LOD_PATH);
+	else
+		std::cout << "WARNING::CLUSTER_MESH::NOT_COOKED " << CLUSTER_LOD_PATH << ", run learningOpenGL --cook" << std::endl;
+	// Every mesh merged into one batch, drawn with one multi-draw and no texture bind between meshes. Like the
+	// impostor, it is built once the textures it copies have streamed in.
+	MaterialBatch ourBatch;
+	vector<unsigned int> ourBatchMeshes = ourModel.AddTo(ourBatch);
+	// The terrain's texture is far larger than the pages of it kept on the GPU, cooked by --cook from a tiled image
+	const string terrainTexturePath = "textures/terrain.vtex";
+	VirtualTexture terrainTexture;
+	if (ifstream(terrainTexturePath).good())
+		terrainTexture.Open(terrainTexturePath);
+	else
+		std::cout << "WARNING::VIRTUAL_TEXTURE::NOT_COOKED " << terrainTexturePath << ", run learningOpenGL --cook" << std::endl;
+	const glm::vec2 terrainUVScale(1.0f / 9.0f); // the 10x10 grid is 9 units across
+	glm::vec3 pointLightPositions[] = {
+		glm::vec3(0.7f, 0.2f, 2.0f),
+		glm::vec3(2.3f, -3.3f, -4.0f),
+		glm::vec3(-4.0f, 2.0f, -12.0f),
+		glm::vec3(0.0f, 0.0f, -3.0f)
+	};
+
+	GpuMemory::PrintStats();
+	ourModel.PrintMemory();
+	terrainTexture.PrintStats();
 
 	// Set Skybox texture ID
 	skyboxShader.Use();
@@ -158,6 +250,28 @@ int main()
 		// Handle inputs
 		processInput(window);
 
+		// Upload the textures the worker threads finished decoding, then drop levels of the cold ones if over budget
+		TextureStreamer::Shared().Update();
+		TextureResidency::Shared().Update();
+		// Pages the terrain's last finished feedback asked for
+		terrainTexture.Update();
+		// Baking waits for the streamer rather than blocking startup on it, the model is drawn in full until then
+		if (impostorBakePending && TextureStreamer::Shared().PendingCount() == 0)
+		{
+			impostorBakePending = false;
+			ourModel.BakeImpostor(ourImpostor, impostorBakeShader);
+		}
+		if (!ourBatch.IsBuilt() && TextureStreamer::Shared().PendingCount() == 0)
+			ourBatch.Build();
+
+		if (crowdBenchmarkRequested)
+		{
+			crowdBenchmarkRequested = false;
+			glm::mat4 character = glm::scale(glm::mat4(1.0f), glm::vec3(0.2f, 0.2f, 0.2f));
+			glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+			CrowdBenchmark::Run(ourModel, skinningShader, crowdShader, character, 2.0f, camera.GetViewMatrix(), projection);
+		}
+
 		// Render
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear Colorbuffer and clear the depth buffer
@@ -178,16 +292,60 @@ int main()
 		model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f)); // it's a bit too big for the scene, so scale down
 		ourShader.setMat4("model", model);
 		ourShader.setVec3("cameraPos", camera.Position);
-		ourModel.Draw(ourShader);
+		impostorShader.Use();
+		impostorShader.setMat4("view", view);
+		impostorShader.setMat4("projection", projection);
+		impostorShader.setVec3("viewPos", camera.Position);
+		impostorShader.setVec3("lightDirection", glm::vec3(-0.2f, -1.0f, -0.3f));
+		if (clusterLODEnabled && ourClusters.IsOpen())
+		{
+			float pixelsPerUnit = viewportHeight / (2.0f * tan(glm::radians(camera.Zoom) * 0.5f));
+			ourClusters.Update(model, projection * view, camera.Position, pixelsPerUnit);
+			ourShader.Use();
+			ourClusters.Draw();
+		}
+		else if (materialBatchEnabled && ourBatch.IsBuilt())
+		{
+			batchShader.Use();
+			batchShader.setMat4("view", view);
+			batchShader.setMat4("projection", projection);
+			setShaderLightsUniforms(batchShader, pointLightPositions);
+			ourModel.Submit(ourBatch, ourBatchMeshes, model, camera, viewportHeight);
+			ourBatch.Draw(batchShader);
+		}
+		else
+			ourModel.DrawWithImpostors(ourShader, impostorShader, ourImpostor, { model }, camera, viewportHeight, impostorDistance);
 
 		// Render Terrain
-		terrainShader.Use();
 		model = glm::mat4(1.0f);
 		model = glm::translate(model, glm::vec3(-5.0f, -1.75f, -5.0f));
-		terrainShader.setMat4("model", model);
-		terrainShader.setMat4("view", view);
-		terrainShader.setMat4("projection", projection);
-		terrain.Draw();
+		if (virtualTextureEnabled && terrainTexture.IsOpen())
+		{
+			// The feedback is drawn at a fraction of the resolution and read back by a later Update
+			if (terrainTexture.BeginFeedback(terrainFeedbackShader, (int)viewportWidth, (int)viewportHeight))
+			{
+				terrainFeedbackShader.setMat4("model", model);
+				terrainFeedbackShader.setMat4("view", view);
+				terrainFeedbackShader.setMat4("projection", projection);
+				terrainFeedbackShader.setVec2("uvScale", terrainUVScale);
+				terrain.Draw();
+				terrainTexture.EndFeedback();
+			}
+			terrainTexture.Bind(terrainVirtualShader);
+			terrainVirtualShader.setMat4("model", model);
+			terrainVirtualShader.setMat4("view", view);
+			terrainVirtualShader.setMat4("projection", projection);
+			terrainVirtualShader.setVec2("uvScale", terrainUVScale);
+			terrain.Draw();
+		}
+		else
+		{
+			terrainShader.Use();
+			terrainShader.setMat4("model", model);
+			terrainShader.setMat4("view", view);
+			terrainShader.setMat4("projection", projection);
+			terrain.Draw();
+		}
 
 		// Render the skybox at the end in the backgrounf
 		glDepthFunc(GL_LEQUAL); // draw skybox in background
@@ -208,12 +366,64 @@ int main()
 		glfwPollEvents();
 	}
 
-	// Terminate GLFW and clear any resources allocated by it
-	glfwTerminate();
+	TextureResidency::Shared().PrintStats();
+	// Finish the uploads still in flight, the locals then free their GL objects and the session terminates GLFW
+	TextureStreamer::Shared().Shutdown();
+	TextureCache::Shared().Release(cubemapTexture);
 	return 0;
 
 }
 
+// Whether a cluster LOD file was written by this version of the builder after the model last changed
+bool clusterLODIsCurrent(const char *path, const char *modelPath)
+{
+	struct stat cookedInfo, modelInfo;
+	if (stat(path, &cookedInfo) != 0 || stat(modelPath, &modelInfo) != 0 || cookedInfo.st_mtime < modelInfo.st_mtime)
+		return false;
+	MappedFile file(path);
+	if (!file.isOpen() || file.length() < sizeof(ClusterLODHeader))
+		return false;
+	const ClusterLODHeader *header = (const ClusterLODHeader*)file.begin();
+	return header->magic == CLUSTER_LOD_MAGIC && header->version == CLUSTER_LOD_VERSION;
+}
+
+// Builds the model's caches that are too slow to build at startup, unless they're up to date. Loading a Model
+// creates its buffers, so this makes a GL context on a hidden window.
+// @return false if one of them failed
+bool cookModels(bool force)
+{
+	glfwInit();
+	GlfwSession session;
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow *window = glfwCreateWindow(1, 1, "LearnOpenGL", nullptr, nullptr);
+	if (window == nullptr)
+	{
+		std::cout << "ERROR::COOK::NO_GL_CONTEXT, models not cooked" << std::endl;
+		return false;
+	}
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+	{
+		std::cout << "ERROR::COOK::NO_GL_CONTEXT, models not cooked" << std::endl;
+		return false;
+	}
+
+	Model model(MODEL_PATH);
+	bool succeeded = true;
+	if (force || !clusterLODIsCurrent(CLUSTER_LOD_PATH, MODEL_PATH))
+	{
+		if (model.CookClusterLOD(CLUSTER_LOD_PATH))
+			std::cout << "COOK:: " << MODEL_PATH << " -> " << CLUSTER_LOD_PATH << std::endl;
+		else
+			succeeded = false;
+	}
+	succeeded &= model.CookLODNormalMaps(LOD_NORMAL_MAPS_FROM, force);
+	return succeeded;
+}
+
 // Process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 void processInput(GLFWwindow *window)
 {
@@ -231,6 +441,34 @@ void processInput(GLFWwindow *window)
 		camera.ProcessKeyboard(LEFT, deltaTime);
 	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
 		camera.ProcessKeyboard(RIGHT, deltaTime);
+
+	// Benchmark the crowd paths once per press of B
+	static bool benchmarkKeyDown = false;
+	bool benchmarkKey = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS;
+	if (benchmarkKey && !benchmarkKeyDown)
+		crowdBenchmarkRequested = true;
+	benchmarkKeyDown = benchmarkKey;
+
+	// Switch between the meshes and the cluster LOD once per press of C
+	static bool clusterKeyDown = false;
+	bool clusterKey = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+	if (clusterKey && !clusterKeyDown)
+		clusterLODEnabled = !clusterLODEnabled;
+	clusterKeyDown = clusterKey;
+
+	// Switch between the per-mesh draws and the material batch once per press of M
+	static bool batchKeyDown = false;
+	bool batchKey = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+	if (batchKey && !batchKeyDown)
+		materialBatchEnabled = !materialBatchEnabled;
+	batchKeyDown = batchKey;
+
+	// Switch the terrain between the plain shader and its virtual texture once per press of V
+	static bool virtualTextureKeyDown = false;
+	bool virtualTextureKey = glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS;
+	if (virtualTextureKey && !virtualTextureKeyDown)
+		virtualTextureEnabled = !virtualTextureEnabled;
+	virtualTextureKeyDown = virtualTextureKey;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
@@ -258,37 +496,13 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
 }
 
 
-// utility function for loading a 2D texture from file
+// utility function for loading a 2D texture from file, through the shared texture cache
 // ---------------------------------------------------
 unsigned int loadTexture(char const * path)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format = getTextureFormat(nrComponents);
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
+	// Streamed: decoded on the worker threads and uploaded by TextureStreamer::Update
+	return TextureCache::Shared().Acquire(TextureCache::MakeKey(path, GL_TEXTURE_2D, false),
+		[&](size_t &) { return TextureStreamer::Shared().Request(path); });
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -296,6 +510,8 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	// make sure the viewport matches the new window dimensions; note that width and 
 	 // height will be significantly larger than specified on retina displays.
 	glViewport(0, 0, width, height);
+	viewportWidth = (float)width;
+	viewportHeight = (float)height;
 }
 
 /// Set up the uniforms of the directional light, 4 point lights and one spotlight for the shader
@@ -367,48 +583,122 @@ GLenum getTextureFormat(int nrComponents)
 }
 
 /**
- * Sets up a single CubeMap texture
+ * Sets up a single CubeMap texture, shared through the texture cache
  * @param textures_faces list of paths to each of the six face textures of the cube REQUIRED in the following order: right, left, top, bottom, back, front
  */
+GpuTexture loadCubemapFromFiles(const vector<std::string> &textures_faces, size_t &bytes);
 unsigned int loadCubemap(vector<std::string> textures_faces)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-	//Because a cubemap consists of 6 textures, one for each face, we have to call glTexImage2D six times
-	int width, height, nrChannels;
-	unsigned char *data;
-	// Generate each of the 6 textures in the order of : right, left, top, bottom, back, front face
-	for(unsigned int i = 0; i < textures_faces.size(); i++)
+	// The cubemap is keyed on all of its faces, in order
+	string key = TextureCache::MakeKey(textures_faces, GL_TEXTURE_CUBE_MAP, false);
+	return TextureCache::Shared().Acquire(key, [&](size_t &bytes) { return loadCubemapFromFiles(textures_faces, bytes); });
+}
+
+/// Uploads the cooked KTX2 files of the faces (see KtxTexture::CookedPath) with their mips to the bound cubemap,
+/// if all six exist and match
+/// @return levels uploaded, 0 if the faces have to be loaded from the images
+unsigned int loadCubemapFromKtx(const vector<std::string> &textures_faces, size_t &bytes)
+{
+	vector<KtxTexture> faces(textures_faces.size());
+	for (unsigned int i = 0; i < faces.size(); i++)
 	{
-		data = stbi_load(textures_faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if(data)
+		if (!faces[i].Open(KtxTexture::CookedPath(textures_faces[i])))
+			return 0;
+		const KtxTexture &first = faces[0];
+		if (faces[i].FaceCount() != 1 || faces[i].Width() != faces[i].Height() || faces[i].Width() != first.Width()
+			|| faces[i].LevelCount() != first.LevelCount() || faces[i].InternalFormat() != first.InternalFormat())
 		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, getTextureFormat(nrChannels), width, height, 0, getTextureFormat(nrChannels), GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
+			std::cout << "ERROR::CUBEMAP::KTX_FACES_DONT_MATCH " << textures_faces[i] << std::endl;
+			return 0;
 		}
-		else
+	}
+
+	faces[0].AllocateStorage(GL_TEXTURE_CUBE_MAP);
+	for (unsigned int i = 0; i < faces.size(); i++)
+	{
+		for (unsigned int level = 0; level < faces[i].LevelCount(); level++)
+			faces[i].UploadLevel(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, faces[i].GetLevel(level).data);
+		bytes += faces[i].Bytes();
+	}
+	return faces[0].LevelCount();
+}
+
+GpuTexture loadCubemapFromFiles(const vector<std::string> &textures_faces, size_t &bytes)
+{
+	GpuTexture texture = GpuTexture::Create();
+	glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+
+	unsigned int cookedLevels = loadCubemapFromKtx(textures_faces, bytes);
+	unsigned int levels = cookedLevels;
+	if (cookedLevels == 0)
+	{
+		// The faces are decoded and their mips built in parallel. Each face is filtered on its own, clamped at its
+		// edges: sampling is clamped too, so seams between faces don't get worse than they were.
+		struct Face
+		{
+			vector<uint8_t> data;	// empty if the face failed to load
+			int width, height, nrChannels;
+			vector<vector<uint8_t>> mips;
+		};
+		vector<Face> faces(textures_faces.size());
+		ThreadPool::Shared().ParallelFor((unsigned int)faces.size(), [&](unsigned int i)
+		{
+			Face &face = faces[i];
+			if (!ImageDecoder::DecodeFile(textures_faces[i], face.data, face.width, face.height, face.nrChannels))
+				return;
+			MipSettings settings;
+			settings.srgb = true;
+			face.mips = MipGenerator::Build(face.data.data(), face.width, face.height, face.nrChannels, settings);
+		});
+
+		//Because a cubemap consists of 6 textures, one for each face, we have to call glTexImage2D six times per level
+		// Generate each of the 6 textures in the order of : right, left, top, bottom, back, front face
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of RGB faces aren't 4 byte aligned
+		levels = faces.empty() || faces[0].data.empty() ? 0 : (unsigned int)faces[0].mips.size() + 1;
+		for(unsigned int i = 0; i < faces.size(); i++)
 		{
-			std::cout << "Cubemap texture failed to load at path: " << textures_faces[i] << std::endl;
-			stbi_image_free(data);
+			Face &face = faces[i];
+			if(!face.data.empty())
+			{
+				GLenum format = getTextureFormat(face.nrChannels);
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, face.width, face.height, 0, format, GL_UNSIGNED_BYTE, face.data.data());
+				bytes += (size_t)face.width * face.height * face.nrChannels;
+				int width = face.width, height = face.height;
+				for (unsigned int level = 0; level < face.mips.size(); level++)
+				{
+					width = std::max(1, width / 2);
+					height = std::max(1, height / 2);
+					glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level + 1, format, width, height, 0, format, GL_UNSIGNED_BYTE, face.mips[level].data());
+					bytes += face.mips[level].size();
+				}
+				levels = std::min(levels, (unsigned int)face.mips.size() + 1);
+			}
+			else
+			{
+				std::cout << "Cubemap texture failed to load at path: " << textures_faces[i] << std::endl;
+				levels = 0;
+			}
 		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		// Faces of different sizes only agree on the levels they all have
+		if (levels > 0)
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levels - 1);
 	}
 
 	// Specify wrapping and filtering methods
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-	return textureID;
+	return texture;
 }
 
-void setSkyboxVAOVBO(unsigned int &skyboxVAO, unsigned int &skyboxVBO)
+void setSkyboxVAOVBO(GpuVertexArray &skyboxVAO, GpuBuffer &skyboxVBO)
 {
-	glGenVertexArrays(1, &skyboxVAO);
-	glGenBuffers(1, &skyboxVBO);
+	skyboxVAO = GpuVertexArray::Create();
+	skyboxVBO = GpuBuffer::Create(GPU_MEMORY_VERTEX_BUFFERS);
 	glBindVertexArray(skyboxVAO);
 	glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
 }
@@ -0,0 +1,31 @@
+#include "StringTable.h"
+
+StringTable &StringTable::Shared()
+{
+	static StringTable table;
+	return table;
+}
+
+unsigned int StringTable::Intern(const std::string &text)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = ids.find(text);
+	if (found != ids.end())
+		return found->second;
+	unsigned int id = (unsigned int)strings.size();
+	strings.push_back(text);
+	ids.emplace(text, id);
+	return id;
+}
+
+const std::string &StringTable::Get(unsigned int id) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return id < strings.size() ? strings[id] : strings[0];
+}
+
+size_t StringTable::Count() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return strings.size();
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Process-wide table of interned strings. Each distinct string is stored once and named by a small id, so data
+// repeated for every mesh (like Texture's path) holds 4 bytes and compares by id instead of by characters.
+class StringTable
+{
+public:
+	static StringTable &Shared();
+
+	/// Id of the string, adding it on first use. Id 0 is the empty string.
+	unsigned int Intern(const std::string &text);
+	/// The string of an id, the reference stays valid for the life of the table
+	const std::string &Get(unsigned int id) const;
+	size_t Count() const;
+
+private:
+	mutable std::mutex mutex;
+	std::deque<std::string> strings; // a deque never moves its elements, so Get's references stay valid
+	std::unordered_map<std::string, unsigned int> ids;
+
+	StringTable() { Intern(std::string()); }
+};
@@ -0,0 +1,156 @@
+#include "TangentSpace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	template<typename T>
+	T readStream(const void *stream, unsigned int stride, size_t i)
+	{
+		T value;
+		memcpy(&value, (const char*)stream + i * stride, sizeof(T));
+		return value;
+	}
+
+	// Component of v perpendicular to the unit vector n, normalized, zero if v is parallel to n
+	glm::vec3 projectOnPlane(glm::vec3 v, glm::vec3 n)
+	{
+		glm::vec3 projected = v - n * glm::dot(n, v);
+		float length = glm::length(projected);
+		return length > 1e-20f ? projected / length : glm::vec3(0.0f);
+	}
+
+	// Directions of increasing u and v across a triangle, false for degenerate texture coordinates. Only the
+	// directions matter, the faces' UV scale is normalized away by the callers.
+	bool faceFrame(const glm::vec3 p[3], const glm::vec2 uv[3], glm::vec3 &tangent, glm::vec3 &bitangent)
+	{
+		glm::vec3 e1 = p[1] - p[0], e2 = p[2] - p[0];
+		glm::vec2 d1 = uv[1] - uv[0], d2 = uv[2] - uv[0];
+		float determinant = d1.x * d2.y - d2.x * d1.y;
+		if (std::abs(determinant) < 1e-20f)
+			return false;
+		tangent = (e1 * d2.y - e2 * d1.y) * (determinant > 0.0f ? 1.0f : -1.0f);
+		bitangent = (e2 * d1.x - e1 * d2.x) * (determinant > 0.0f ? 1.0f : -1.0f);
+		return true;
+	}
+
+	// Whether the frame of a face seen from a vertex of the given normal is mirrored
+	bool isMirrored(glm::vec3 normal, glm::vec3 faceTangent, glm::vec3 faceBitangent)
+	{
+		return glm::dot(glm::cross(normal, projectOnPlane(faceTangent, normal)), projectOnPlane(faceBitangent, normal)) < 0.0f;
+	}
+
+	// Any unit vector perpendicular to n, for vertices whose faces have no usable texture coordinates
+	glm::vec3 anyPerpendicular(glm::vec3 n)
+	{
+		glm::vec3 axis = std::abs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		return glm::normalize(glm::cross(axis, n));
+	}
+}
+
+void TangentSpace::Generate(const VertexStreams &streams, const unsigned int *indices, size_t indexCount, glm::vec4 *tangents)
+{
+	size_t vertexCount = streams.vertexCount;
+	std::vector<glm::vec3> normals(vertexCount), tangentSums(vertexCount, glm::vec3(0.0f));
+	std::vector<float> handedness(vertexCount, 0.0f);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		glm::vec3 normal = readStream<glm::vec3>(streams.normals, streams.normalStride, v);
+		float length = glm::length(normal);
+		normals[v] = length > 1e-20f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+	}
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		const unsigned int *triangle = &indices[i];
+		glm::vec3 p[3];
+		glm::vec2 uv[3];
+		for (int k = 0; k < 3; k++)
+		{
+			p[k] = readStream<glm::vec3>(streams.positions, streams.positionStride, triangle[k]);
+			uv[k] = readStream<glm::vec2>(streams.texCoords, streams.texCoordStride, triangle[k]);
+		}
+		glm::vec3 faceTangent, faceBitangent;
+		if (!faceFrame(p, uv, faceTangent, faceBitangent))
+			continue; // degenerate texture coordinates give no direction
+
+		for (int k = 0; k < 3; k++)
+		{
+			glm::vec3 toNext = p[(k + 1) % 3] - p[k], toPrevious = p[(k + 2) % 3] - p[k];
+			float lengths = glm::length(toNext) * glm::length(toPrevious);
+			if (lengths <= 0.0f)
+				continue;
+			float angle = std::acos(std::min(std::max(glm::dot(toNext, toPrevious) / lengths, -1.0f), 1.0f));
+
+			unsigned int v = triangle[k];
+			tangentSums[v] += projectOnPlane(faceTangent, normals[v]) * angle;
+			handedness[v] += isMirrored(normals[v], faceTangent, faceBitangent) ? -angle : angle;
+		}
+	}
+
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		glm::vec3 tangent = projectOnPlane(tangentSums[v], normals[v]);
+		if (glm::dot(tangent, tangent) == 0.0f)
+			tangent = anyPerpendicular(normals[v]);
+		tangents[v] = glm::vec4(tangent, handedness[v] < 0.0f ? -1.0f : 1.0f);
+	}
+}
+
+void TangentSpace::Generate(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices, std::vector<unsigned int> *copiedFrom)
+{
+	if (vertices.empty())
+		return;
+
+	// Corners whose face is mirrored at a vertex that also has unmirrored faces move to a copy of the vertex, so
+	// each side of a UV mirror line gets a tangent of its own handedness like MikkTSpace's split vertices
+	size_t vertexCount = vertices.size();
+	std::vector<unsigned char> sides(vertexCount, 0);	// bit 0 for unmirrored corners, bit 1 for mirrored ones
+	std::vector<unsigned char> cornerMirrored(indices.size(), 0);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		glm::vec3 p[3];
+		glm::vec2 uv[3];
+		for (int k = 0; k < 3; k++)
+		{
+			p[k] = vertices[indices[i + k]].Position;
+			uv[k] = vertices[indices[i + k]].TexCoords;
+		}
+		glm::vec3 faceTangent, faceBitangent;
+		if (!faceFrame(p, uv, faceTangent, faceBitangent))
+			continue;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = indices[i + k];
+			glm::vec3 normal = vertices[v].Normal;
+			float length = glm::length(normal);
+			normal = length > 1e-20f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+			cornerMirrored[i + k] = isMirrored(normal, faceTangent, faceBitangent);
+			sides[v] |= cornerMirrored[i + k] ? 2 : 1;
+		}
+	}
+	std::vector<unsigned int> mirroredCopy(vertexCount, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		if (sides[v] != 3)
+			continue;
+		mirroredCopy[v] = (unsigned int)vertices.size();
+		vertices.push_back(vertices[v]);
+		if (copiedFrom)
+			copiedFrom->push_back((unsigned int)v);
+	}
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		if (cornerMirrored[i] && sides[indices[i]] == 3)
+			indices[i] = mirroredCopy[indices[i]];
+	}
+
+	std::vector<glm::vec4> tangents(vertices.size());
+	VertexStreams streams = { vertices.size(), &vertices[0].Position, &vertices[0].Normal, &vertices[0].TexCoords, nullptr,
+		sizeof(Vertex), sizeof(Vertex), sizeof(Vertex), 0 };
+	Generate(streams, indices.data(), indices.size(), tangents.data());
+	for (size_t v = 0; v < vertices.size(); v++)
+		vertices[v].Tangent = tangents[v];
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "Mesh.h"
+
+#include <vector>
+
+// Per-vertex tangents with the conventions of MikkTSpace, which is what normal maps from most bakers expect:
+// each face's tangent and bitangent are projected onto the plane of the vertex normal and weighted by the face's
+// angle at the vertex, and only the tangent is stored, with the bitangent's handedness in w. Shaders rebuild
+// B = w * cross(N, T) per vertex and don't renormalize the interpolated frame.
+// Like MikkTSpace, a vertex shared by faces of opposite handedness (a UV mirror line) is split in two, one per
+// handedness. Streams can't grow, so there such a vertex keeps the majority's handedness instead.
+class TangentSpace
+{
+public:
+	/// Writes the tangent of every vertex of the streams, the streams' own tangents are ignored. Vertices aren't split.
+	static void Generate(const VertexStreams &streams, const unsigned int *indices, size_t indexCount, glm::vec4 *tangents);
+	/// Fills in Vertex::Tangent, appending a copy of each vertex on a mirror line and pointing the mirrored faces'
+	/// indices at it
+	/// @param copiedFrom if not null, receives the vertex each appended one is a copy of, for per-vertex data kept aside
+	static void Generate(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices,
+		std::vector<unsigned int> *copiedFrom = nullptr);
+};
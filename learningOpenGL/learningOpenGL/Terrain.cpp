@@ -4,25 +4,30 @@
 // TODO Reformat so that data is stored in Mesh.Vertex instead of arrays
 // TODO add normals and UVs so that we can just use Mesh.h to render
 
-Terrain::Terrain(int width, int height)
+Terrain::Terrain(int width, int height, MeshResidency residency)
 {
 	this->width = width;
 	this->height = height;
 	getVertices(width, height);
 	getIndices(width, height);
 	setupMesh();
-}
 
+	if (residency != MESH_RESIDENCY_FULL)
+		std::vector<float>().swap(vertices);
+	if (residency == MESH_RESIDENCY_GPU_ONLY)
+		std::vector<int>().swap(indices);
+}
 
-Terrain::~Terrain()
+size_t Terrain::HostBytes() const
 {
+	return vertices.capacity() * sizeof(float) + indices.capacity() * sizeof(int);
 }
 
 float* Terrain::getVertices(int width, int height)
 {
-	if (vertices) return vertices;
+	if (!vertices.empty()) return vertices.data();
 
-	vertices = new float[getVerticesCount(width, height)];
+	vertices.resize(getVerticesCount(width, height));
 	int i = 0;
 
 	// Populate Vertex positions
@@ -36,14 +41,14 @@ float* Terrain::getVertices(int width, int height)
 		}
 	}
 
-	return vertices;
+	return vertices.data();
 }
 
 int* Terrain::getIndices(int width, int height)
 {
-	if (indices) return indices;
+	if (!indices.empty()) return indices.data();
 
-	indices = new int[getIndicesCount(width, height)];
+	indices.resize(getIndicesCount(width, height));
 	int numTriStrips = height - 1; // number of triangle strips required
 	int offset = 0;
 
@@ -64,7 +69,7 @@ int* Terrain::getIndices(int width, int height)
 		if(y < height - 2)
 			indices[offset++] = (y + 2) * width - 1; // last vertex of curr strip
 	}
-	return indices;
+	return indices.data();
 }
 
 void Terrain::Draw()
@@ -90,16 +95,13 @@ int Terrain::getIndicesCount(int width, int height)
 
 void Terrain::setupMesh()
 {
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
+	VAO = GpuVertexArray::Create();
+	VBO = GpuBuffer::Create(GPU_MEMORY_VERTEX_BUFFERS);
+	EBO = GpuBuffer::Create(GPU_MEMORY_INDEX_BUFFERS);
 
 	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER,getVerticesCount(width,height) * sizeof(float), vertices, GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, getIndicesCount(width, height) * sizeof(int), indices, GL_STATIC_DRAW);
+	GpuBufferData(VBO, GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+	GpuBufferData(EBO, GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(int), indices.data(), GL_STATIC_DRAW);
 
 	// vertex positions
 	glEnableVertexAttribArray(0);
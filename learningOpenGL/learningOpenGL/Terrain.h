@@ -1,22 +1,31 @@
 #pragma once
+#include "GpuResource.h"
+#include "MeshResidency.h"
+
+#include <vector>
+
 class Terrain
 {
 public:
-	Terrain(int width, int height);
-	~Terrain();
+	/// @param residency what stays in host memory after upload. The grid's positions follow from its size, so
+	/// CPU_COMPACT only keeps the indices; dropped arrays are rebuilt by getVertices/getIndices when asked for.
+	Terrain(int width, int height, MeshResidency residency = MESH_RESIDENCY_FULL);
 	float* getVertices(int width, int height);
 	int* getIndices(int width, int height);
 	void Draw();
+	/// Bytes of host memory held by the vertex and index arrays
+	size_t HostBytes() const;
 private:
 	int width;
 	int height;
-	float* vertices = nullptr;
-	int* indices = nullptr;
+	std::vector<float> vertices;
+	std::vector<int> indices;
 	int getVerticesCount(int width, int height);
 	int getIndicesCount(int width, int height);
 
 	/* Render Data */
-	unsigned int VAO, VBO, EBO;
+	GpuVertexArray VAO;
+	GpuBuffer VBO, EBO;
 	void setupMesh();
 };
 
@@ -0,0 +1,131 @@
+#include "TextureCache.h"
+#include "TextureResidency.h"
+#include <glad/glad.h>
+
+#include <iostream>
+#include <utility>
+
+TextureCache &TextureCache::Shared()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+unsigned int TextureCache::Acquire(const std::string &key, const std::function<GpuTexture(size_t &bytes)> &load)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = entries.find(key);
+	if (found != entries.end())
+	{
+		hits++;
+		found->second.references++;
+		return found->second.texture;
+	}
+
+	misses++;
+	size_t bytes = 0;
+	GpuTexture texture = load(bytes);
+	unsigned int id = texture;
+	Entry &entry = entries[key];
+	entry.texture = std::move(texture);
+	if (bytes > 0)
+		entry.texture.SetBytes(bytes);
+	entry.references = 1;
+	keysById[id] = key;
+	residentBytes += entry.texture.Bytes();
+	return id;
+}
+
+void TextureCache::Release(unsigned int textureID)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto key = keysById.find(textureID);
+	if (key == keysById.end())
+		return;
+	auto entry = entries.find(key->second);
+	if (--entry->second.references > 0)
+		return;
+
+	residentBytes -= entry->second.texture.Bytes();
+	TextureResidency::Shared().Forget(textureID);
+	entries.erase(entry); // deletes the GL texture
+	keysById.erase(key);
+}
+
+void TextureCache::SetBytes(unsigned int textureID, size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto key = keysById.find(textureID);
+	if (key == keysById.end())
+		return;
+	Entry &entry = entries[key->second];
+	residentBytes = residentBytes - entry.texture.Bytes() + bytes;
+	entry.texture.SetBytes(bytes);
+}
+
+std::string TextureCache::MakeKey(const std::string &path, unsigned int target, bool gamma)
+{
+	return NormalizePath(path) + '|' + std::to_string(target) + (gamma ? "|srgb" : "|linear");
+}
+
+std::string TextureCache::MakeKey(const std::vector<std::string> &paths, unsigned int target, bool gamma)
+{
+	std::string key;
+	for (const std::string &path : paths)
+		key += NormalizePath(path) + ';';
+	return key + '|' + std::to_string(target) + (gamma ? "|srgb" : "|linear");
+}
+
+std::string TextureCache::NormalizePath(const std::string &path)
+{
+	std::string unified = path;
+	for (char &c : unified)
+	{
+		if (c == '\\')
+			c = '/';
+	}
+
+	// Split on '/' and resolve the "." and ".." components
+	bool absolute = !unified.empty() && unified[0] == '/';
+	std::vector<std::string> parts;
+	size_t start = 0;
+	while (start <= unified.size())
+	{
+		size_t end = unified.find('/', start);
+		if (end == std::string::npos)
+			end = unified.size();
+		std::string part = unified.substr(start, end - start);
+		if (part == "..")
+		{
+			if (!parts.empty() && parts.back() != "..")
+				parts.pop_back();
+			else if (!absolute)
+				parts.push_back(part);
+		}
+		else if (!part.empty() && part != ".")
+			parts.push_back(part);
+		start = end + 1;
+	}
+
+	std::string normalized = absolute ? "/" : "";
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		if (i > 0)
+			normalized += '/';
+		normalized += parts[i];
+	}
+	return normalized;
+}
+
+TextureCache::Stats TextureCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return { hits, misses, (unsigned int)entries.size(), residentBytes };
+}
+
+void TextureCache::PrintStats() const
+{
+	Stats stats = GetStats();
+	std::cout << "TEXTURE_CACHE:: " << stats.textureCount << " textures, " << stats.residentBytes / 1024 << " KB resident, "
+		<< stats.hits << " hits, " << stats.misses << " misses" << std::endl;
+}
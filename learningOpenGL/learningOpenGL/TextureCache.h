@@ -0,0 +1,58 @@
+#pragma once
+#include "GpuResource.h"
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Process-wide cache of GL textures, shared by every Model, loadTexture and loadCubemap.
+// Textures are keyed on their normalized path(s) and load parameters and reference counted, the GL texture is
+// deleted when the last reference is released. Their memory is counted in GpuMemory under GPU_MEMORY_TEXTURES.
+class TextureCache
+{
+public:
+	struct Stats
+	{
+		unsigned int hits;
+		unsigned int misses;
+		unsigned int textureCount;
+		size_t residentBytes;	// estimated GPU memory of the cached textures, mip chains included
+	};
+
+	static TextureCache &Shared();
+
+	/// Returns the cached texture for key and adds a reference to it. On a miss, load is called to create the
+	/// texture; it returns the texture, which the cache then owns, and sets bytes to the memory it allocated if it
+	/// knows it. Streamed textures leave bytes alone and report their size later through SetBytes.
+	unsigned int Acquire(const std::string &key, const std::function<GpuTexture(size_t &bytes)> &load);
+	/// Drops a reference taken by Acquire, deleting the texture when nothing uses it anymore
+	void Release(unsigned int textureID);
+
+	/// Updates the memory accounted to a texture whose size was only known after it was created (streamed textures)
+	void SetBytes(unsigned int textureID, size_t bytes);
+
+	/// Builds the cache key of a texture file loaded with the given target (GL_TEXTURE_2D...) and color space
+	static std::string MakeKey(const std::string &path, unsigned int target, bool gamma);
+	/// Same for textures built from several files (e.g. the six faces of a cubemap), order matters
+	static std::string MakeKey(const std::vector<std::string> &paths, unsigned int target, bool gamma);
+	/// Resolves '\\', "." and ".." so different spellings of the same file share one cache entry
+	static std::string NormalizePath(const std::string &path);
+
+	Stats GetStats() const;
+	void PrintStats() const;
+
+private:
+	struct Entry
+	{
+		GpuTexture texture;
+		unsigned int references;
+	};
+	std::unordered_map<std::string, Entry> entries;
+	std::unordered_map<unsigned int, std::string> keysById;
+	unsigned int hits = 0, misses = 0;
+	size_t residentBytes = 0;
+	mutable std::mutex mutex;
+};
@@ -0,0 +1,343 @@
+#include "TextureCooker.h"
+#include "KtxTexture.h"
+#include "MipGenerator.h"
+#include "ImageDecoder.h"
+#include "VirtualTextureBuilder.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	const char *const IMAGE_EXTENSIONS[] = { ".png", ".jpg", ".jpeg", ".tga", ".bmp" };
+	// Parts of a file name marking a tangent space normal map
+	const char *const NORMAL_MAP_MARKERS[] = { "_ddn", "_nrm", "_normal", "_norm", "normalmap" };
+	// Parts of a file name marking other maps holding data rather than sRGB color, the ones Model doesn't gamma decode
+	const char *const DATA_MAP_MARKERS[] = { "_spec", "_gloss", "_rough", "_metal", "_ao", "_occlusion", "_height",
+		"_disp", "_bump", "_mask", "_opacity", "_alpha" };
+
+	// Virtual textures the application streams, cooked from their images along with the default directories
+	struct VirtualTextureSource
+	{
+		const char *imagePath, *path;
+		unsigned int size;
+	};
+	const VirtualTextureSource VIRTUAL_TEXTURES[] =
+	{
+		{ "textures/container.jpg", "textures/terrain.vtex", 4096 }	// the terrain of Source.cpp
+	};
+
+	const KtxFormat KTX_FORMATS[BLOCK_FORMAT_COUNT] =
+	{
+		KTX_FORMAT_BC1_RGB_UNORM, KTX_FORMAT_BC3_UNORM, KTX_FORMAT_BC4_UNORM, KTX_FORMAT_BC5_UNORM, KTX_FORMAT_BC7_UNORM
+	};
+
+	std::string toLower(std::string text)
+	{
+		for (char &c : text)
+			c = (char)std::tolower((unsigned char)c);
+		return text;
+	}
+
+	bool endsWith(const std::string &text, const std::string &suffix)
+	{
+		return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	bool nameContains(const std::string &path, const char *const *markers, size_t markerCount)
+	{
+		std::string name = toLower(path.substr(path.find_last_of("/\\") + 1));
+		for (size_t i = 0; i < markerCount; i++)
+		{
+			if (name.find(markers[i]) != std::string::npos)
+				return true;
+		}
+		return false;
+	}
+
+	bool isImage(const std::string &path)
+	{
+		std::string lower = toLower(path);
+		for (const char *extension : IMAGE_EXTENSIONS)
+		{
+			if (endsWith(lower, extension))
+				return true;
+		}
+		return false;
+	}
+
+	bool modificationTime(const std::string &path, time_t &time)
+	{
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			return false;
+		time = info.st_mtime;
+		return true;
+	}
+
+	bool isDirectory(const std::string &path)
+	{
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+	}
+
+	// Files directly in a directory, and its subdirectories
+	void listDirectory(const std::string &directory, std::vector<std::string> &files, std::vector<std::string> &directories)
+	{
+#ifdef _WIN32
+		WIN32_FIND_DATAA entry;
+		HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &entry);
+		if (find == INVALID_HANDLE_VALUE)
+			return;
+		do
+		{
+			std::string name = entry.cFileName;
+			if (name == "." || name == "..")
+				continue;
+			if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				directories.push_back(directory + '/' + name);
+			else
+				files.push_back(directory + '/' + name);
+		} while (FindNextFileA(find, &entry));
+		FindClose(find);
+#else
+		DIR *dir = opendir(directory.c_str());
+		if (!dir)
+			return;
+		while (dirent *entry = readdir(dir))
+		{
+			std::string name = entry->d_name;
+			if (name == "." || name == "..")
+				continue;
+			std::string path = directory + '/' + name;
+			if (isDirectory(path))
+				directories.push_back(path);
+			else
+				files.push_back(path);
+		}
+		closedir(dir);
+#endif
+		std::sort(files.begin(), files.end());
+		std::sort(directories.begin(), directories.end());
+	}
+
+	// Peak signal to noise ratio of the channels a format keeps, in dB
+	double measurePsnr(BlockFormat format, const std::vector<uint8_t> &source, const std::vector<uint8_t> &decoded)
+	{
+		const int channelCounts[BLOCK_FORMAT_COUNT] = { 3, 4, 1, 2, 4 };
+		int channels = channelCounts[format];
+		double squaredError = 0.0;
+		for (size_t i = 0; i < source.size(); i++)
+		{
+			if ((int)(i % 4) >= channels)
+				continue;
+			double d = (double)source[i] - decoded[i];
+			squaredError += d * d;
+		}
+		double mean = squaredError / (source.size() / 4 * channels);
+		return mean > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mean) : 99.0;
+	}
+
+	void printUsage()
+	{
+		std::cout << "usage: learningOpenGL --cook [--quality fast|normal|best] [--s3tc] [--mip-filter box|kaiser|lanczos]"
+			" [--alpha-cutoff value] [--force] [files or directories...]" << std::endl;
+	}
+}
+
+int TextureCooker::RunCommandLine(int argc, char **argv)
+{
+	TextureCookSettings settings;
+	std::vector<std::string> paths;
+	for (int i = 0; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		if (argument == "--s3tc")
+			settings.s3tc = true;
+		else if (argument == "--force")
+			settings.force = true;
+		else if (argument == "--quality" && i + 1 < argc)
+		{
+			std::string quality = argv[++i];
+			int found = -1;
+			for (int q = 0; q < ENCODE_QUALITY_COUNT; q++)
+			{
+				if (quality == ENCODE_QUALITY_NAMES[q])
+					found = q;
+			}
+			if (found < 0)
+			{
+				printUsage();
+				return 1;
+			}
+			settings.quality = (EncodeQuality)found;
+		}
+		else if (argument == "--mip-filter" && i + 1 < argc)
+		{
+			std::string filter = argv[++i];
+			int found = -1;
+			for (int f = 0; f < MIP_FILTER_COUNT; f++)
+			{
+				if (filter == MIP_FILTER_NAMES[f])
+					found = f;
+			}
+			if (found < 0)
+			{
+				printUsage();
+				return 1;
+			}
+			settings.mipFilter = (MipFilter)found;
+		}
+		else if (argument == "--alpha-cutoff" && i + 1 < argc)
+		{
+			settings.alphaCutoff = (float)std::atof(argv[++i]);
+			if (settings.alphaCutoff <= 0.0f || settings.alphaCutoff >= 1.0f)
+			{
+				printUsage();
+				return 1;
+			}
+		}
+		else if (argument.compare(0, 2, "--") == 0)
+		{
+			printUsage();
+			return 1;
+		}
+		else
+			paths.push_back(argument);
+	}
+	bool virtualTextures = paths.empty();
+	if (paths.empty())
+		paths = { "models", "textures" };
+
+	auto start = std::chrono::steady_clock::now();
+	bool succeeded = true;
+	for (const std::string &path : paths)
+		succeeded &= isDirectory(path) ? CookDirectory(path, settings) : CookImage(path, settings);
+	for (unsigned int i = 0; virtualTextures && i < sizeof(VIRTUAL_TEXTURES) / sizeof(VIRTUAL_TEXTURES[0]); i++)
+		succeeded &= CookVirtualTexture(VIRTUAL_TEXTURES[i].imagePath, VIRTUAL_TEXTURES[i].path, VIRTUAL_TEXTURES[i].size, settings);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "COOK:: done in " << seconds << " s" << (succeeded ? "" : ", some images failed") << std::endl;
+	return succeeded ? 0 : 1;
+}
+
+bool TextureCooker::CookDirectory(const std::string &directory, const TextureCookSettings &settings)
+{
+	std::vector<std::string> files, directories;
+	listDirectory(directory, files, directories);
+	bool succeeded = true;
+	for (const std::string &file : files)
+	{
+		if (isImage(file))
+			succeeded &= CookImage(file, settings);
+	}
+	for (const std::string &subdirectory : directories)
+		succeeded &= CookDirectory(subdirectory, settings);
+	return succeeded;
+}
+
+bool TextureCooker::CookImage(const std::string &path, const TextureCookSettings &settings)
+{
+	std::string cookedPath = KtxTexture::CookedPath(path);
+	time_t sourceTime, cookedTime;
+	if (!settings.force && modificationTime(path, sourceTime) && modificationTime(cookedPath, cookedTime) && cookedTime >= sourceTime)
+		return true; // up to date
+
+	auto start = std::chrono::steady_clock::now();
+	int width, height, components;
+	std::vector<uint8_t> level;
+	if (!ImageDecoder::DecodeFile(path, level, width, height, components, 4))
+	{
+		std::cout << "ERROR::COOK::CANNOT_LOAD " << path << std::endl;
+		return false;
+	}
+
+	// Color is filtered in linear light, normals renormalized. The cooker can't tell whether an image repeats, so
+	// the filter stays clamped at the edges.
+	BlockFormat format = ChooseFormat(path, level.data(), (size_t)width * height, settings);
+	MipSettings mipSettings;
+	mipSettings.filter = settings.mipFilter;
+	mipSettings.srgb = IsColor(path);
+	mipSettings.normalMap = format == BLOCK_FORMAT_BC5;
+	mipSettings.alphaCutoff = settings.alphaCutoff;
+	std::vector<std::vector<uint8_t>> mips = MipGenerator::Build(level.data(), (unsigned int)width, (unsigned int)height, 4, mipSettings);
+
+	std::vector<std::vector<uint8_t>> levels;
+	levels.push_back(TextureEncoder::Encode(format, level.data(), (unsigned int)width, (unsigned int)height, settings.quality));
+	double psnr = measurePsnr(format, level, TextureEncoder::Decode(format, levels[0].data(), (unsigned int)width, (unsigned int)height));
+	unsigned int levelWidth = (unsigned int)width, levelHeight = (unsigned int)height;
+	for (const std::vector<uint8_t> &mip : mips)
+	{
+		levelWidth = std::max(1u, levelWidth / 2);
+		levelHeight = std::max(1u, levelHeight / 2);
+		levels.push_back(TextureEncoder::Encode(format, mip.data(), levelWidth, levelHeight, settings.quality));
+	}
+	if (!KtxTexture::Write(cookedPath, KTX_FORMATS[format], (unsigned int)width, (unsigned int)height, levels))
+		return false;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "COOK:: " << path << " -> " << BLOCK_FORMAT_NAMES[format] << " " << width << "x" << height << ", "
+		<< levels.size() << " levels, " << seconds << " s, " << psnr << " dB" << std::endl;
+	return true;
+}
+
+bool TextureCooker::CookVirtualTexture(const std::string &imagePath, const std::string &path, unsigned int size,
+	const TextureCookSettings &settings)
+{
+	time_t sourceTime, cookedTime;
+	if (!settings.force && modificationTime(imagePath, sourceTime) && modificationTime(path, cookedTime) && cookedTime >= sourceTime)
+		return true; // up to date
+
+	auto start = std::chrono::steady_clock::now();
+	VirtualTextureSettings virtualSettings;
+	virtualSettings.size = size;
+	virtualSettings.quality = settings.quality;
+	virtualSettings.mipFilter = settings.mipFilter;
+	virtualSettings.srgb = IsColor(imagePath);
+	if (!VirtualTextureBuilder::CookImage(imagePath, path, virtualSettings))
+		return false;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "COOK:: " << imagePath << " -> " << path << ", " << seconds << " s" << std::endl;
+	return true;
+}
+
+bool TextureCooker::IsColor(const std::string &path)
+{
+	return !nameContains(path, NORMAL_MAP_MARKERS, sizeof(NORMAL_MAP_MARKERS) / sizeof(NORMAL_MAP_MARKERS[0]))
+		&& !nameContains(path, DATA_MAP_MARKERS, sizeof(DATA_MAP_MARKERS) / sizeof(DATA_MAP_MARKERS[0]));
+}
+
+BlockFormat TextureCooker::ChooseFormat(const std::string &path, const uint8_t *rgba, size_t pixelCount, const TextureCookSettings &settings)
+{
+	if (nameContains(path, NORMAL_MAP_MARKERS, sizeof(NORMAL_MAP_MARKERS) / sizeof(NORMAL_MAP_MARKERS[0])))
+		return BLOCK_FORMAT_BC5;
+
+	bool grey = true, opaque = true;
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		const uint8_t *pixel = &rgba[i * 4];
+		grey &= pixel[0] == pixel[1] && pixel[1] == pixel[2];
+		opaque &= pixel[3] == 255;
+	}
+	// A grey diffuse map is still color: its mips are filtered in sRGB, which one channel BC4 can't carry
+	if (!IsColor(path) && grey && opaque)
+		return BLOCK_FORMAT_BC4;
+	if (!settings.s3tc)
+		return BLOCK_FORMAT_BC7;
+	return opaque ? BLOCK_FORMAT_BC1 : BLOCK_FORMAT_BC3;
+}
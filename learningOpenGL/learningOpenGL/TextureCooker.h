@@ -0,0 +1,50 @@
+#pragma once
+#include "TextureEncoder.h"
+#include "MipGenerator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct TextureCookSettings
+{
+	EncodeQuality quality = ENCODE_QUALITY_NORMAL;
+	// BC1 / BC3 instead of BC7 for color images, faster to cook but further from the source. Only for drivers with
+	// EXT_texture_compression_s3tc, KtxTexture refuses them elsewhere and the source images get loaded instead.
+	bool s3tc = false;
+	MipFilter mipFilter = MIP_FILTER_KAISER;
+	float alphaCutoff = 0.0f;	// alpha test threshold whose coverage the mips keep (see MipSettings), 0 for none
+	bool force = false;	// cook images whose .ktx2 is already newer than them too
+};
+
+// Offline conversion of PNG / JPEG images to block compressed .ktx2 files with their whole mip chain, written next to
+// the images (see KtxTexture::CookedPath) where TextureStreamer and loadCubemap pick them up instead. The default run
+// also builds the virtual textures the application streams (.vtex, see VirtualTextureBuilder).
+// Run from the command line:
+// learningOpenGL --cook [--quality fast|normal|best] [--s3tc] [--mip-filter box|kaiser|lanczos] [--alpha-cutoff value]
+//	[--force] [paths...]
+class TextureCooker
+{
+public:
+	/// Parses the arguments following --cook and cooks every image of the given files and directories, "models"
+	/// and "textures" and the virtual textures by default
+	/// @return the process exit code, non zero if an image failed
+	static int RunCommandLine(int argc, char **argv);
+
+	/// Cooks every image under a directory, recursively
+	/// @return false if an image failed
+	static bool CookDirectory(const std::string &directory, const TextureCookSettings &settings);
+	static bool CookImage(const std::string &path, const TextureCookSettings &settings);
+	/// Builds a virtual texture from an image unless it's newer than the image
+	/// @param size texels per side of its level 0 (see VirtualTextureSettings)
+	static bool CookVirtualTexture(const std::string &imagePath, const std::string &path, unsigned int size,
+		const TextureCookSettings &settings);
+
+	/// Whether an image holds sRGB color, told from its name like Model tells it from the material slot: normal,
+	/// specular, roughness, height... maps are data, anything else is color
+	static bool IsColor(const std::string &path);
+	/// BC5 for normal maps, BC4 for opaque grey data maps, and BC7 for the rest (BC1 or BC3 depending on the alpha
+	/// channel with the s3tc setting). Usage comes from the name (see IsColor), only the channel count from the pixels.
+	static BlockFormat ChooseFormat(const std::string &path, const uint8_t *rgba, size_t pixelCount, const TextureCookSettings &settings);
+};
@@ -0,0 +1,718 @@
+#include "TextureEncoder.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXTURE_ENCODER_SSE2
+#endif
+
+namespace
+{
+	// Pixels of a block split by channel, so four pixels go through the same instructions at once
+	struct Block
+	{
+		alignas(16) float channels[4][16];
+	};
+
+	struct Palette
+	{
+		float colors[16][4];
+		unsigned int size;
+	};
+
+	// Squared error weights of the channels: luminance for color, every channel counts the same for data
+	const float COLOR_WEIGHTS[4] = { 0.299f, 0.587f, 0.114f, 0.0f };
+	const float RGBA_WEIGHTS[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	// Least squares refinement passes per quality
+	const unsigned int REFINE_PASSES[ENCODE_QUALITY_COUNT] = { 0, 2, 4 };
+
+	// Interpolation weights of BC7's 4 bit indices, out of 64
+	const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	Block loadBlock(const uint8_t *pixels)
+	{
+		Block block;
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+				block.channels[c][i] = pixels[i * 4 + c];
+		}
+		return block;
+	}
+
+	// Index of the palette entry closest to every pixel by weighted squared distance, returns the block's total error
+	float selectIndices(const Block &block, const Palette &palette, const float weights[4], uint8_t indices[16])
+	{
+		float total = 0.0f;
+#ifdef TEXTURE_ENCODER_SSE2
+		for (int group = 0; group < 16; group += 4)
+		{
+			__m128 pixel[4];
+			for (int c = 0; c < 4; c++)
+				pixel[c] = _mm_load_ps(&block.channels[c][group]);
+			__m128 best = _mm_set1_ps(FLT_MAX);
+			__m128i bestIndex = _mm_setzero_si128();
+			for (unsigned int p = 0; p < palette.size; p++)
+			{
+				__m128 distance = _mm_setzero_ps();
+				for (int c = 0; c < 4; c++)
+				{
+					__m128 d = _mm_sub_ps(pixel[c], _mm_set1_ps(palette.colors[p][c]));
+					distance = _mm_add_ps(distance, _mm_mul_ps(_mm_mul_ps(d, d), _mm_set1_ps(weights[c])));
+				}
+				__m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+				best = _mm_min_ps(distance, best);
+				bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32((int)p)), _mm_andnot_si128(closer, bestIndex));
+			}
+			alignas(16) float errors[4];
+			alignas(16) int32_t chosen[4];
+			_mm_store_ps(errors, best);
+			_mm_store_si128((__m128i*)chosen, bestIndex);
+			for (int i = 0; i < 4; i++)
+			{
+				indices[group + i] = (uint8_t)chosen[i];
+				total += errors[i];
+			}
+		}
+#else
+		for (int i = 0; i < 16; i++)
+		{
+			float best = FLT_MAX;
+			for (unsigned int p = 0; p < palette.size; p++)
+			{
+				float distance = 0.0f;
+				for (int c = 0; c < 4; c++)
+				{
+					float d = block.channels[c][i] - palette.colors[p][c];
+					distance += d * d * weights[c];
+				}
+				if (distance < best)
+				{
+					best = distance;
+					indices[i] = (uint8_t)p;
+				}
+			}
+			total += best;
+		}
+#endif
+		return total;
+	}
+
+	// Ends of the segment the block's pixels spread along, found from the principal axis of their covariance
+	void principalEndpoints(const Block &block, int channelCount, float endpoint0[4], float endpoint1[4])
+	{
+		float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int c = 0; c < channelCount; c++)
+		{
+			for (int i = 0; i < 16; i++)
+				mean[c] += block.channels[c][i];
+			mean[c] /= 16.0f;
+		}
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			for (int a = 0; a < channelCount; a++)
+			{
+				for (int b = a; b < channelCount; b++)
+					covariance[a][b] += (block.channels[a][i] - mean[a]) * (block.channels[b][i] - mean[b]);
+			}
+		}
+		for (int a = 0; a < channelCount; a++)
+		{
+			for (int b = 0; b < a; b++)
+				covariance[a][b] = covariance[b][a];
+		}
+
+		// Power iteration, starting from the diagonal so it converges in a few steps
+		float axis[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int c = 0; c < channelCount; c++)
+			axis[c] = covariance[c][c] + 1e-3f;
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			float length = 0.0f;
+			for (int a = 0; a < channelCount; a++)
+			{
+				for (int b = 0; b < channelCount; b++)
+					next[a] += covariance[a][b] * axis[b];
+				length += next[a] * next[a];
+			}
+			if (length < 1e-12f)
+				break; // every pixel is the same, any axis will do
+			length = std::sqrt(length);
+			for (int c = 0; c < channelCount; c++)
+				axis[c] = next[c] / length;
+		}
+
+		float tMin = FLT_MAX, tMax = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < channelCount; c++)
+				t += (block.channels[c][i] - mean[c]) * axis[c];
+			tMin = std::min(tMin, t);
+			tMax = std::max(tMax, t);
+		}
+		for (int c = 0; c < 4; c++)
+		{
+			endpoint0[c] = c < channelCount ? mean[c] + axis[c] * tMin : 255.0f;
+			endpoint1[c] = c < channelCount ? mean[c] + axis[c] * tMax : 255.0f;
+		}
+	}
+
+	// Endpoints minimizing the squared error of the block given each pixel's position between them
+	// @param positions 0 for endpoint 0 to 1 for endpoint 1, for every pixel
+	bool leastSquaresEndpoints(const Block &block, int channelCount, const float positions[16], float endpoint0[4], float endpoint1[4])
+	{
+		float a = 0.0f, b = 0.0f, c = 0.0f;
+		float x0[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, x1[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; i++)
+		{
+			float t = positions[i], s = 1.0f - t;
+			a += s * s;
+			b += s * t;
+			c += t * t;
+			for (int k = 0; k < channelCount; k++)
+			{
+				x0[k] += s * block.channels[k][i];
+				x1[k] += t * block.channels[k][i];
+			}
+		}
+		float determinant = a * c - b * b;
+		if (std::abs(determinant) < 1e-6f)
+			return false; // every pixel uses the same index
+		for (int k = 0; k < channelCount; k++)
+		{
+			endpoint0[k] = std::min(std::max((c * x0[k] - b * x1[k]) / determinant, 0.0f), 255.0f);
+			endpoint1[k] = std::min(std::max((a * x1[k] - b * x0[k]) / determinant, 0.0f), 255.0f);
+		}
+		return true;
+	}
+
+	// Little endian bit stream of a 128 bit block
+	struct BitWriter
+	{
+		uint8_t *bytes;
+		unsigned int position = 0;
+
+		void write(unsigned int value, unsigned int bits)
+		{
+			for (unsigned int i = 0; i < bits; i++, position++)
+			{
+				if (value & (1u << i))
+					bytes[position / 8] |= (uint8_t)(1u << (position % 8));
+			}
+		}
+	};
+	struct BitReader
+	{
+		const uint8_t *bytes;
+		unsigned int position = 0;
+
+		unsigned int read(unsigned int bits)
+		{
+			unsigned int value = 0;
+			for (unsigned int i = 0; i < bits; i++, position++)
+				value |= ((bytes[position / 8] >> (position % 8)) & 1u) << i;
+			return value;
+		}
+	};
+
+	// --- BC1 ---
+
+	uint16_t quantize565(const float color[4])
+	{
+		int r = (int)std::lround(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f);
+		int g = (int)std::lround(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f);
+		int b = (int)std::lround(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	void expand565(uint16_t packed, float color[4])
+	{
+		int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = (float)((r << 3) | (r >> 2));
+		color[1] = (float)((g << 2) | (g >> 4));
+		color[2] = (float)((b << 3) | (b >> 2));
+		color[3] = 255.0f;
+	}
+
+	// Four color mode: the first endpoint must be the larger one
+	Palette bc1Palette(uint16_t color0, uint16_t color1)
+	{
+		Palette palette;
+		palette.size = 4;
+		expand565(color0, palette.colors[0]);
+		expand565(color1, palette.colors[1]);
+		for (int c = 0; c < 4; c++)
+		{
+			palette.colors[2][c] = (2.0f * palette.colors[0][c] + palette.colors[1][c]) / 3.0f;
+			palette.colors[3][c] = (palette.colors[0][c] + 2.0f * palette.colors[1][c]) / 3.0f;
+		}
+		return palette;
+	}
+
+	// Error of the block with the given endpoints, which are swapped into the order of four color mode
+	float tryBC1(const Block &block, uint16_t &color0, uint16_t &color1, uint8_t indices[16])
+	{
+		if (color0 < color1)
+			std::swap(color0, color1);
+		return selectIndices(block, bc1Palette(color0, color1), COLOR_WEIGHTS, indices);
+	}
+
+	void encodeBC1(const Block &block, EncodeQuality quality, uint8_t *out)
+	{
+		const float BC1_POSITIONS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+		float endpoint0[4], endpoint1[4];
+		principalEndpoints(block, 3, endpoint0, endpoint1);
+		uint16_t color0 = quantize565(endpoint0), color1 = quantize565(endpoint1);
+		uint8_t indices[16];
+		float error = tryBC1(block, color0, color1, indices);
+
+		for (unsigned int pass = 0; pass < REFINE_PASSES[quality]; pass++)
+		{
+			float positions[16];
+			for (int i = 0; i < 16; i++)
+				positions[i] = BC1_POSITIONS[indices[i]];
+			if (!leastSquaresEndpoints(block, 3, positions, endpoint0, endpoint1))
+				break;
+			uint16_t refined0 = quantize565(endpoint0), refined1 = quantize565(endpoint1);
+			uint8_t refinedIndices[16];
+			float refinedError = tryBC1(block, refined0, refined1, refinedIndices);
+			if (refinedError >= error)
+				break;
+			error = refinedError;
+			color0 = refined0;
+			color1 = refined1;
+			std::memcpy(indices, refinedIndices, 16);
+		}
+
+		if (quality == ENCODE_QUALITY_BEST)
+		{
+			// Nudge each channel of each endpoint by one step, the rounding of 565 is often off by one
+			const uint16_t steps[3] = { 1 << 11, 1 << 5, 1 };
+			const uint16_t masks[3] = { 31 << 11, 63 << 5, 31 };
+			bool improved = true;
+			for (int round = 0; round < 4 && improved; round++)
+			{
+				improved = false;
+				for (int endpoint = 0; endpoint < 2; endpoint++)
+				{
+					for (int channel = 0; channel < 3; channel++)
+					{
+						for (int direction = -1; direction <= 1; direction += 2)
+						{
+							uint16_t candidate0 = color0, candidate1 = color1;
+							uint16_t &moved = endpoint == 0 ? candidate0 : candidate1;
+							int field = (moved & masks[channel]) / steps[channel] + direction;
+							if (field < 0 || field > (int)(masks[channel] / steps[channel]))
+								continue;
+							moved = (uint16_t)((moved & ~masks[channel]) | (field * steps[channel]));
+							uint8_t candidateIndices[16];
+							float candidateError = tryBC1(block, candidate0, candidate1, candidateIndices);
+							if (candidateError < error)
+							{
+								error = candidateError;
+								color0 = candidate0;
+								color1 = candidate1;
+								std::memcpy(indices, candidateIndices, 16);
+								improved = true;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		// Equal endpoints would switch the decoder to three color mode, where index 3 is black: every index
+		// gives the same color anyway
+		if (color0 == color1)
+			std::memset(indices, 0, 16);
+		uint32_t packed = 0;
+		for (int i = 0; i < 16; i++)
+			packed |= (uint32_t)indices[i] << (2 * i);
+		out[0] = (uint8_t)(color0 & 0xFF);
+		out[1] = (uint8_t)(color0 >> 8);
+		out[2] = (uint8_t)(color1 & 0xFF);
+		out[3] = (uint8_t)(color1 >> 8);
+		for (int i = 0; i < 4; i++)
+			out[4 + i] = (uint8_t)(packed >> (8 * i));
+	}
+
+	void decodeBC1(const uint8_t *block, uint8_t *pixels)
+	{
+		uint16_t color0 = (uint16_t)(block[0] | (block[1] << 8)), color1 = (uint16_t)(block[2] | (block[3] << 8));
+		float colors[4][4];
+		expand565(color0, colors[0]);
+		expand565(color1, colors[1]);
+		bool fourColors = color0 > color1;
+		for (int c = 0; c < 4; c++)
+		{
+			colors[2][c] = fourColors ? (2.0f * colors[0][c] + colors[1][c]) / 3.0f : (colors[0][c] + colors[1][c]) / 2.0f;
+			colors[3][c] = fourColors ? (colors[0][c] + 2.0f * colors[1][c]) / 3.0f : 0.0f;
+		}
+		uint32_t packed = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+		for (int i = 0; i < 16; i++)
+		{
+			unsigned int index = (packed >> (2 * i)) & 3;
+			for (int c = 0; c < 3; c++)
+				pixels[i * 4 + c] = (uint8_t)std::lround(colors[index][c]);
+			pixels[i * 4 + 3] = fourColors || index != 3 ? 255 : 0;
+		}
+	}
+
+	// --- BC4 ---
+
+	Palette bc4Palette(int value0, int value1, int channel)
+	{
+		Palette palette;
+		palette.size = 8;
+		float values[8];
+		values[0] = (float)value0;
+		values[1] = (float)value1;
+		if (value0 > value1)
+		{
+			for (int i = 1; i < 7; i++)
+				values[1 + i] = ((7 - i) * value0 + i * value1) / 7.0f;
+		}
+		else
+		{
+			for (int i = 1; i < 5; i++)
+				values[1 + i] = ((5 - i) * value0 + i * value1) / 5.0f;
+			values[6] = 0.0f;
+			values[7] = 255.0f;
+		}
+		for (int p = 0; p < 8; p++)
+		{
+			for (int c = 0; c < 4; c++)
+				palette.colors[p][c] = c == channel ? values[p] : 0.0f;
+		}
+		return palette;
+	}
+
+	void encodeBC4(const Block &block, int channel, EncodeQuality quality, uint8_t *out)
+	{
+		float weights[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		weights[channel] = 1.0f;
+		int low = 255, high = 0, innerLow = 255, innerHigh = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int value = (int)block.channels[channel][i];
+			low = std::min(low, value);
+			high = std::max(high, value);
+			if (value > 0 && value < 255)
+			{
+				innerLow = std::min(innerLow, value);
+				innerHigh = std::max(innerHigh, value);
+			}
+		}
+
+		// Eight value mode spanning the block
+		int value0 = high, value1 = low;
+		uint8_t indices[16];
+		float error = selectIndices(block, bc4Palette(value0, value1, channel), weights, indices);
+		auto tryEndpoints = [&](int candidate0, int candidate1)
+		{
+			uint8_t candidateIndices[16];
+			float candidateError = selectIndices(block, bc4Palette(candidate0, candidate1, channel), weights, candidateIndices);
+			if (candidateError < error)
+			{
+				error = candidateError;
+				value0 = candidate0;
+				value1 = candidate1;
+				std::memcpy(indices, candidateIndices, 16);
+			}
+		};
+		if (quality != ENCODE_QUALITY_FAST)
+		{
+			// Six value mode, its explicit 0 and 255 free the interpolated values for the pixels in between
+			if ((low == 0 || high == 255) && innerLow <= innerHigh)
+				tryEndpoints(innerLow, innerHigh);
+			// The extremes are rarely the best endpoints, pull them in a little
+			int range = quality == ENCODE_QUALITY_BEST ? 4 : 1;
+			for (int inset0 = 0; inset0 <= range; inset0++)
+			{
+				for (int inset1 = 0; inset1 <= range; inset1++)
+				{
+					if (high - inset0 > low + inset1)
+						tryEndpoints(high - inset0, low + inset1);
+				}
+			}
+		}
+
+		uint64_t packed = 0;
+		for (int i = 0; i < 16; i++)
+			packed |= (uint64_t)indices[i] << (3 * i);
+		out[0] = (uint8_t)value0;
+		out[1] = (uint8_t)value1;
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = (uint8_t)(packed >> (8 * i));
+	}
+
+	void decodeBC4(const uint8_t *block, int channel, uint8_t *pixels)
+	{
+		Palette palette = bc4Palette(block[0], block[1], channel);
+		uint64_t packed = 0;
+		for (int i = 0; i < 6; i++)
+			packed |= (uint64_t)block[2 + i] << (8 * i);
+		for (int i = 0; i < 16; i++)
+			pixels[i * 4 + channel] = (uint8_t)std::lround(palette.colors[(packed >> (3 * i)) & 7][channel]);
+	}
+
+	// --- BC7 mode 6 ---
+
+	// 7 bit endpoint and its p-bit, the decoder's 8 bit value being (value << 1) | pBit
+	struct BC7Endpoint
+	{
+		int value[4];
+		int pBit;
+	};
+
+	BC7Endpoint quantizeBC7(const float color[4], int pBit)
+	{
+		BC7Endpoint endpoint;
+		endpoint.pBit = pBit;
+		for (int c = 0; c < 4; c++)
+			endpoint.value[c] = std::min(std::max((int)std::lround((color[c] - pBit) / 2.0f), 0), 127);
+		return endpoint;
+	}
+
+	// The p-bit that rounds the endpoint closest to its color
+	BC7Endpoint quantizeBC7(const float color[4])
+	{
+		BC7Endpoint best = quantizeBC7(color, 0);
+		float bestError = FLT_MAX;
+		for (int pBit = 0; pBit < 2; pBit++)
+		{
+			BC7Endpoint endpoint = quantizeBC7(color, pBit);
+			float error = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				float d = (float)((endpoint.value[c] << 1) | pBit) - color[c];
+				error += d * d;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				best = endpoint;
+			}
+		}
+		return best;
+	}
+
+	Palette bc7Palette(const BC7Endpoint &endpoint0, const BC7Endpoint &endpoint1)
+	{
+		Palette palette;
+		palette.size = 16;
+		for (int c = 0; c < 4; c++)
+		{
+			int value0 = (endpoint0.value[c] << 1) | endpoint0.pBit, value1 = (endpoint1.value[c] << 1) | endpoint1.pBit;
+			for (int p = 0; p < 16; p++)
+				palette.colors[p][c] = (float)(((64 - BC7_WEIGHTS[p]) * value0 + BC7_WEIGHTS[p] * value1 + 32) >> 6);
+		}
+		return palette;
+	}
+
+	void encodeBC7(const Block &block, EncodeQuality quality, uint8_t *out)
+	{
+		float color0[4], color1[4];
+		principalEndpoints(block, 4, color0, color1);
+		BC7Endpoint endpoint0 = quantizeBC7(color0), endpoint1 = quantizeBC7(color1);
+		uint8_t indices[16];
+		float error = selectIndices(block, bc7Palette(endpoint0, endpoint1), RGBA_WEIGHTS, indices);
+		auto tryEndpoints = [&](const BC7Endpoint &candidate0, const BC7Endpoint &candidate1)
+		{
+			uint8_t candidateIndices[16];
+			float candidateError = selectIndices(block, bc7Palette(candidate0, candidate1), RGBA_WEIGHTS, candidateIndices);
+			if (candidateError >= error)
+				return false;
+			error = candidateError;
+			endpoint0 = candidate0;
+			endpoint1 = candidate1;
+			std::memcpy(indices, candidateIndices, 16);
+			return true;
+		};
+
+		for (unsigned int pass = 0; pass < REFINE_PASSES[quality]; pass++)
+		{
+			float positions[16];
+			for (int i = 0; i < 16; i++)
+				positions[i] = BC7_WEIGHTS[indices[i]] / 64.0f;
+			if (!leastSquaresEndpoints(block, 4, positions, color0, color1))
+				break;
+			bool improved = tryEndpoints(quantizeBC7(color0), quantizeBC7(color1));
+			if (quality == ENCODE_QUALITY_BEST)
+			{
+				// Every combination of p-bits against the whole block, not just the closest rounding of each endpoint
+				for (int pBits = 0; pBits < 4; pBits++)
+					improved |= tryEndpoints(quantizeBC7(color0, pBits & 1), quantizeBC7(color1, pBits >> 1));
+			}
+			if (!improved)
+				break;
+		}
+
+		// The first pixel's index is stored without its top bit, so it must be in the first half of the palette
+		if (indices[0] >= 8)
+		{
+			std::swap(endpoint0, endpoint1);
+			for (int i = 0; i < 16; i++)
+				indices[i] = (uint8_t)(15 - indices[i]);
+		}
+
+		std::memset(out, 0, 16);
+		BitWriter writer = { out };
+		writer.write(1u << 6, 7); // mode 6
+		for (int c = 0; c < 4; c++)
+		{
+			writer.write(endpoint0.value[c], 7);
+			writer.write(endpoint1.value[c], 7);
+		}
+		writer.write(endpoint0.pBit, 1);
+		writer.write(endpoint1.pBit, 1);
+		for (int i = 0; i < 16; i++)
+			writer.write(indices[i], i == 0 ? 3 : 4);
+	}
+
+	void decodeBC7(const uint8_t *block, uint8_t *pixels)
+	{
+		BitReader reader = { block };
+		if (reader.read(7) != (1u << 6))
+		{
+			// Not mode 6, which is all the encoder writes: magenta, so it shows
+			for (int i = 0; i < 16; i++)
+			{
+				const uint8_t magenta[4] = { 255, 0, 255, 255 };
+				std::memcpy(&pixels[i * 4], magenta, 4);
+			}
+			return;
+		}
+		BC7Endpoint endpoint0, endpoint1;
+		for (int c = 0; c < 4; c++)
+		{
+			endpoint0.value[c] = (int)reader.read(7);
+			endpoint1.value[c] = (int)reader.read(7);
+		}
+		endpoint0.pBit = (int)reader.read(1);
+		endpoint1.pBit = (int)reader.read(1);
+		Palette palette = bc7Palette(endpoint0, endpoint1);
+		for (int i = 0; i < 16; i++)
+		{
+			unsigned int index = reader.read(i == 0 ? 3 : 4);
+			for (int c = 0; c < 4; c++)
+				pixels[i * 4 + c] = (uint8_t)palette.colors[index][c];
+		}
+	}
+}
+
+unsigned int TextureEncoder::BlockBytes(BlockFormat format)
+{
+	return format == BLOCK_FORMAT_BC1 || format == BLOCK_FORMAT_BC4 ? 8 : 16;
+}
+
+void TextureEncoder::EncodeBlock(BlockFormat format, const uint8_t *pixels, EncodeQuality quality, uint8_t *block)
+{
+	Block loaded = loadBlock(pixels);
+	switch (format)
+	{
+	case BLOCK_FORMAT_BC1:
+		encodeBC1(loaded, quality, block);
+		break;
+	case BLOCK_FORMAT_BC3:
+		encodeBC4(loaded, 3, quality, block);
+		encodeBC1(loaded, quality, block + 8);
+		break;
+	case BLOCK_FORMAT_BC4:
+		encodeBC4(loaded, 0, quality, block);
+		break;
+	case BLOCK_FORMAT_BC5:
+		encodeBC4(loaded, 0, quality, block);
+		encodeBC4(loaded, 1, quality, block + 8);
+		break;
+	case BLOCK_FORMAT_BC7:
+	default:
+		encodeBC7(loaded, quality, block);
+		break;
+	}
+}
+
+void TextureEncoder::DecodeBlock(BlockFormat format, const uint8_t *block, uint8_t *pixels)
+{
+	// Channels a format doesn't store read back as the GL defaults: 0 for color, 255 for alpha
+	for (int i = 0; i < 16; i++)
+	{
+		pixels[i * 4] = pixels[i * 4 + 1] = pixels[i * 4 + 2] = 0;
+		pixels[i * 4 + 3] = 255;
+	}
+	switch (format)
+	{
+	case BLOCK_FORMAT_BC1:
+		decodeBC1(block, pixels);
+		break;
+	case BLOCK_FORMAT_BC3:
+		decodeBC1(block + 8, pixels);
+		decodeBC4(block, 3, pixels);
+		break;
+	case BLOCK_FORMAT_BC4:
+		decodeBC4(block, 0, pixels);
+		break;
+	case BLOCK_FORMAT_BC5:
+		decodeBC4(block, 0, pixels);
+		decodeBC4(block + 8, 1, pixels);
+		break;
+	case BLOCK_FORMAT_BC7:
+	default:
+		decodeBC7(block, pixels);
+		break;
+	}
+}
+
+std::vector<uint8_t> TextureEncoder::Encode(BlockFormat format, const uint8_t *rgba, unsigned int width, unsigned int height,
+	EncodeQuality quality)
+{
+	unsigned int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+	unsigned int blockBytes = BlockBytes(format);
+	std::vector<uint8_t> blocks((size_t)blocksWide * blocksHigh * blockBytes);
+	ThreadPool::Shared().ParallelFor(blocksHigh, [&](unsigned int blockY)
+	{
+		uint8_t pixels[64];
+		for (unsigned int blockX = 0; blockX < blocksWide; blockX++)
+		{
+			for (unsigned int i = 0; i < 16; i++)
+			{
+				unsigned int x = std::min(blockX * 4 + i % 4, width - 1), y = std::min(blockY * 4 + i / 4, height - 1);
+				std::memcpy(&pixels[i * 4], &rgba[((size_t)y * width + x) * 4], 4);
+			}
+			EncodeBlock(format, pixels, quality, &blocks[((size_t)blockY * blocksWide + blockX) * blockBytes]);
+		}
+	});
+	return blocks;
+}
+
+std::vector<uint8_t> TextureEncoder::Decode(BlockFormat format, const uint8_t *blocks, unsigned int width, unsigned int height)
+{
+	unsigned int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+	unsigned int blockBytes = BlockBytes(format);
+	std::vector<uint8_t> rgba((size_t)width * height * 4);
+	ThreadPool::Shared().ParallelFor(blocksHigh, [&](unsigned int blockY)
+	{
+		uint8_t pixels[64];
+		for (unsigned int blockX = 0; blockX < blocksWide; blockX++)
+		{
+			DecodeBlock(format, &blocks[((size_t)blockY * blocksWide + blockX) * blockBytes], pixels);
+			for (unsigned int i = 0; i < 16; i++)
+			{
+				unsigned int x = blockX * 4 + i % 4, y = blockY * 4 + i / 4;
+				if (x < width && y < height)
+					std::memcpy(&rgba[((size_t)y * width + x) * 4], &pixels[i * 4], 4);
+			}
+		}
+	});
+	return rgba;
+}
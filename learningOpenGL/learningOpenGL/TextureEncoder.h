@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Block compressed formats the encoder writes, every block covers 4x4 pixels
+enum BlockFormat
+{
+	BLOCK_FORMAT_BC1,	// RGB, 8 bytes: two 565 endpoints and 2 bit indices
+	BLOCK_FORMAT_BC3,	// RGBA, 16 bytes: a BC4 block of alpha then a BC1 block of color
+	BLOCK_FORMAT_BC4,	// one channel (red), 8 bytes: two 8 bit endpoints and 3 bit indices
+	BLOCK_FORMAT_BC5,	// two channels (red, green), 16 bytes: two BC4 blocks
+	BLOCK_FORMAT_BC7,	// RGBA, 16 bytes, written in mode 6: 7 bit endpoints with a p-bit each and 4 bit indices
+	BLOCK_FORMAT_COUNT
+};
+const char *const BLOCK_FORMAT_NAMES[BLOCK_FORMAT_COUNT] = { "BC1", "BC3", "BC4", "BC5", "BC7" };
+
+// How hard the encoder searches for endpoints, each step is a few times slower than the previous one
+enum EncodeQuality
+{
+	ENCODE_QUALITY_FAST,	// endpoints from the principal axis of the block only
+	ENCODE_QUALITY_NORMAL,	// refined by least squares from the chosen indices
+	ENCODE_QUALITY_BEST,	// more refinement passes, and every endpoint variant is tried against the whole block
+	ENCODE_QUALITY_COUNT
+};
+const char *const ENCODE_QUALITY_NAMES[ENCODE_QUALITY_COUNT] = { "fast", "normal", "best" };
+
+// CPU block compression encoder. Every block is fitted on its own: endpoints along the principal axis of its pixels,
+// refined by least squares for the better qualities, with the closest palette entry picked for four pixels at a time
+// with SSE2 where it's available. Rows of blocks are encoded in parallel on the worker pool.
+class TextureEncoder
+{
+public:
+	static unsigned int BlockBytes(BlockFormat format);
+
+	/// Compresses an RGBA8 image, rows top to bottom. Blocks past the right and bottom edges of sizes that aren't
+	/// multiples of 4 repeat the last column and row.
+	static std::vector<uint8_t> Encode(BlockFormat format, const uint8_t *rgba, unsigned int width, unsigned int height,
+		EncodeQuality quality = ENCODE_QUALITY_NORMAL);
+	/// Decodes blocks written by Encode back to RGBA8 (only BC7 mode 6), to measure what the compression lost
+	static std::vector<uint8_t> Decode(BlockFormat format, const uint8_t *blocks, unsigned int width, unsigned int height);
+
+	/// One block of 16 RGBA8 pixels, row by row
+	static void EncodeBlock(BlockFormat format, const uint8_t *pixels, EncodeQuality quality, uint8_t *block);
+	static void DecodeBlock(BlockFormat format, const uint8_t *block, uint8_t *pixels);
+};
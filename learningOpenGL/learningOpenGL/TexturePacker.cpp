@@ -0,0 +1,168 @@
+#include "TexturePacker.h"
+#include "KtxTexture.h"
+#include "MipGenerator.h"
+#include "TextureEncoder.h"
+#include "ImageDecoder.h"
+#include "MappedFile.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+	const char *const MASK_MARKER = "_mask_";
+
+	bool modificationTime(const std::string &path, time_t &time)
+	{
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			return false;
+		time = info.st_mtime;
+		return true;
+	}
+}
+
+std::string TexturePacker::PackedPath(const std::string (&sources)[MASK_CHANNEL_COUNT])
+{
+	// Materials sharing their first map but not the others get different textures through the hash of every map
+	std::string first, letters;
+	uint64_t hash = HashBytes(nullptr, 0);
+	for (unsigned int c = 0; c < MASK_CHANNEL_COUNT; c++)
+	{
+		hash = HashBytes((const uint8_t*)sources[c].c_str(), sources[c].size() + 1, hash);
+		if (sources[c].empty())
+			continue;
+		if (first.empty())
+			first = sources[c];
+		letters += MASK_CHANNEL_LETTERS[c];
+	}
+	if (first.empty())
+		return std::string();
+	size_t dot = first.find_last_of('.');
+	size_t slash = first.find_last_of("/\\");
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+		first.erase(dot);
+	std::string digits;
+	for (int shift = 28; shift >= 0; shift -= 4)
+		digits += "0123456789abcdef"[((hash ^ (hash >> 32)) >> shift) & 0xF];
+	return first + MASK_MARKER + letters + '_' + digits + KTX_EXTENSION;
+}
+
+unsigned int TexturePacker::ChannelsFromPath(const std::string &path)
+{
+	size_t marker = path.rfind(MASK_MARKER);
+	if (marker == std::string::npos)
+		return 0;
+	unsigned int channels = 0;
+	for (size_t i = marker + std::strlen(MASK_MARKER); i < path.size() && path[i] != '_' && path[i] != '.'; i++)
+	{
+		for (unsigned int c = 0; c < MASK_CHANNEL_COUNT; c++)
+		{
+			if (path[i] == MASK_CHANNEL_LETTERS[c])
+				channels |= 1u << c;
+		}
+	}
+	return channels;
+}
+
+bool TexturePacker::Pack(const std::string &directory, const std::string (&sources)[MASK_CHANNEL_COUNT])
+{
+	std::string packedPath = directory + '/' + PackedPath(sources);
+	time_t packedTime, sourceTime;
+	bool upToDate = modificationTime(packedPath, packedTime);
+	for (unsigned int c = 0; c < MASK_CHANNEL_COUNT && upToDate; c++)
+	{
+		if (!sources[c].empty())
+			upToDate = modificationTime(directory + '/' + sources[c], sourceTime) && sourceTime <= packedTime;
+	}
+	if (upToDate)
+		return true;
+
+	// Every map as one channel, colored ones by their luminance. The first map sets the size, the others are point
+	// sampled to it if they differ.
+	std::vector<uint8_t> maps[MASK_CHANNEL_COUNT];
+	std::vector<uint8_t> pixels;	// decoded map, reused for every source
+	int width = 0, height = 0;
+	unsigned int stored = 0;
+	for (unsigned int c = 0; c < MASK_CHANNEL_COUNT; c++)
+	{
+		if (sources[c].empty())
+			continue;
+		int mapWidth, mapHeight, components;
+		if (!ImageDecoder::DecodeFile(directory + '/' + sources[c], pixels, mapWidth, mapHeight, components, 1))
+		{
+			std::cout << "ERROR::TEXTURE_PACKER::CANNOT_LOAD " << directory << '/' << sources[c] << std::endl;
+			return false; // the packed name promises every map
+		}
+		if (stored == 0)
+		{
+			width = mapWidth;
+			height = mapHeight;
+		}
+		maps[c].resize((size_t)width * height);
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+				maps[c][(size_t)y * width + x] = pixels[(size_t)(y * mapHeight / height) * mapWidth + x * mapWidth / width];
+		}
+		stored++;
+	}
+	if (stored == 0)
+		return false;
+
+	// Interleaved as RGBA for the mip filter and the encoder, the maps in the first channels
+	std::vector<uint8_t> rgba((size_t)width * height * 4, 0);
+	unsigned int channel = 0;
+	for (unsigned int c = 0; c < MASK_CHANNEL_COUNT; c++)
+	{
+		if (maps[c].empty())
+			continue;
+		for (size_t i = 0; i < maps[c].size(); i++)
+			rgba[i * 4 + channel] = maps[c][i];
+		channel++;
+	}
+	MipSettings mipSettings;
+	mipSettings.wrap = true; // model textures repeat
+	std::vector<std::vector<uint8_t>> mips = MipGenerator::Build(rgba.data(), (unsigned int)width, (unsigned int)height, 4, mipSettings);
+	mips.insert(mips.begin(), std::move(rgba));
+
+	KtxFormat format = stored == 1 ? KTX_FORMAT_BC4_UNORM : stored == 2 ? KTX_FORMAT_BC5_UNORM : KTX_FORMAT_R8G8B8A8_UNORM;
+	if (stored <= 2)
+	{
+		BlockFormat blockFormat = stored == 1 ? BLOCK_FORMAT_BC4 : BLOCK_FORMAT_BC5;
+		unsigned int levelWidth = (unsigned int)width, levelHeight = (unsigned int)height;
+		for (std::vector<uint8_t> &level : mips)
+		{
+			level = TextureEncoder::Encode(blockFormat, level.data(), levelWidth, levelHeight);
+			levelWidth = std::max(1u, levelWidth / 2);
+			levelHeight = std::max(1u, levelHeight / 2);
+		}
+	}
+	if (!KtxTexture::Write(packedPath, format, (unsigned int)width, (unsigned int)height, mips))
+		return false;
+	std::cout << "PACK:: " << packedPath << " " << width << "x" << height << ", " << stored << " maps" << std::endl;
+	return true;
+}
+
+void TexturePacker::MaskChannelMatrix(unsigned int channels, float out[16])
+{
+	std::fill(out, out + 16, 0.0f);
+	unsigned int stored = 0;
+	for (unsigned int c = 0; c < MASK_CHANNEL_COUNT; c++)
+	{
+		if (channels & (1u << c))
+			out[stored++ * 4 + c] = 1.0f;
+	}
+}
+
+void TexturePacker::MaskChannelDefaults(unsigned int channels, float out[MASK_CHANNEL_COUNT])
+{
+	for (unsigned int c = 0; c < MASK_CHANNEL_COUNT; c++)
+		out[c] = channels & (1u << c) ? 0.0f : MASK_CHANNEL_DEFAULTS[c];
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+
+// Single channel maps of a material packed together in one texture, in this order of channels
+enum MaskChannel
+{
+	MASK_SPECULAR,	// specular intensity
+	MASK_GLOSS,		// scales material.shininess
+	MASK_OCCLUSION,	// ambient occlusion, darkens the ambient term
+	MASK_HEIGHT,	// packed for parallax mapping, the lighting doesn't read it yet
+	MASK_CHANNEL_COUNT
+};
+// Letters of the channels in a packed texture's name, and the values of the maps a material doesn't have
+const char MASK_CHANNEL_LETTERS[MASK_CHANNEL_COUNT + 1] = "sgoh";
+const float MASK_CHANNEL_DEFAULTS[MASK_CHANNEL_COUNT] = { 1.0f, 1.0f, 1.0f, 0.0f };
+
+// Packs a material's specular, gloss, occlusion and height maps into one texture at import, so a mesh binds one
+// texture and a fragment fetches it once for all of them. Only the maps the material has are stored, one after the
+// other: a lone specular map becomes a BC4 texture (an eighth of the RGBA image it was), two maps BC5, more plain
+// RGBA8. The shaders put the channels back in place with the material.maskChannels matrix (see MaskChannelMatrix).
+// The packed texture is a .ktx2 next to the first map, named after it, the channels it holds and a hash of every
+// map's path ("arm_spec.png" with a gloss map -> "arm_spec_mask_sg_8aa6541e.ktx2"), and only rebuilt when a map is newer.
+class TexturePacker
+{
+public:
+	/// @param sources paths of the maps relative to the model, empty for the ones the material doesn't have
+	/// @return the packed texture's path relative to the model, empty if there are no maps
+	static std::string PackedPath(const std::string (&sources)[MASK_CHANNEL_COUNT]);
+	/// Bit i set if MaskChannel i is stored in the texture, read from its name
+	static unsigned int ChannelsFromPath(const std::string &path);
+
+	/// Builds the packed texture unless it's newer than every map
+	/// @param directory the model's directory, sources and the packed path are relative to it
+	/// @return false if no map could be loaded
+	static bool Pack(const std::string &directory, const std::string (&sources)[MASK_CHANNEL_COUNT]);
+
+	/// Column k of the result is the channel the k-th stored map goes to, so matrix * texel gives every map in
+	/// place, 0 for the missing ones (MASK_CHANNEL_DEFAULTS fills those in)
+	/// @param out 16 floats, column-major
+	static void MaskChannelMatrix(unsigned int channels, float out[16]);
+	/// MASK_CHANNEL_DEFAULTS for the channels not stored, 0 for the others
+	static void MaskChannelDefaults(unsigned int channels, float out[MASK_CHANNEL_COUNT]);
+};
@@ -0,0 +1,136 @@
+#include "TextureResidency.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <iostream>
+
+TextureResidency &TextureResidency::Shared()
+{
+	static TextureResidency residency;
+	return residency;
+}
+
+void TextureResidency::Uploaded(GLuint texture, const std::string &path, bool gamma, unsigned int width, unsigned int height,
+	const std::vector<size_t> &levelBytes)
+{
+	if (levelBytes.empty())
+	{
+		// The file is gone, whatever levels the texture still has are all it will get
+		Forget(texture);
+		return;
+	}
+	Resident &resident = textures[texture];
+	resident.path = path;
+	resident.gamma = gamma;
+	resident.levelBytes = levelBytes;
+	resident.width = width;
+	resident.height = height;
+	resident.baseLevel = 0;
+	resident.reloading = false;
+	resident.lastUsed = std::max(resident.lastUsed, frame);
+}
+
+void TextureResidency::Update()
+{
+	frame++;
+	size_t total = 0;
+	for (const auto &texture : textures)
+		total += residentBytes(texture.second);
+	for (const auto &texture : pinned)
+		total += texture.second;
+	if (total <= budget)
+		return;
+
+	// Least recently used first, among the textures cold enough to lose levels
+	std::vector<std::pair<uint64_t, GLuint>> cold;
+	for (const auto &texture : textures)
+	{
+		if (!texture.second.reloading && texture.second.lastUsed + RESIDENCY_COLD_FRAMES < frame)
+			cold.push_back(std::make_pair(texture.second.lastUsed, texture.first));
+	}
+	std::sort(cold.begin(), cold.end());
+
+	size_t freed = 0;
+	for (const std::pair<uint64_t, GLuint> &texture : cold)
+	{
+		if (total - freed <= budget)
+			break;
+		size_t bytes = dropLevels(texture.second, textures[texture.second], total - freed - budget);
+		freed += bytes;
+		evictions += bytes > 0;
+	}
+}
+
+size_t TextureResidency::dropLevels(GLuint texture, Resident &resident, size_t excess)
+{
+	// One level at a time, each one freeing three quarters of what is left, until the excess is covered
+	unsigned int baseLevel = resident.baseLevel;
+	size_t freed = 0;
+	while (freed < excess && baseLevel + 1 < resident.levelBytes.size()
+		&& std::max(resident.width >> (baseLevel + 1), resident.height >> (baseLevel + 1)) >= RESIDENCY_MIN_SIZE)
+	{
+		freed += resident.levelBytes[baseLevel];
+		baseLevel++;
+	}
+	if (baseLevel == resident.baseLevel)
+		return 0;
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel);
+	// Respecifying a level with no texels gives its memory back, the levels from baseLevel on are left as they are
+	GLint internalFormat, compressed;
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, baseLevel, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, baseLevel, GL_TEXTURE_COMPRESSED, &compressed);
+	for (unsigned int level = resident.baseLevel; level < baseLevel; level++)
+	{
+		if (compressed)
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, 0, 0, 0, 0, NULL);
+		else
+			glTexImage2D(GL_TEXTURE_2D, level, internalFormat, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	resident.baseLevel = baseLevel;
+	TextureCache::Shared().SetBytes(texture, residentBytes(resident));
+	return freed;
+}
+
+void TextureResidency::reload(GLuint texture, Resident &resident)
+{
+	resident.reloading = true;
+	reloads++;
+	TextureStreamer::Shared().Reload(texture, resident.path, resident.gamma, resident.baseLevel);
+}
+
+size_t TextureResidency::residentBytes(const Resident &resident)
+{
+	size_t bytes = 0;
+	for (size_t level = resident.baseLevel; level < resident.levelBytes.size(); level++)
+		bytes += resident.levelBytes[level];
+	return bytes;
+}
+
+TextureResidency::Stats TextureResidency::GetStats() const
+{
+	Stats stats = { budget, 0, 0, 0, (unsigned int)textures.size(), 0, evictions, reloads };
+	for (const auto &texture : textures)
+	{
+		size_t bytes = residentBytes(texture.second);
+		stats.residentBytes += bytes;
+		for (size_t level = 0; level < texture.second.baseLevel; level++)
+			stats.evictedBytes += texture.second.levelBytes[level];
+		stats.evictedTextures += texture.second.baseLevel > 0;
+	}
+	for (const auto &texture : pinned)
+		stats.pinnedBytes += texture.second;
+	return stats;
+}
+
+void TextureResidency::PrintStats() const
+{
+	Stats stats = GetStats();
+	std::cout << "TEXTURE_RESIDENCY:: " << stats.textureCount << " textures, " << stats.residentBytes / 1024 << " KB resident of a "
+		<< stats.budgetBytes / 1024 << " KB budget, " << stats.evictedBytes / 1024 << " KB evicted from " << stats.evictedTextures
+		<< " textures, " << stats.pinnedBytes / 1024 << " KB pinned, " << stats.evictions << " evictions, " << stats.reloads << " reloads" << std::endl;
+}
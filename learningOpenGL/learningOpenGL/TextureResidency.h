@@ -0,0 +1,94 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bytes of texture memory the residency manager tries to stay under by default
+const size_t RESIDENCY_DEFAULT_BUDGET = 256 * 1024 * 1024;
+// Frames a texture must go unbound before its finest levels may be dropped
+const unsigned int RESIDENCY_COLD_FRAMES = 120;
+// Cold textures keep their levels up to this size, so they still look right from afar
+const unsigned int RESIDENCY_MIN_SIZE = 128;
+
+// Keeps the 2D textures streamed from files (see TextureStreamer) within a byte budget. Every bind marks a texture
+// used this frame. While the resident bytes are over the budget, the textures unused for longest lose their finest
+// levels: GL_TEXTURE_BASE_LEVEL moves past them and the levels are reallocated empty, which frees their memory.
+// Binding such a texture again queues its file on the streamer, which brings the dropped levels back.
+// The budget is soft: textures used in the last RESIDENCY_COLD_FRAMES frames are never dropped.
+// Embedded images and cubemaps have no file to come back from and aren't managed. Called on the GL thread only.
+class TextureResidency
+{
+public:
+	struct Stats
+	{
+		size_t budgetBytes;
+		size_t residentBytes;	// levels on the GPU, of the managed textures
+		size_t evictedBytes;	// levels dropped and not loaded back yet
+		size_t pinnedBytes;		// textures counted against the budget that never lose levels
+		unsigned int textureCount;
+		unsigned int evictedTextures;	// textures missing some of their levels
+		unsigned int evictions;	// times a texture lost levels
+		unsigned int reloads;	// times dropped levels were requested again
+	};
+
+	static TextureResidency &Shared();
+
+	void SetBudget(size_t bytes) { budget = bytes; }
+	/// Marks the texture as used this frame, requesting its dropped levels if it has any
+	void Touch(GLuint texture)
+	{
+		auto found = textures.find(texture);
+		if (found == textures.end())
+			return;
+		found->second.lastUsed = frame;
+		if (found->second.baseLevel > 0 && !found->second.reloading)
+			reload(texture, found->second);
+	}
+	/// Called by the streamer once every level of a texture is uploaded, for the first time or after a reload
+	/// @param width, height size of level 0
+	/// @param levelBytes bytes of each level, full resolution first; empty if the file couldn't be loaded
+	void Uploaded(GLuint texture, const std::string &path, bool gamma, unsigned int width, unsigned int height,
+		const std::vector<size_t> &levelBytes);
+	/// Counts a texture with no file to reload it from against the budget (MaterialBatch's arrays), so the textures
+	/// it was copied from go cold and lose their levels first instead of staying resident beside it
+	void Pin(GLuint texture, size_t bytes) { pinned[texture] = bytes; }
+	/// Stops managing a texture, before it is deleted
+	void Forget(GLuint texture)
+	{
+		textures.erase(texture);
+		pinned.erase(texture);
+	}
+	/// Drops the finest levels of the coldest textures while over budget. Call once per frame.
+	void Update();
+
+	Stats GetStats() const;
+	void PrintStats() const;
+
+private:
+	struct Resident
+	{
+		std::string path;
+		bool gamma;
+		std::vector<size_t> levelBytes;
+		unsigned int width, height;	// of level 0
+		unsigned int baseLevel = 0;	// finest level on the GPU
+		uint64_t lastUsed = 0;
+		bool reloading = false;
+	};
+
+	std::unordered_map<GLuint, Resident> textures;
+	std::unordered_map<GLuint, size_t> pinned;
+	size_t budget = RESIDENCY_DEFAULT_BUDGET;
+	uint64_t frame = 0;
+	unsigned int evictions = 0;
+	unsigned int reloads = 0;
+
+	TextureResidency() {}
+	void reload(GLuint texture, Resident &resident);
+	size_t dropLevels(GLuint texture, Resident &resident, size_t excess);
+	static size_t residentBytes(const Resident &resident);
+};
@@ -0,0 +1,371 @@
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+#include "TextureCache.h"
+#include "TextureResidency.h"
+#include "MipGenerator.h"
+#include "ImageDecoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+	GLenum formatForComponents(int components)
+	{
+		if (components == 1)
+			return GL_RED;
+		if (components == 2)
+			return GL_RG;
+		if (components == 3)
+			return GL_RGB;
+		return GL_RGBA;
+	}
+}
+
+TextureStreamer &TextureStreamer::Shared()
+{
+	static TextureStreamer streamer;
+	return streamer;
+}
+
+GpuTexture TextureStreamer::createPlaceholder()
+{
+	GpuTexture texture = GpuTexture::Create();
+	glBindTexture(GL_TEXTURE_2D, texture);
+	// Neutral grey placeholder, without mips until the real image arrives
+	const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	texture.SetBytes(sizeof(placeholder));
+	pendingCount++;
+	return texture;
+}
+
+GpuTexture TextureStreamer::Request(const std::string &path, bool gamma)
+{
+	GpuTexture placeholder = createPlaceholder();
+	GLuint texture = placeholder;
+	std::shared_ptr<DecodedQueue> queue = decoded;
+	ThreadPool::Shared().Submit([queue, texture, path, gamma]
+	{
+		DecodedImage image;
+		image.texture = texture;
+		image.path = path;
+		image.gamma = gamma;
+		image.managed = true;
+		if (!openCooked(image, path))
+		{
+			ImageDecoder::DecodeFile(path, image.pixels, image.width, image.height, image.components);
+			buildMips(image);
+		}
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->images.push_back(std::move(image));
+	});
+	return placeholder;
+}
+
+void TextureStreamer::Reload(GLuint texture, const std::string &path, bool gamma, unsigned int levels)
+{
+	pendingCount++;
+	std::shared_ptr<DecodedQueue> queue = decoded;
+	ThreadPool::Shared().Submit([queue, texture, path, gamma, levels]
+	{
+		DecodedImage image;
+		image.texture = texture;
+		image.path = path;
+		image.gamma = gamma;
+		image.managed = true;
+		if (openCooked(image, path))
+		{
+			// Only the missing levels are uploaded, finest last, the coarser ones are still on the GPU
+			if (levels < image.ktx->LevelCount())
+			{
+				image.reloadLevels = levels;
+				image.uploadedLevels = image.ktx->LevelCount() - levels;
+			}
+		}
+		else
+		{
+			// A decoded image is uploaded whole, every level is specified again
+			ImageDecoder::DecodeFile(path, image.pixels, image.width, image.height, image.components);
+			buildMips(image);
+		}
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->images.push_back(std::move(image));
+	});
+}
+
+GpuTexture TextureStreamer::Request(std::shared_ptr<const void> owner, const unsigned char *bytes, size_t size, const std::string &name, bool gamma)
+{
+	GpuTexture placeholder = createPlaceholder();
+	GLuint texture = placeholder;
+	std::shared_ptr<DecodedQueue> queue = decoded;
+	ThreadPool::Shared().Submit([queue, texture, owner, bytes, size, name, gamma]
+	{
+		DecodedImage image;
+		image.texture = texture;
+		image.path = name;
+		image.gamma = gamma;
+		if (KtxTexture::IsKtx(bytes, size))
+		{
+			std::shared_ptr<KtxTexture> ktx = std::make_shared<KtxTexture>();
+			if (ktx->Parse(owner, bytes, size, name))
+				image.ktx = ktx;
+		}
+		else
+		{
+			ImageDecoder::Decode(bytes, size, image.pixels, image.width, image.height, image.components);
+			buildMips(image);
+		}
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->images.push_back(std::move(image));
+	});
+	return placeholder;
+}
+
+void TextureStreamer::Update()
+{
+	size_t uploaded = 0;
+	while (uploaded < STREAMING_UPLOAD_BUDGET)
+	{
+		DecodedImage image;
+		{
+			std::lock_guard<std::mutex> lock(decoded->mutex);
+			if (decoded->images.empty())
+				break;
+			image = std::move(decoded->images.front()); // the pixels and mips are moved, not copied
+		}
+		size_t bytes = 0;
+		if (!upload(image, bytes))
+		{
+			// Every pixel buffer is still in flight or couldn't be mapped, try again next frame
+			std::lock_guard<std::mutex> lock(decoded->mutex);
+			decoded->images.front() = std::move(image);
+			break;
+		}
+		uploaded += bytes;
+
+		bool finished = !image.ktx || image.uploadedLevels == image.ktx->LevelCount();
+		{
+			std::lock_guard<std::mutex> lock(decoded->mutex);
+			decoded->images.pop_front();
+			if (!finished)
+				decoded->images.push_back(std::move(image)); // finer levels wait behind the other textures
+		}
+		if (finished)
+		{
+			pendingCount--;
+			if (image.managed)
+				TextureResidency::Shared().Uploaded(image.texture, image.path, image.gamma, image.width, image.height, image.levelBytes);
+		}
+	}
+}
+
+void TextureStreamer::Flush()
+{
+	while (pendingCount > 0)
+	{
+		Update();
+		if (pendingCount > 0)
+			std::this_thread::yield();
+	}
+}
+
+void TextureStreamer::Shutdown()
+{
+	Flush();
+	for (PixelBuffer &pbo : pixelBuffers)
+	{
+		if (pbo.fence)
+			glDeleteSync(pbo.fence);
+		pbo = PixelBuffer(); // deletes the buffer
+	}
+}
+
+TextureStreamer::PixelBuffer *TextureStreamer::acquirePixelBuffer(size_t bytes)
+{
+	PixelBuffer &pbo = pixelBuffers[nextBuffer];
+	if (pbo.fence)
+	{
+		// Don't wait on the GPU, a buffer still being read means the ring is full for this frame
+		if (glClientWaitSync(pbo.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			return nullptr;
+		glDeleteSync(pbo.fence);
+		pbo.fence = 0;
+	}
+	if (!pbo.buffer)
+		pbo.buffer = GpuBuffer::Create(GPU_MEMORY_STAGING_BUFFERS);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo.buffer);
+	if (pbo.capacity < bytes)
+	{
+		GpuBufferData(pbo.buffer, GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		pbo.capacity = bytes;
+	}
+	nextBuffer = (nextBuffer + 1) % STREAMING_PBO_COUNT;
+	return &pbo;
+}
+
+void TextureStreamer::returnPixelBuffer()
+{
+	// The buffer acquirePixelBuffer just handed out holds no upload, it is the next one again
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	nextBuffer = (nextBuffer + STREAMING_PBO_COUNT - 1) % STREAMING_PBO_COUNT;
+}
+
+bool TextureStreamer::openCooked(DecodedImage &image, const std::string &path)
+{
+	std::shared_ptr<KtxTexture> ktx = std::make_shared<KtxTexture>();
+	if (!ktx->Open(KtxTexture::CookedPath(path)))
+		return false;
+	image.ktx = ktx;
+	image.width = (int)ktx->Width();
+	image.height = (int)ktx->Height();
+	return true;
+}
+
+void TextureStreamer::buildMips(DecodedImage &image)
+{
+	if (image.pixels.empty())
+		return;
+	// Textures repeat (see createPlaceholder), so the filter wraps around the edges too
+	MipSettings settings;
+	settings.srgb = image.gamma;
+	settings.wrap = true;
+	image.mips = MipGenerator::Build(image.pixels.data(), (unsigned int)image.width, (unsigned int)image.height, (unsigned int)image.components, settings);
+}
+
+bool TextureStreamer::upload(DecodedImage &image, size_t &bytes)
+{
+	if (image.ktx)
+		return uploadKtxLevels(image, bytes);
+	if (image.pixels.empty())
+	{
+		std::cout << "Texture failed to load at path: " << image.path << std::endl;
+		return true; // keeps its placeholder
+	}
+
+	size_t baseBytes = (size_t)image.width * image.height * image.components;
+	bytes = baseBytes;
+	image.levelBytes.assign(1, baseBytes);
+	for (const std::vector<uint8_t> &mip : image.mips)
+	{
+		bytes += mip.size();
+		image.levelBytes.push_back(mip.size());
+	}
+	PixelBuffer *pbo = acquirePixelBuffer(bytes);
+	if (!pbo)
+		return false;
+
+	// Copy every level into the PBO, the driver then transfers them to the texture without blocking this thread
+	unsigned char *mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!mapped)
+	{
+		returnPixelBuffer();
+		return false;
+	}
+	std::memcpy(mapped, image.pixels.data(), baseBytes);
+	size_t offset = baseBytes;
+	for (const std::vector<uint8_t> &mip : image.mips)
+	{
+		std::memcpy(mapped + offset, mip.data(), mip.size());
+		offset += mip.size();
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	std::vector<uint8_t>().swap(image.pixels);
+
+	GLenum format = formatForComponents(image.components);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of RGB/RED images aren't 4 byte aligned
+	glBindTexture(GL_TEXTURE_2D, image.texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, (void*)0);
+	// The mips were built on the worker, each level is half the previous one down to 1x1
+	offset = baseBytes;
+	int width = image.width, height = image.height;
+	for (unsigned int level = 0; level < image.mips.size(); level++)
+	{
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+		glTexImage2D(GL_TEXTURE_2D, level + 1, format, width, height, 0, format, GL_UNSIGNED_BYTE, (void*)offset);
+		offset += image.mips[level].size();
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.mips.empty() ? GL_LINEAR : GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0); // a reload brings back the levels TextureResidency dropped
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	pbo->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	image.mips.clear();
+
+	// The size is only known now that the image is decoded
+	TextureCache::Shared().SetBytes(image.texture, bytes);
+	return true;
+}
+
+bool TextureStreamer::uploadKtxLevels(DecodedImage &image, size_t &bytes)
+{
+	const KtxTexture &ktx = *image.ktx;
+	// The next batch of levels, from the coarsest one not uploaded yet towards the finer ones
+	unsigned int coarsest = ktx.LevelCount() - 1 - image.uploadedLevels, finest = coarsest;
+	bytes = ktx.GetLevel(coarsest).faceBytes;
+	while (finest > 0 && bytes + ktx.GetLevel(finest - 1).faceBytes <= STREAMING_MIP_BATCH_BYTES)
+		bytes += ktx.GetLevel(--finest).faceBytes;
+	PixelBuffer *pbo = acquirePixelBuffer(bytes);
+	if (!pbo)
+		return false;
+
+	unsigned char *mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!mapped)
+	{
+		returnPixelBuffer();
+		return false;
+	}
+	size_t offset = 0;
+	for (unsigned int level = coarsest; level + 1 > finest; level--)
+	{
+		std::memcpy(mapped + offset, ktx.GetLevel(level).data, ktx.GetLevel(level).faceBytes);
+		offset += ktx.GetLevel(level).faceBytes;
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	glBindTexture(GL_TEXTURE_2D, image.texture);
+	if (image.uploadedLevels == 0)
+	{
+		// Storage for the whole chain replaces the placeholder, the size is known from the header
+		ktx.AllocateStorage(GL_TEXTURE_2D);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, ktx.LevelCount() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		TextureCache::Shared().SetBytes(image.texture, ktx.Bytes());
+	}
+	else if (image.reloadLevels > 0 && image.uploadedLevels + image.reloadLevels == ktx.LevelCount())
+	{
+		// First batch of a reload: the dropped levels were freed, allocate them again
+		ktx.AllocateLevels(GL_TEXTURE_2D, 0, image.reloadLevels);
+		TextureCache::Shared().SetBytes(image.texture, ktx.Bytes());
+	}
+	if (image.levelBytes.empty())
+	{
+		for (unsigned int level = 0; level < ktx.LevelCount(); level++)
+			image.levelBytes.push_back(ktx.GetLevel(level).faceBytes);
+	}
+	offset = 0;
+	for (unsigned int level = coarsest; level + 1 > finest; level--)
+	{
+		ktx.UploadLevel(GL_TEXTURE_2D, level, (void*)offset);
+		offset += ktx.GetLevel(level).faceBytes;
+	}
+	// Only the levels uploaded so far are sampled, the finer ones are still undefined
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, finest);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	pbo->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	image.uploadedLevels += coarsest - finest + 1;
+	if (image.uploadedLevels == ktx.LevelCount())
+		image.ktx.reset(); // unmaps the file
+	return true;
+}
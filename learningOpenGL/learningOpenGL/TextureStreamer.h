@@ -0,0 +1,98 @@
+#pragma once
+#include <glad/glad.h>
+
+#include "GpuResource.h"
+#include "KtxTexture.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Number of pixel buffer objects cycled through for uploads, and how many bytes may be uploaded per frame
+const unsigned int STREAMING_PBO_COUNT = 4;
+const size_t STREAMING_UPLOAD_BUDGET = 8 * 1024 * 1024;
+// Levels of a cooked texture are uploaded coarsest first, a batch at a time, each batch holding as many levels as
+// fit in this many bytes (or a single bigger level)
+const size_t STREAMING_MIP_BATCH_BYTES = 256 * 1024;
+
+// Loads 2D textures asynchronously: files are decoded and their mips built (see MipGenerator) on the worker pool,
+// then uploaded from the main thread through a ring of pixel buffer objects. Until its pixels arrive a texture holds
+// a 1x1 placeholder, so the GL name handed out by Request can be bound right away and never changes.
+// Images with a cooked KTX2 file next to them (see KtxTexture::CookedPath) skip decoding: their compressed mips are
+// uploaded as they are, coarsest first, and a texture with finer levels left goes back to the end of the queue, so
+// every texture gets its coarse levels before any gets its finest.
+// Textures requested from a file are handed to TextureResidency once uploaded, which may drop their finest levels
+// later and reload them through Reload.
+class TextureStreamer
+{
+public:
+	static TextureStreamer &Shared();
+
+	/// Creates the texture with its placeholder and queues the file for decoding. The caller owns the texture
+	/// (normally the TextureCache), and must keep it alive until the streamer is flushed or shut down.
+	/// @param gamma the image holds sRGB encoded color, its mips are averaged in linear light. The texture still
+	/// stores the encoded values (not GL_SRGB8) since the shaders light with them as they are.
+	GpuTexture Request(const std::string &path, bool gamma = false);
+	/// Same for an encoded image (PNG, JPEG...) already in memory, e.g. embedded in a model file
+	/// @param owner kept alive until the image is decoded, the bytes must stay valid as long as it lives
+	/// @param name reported if decoding fails
+	GpuTexture Request(std::shared_ptr<const void> owner, const unsigned char *bytes, size_t size, const std::string &name, bool gamma = false);
+	/// Loads the file of a texture again and uploads its finest levels, which TextureResidency dropped. The levels
+	/// still on the GPU are sampled until then.
+	/// @param levels levels to bring back, from level 0
+	void Reload(GLuint texture, const std::string &path, bool gamma, unsigned int levels);
+	/// Uploads decoded textures, within STREAMING_UPLOAD_BUDGET bytes. Call once per frame on the GL thread.
+	void Update();
+	/// Blocks until every requested texture is uploaded
+	void Flush();
+	/// Releases the PBOs, must be called while the GL context is still alive
+	void Shutdown();
+
+	unsigned int PendingCount() const { return pendingCount; }
+
+private:
+	struct DecodedImage
+	{
+		GLuint texture = 0;
+		std::string path;
+		bool gamma = false;
+		int width = 0, height = 0, components = 0;
+		std::vector<uint8_t> pixels;	// decoded by ImageDecoder, empty if decoding failed
+		std::vector<std::vector<uint8_t>> mips;	// levels below pixels
+		std::shared_ptr<KtxTexture> ktx;	// cooked texture uploaded instead of pixels
+		unsigned int uploadedLevels = 0;	// levels of ktx uploaded so far, from the coarsest
+		bool managed = false;				// loaded from a file, TextureResidency can drop its levels
+		unsigned int reloadLevels = 0;		// levels being brought back by Reload, 0 for a first upload
+		std::vector<size_t> levelBytes;		// bytes of each level, for TextureResidency
+	};
+	// Shared with the decode jobs so they stay valid even if the jobs outlive the streamer at exit
+	struct DecodedQueue
+	{
+		std::mutex mutex;
+		std::deque<DecodedImage> images;
+	};
+	struct PixelBuffer
+	{
+		GpuBuffer buffer;
+		size_t capacity = 0;
+		GLsync fence = 0;	// signaled once the GPU is done reading the last upload
+	};
+
+	std::shared_ptr<DecodedQueue> decoded = std::make_shared<DecodedQueue>();
+	PixelBuffer pixelBuffers[STREAMING_PBO_COUNT];
+	unsigned int nextBuffer = 0;
+	unsigned int pendingCount = 0;
+
+	TextureStreamer() {}
+	GpuTexture createPlaceholder();
+	bool upload(DecodedImage &image, size_t &bytes);
+	bool uploadKtxLevels(DecodedImage &image, size_t &bytes);
+	static bool openCooked(DecodedImage &image, const std::string &path);
+	static void buildMips(DecodedImage &image);
+	PixelBuffer *acquirePixelBuffer(size_t bytes);
+	void returnPixelBuffer();
+};
@@ -0,0 +1,150 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads for CPU side asset work (mesh processing, decoding, baking...).
+// Jobs must not touch the OpenGL context, which only lives on the main thread.
+class ThreadPool
+{
+public:
+	/// Process-wide pool with one worker per hardware thread
+	static ThreadPool &Shared()
+	{
+		static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+		return pool;
+	}
+
+	explicit ThreadPool(unsigned int threadCount)
+	{
+		for (unsigned int i = 0; i < threadCount; i++)
+			workers.emplace_back([this] { workerLoop(); });
+	}
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeUp.notify_all();
+		for (std::thread &worker : workers)
+			worker.join();
+	}
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool &operator=(const ThreadPool&) = delete;
+
+	unsigned int ThreadCount() const { return (unsigned int)workers.size(); }
+
+	/// Queues a job and returns a future to its result
+	template<typename F>
+	auto Submit(F job) -> std::future<decltype(job())>
+	{
+		auto task = std::make_shared<std::packaged_task<decltype(job())()>>(std::move(job));
+		std::future<decltype(job())> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push([task] { (*task)(); });
+		}
+		wakeUp.notify_one();
+		return result;
+	}
+
+	/// Calls body(i) for every i in [0, count) across the workers and the calling thread, and waits for all of them.
+	/// Indices are handed out one at a time so uneven jobs (e.g. meshes of very different sizes) balance out.
+	/// The calling thread only ever runs this loop's own indices, never other queued jobs (a texture decode would
+	/// stall a per-frame caller), and the first exception thrown by body is rethrown once every index is done.
+	template<typename F>
+	void ParallelFor(unsigned int count, F body)
+	{
+		if (count == 0)
+			return;
+		// Helpers still queued when the loop is over find no index left and return without touching body
+		auto state = std::make_shared<ParallelForState>();
+		state->count = count;
+		F *loopBody = &body;
+		auto run = [state, loopBody]
+		{
+			state->running++;
+			for (unsigned int i = state->next++; i < state->count; i = state->next++)
+			{
+				try
+				{
+					(*loopBody)(i);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(state->mutex);
+					if (!state->error)
+						state->error = std::current_exception();
+					state->next = state->count; // hand out no more indices
+				}
+			}
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if (--state->running == 0)
+				state->finished.notify_all();
+		};
+
+		unsigned int helpers = std::min(ThreadCount(), count - 1);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (unsigned int i = 0; i < helpers; i++)
+				jobs.push(run);
+		}
+		if (helpers == 1)
+			wakeUp.notify_one();
+		else if (helpers > 1)
+			wakeUp.notify_all();
+		run();
+
+		// Every index is handed out by now, wait for the helpers still running body
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->finished.wait(lock, [&state] { return state->running == 0; });
+		if (state->error)
+			std::rethrow_exception(state->error);
+	}
+
+private:
+	struct ParallelForState
+	{
+		std::atomic<unsigned int> next{ 0 };
+		std::atomic<unsigned int> running{ 0 };	// threads inside the loop, a helper counts itself before taking an index
+		unsigned int count = 0;
+		std::mutex mutex;
+		std::condition_variable finished;
+		std::exception_ptr error;
+	};
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	bool stopping = false;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeUp.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop();
+			}
+			job();
+		}
+	}
+};
+#endif
@@ -0,0 +1,177 @@
+#include "VertexAnimationTexture.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+	signed char toSnorm(float value)
+	{
+		return (signed char)std::lround(glm::clamp(value, -1.0f, 1.0f) * 127.0f);
+	}
+
+	GpuTexture createTexture(GLenum internalFormat, unsigned int height, GLenum format, GLenum type, const void *data, size_t bytes)
+	{
+		GpuTexture texture = GpuTexture::Create();
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, VAT_TEXTURE_WIDTH, height, 0, format, type, data);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		// Read with texelFetch, frames are blended in the shader
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		texture.SetBytes(bytes);
+		return texture;
+	}
+}
+
+bool VertexAnimationTexture::Bake(const std::vector<Mesh> &meshes, const std::vector<unsigned int> &meshNodes, const NodeHierarchy &nodes,
+	const Skeleton &skeleton, float framesPerSecond)
+{
+	Release();
+
+	meshBases.resize(meshes.size());
+	vertexCount = 0;
+	for (unsigned int i = 0; i < meshes.size(); i++)
+	{
+		if (meshes[i].vertices.empty())
+		{
+			std::cout << "ERROR::VAT::MESH_HAS_NO_CPU_VERTICES " << i << std::endl;
+			return false;
+		}
+		meshBases[i] = vertexCount;
+		vertexCount += (unsigned int)meshes[i].vertices.size();
+	}
+
+	// Every clip is baked as a loop: frame k holds the pose at k / framesPerSecond seconds
+	unsigned int frameCount = 0;
+	for (const AnimationClip &clip : skeleton.clips)
+	{
+		float seconds = clip.duration / (clip.ticksPerSecond > 0.0f ? clip.ticksPerSecond : 25.0f);
+		VATClip baked = { frameCount, std::max(1u, (unsigned int)std::ceil(seconds * framesPerSecond)), framesPerSecond, 0.0f };
+		clips.push_back(baked);
+		frameCount += baked.frameCount;
+	}
+	if (clips.empty())
+	{
+		clips.push_back({ 0, 1, framesPerSecond, 0.0f });
+		frameCount = 1;
+	}
+
+	uint64_t texels = (uint64_t)frameCount * vertexCount;
+	unsigned int height = (unsigned int)((texels + VAT_TEXTURE_WIDTH - 1) / VAT_TEXTURE_WIDTH);
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if (height > (unsigned int)maxSize)
+	{
+		std::cout << "ERROR::VAT::TOO_MANY_FRAMES " << frameCount << " frames of " << vertexCount << " vertices" << std::endl;
+		clips.clear();
+		return false;
+	}
+
+	std::vector<float> positions((size_t)VAT_TEXTURE_WIDTH * height * 3, 0.0f);
+	std::vector<signed char> normals((size_t)VAT_TEXTURE_WIDTH * height * 4, 0);
+
+	ThreadPool::Shared().ParallelFor(frameCount, [&](unsigned int frame)
+	{
+		unsigned int clip = 0;
+		while (clip + 1 < clips.size() && frame >= clips[clip + 1].firstFrame)
+			clip++;
+
+		std::vector<glm::mat4> palette(skeleton.bones.size());
+		if (!skeleton.clips.empty())
+		{
+			Animator animator(skeleton, nodes);
+			animator.Play(clip, (frame - clips[clip].firstFrame) / framesPerSecond);
+			animator.Sample(palette.data());
+		}
+
+		for (unsigned int m = 0; m < meshes.size(); m++)
+		{
+			const Mesh &mesh = meshes[m];
+			// Meshes without bones keep their node's transform, as in Model::DrawSkinned
+			glm::mat4 rigid = nodes.WorldTransform(meshNodes[m]);
+			for (unsigned int v = 0; v < mesh.vertices.size(); v++)
+			{
+				glm::mat4 transform = rigid;
+				if (!mesh.skin.empty() && !palette.empty())
+				{
+					const SkinVertex &skin = mesh.skin[v];
+					transform = glm::mat4(0.0f);
+					for (unsigned int i = 0; i < MAX_BONE_INFLUENCES; i++)
+					{
+						if (skin.Weights[i])
+							transform += palette[skin.Joints[i]] * (skin.Weights[i] / 255.0f);
+					}
+				}
+				glm::vec3 position = glm::vec3(transform * glm::vec4(mesh.vertices[v].Position, 1.0f));
+				glm::vec3 normal = glm::normalize(glm::transpose(glm::inverse(glm::mat3(transform))) * mesh.vertices[v].Normal);
+
+				size_t texel = (size_t)frame * vertexCount + meshBases[m] + v;
+				positions[texel * 3 + 0] = position.x;
+				positions[texel * 3 + 1] = position.y;
+				positions[texel * 3 + 2] = position.z;
+				normals[texel * 4 + 0] = toSnorm(normal.x);
+				normals[texel * 4 + 1] = toSnorm(normal.y);
+				normals[texel * 4 + 2] = toSnorm(normal.z);
+			}
+		}
+	});
+
+	// Positions need full precision as models can be any size, normals fit in bytes
+	positionTexture = createTexture(GL_RGB32F, height, GL_RGB, GL_FLOAT, positions.data(), positions.size() * sizeof(float));
+	normalTexture = createTexture(GL_RGBA8_SNORM, height, GL_RGBA, GL_BYTE, normals.data(), normals.size());
+	bytes = positionTexture.Bytes() + normalTexture.Bytes();
+
+	clipBuffer = GpuBuffer::Create(GPU_MEMORY_STORAGE_BUFFERS);
+	GpuBufferData(clipBuffer, GL_SHADER_STORAGE_BUFFER, clips.size() * sizeof(VATClip), clips.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return true;
+}
+
+void VertexAnimationTexture::Bind(Shader &shader) const
+{
+	glActiveTexture(GL_TEXTURE0 + VAT_POSITION_UNIT);
+	glBindTexture(GL_TEXTURE_2D, positionTexture);
+	glActiveTexture(GL_TEXTURE0 + VAT_NORMAL_UNIT);
+	glBindTexture(GL_TEXTURE_2D, normalTexture);
+	glActiveTexture(GL_TEXTURE0);
+	shader.setInt("vatPositions", VAT_POSITION_UNIT);
+	shader.setInt("vatNormals", VAT_NORMAL_UNIT);
+	shader.setUInt("vatVertexCount", vertexCount);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VAT_CLIP_BINDING, clipBuffer);
+}
+
+void VertexAnimationTexture::Release()
+{
+	positionTexture.Reset();
+	normalTexture.Reset();
+	clipBuffer.Reset();
+	clips.clear();
+	meshBases.clear();
+	vertexCount = 0;
+	bytes = 0;
+}
+
+void CrowdInstances::SetInstances(const std::vector<CrowdInstance> &instances)
+{
+	if (!buffer)
+		buffer = GpuBuffer::Create(GPU_MEMORY_STORAGE_BUFFERS);
+	GpuBufferData(buffer, GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof(CrowdInstance), instances.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	count = (unsigned int)instances.size();
+}
+
+void CrowdInstances::Bind() const
+{
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CROWD_INSTANCE_BINDING, buffer);
+}
+
+void CrowdInstances::Release()
+{
+	buffer.Reset();
+	count = 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "Shader.h"
+#include "NodeHierarchy.h"
+#include "Animation.h"
+
+#include <vector>
+
+// Texels are laid out frame after frame, vertex after vertex, wrapping every VAT_TEXTURE_WIDTH texels
+// (texel = frame * vertexCount + vertex), so models with more vertices than GL_MAX_TEXTURE_SIZE still fit
+const unsigned int VAT_TEXTURE_WIDTH = 4096;
+// Texture units of the baked textures, above the ones taken by the meshes' materials
+const unsigned int VAT_POSITION_UNIT = 14;
+const unsigned int VAT_NORMAL_UNIT = 15;
+// Shader storage bindings read by shaders/vat_crowd.vert
+const unsigned int CROWD_INSTANCE_BINDING = 6;
+const unsigned int VAT_CLIP_BINDING = 7;
+
+// Frames of one clip in the baked textures, laid out to match the std430 struct of the shader
+struct VATClip
+{
+	unsigned int firstFrame;
+	unsigned int frameCount;
+	float framesPerSecond;
+	float padding;
+};
+
+// One member of a crowd, laid out to match the std430 struct of the shader
+struct CrowdInstance
+{
+	glm::mat4 model;
+	unsigned int clip;		// clip of the baked model to play
+	float timeOffset;		// in seconds, so instances playing the same clip are out of step
+	float speed;			// playback rate
+	float padding;
+};
+
+// Every animation clip of a skinned model sampled ahead of time into a position and a normal texture.
+// Drawing a crowd then costs no CPU animation at all: the vertex shader looks up each vertex of each instance
+// at the instance's clip and time, blending the two closest baked frames.
+class VertexAnimationTexture
+{
+public:
+	/// Samples every clip of the skeleton at framesPerSecond and uploads the results, frames are baked in parallel.
+	/// Models without clips get a single one frame clip holding the bind pose.
+	/// @param meshes meshes of the model, they must still have their CPU side vertices
+	/// @param meshNodes node each mesh hangs from, meshes without bones are placed by it
+	/// @return false if the model can't be baked
+	bool Bake(const std::vector<Mesh> &meshes, const std::vector<unsigned int> &meshNodes, const NodeHierarchy &nodes,
+		const Skeleton &skeleton, float framesPerSecond = 30.0f);
+
+	/// Binds the textures and clip table and sets the shader's VAT uniforms, the shader must be in use
+	void Bind(Shader &shader) const;
+	void Release();
+
+	/// First texel column of a mesh's vertices, the shader's vatVertexBase
+	unsigned int MeshVertexBase(unsigned int mesh) const { return meshBases[mesh]; }
+	unsigned int ClipCount() const { return (unsigned int)clips.size(); }
+	/// Size of both textures in bytes
+	size_t Bytes() const { return bytes; }
+
+private:
+	GpuTexture positionTexture, normalTexture;
+	GpuBuffer clipBuffer;
+	std::vector<VATClip> clips;
+	std::vector<unsigned int> meshBases;
+	unsigned int vertexCount = 0; // of all meshes together
+	size_t bytes = 0;
+};
+
+// Shader storage buffer of the instances of a crowd drawn by Model::DrawCrowd
+class CrowdInstances
+{
+public:
+	/// Uploads every instance, only needs to be called when instances are added, moved or change clip
+	void SetInstances(const std::vector<CrowdInstance> &instances);
+	/// Binds the instances at CROWD_INSTANCE_BINDING
+	void Bind() const;
+	void Release();
+
+	unsigned int Count() const { return count; }
+
+private:
+	GpuBuffer buffer;
+	unsigned int count = 0;
+};
@@ -0,0 +1,448 @@
+#include "VirtualTexture.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	const unsigned int STORED_PAGE_SIZE = VIRTUAL_PAGE_SIZE + 2 * VIRTUAL_PAGE_BORDER;
+
+	bool inFile(uint64_t offset, uint64_t bytes, size_t fileSize)
+	{
+		return offset <= fileSize && bytes <= fileSize - offset;
+	}
+
+	GLenum atlasFormat(uint32_t format)
+	{
+		return format == VIRTUAL_PAGE_BC7 ? GL_COMPRESSED_RGBA_BPTC_UNORM : GL_RGBA8;
+	}
+}
+
+bool VirtualTexture::Open(const std::string &path, unsigned int atlasPages)
+{
+	Release();
+	file = std::make_shared<MappedFile>();
+	if (!file->open(path) || file->length() < sizeof(VirtualTextureHeader))
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::FILE_NOT_READ " << path << std::endl;
+		file.reset();
+		return false;
+	}
+
+	// Everything Update indexes with is checked once here
+	header = (const VirtualTextureHeader*)file->begin();
+	bool valid = header->magic == VIRTUAL_TEXTURE_MAGIC && header->version == VIRTUAL_TEXTURE_VERSION
+		&& header->pageSize == VIRTUAL_PAGE_SIZE && header->border == VIRTUAL_PAGE_BORDER && header->format < VIRTUAL_PAGE_FORMAT_COUNT
+		&& header->pageBytes == VirtualTextureBuilder::PageBytes((VirtualPageFormat)header->format)
+		&& header->pagesPerSide <= VIRTUAL_MAX_PAGES && header->levelCount > 0 && header->levelCount <= 32
+		&& header->pagesPerSide == 1u << (header->levelCount - 1);
+	if (valid)
+	{
+		for (uint32_t l = 0; l <= header->levelCount; l++)
+			firstPages.push_back((uint32_t)VirtualTextureBuilder::FirstPage(header->pagesPerSide, l));
+		pageCount = firstPages.back();
+		valid = inFile(header->dataOffset, (uint64_t)pageCount * header->pageBytes, file->length());
+	}
+	if (!valid)
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::INVALID_FILE " << path << std::endl;
+		Release();
+		return false;
+	}
+
+	// Slots are stored in 8 bits by the indirection texture, and the atlas must fit in a texture
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	atlasPages = std::min(std::min(std::max(atlasPages, 2u), 256u), (unsigned int)maxSize / STORED_PAGE_SIZE);
+	this->atlasPages = atlasPages;
+	slots.assign(atlasPages * atlasPages, Slot());
+	pageSlots.assign(pageCount, VIRTUAL_NONE);
+	pageRequested.assign(pageCount, 0);
+	pageCoverage.assign(pageCount, 0);
+
+	// The atlas only has level 0: the levels of the virtual texture are its pages, and the borders make bilinear
+	// filtering safe
+	unsigned int atlasSize = atlasPages * STORED_PAGE_SIZE;
+	atlas = GpuTexture::Create();
+	glBindTexture(GL_TEXTURE_2D, atlas);
+	glTexStorage2D(GL_TEXTURE_2D, 1, atlasFormat(header->format), atlasSize, atlasSize);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	atlas.SetBytes((size_t)slots.size() * header->pageBytes);
+
+	indirection = GpuTexture::Create();
+	glBindTexture(GL_TEXTURE_2D, indirection);
+	glTexStorage2D(GL_TEXTURE_2D, header->levelCount, GL_RGBA8UI, header->pagesPerSide, header->pagesPerSide);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	indirection.SetBytes((size_t)pageCount * 4);
+	indirectionLevels.resize(header->levelCount);
+	for (uint32_t l = 0; l < header->levelCount; l++)
+		indirectionLevels[l].assign((size_t)(firstPages[l + 1] - firstPages[l]) * 4, 0);
+
+	for (Readback &readback : readbacks)
+		readback.buffer = GpuBuffer::Create(GPU_MEMORY_STAGING_BUFFERS);
+
+	// The coarsest page is uploaded straight from the mapping, everything else streams in
+	uint32_t root = pageIndex(header->levelCount - 1, 0, 0);
+	uint32_t slot = acquireSlot();
+	slots[slot].pinned = true;
+	upload(root, slot, file->begin() + header->dataOffset + (uint64_t)root * header->pageBytes);
+	updateIndirection();
+	return true;
+}
+
+void VirtualTexture::upload(uint32_t page, uint32_t slot, const unsigned char *bytes)
+{
+	GLint x = (GLint)(slot % atlasPages * STORED_PAGE_SIZE), y = (GLint)(slot / atlasPages * STORED_PAGE_SIZE);
+	glBindTexture(GL_TEXTURE_2D, atlas);
+	if (header->format == VIRTUAL_PAGE_BC7)
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, STORED_PAGE_SIZE, STORED_PAGE_SIZE, GL_COMPRESSED_RGBA_BPTC_UNORM,
+			(GLsizei)header->pageBytes, bytes);
+	else
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, STORED_PAGE_SIZE, STORED_PAGE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, bytes);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	slots[slot].page = page;
+	slots[slot].lastUsed = frame;
+	pageSlots[page] = slot;
+	pageRequested[page] = 0;
+	residentPages++;
+	residencyChanged = true;
+}
+
+uint32_t VirtualTexture::acquireSlot()
+{
+	// A free slot, or the least recently used page the last feedback didn't ask for
+	uint32_t victim = VIRTUAL_NONE;
+	for (uint32_t i = 0; i < slots.size(); i++)
+	{
+		if (slots[i].page == VIRTUAL_NONE)
+			return i;
+		if (!slots[i].pinned && slots[i].lastUsed < frame && (victim == VIRTUAL_NONE || slots[i].lastUsed < slots[victim].lastUsed))
+			victim = i;
+	}
+	if (victim != VIRTUAL_NONE)
+	{
+		pageSlots[slots[victim].page] = VIRTUAL_NONE;
+		slots[victim].page = VIRTUAL_NONE;
+		residentPages--;
+		residencyChanged = true;
+	}
+	return victim;
+}
+
+void VirtualTexture::uploadLoadedPages()
+{
+	size_t uploaded = 0;
+	while (uploaded < VIRTUAL_UPLOAD_BUDGET)
+	{
+		LoadedPage loadedPage;
+		{
+			std::lock_guard<std::mutex> lock(loaded->mutex);
+			if (loaded->pages.empty())
+				break;
+			loadedPage = std::move(loaded->pages.front());
+			loaded->pages.pop_front();
+		}
+		pendingLoads--;
+
+		uint32_t slot = acquireSlot();
+		if (slot == VIRTUAL_NONE)
+		{
+			// Every slot is in use, the page is requested again if the feedback still asks for it
+			pageRequested[loadedPage.page] = 0;
+			continue;
+		}
+		upload(loadedPage.page, slot, loadedPage.bytes.data());
+		uploaded += loadedPage.bytes.size();
+	}
+}
+
+void VirtualTexture::requestPage(uint32_t page)
+{
+	pageRequested[page] = 1;
+	pendingLoads++;
+	std::shared_ptr<MappedFile> mapping = file;
+	std::shared_ptr<LoadQueue> queue = loaded;
+	uint64_t offset = header->dataOffset + (uint64_t)page * header->pageBytes;
+	size_t bytes = (size_t)header->pageBytes;
+	ThreadPool::Shared().Submit([mapping, queue, page, offset, bytes]
+	{
+		// Copying out of the mapping takes the page faults on the worker instead of the GL thread
+		LoadedPage loadedPage = { page, std::vector<unsigned char>(mapping->begin() + offset, mapping->begin() + offset + bytes) };
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->pages.push_back(std::move(loadedPage));
+	});
+}
+
+bool VirtualTexture::resizeFeedback(int width, int height)
+{
+	feedbackColor = GpuTexture::Create();
+	glBindTexture(GL_TEXTURE_2D, feedbackColor);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8UI, width, height, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	feedbackColor.SetBytes((size_t)width * height * 4);
+	feedbackDepth = GpuTexture::Create();
+	glBindTexture(GL_TEXTURE_2D, feedbackDepth);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	feedbackDepth.SetBytes((size_t)width * height * 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (!feedbackFramebuffer)
+		feedbackFramebuffer = GpuFramebuffer::Create();
+	glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, feedbackDepth, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::FRAMEBUFFER_INCOMPLETE" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+		feedbackWidth = feedbackHeight = 0;
+		return false;
+	}
+	feedbackWidth = width;
+	feedbackHeight = height;
+	return true;
+}
+
+bool VirtualTexture::BeginFeedback(Shader &feedbackShader, int viewportWidth, int viewportHeight)
+{
+	if (!IsOpen())
+		return false;
+	int width = std::max(viewportWidth / (int)VIRTUAL_FEEDBACK_DIVISOR, 1);
+	int height = std::max(viewportHeight / (int)VIRTUAL_FEEDBACK_DIVISOR, 1);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, savedViewport);
+	if ((width != feedbackWidth || height != feedbackHeight) && !resizeFeedback(width, height))
+		return false;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+	glViewport(0, 0, width, height);
+	// A zero alpha marks the pixels nothing virtually textured covers
+	const GLuint empty[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, empty);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	feedbackShader.Use();
+	// Derivatives are VIRTUAL_FEEDBACK_DIVISOR times larger than in the viewport, so would be the levels
+	setUniforms(feedbackShader, -std::log2((float)VIRTUAL_FEEDBACK_DIVISOR));
+	return true;
+}
+
+void VirtualTexture::EndFeedback()
+{
+	Readback &readback = readbacks[nextReadback];
+	// While the CPU hasn't caught up with the ring, this frame's feedback is dropped
+	if (!readback.fence)
+	{
+		size_t bytes = (size_t)feedbackWidth * feedbackHeight * 4;
+		if (readback.buffer.Bytes() < bytes)
+			GpuBufferData(readback.buffer, GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, (void*)0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		readback.width = feedbackWidth;
+		readback.height = feedbackHeight;
+		nextReadback = (nextReadback + 1) % VIRTUAL_FEEDBACK_BUFFERS;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+	glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+}
+
+void VirtualTexture::analyzeFeedback(Readback &readback)
+{
+	frame++;
+	size_t bytes = (size_t)readback.width * readback.height * 4;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+	const uint8_t *texels = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+	if (texels)
+	{
+		// Deduplicate: every distinct page once, with the pixels asking for it
+		for (size_t i = 0; i < bytes; i += 4)
+		{
+			const uint8_t *texel = &texels[i];
+			uint32_t level = texel[2], side = header->pagesPerSide >> level;
+			if (texel[3] == 0 || level >= header->levelCount || texel[0] >= side || texel[1] >= side)
+				continue;
+			uint32_t page = pageIndex(level, texel[0], texel[1]);
+			if (pageCoverage[page]++ == 0)
+				wantedPages.push_back(page);
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	requestedPages = (unsigned int)wantedPages.size();
+
+	// The ancestors of a page are what shaders fall back to until it arrives, and what they will fall back to when
+	// it is evicted, so they are wanted too
+	size_t requested = wantedPages.size();
+	for (size_t i = 0; i < requested; i++)
+	{
+		uint32_t page = wantedPages[i];
+		uint32_t level = pageLevel(page);
+		uint32_t side = header->pagesPerSide >> level;
+		uint32_t x = (page - firstPages[level]) % side, y = (page - firstPages[level]) / side;
+		uint32_t coverage = pageCoverage[page];
+		for (level++, x /= 2, y /= 2; level < header->levelCount; level++, x /= 2, y /= 2)
+		{
+			uint32_t ancestor = pageIndex(level, x, y);
+			if (pageCoverage[ancestor] == 0)
+				wantedPages.push_back(ancestor);
+			pageCoverage[ancestor] += coverage;
+		}
+	}
+
+	// Keep the resident pages, and load the missing ones coarsest first so the fallbacks fill in quickly, then
+	// the ones covering the most pixels
+	std::vector<std::pair<uint64_t, uint32_t>> requests;
+	for (uint32_t page : wantedPages)
+	{
+		if (pageSlots[page] != VIRTUAL_NONE)
+			slots[pageSlots[page]].lastUsed = frame;
+		else if (!pageRequested[page])
+			requests.push_back({ (uint64_t)pageLevel(page) << 32 | pageCoverage[page], page });
+		pageCoverage[page] = 0;
+	}
+	wantedPages.clear();
+	std::sort(requests.begin(), requests.end(), [](const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b) { return a.first > b.first; });
+
+	// Not more than the atlas can take without evicting pages this feedback asked for
+	unsigned int evictable = 0;
+	for (const Slot &slot : slots)
+	{
+		if (slot.page == VIRTUAL_NONE || (!slot.pinned && slot.lastUsed < frame))
+			evictable++;
+	}
+	for (const std::pair<uint64_t, uint32_t> &request : requests)
+	{
+		if (pendingLoads >= VIRTUAL_MAX_PENDING_LOADS || pendingLoads >= evictable)
+			break;
+		requestPage(request.second);
+	}
+}
+
+void VirtualTexture::updateIndirection()
+{
+	// Coarsest first: a missing page takes the entry of its parent, which is already final
+	glBindTexture(GL_TEXTURE_2D, indirection);
+	for (uint32_t level = header->levelCount; level-- > 0;)
+	{
+		uint32_t side = header->pagesPerSide >> level;
+		std::vector<uint8_t> &entries = indirectionLevels[level];
+		for (uint32_t y = 0; y < side; y++)
+		{
+			for (uint32_t x = 0; x < side; x++)
+			{
+				uint8_t *entry = &entries[((size_t)y * side + x) * 4];
+				uint32_t slot = pageSlots[pageIndex(level, x, y)];
+				if (slot != VIRTUAL_NONE)
+				{
+					entry[0] = (uint8_t)(slot % atlasPages);
+					entry[1] = (uint8_t)(slot / atlasPages);
+					entry[2] = (uint8_t)level;
+					entry[3] = 255;
+				}
+				else if (level + 1 < header->levelCount)
+					memcpy(entry, &indirectionLevels[level + 1][((size_t)(y / 2) * (side / 2) + x / 2) * 4], 4);
+			}
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, side, side, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	residencyChanged = false;
+}
+
+void VirtualTexture::Update()
+{
+	if (!IsOpen())
+		return;
+
+	// Only the oldest readback is looked at, and only if the GPU is done with it: never wait on the GPU here
+	Readback &readback = readbacks[oldestReadback];
+	if (readback.fence && glClientWaitSync(readback.fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+	{
+		glDeleteSync(readback.fence);
+		readback.fence = 0;
+		analyzeFeedback(readback);
+		oldestReadback = (oldestReadback + 1) % VIRTUAL_FEEDBACK_BUFFERS;
+	}
+	uploadLoadedPages();
+	if (residencyChanged)
+		updateIndirection();
+}
+
+void VirtualTexture::setUniforms(Shader &shader, float lodBias)
+{
+	shader.setInt("virtualTexture.pagesPerSide", (int)header->pagesPerSide);
+	shader.setInt("virtualTexture.levelCount", (int)header->levelCount);
+	shader.setInt("virtualTexture.pageSize", (int)header->pageSize);
+	shader.setInt("virtualTexture.border", (int)header->border);
+	shader.setInt("virtualTexture.atlasPages", (int)atlasPages);
+	shader.setFloat("virtualTexture.lodBias", lodBias);
+}
+
+void VirtualTexture::Bind(Shader &shader, unsigned int firstUnit)
+{
+	if (!IsOpen())
+		return;
+	glActiveTexture(GL_TEXTURE0 + firstUnit);
+	glBindTexture(GL_TEXTURE_2D, atlas);
+	glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+	glBindTexture(GL_TEXTURE_2D, indirection);
+	glActiveTexture(GL_TEXTURE0);
+	shader.Use();
+	shader.setInt("virtualTexture.atlas", (int)firstUnit);
+	shader.setInt("virtualTexture.indirection", (int)firstUnit + 1);
+	setUniforms(shader, 0.0f);
+}
+
+void VirtualTexture::Release()
+{
+	for (Readback &readback : readbacks)
+	{
+		if (readback.fence)
+			glDeleteSync(readback.fence);
+		readback = Readback(); // deletes the buffer
+	}
+	nextReadback = oldestReadback = 0;
+	feedbackFramebuffer.Reset();
+	feedbackColor.Reset();
+	feedbackDepth.Reset();
+	feedbackWidth = feedbackHeight = 0;
+	atlas.Reset();
+	indirection.Reset();
+	indirectionLevels.clear();
+	slots.clear();
+	pageSlots.clear();
+	pageRequested.clear();
+	pageCoverage.clear();
+	wantedPages.clear();
+	firstPages.clear();
+	residentPages = requestedPages = pageCount = 0;
+	// Loads still in flight land in the old queue, which they keep alive with the mapping
+	loaded = std::make_shared<LoadQueue>();
+	pendingLoads = 0;
+	residencyChanged = true;
+	header = nullptr;
+	file.reset();
+}
+
+void VirtualTexture::PrintStats() const
+{
+	if (!IsOpen())
+		return;
+	unsigned int side = header->pagesPerSide * header->pageSize;
+	std::cout << "Virtual texture: " << side << "x" << side << ", " << residentPages << " of " << pageCount << " pages resident in "
+		<< slots.size() << " slots, " << requestedPages << " requested by the last feedback, " << pendingLoads << " loading" << std::endl;
+}
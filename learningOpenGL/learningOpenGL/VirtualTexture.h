@@ -0,0 +1,135 @@
+#pragma once
+#include <glad/glad.h>
+
+#include "GpuResource.h"
+#include "MappedFile.h"
+#include "Shader.h"
+#include "VirtualTextureBuilder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Pages per side of the physical atlas by default, and how many bytes of pages may be uploaded per frame
+const unsigned int VIRTUAL_ATLAS_PAGES = 16;
+const size_t VIRTUAL_UPLOAD_BUDGET = 2 * 1024 * 1024;
+// Page loads in flight on the worker pool at once
+const unsigned int VIRTUAL_MAX_PENDING_LOADS = 16;
+// The feedback pass renders at the viewport's size divided by this
+const unsigned int VIRTUAL_FEEDBACK_DIVISOR = 8;
+// Feedback readbacks in flight, the CPU reads each one this many frames after it was rendered
+const unsigned int VIRTUAL_FEEDBACK_BUFFERS = 3;
+const uint32_t VIRTUAL_NONE = 0xFFFFFFFF;
+
+// Samples a texture cooked by VirtualTextureBuilder, far larger than what fits in GPU memory, through a fixed atlas
+// of physical pages. Nothing depends on sparse texture extensions, so it runs on any GL 4.4 implementation.
+// - A feedback pass draws the surfaces at a fraction of the viewport's resolution with shaders/vt_feedback.frag,
+//   which writes the page and level every pixel would sample into an integer texture read back through a PBO.
+// - A few frames later, once its fence is signaled, the readback is deduplicated on the CPU into the pages it
+//   needs. Missing pages (and their missing ancestors) are loaded from the memory mapped file on the worker pool,
+//   coarsest and most covered first, and uploaded into the least recently used atlas slots.
+// - An indirection texture holds one texel per page of every level, with the atlas slot of the page or of its
+//   finest resident ancestor, so shaders fall back to a blurrier page until the right one arrives.
+// The coarsest level is a single page that stays resident, there is always something to sample.
+class VirtualTexture
+{
+public:
+	VirtualTexture() {}
+	VirtualTexture(const VirtualTexture&) = delete;
+	VirtualTexture &operator=(const VirtualTexture&) = delete;
+
+	/// Maps a .vtex file, allocates the atlas and the indirection texture and uploads the coarsest page
+	/// @param atlasPages pages per side of the atlas
+	bool Open(const std::string &path, unsigned int atlasPages = VIRTUAL_ATLAS_PAGES);
+	/// Binds the feedback framebuffer, sized for the viewport, and sets the shader's virtual texture uniforms. Draw
+	/// the virtually textured surfaces with the shader and the same matrices as the main pass, then call EndFeedback.
+	/// @return false if the feedback framebuffer can't be created, nothing should be drawn then
+	bool BeginFeedback(Shader &feedbackShader, int viewportWidth, int viewportHeight);
+	/// Queues the readback of the feedback and restores the framebuffer and viewport BeginFeedback replaced
+	void EndFeedback();
+	/// Analyzes the oldest finished readback, requests the pages it misses, uploads the pages loaded since the last
+	/// call and updates the indirection texture. Call once per frame on the GL thread.
+	void Update();
+	/// Binds the atlas and the indirection texture to two texture units and sets the shader's uniforms
+	/// @param firstUnit unit of the atlas, the indirection texture takes the next one
+	void Bind(Shader &shader, unsigned int firstUnit = 0);
+	void Release();
+
+	bool IsOpen() const { return file && file->isOpen(); }
+	unsigned int ResidentPages() const { return residentPages; }
+	/// Distinct pages the last analyzed feedback asked for
+	unsigned int RequestedPages() const { return requestedPages; }
+	void PrintStats() const;
+
+private:
+	struct Slot
+	{
+		uint32_t page = VIRTUAL_NONE;
+		uint64_t lastUsed = 0;	// frame a feedback last asked for the page, or for a finer page it stands in for
+		bool pinned = false;	// the coarsest page is never evicted
+	};
+	struct LoadedPage
+	{
+		uint32_t page;
+		std::vector<unsigned char> bytes;	// copied out of the mapping on a worker
+	};
+	// Shared with the load jobs so they stay valid even if the jobs outlive the texture
+	struct LoadQueue
+	{
+		std::mutex mutex;
+		std::deque<LoadedPage> pages;
+	};
+	struct Readback
+	{
+		GpuBuffer buffer;
+		GLsync fence = 0;	// signaled once the feedback is copied into buffer
+		int width = 0, height = 0;
+	};
+
+	std::shared_ptr<MappedFile> file;
+	const VirtualTextureHeader *header = nullptr;
+	uint32_t pageCount = 0;
+	std::vector<uint32_t> firstPages;	// of every level, and the page count after the last one
+
+	std::vector<Slot> slots;
+	unsigned int atlasPages = 0;
+	std::vector<uint32_t> pageSlots;			// slot of every page, VIRTUAL_NONE while not resident
+	std::vector<unsigned char> pageRequested;	// page queued or being loaded
+	std::vector<uint32_t> pageCoverage;			// pixels of the feedback being analyzed asking for each page
+	std::vector<uint32_t> wantedPages;			// pages with a coverage, reset after each analysis
+	bool residencyChanged = true;
+	unsigned int pendingLoads = 0, residentPages = 0, requestedPages = 0;
+	uint64_t frame = 0;	// feedbacks analyzed so far
+	std::shared_ptr<LoadQueue> loaded = std::make_shared<LoadQueue>();
+
+	GpuTexture atlas, indirection;
+	std::vector<std::vector<uint8_t>> indirectionLevels;	// RGBA8UI texels: atlas slot x, y and level of the page
+
+	GpuFramebuffer feedbackFramebuffer;
+	GpuTexture feedbackColor, feedbackDepth;
+	int feedbackWidth = 0, feedbackHeight = 0;
+	Readback readbacks[VIRTUAL_FEEDBACK_BUFFERS];
+	unsigned int nextReadback = 0, oldestReadback = 0;	// next one to write and next one to analyze
+	GLint savedFramebuffer = 0, savedViewport[4] = { 0, 0, 0, 0 };
+
+	uint32_t pageIndex(uint32_t level, uint32_t x, uint32_t y) const
+	{
+		return firstPages[level] + y * (header->pagesPerSide >> level) + x;
+	}
+	uint32_t pageLevel(uint32_t page) const
+	{
+		return (uint32_t)(std::upper_bound(firstPages.begin(), firstPages.end(), page) - firstPages.begin()) - 1;
+	}
+	void setUniforms(Shader &shader, float lodBias);
+	void upload(uint32_t page, uint32_t slot, const unsigned char *bytes);
+	void uploadLoadedPages();
+	uint32_t acquireSlot();
+	void requestPage(uint32_t page);
+	void analyzeFeedback(Readback &readback);
+	void updateIndirection();
+	bool resizeFeedback(int width, int height);
+};
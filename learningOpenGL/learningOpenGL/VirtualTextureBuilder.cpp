@@ -0,0 +1,144 @@
+#include "VirtualTextureBuilder.h"
+#include "ImageDecoder.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+	const unsigned int STORED_PAGE_SIZE = VIRTUAL_PAGE_SIZE + 2 * VIRTUAL_PAGE_BORDER;
+
+	// Copies a page and its border out of a level, repeating the edge texels of the level past its sides
+	void extractPage(const uint8_t *level, unsigned int levelSide, unsigned int pageX, unsigned int pageY, uint8_t *page)
+	{
+		for (unsigned int y = 0; y < STORED_PAGE_SIZE; y++)
+		{
+			int sourceY = std::min(std::max((int)(pageY * VIRTUAL_PAGE_SIZE + y) - (int)VIRTUAL_PAGE_BORDER, 0), (int)levelSide - 1);
+			for (unsigned int x = 0; x < STORED_PAGE_SIZE; x++)
+			{
+				int sourceX = std::min(std::max((int)(pageX * VIRTUAL_PAGE_SIZE + x) - (int)VIRTUAL_PAGE_BORDER, 0), (int)levelSide - 1);
+				const uint8_t *texel = &level[((size_t)sourceY * levelSide + sourceX) * 4];
+				std::copy(texel, texel + 4, &page[((size_t)y * STORED_PAGE_SIZE + x) * 4]);
+			}
+		}
+	}
+}
+
+uint64_t VirtualTextureBuilder::PageBytes(VirtualPageFormat format)
+{
+	if (format == VIRTUAL_PAGE_BC7)
+		return (uint64_t)(STORED_PAGE_SIZE / 4) * (STORED_PAGE_SIZE / 4) * TextureEncoder::BlockBytes(BLOCK_FORMAT_BC7);
+	return (uint64_t)STORED_PAGE_SIZE * STORED_PAGE_SIZE * 4;
+}
+
+uint64_t VirtualTextureBuilder::FirstPage(uint32_t pagesPerSide, uint32_t level)
+{
+	uint64_t first = 0;
+	for (uint32_t i = 0; i < level; i++)
+		first += (uint64_t)(pagesPerSide >> i) * (pagesPerSide >> i);
+	return first;
+}
+
+bool VirtualTextureBuilder::Build(const uint8_t *rgba, unsigned int width, unsigned int height, const std::string &path,
+	const VirtualTextureSettings &settings)
+{
+	if (!rgba || width == 0 || height == 0 || settings.format >= VIRTUAL_PAGE_FORMAT_COUNT)
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::INVALID_IMAGE " << path << std::endl;
+		return false;
+	}
+	auto start = std::chrono::steady_clock::now();
+
+	unsigned int requested = settings.size ? settings.size : std::max(width, height);
+	unsigned int pagesPerSide = 1, levelCount = 1;
+	while (pagesPerSide * VIRTUAL_PAGE_SIZE < requested && pagesPerSide < VIRTUAL_MAX_PAGES)
+	{
+		pagesPerSide *= 2;
+		levelCount++;
+	}
+	if (pagesPerSide * VIRTUAL_PAGE_SIZE < requested)
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::TOO_LARGE " << requested << " " << path << std::endl;
+		return false;
+	}
+
+	// Level 0 is the image repeated, or cropped, to the size of the pages
+	unsigned int side = pagesPerSide * VIRTUAL_PAGE_SIZE;
+	std::vector<uint8_t> level(((size_t)side * side) * 4);
+	ThreadPool::Shared().ParallelFor(side, [&](unsigned int y)
+	{
+		const uint8_t *sourceRow = &rgba[(size_t)(y % height) * width * 4];
+		uint8_t *row = &level[(size_t)y * side * 4];
+		for (unsigned int x = 0; x < side; x++)
+			std::copy(&sourceRow[(x % width) * 4], &sourceRow[(x % width) * 4] + 4, &row[x * 4]);
+	});
+	MipSettings mipSettings;
+	mipSettings.filter = settings.mipFilter;
+	mipSettings.srgb = settings.srgb;
+	std::vector<std::vector<uint8_t>> mips = MipGenerator::Build(level.data(), side, side, 4, mipSettings);
+
+	VirtualTextureHeader header = {};
+	header.magic = VIRTUAL_TEXTURE_MAGIC;
+	header.version = VIRTUAL_TEXTURE_VERSION;
+	header.pageSize = VIRTUAL_PAGE_SIZE;
+	header.border = VIRTUAL_PAGE_BORDER;
+	header.pagesPerSide = pagesPerSide;
+	header.levelCount = levelCount;
+	header.format = settings.format;
+	header.pageBytes = PageBytes(settings.format);
+	header.dataOffset = sizeof(header);
+
+	// Write to a temporary file and rename it so a crash never leaves a half written file behind
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		out.write((const char*)&header, sizeof(header));
+		for (unsigned int l = 0; l < levelCount; l++)
+		{
+			// A level's pages are cut and compressed in parallel, then written in order
+			const uint8_t *pixels = l == 0 ? level.data() : mips[l - 1].data();
+			unsigned int levelPages = pagesPerSide >> l;
+			std::vector<std::vector<uint8_t>> pages((size_t)levelPages * levelPages);
+			ThreadPool::Shared().ParallelFor((unsigned int)pages.size(), [&](unsigned int i)
+			{
+				std::vector<uint8_t> page((size_t)STORED_PAGE_SIZE * STORED_PAGE_SIZE * 4);
+				extractPage(pixels, side >> l, i % levelPages, i / levelPages, page.data());
+				if (settings.format == VIRTUAL_PAGE_BC7)
+					pages[i] = TextureEncoder::Encode(BLOCK_FORMAT_BC7, page.data(), STORED_PAGE_SIZE, STORED_PAGE_SIZE, settings.quality);
+				else
+					pages[i] = std::move(page);
+			});
+			for (const std::vector<uint8_t> &page : pages)
+				out.write((const char*)page.data(), (std::streamsize)page.size());
+		}
+		if (!out)
+			return false;
+	}
+	std::remove(path.c_str());
+	if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+		return false;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "VIRTUAL_TEXTURE:: " << path << " " << side << "x" << side << ", " << FirstPage(pagesPerSide, levelCount)
+		<< " pages in " << levelCount << " levels, " << seconds << " s" << std::endl;
+	return true;
+}
+
+bool VirtualTextureBuilder::CookImage(const std::string &imagePath, const std::string &path, const VirtualTextureSettings &settings)
+{
+	std::vector<uint8_t> pixels;
+	int width, height, components;
+	if (!ImageDecoder::DecodeFile(imagePath, pixels, width, height, components, 4))
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::CANNOT_LOAD " << imagePath << std::endl;
+		return false;
+	}
+	return Build(pixels.data(), (unsigned int)width, (unsigned int)height, path, settings);
+}
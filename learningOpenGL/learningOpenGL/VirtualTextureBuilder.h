@@ -0,0 +1,70 @@
+#pragma once
+#include "TextureEncoder.h"
+#include "MipGenerator.h"
+
+#include <cstdint>
+#include <string>
+
+// Virtual texture files (.vtex) hold one very large texture and its mip chain cut into square pages, the unit
+// VirtualTexture streams into its physical page atlas. Level 0 is VIRTUAL_PAGE_SIZE times a power of two texels per
+// side, every level halves it down to a single page. Each stored page repeats VIRTUAL_PAGE_BORDER texels of its
+// neighbours on every side (clamped at the edges of the texture), so bilinear filtering in the atlas never reads the
+// unrelated page next to it.
+// Layout: VirtualTextureHeader, then every page of level 0 row by row, then every page of level 1 and so on, all of
+// header.pageBytes and starting at header.dataOffset.
+const uint32_t VIRTUAL_TEXTURE_MAGIC = 0x58455456; // "VTEX"
+const uint32_t VIRTUAL_TEXTURE_VERSION = 1;
+const unsigned int VIRTUAL_PAGE_SIZE = 128;
+const unsigned int VIRTUAL_PAGE_BORDER = 4;
+// Pages per side of level 0 at most, page coordinates are stored in 8 bits by the feedback and indirection textures
+const unsigned int VIRTUAL_MAX_PAGES = 256;
+
+// How the texels of a page are stored, both uploadable on any GL 4.4 implementation
+enum VirtualPageFormat
+{
+	VIRTUAL_PAGE_RGBA8,
+	VIRTUAL_PAGE_BC7,	// a quarter of the size, BPTC is core since GL 4.2 unlike S3TC
+	VIRTUAL_PAGE_FORMAT_COUNT
+};
+
+struct VirtualTextureHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pageSize;		// texels of a page's own content per side
+	uint32_t border;		// texels repeated from the neighbours on each side
+	uint32_t pagesPerSide;	// at level 0, a power of two
+	uint32_t levelCount;	// the last one is a single page
+	uint32_t format;		// VirtualPageFormat
+	uint32_t padding;
+	uint64_t pageBytes;		// of every stored page, border included
+	uint64_t dataOffset;	// of the first page of level 0
+};
+
+struct VirtualTextureSettings
+{
+	unsigned int size = 0;	// texels per side of level 0, rounded up to VIRTUAL_PAGE_SIZE times a power of two;
+							// 0 for the source image's size. A smaller image is repeated to fill it, a larger one cropped.
+	VirtualPageFormat format = VIRTUAL_PAGE_BC7;
+	EncodeQuality quality = ENCODE_QUALITY_FAST;
+	MipFilter mipFilter = MIP_FILTER_KAISER;
+	bool srgb = true;	// the image holds sRGB encoded color, filtered in linear light
+};
+
+// Builds .vtex files. The whole image and its mips are processed in memory, only the runtime is out of core.
+class VirtualTextureBuilder
+{
+public:
+	/// Cuts an RGBA8 image (rows top to bottom) into pages on the worker pool and writes them to path
+	/// @return false if the image is empty, too large or the file can't be written
+	static bool Build(const uint8_t *rgba, unsigned int width, unsigned int height, const std::string &path,
+		const VirtualTextureSettings &settings = VirtualTextureSettings());
+	/// Loads a PNG / JPEG image and builds path from it
+	static bool CookImage(const std::string &imagePath, const std::string &path,
+		const VirtualTextureSettings &settings = VirtualTextureSettings());
+
+	/// Bytes of a stored page in the given format, border included
+	static uint64_t PageBytes(VirtualPageFormat format);
+	/// Index of the first page of a level in the file, pages of finer levels come before it
+	static uint64_t FirstPage(uint32_t pagesPerSide, uint32_t level);
+};
@@ -4,10 +4,16 @@ out vec4 FragColor;
 
 struct Material{
 	sampler2D diffuse;
-	sampler2D specular;
+	sampler2D specular;	// only red is read, the map is grey
 	float shininess;
 };
 
+// What the lights need from the textures, fetched once per fragment rather than once per light
+struct Surface {
+	vec3 albedo;
+	float specular;
+};
+
 struct DirLight {
 	vec3 direction;
 	vec3 ambient;
@@ -55,9 +61,9 @@ in vec3 Normal;
 in vec2 TexCoords;
 
 // function prototypes
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);  
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);  
-vec3 CalcSpotLight(SpotLight light, vec3 norm,vec3 fragPos, vec3 viewDir);  
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 normal, vec3 viewDir);  
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir);  
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 norm,vec3 fragPos, vec3 viewDir);  
 
 void main()
 {
@@ -65,18 +71,22 @@ void main()
 	vec3 normal = normalize(Normal);
 	vec3 viewDir = normalize(viewPos - FragPos);
 
+	Surface surface;
+	surface.albedo = texture(material.diffuse, TexCoords).rgb;
+	surface.specular = texture(material.specular, TexCoords).r;
+
 	// Phase I : Directional Light
-	vec3 result = CalcDirLight(dirLight, normal, viewDir);
+	vec3 result = CalcDirLight(dirLight, surface, normal, viewDir);
 	// Phase II : Point Lights
 	for (int i = 0 ; i < NR_POINT_LIGHTS ; i ++)
-		result += CalcPointLight(pointLights[i], normal, FragPos, viewDir);
+		result += CalcPointLight(pointLights[i], surface, normal, FragPos, viewDir);
 	// Phase III : Spotlight Light
-    result += CalcSpotLight(spotLight, normal, FragPos, viewDir);    
+    result += CalcSpotLight(spotLight, surface, normal, FragPos, viewDir);    
 
 	FragColor = vec4(result, 1.0);
 }
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir){
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 normal, vec3 viewDir){
 
 	vec3 lightDir = normalize(-light.direction);
 	// Diffuse shading	
@@ -85,13 +95,13 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir){
 	vec3 reflectDir = reflect(-lightDir,normal);
 	float spec = pow(max(dot(viewDir,reflectDir),0.0), material.shininess);
 	// combine regions
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse,TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse,TexCoords));
-	vec3 specular = light.specular * spec * vec3(texture(material.specular,TexCoords));
+	vec3 ambient = light.ambient * surface.albedo;
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
 	return (ambient + diffuse + specular);
 };
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir){
 
 	vec3 lightDir = normalize(light.position - fragPos);
 	// Diffuse shading	
@@ -105,9 +115,9 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
 	float attenuation = 1.0/(light.constant + light.linear*distance + light.quadratic*(distance*distance));
 
 	// combine regions
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse,TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse,TexCoords));
-	vec3 specular = light.specular * spec * vec3(texture(material.specular,TexCoords));
+	vec3 ambient = light.ambient * surface.albedo;
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
 	ambient *= attenuation;
 	diffuse *= attenuation;
 	specular *= attenuation;
@@ -115,7 +125,7 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
 
 };
 
-vec3 CalcSpotLight(SpotLight light, vec3 normal,vec3 fragPos, vec3 viewDir){
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 normal,vec3 fragPos, vec3 viewDir){
 
 
 	vec3 lightDir = normalize(light.position - fragPos);
@@ -135,9 +145,9 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal,vec3 fragPos, vec3 viewDir){
 	float intensity = clamp((tetha - light.outerCutOff)/epsilon, 0.0,1.0);
 
 	// combine regions
-	vec3 ambient = light.ambient * vec3(texture(material.diffuse,TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse,TexCoords));
-	vec3 specular = light.specular * spec * vec3(texture(material.specular,TexCoords));
+	vec3 ambient = light.ambient * surface.albedo;
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
 	ambient *= attenuation * intensity;
 	diffuse *= attenuation * intensity;
 	specular *= attenuation * intensity;
@@ -0,0 +1,118 @@
+#version 440 core
+
+out vec4 FragColor;
+
+layout(std430, binding = 8) readonly buffer ImpostorInstances { mat4 instances[]; };
+
+uniform sampler2D impostorAlbedo;
+uniform sampler2D impostorNormalDepth;
+uniform uint framesPerSide;
+uniform bool hemisphere;
+uniform vec3 impostorCenter;
+uniform float impostorRadius;
+uniform vec3 lightDirection;	// world space, pointing from the light
+uniform mat4 view;
+uniform mat4 projection;
+
+in vec3 QuadPos;
+flat in vec3 ViewDir;
+flat in int Instance;
+
+vec2 signNotZero(vec2 v)
+{
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Position in [0,1]^2 of the octahedral grid of a direction, and back (see octDecode in Impostor.cpp)
+vec2 octEncode(vec3 d)
+{
+	d /= abs(d.x) + abs(d.y) + abs(d.z);
+	vec2 p;
+	if (hemisphere)
+		p = vec2(d.x + d.z, d.x - d.z);
+	else
+	{
+		p = d.xz;
+		if (d.y < 0.0)
+			p = (1.0 - abs(p.yx)) * signNotZero(p);
+	}
+	return p * 0.5 + 0.5;
+}
+
+vec3 octDecode(vec2 uv)
+{
+	vec2 p = uv * 2.0 - 1.0;
+	vec3 d;
+	if (hemisphere)
+	{
+		d.x = (p.x + p.y) * 0.5;
+		d.z = (p.x - p.y) * 0.5;
+		d.y = 1.0 - abs(d.x) - abs(d.z);
+	}
+	else
+	{
+		d = vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y);
+		if (d.y < 0.0)
+			d.xz = (1.0 - abs(d.zx)) * signNotZero(d.xz);
+	}
+	return normalize(d);
+}
+
+vec4 albedoSum = vec4(0.0);
+vec4 normalDepthSum = vec4(0.0);
+
+// Projects the quad's point onto the plane of the view baked at frame and accumulates what it sees there
+void sampleFrame(ivec2 frame, float weight)
+{
+	if (weight <= 0.0)
+		return;
+	vec3 direction = octDecode(vec2(frame) / float(framesPerSide - 1u));
+	vec3 up = abs(direction.y) > 0.999 ? vec3(0.0, 0.0, -1.0) : vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(-direction, up));
+	up = cross(right, -direction);
+
+	vec2 uv = vec2(dot(QuadPos, right), dot(QuadPos, up)) / (2.0 * impostorRadius) + 0.5;
+	if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))
+		return;
+	uv = (vec2(frame) + uv) / float(framesPerSide);
+
+	vec4 albedo = texture(impostorAlbedo, uv);
+	albedoSum += vec4(albedo.rgb, 1.0) * albedo.a * weight;
+	normalDepthSum += texture(impostorNormalDepth, uv) * albedo.a * weight;
+}
+
+void main()
+{
+	// The three views around the view direction: corners of the grid triangle holding it, barycentric weights
+	float last = float(framesPerSide - 1u);
+	vec2 grid = octEncode(ViewDir) * last;
+	ivec2 cell = ivec2(min(floor(grid), vec2(last - 1.0)));
+	vec2 f = grid - vec2(cell);
+	if (f.x + f.y < 1.0)
+	{
+		sampleFrame(cell, 1.0 - f.x - f.y);
+		sampleFrame(cell + ivec2(1, 0), f.x);
+		sampleFrame(cell + ivec2(0, 1), f.y);
+	}
+	else
+	{
+		sampleFrame(cell + ivec2(1, 1), f.x + f.y - 1.0);
+		sampleFrame(cell + ivec2(1, 0), 1.0 - f.y);
+		sampleFrame(cell + ivec2(0, 1), 1.0 - f.x);
+	}
+	if (albedoSum.a < 0.5)
+		discard;
+	vec3 color = albedoSum.rgb / albedoSum.a;
+	vec4 normalDepth = normalDepthSum / albedoSum.a;
+
+	// Simple directional lighting, the baked views hold unlit albedo
+	mat4 model = instances[Instance];
+	vec3 normal = normalize(mat3(transpose(inverse(model))) * (normalDepth.xyz * 2.0 - 1.0));
+	float diffuse = max(dot(normal, normalize(-lightDirection)), 0.0);
+	FragColor = vec4(color * (0.3 + 0.7 * diffuse), 1.0);
+
+	// Move the fragment to the baked surface so impostors intersect the rest of the scene
+	vec3 surface = impostorCenter + QuadPos + ViewDir * impostorRadius * (1.0 - 2.0 * normalDepth.w);
+	vec4 clip = projection * view * model * vec4(surface, 1.0);
+	gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+}
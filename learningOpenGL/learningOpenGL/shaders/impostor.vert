@@ -0,0 +1,38 @@
+#version 440 core
+
+// World matrix of every instance drawn as an impostor
+layout(std430, binding = 8) readonly buffer ImpostorInstances { mat4 instances[]; };
+
+uniform vec3 impostorCenter;	// model space bounding sphere the views were baked on
+uniform float impostorRadius;
+uniform bool hemisphere;
+uniform vec3 viewPos;
+uniform mat4 view;
+uniform mat4 projection;
+
+out vec3 QuadPos;				// model space offset from the center, on the plane facing the camera
+flat out vec3 ViewDir;			// model space direction from the center to the camera
+flat out int Instance;
+
+void main()
+{
+	mat4 model = instances[gl_InstanceID];
+
+	// The view direction is taken in the model's space so rotated instances pick the matching baked views
+	vec3 direction = normalize(vec3(inverse(model) * vec4(viewPos, 1.0)) - impostorCenter);
+	if (hemisphere)
+		direction = normalize(vec3(direction.x, max(direction.y, 0.0), direction.z));
+
+	// Same basis as the orthographic views of the bake (glm::lookAt towards the center)
+	vec3 up = abs(direction.y) > 0.999 ? vec3(0.0, 0.0, -1.0) : vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(-direction, up));
+	up = cross(right, -direction);
+
+	// Triangle strip corners (-1,-1) (1,-1) (-1,1) (1,1)
+	vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0 - 1.0;
+	QuadPos = (right * corner.x + up * corner.y) * impostorRadius;
+	ViewDir = direction;
+	Instance = gl_InstanceID;
+
+	gl_Position = projection * view * model * vec4(impostorCenter + QuadPos, 1.0);
+}
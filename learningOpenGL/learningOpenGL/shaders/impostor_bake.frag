@@ -0,0 +1,22 @@
+#version 440 core
+
+layout(location = 0) out vec4 Albedo;		// rgb color, alpha coverage
+layout(location = 1) out vec4 NormalDepth;	// model space normal in rgb, depth across the bounding sphere in a
+
+struct Material {
+	sampler2D texture_diffuse1;
+};
+uniform Material material;
+
+in vec3 Normal;
+in vec2 TexCoords;
+
+void main()
+{
+	vec4 color = texture(material.texture_diffuse1, TexCoords);
+	if (color.a < 0.5)
+		discard;
+	Albedo = vec4(color.rgb, 1.0);
+	// The projection is orthographic so the window depth is linear, 0 at the front of the sphere and 1 at its back
+	NormalDepth = vec4(normalize(Normal) * 0.5 + 0.5, gl_FragCoord.z);
+}
@@ -0,0 +1,19 @@
+#version 440 core
+
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+
+uniform mat4 model;			// the mesh's node transform, the model itself is baked in its own space
+uniform mat4 view;
+uniform mat4 projection;	// orthographic, spanning the model's bounding sphere
+
+out vec3 Normal;
+out vec2 TexCoords;
+
+void main()
+{
+	Normal = mat3(transpose(inverse(model))) * aNormal;
+	TexCoords = aTexCoords;
+	gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
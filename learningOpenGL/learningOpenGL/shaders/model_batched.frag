@@ -0,0 +1,185 @@
+#version 440
+
+out vec4 FragColor;
+
+// The textures of every mesh of the batch, each draw samples its own layers (see MaterialBatch)
+struct Material{
+	sampler2DArray diffuseLayers;
+	sampler2DArray normalLayers;	// tangent space
+	sampler2DArray maskLayers;	// specular, gloss, occlusion and height maps packed together (see TexturePacker)
+	float shininess;
+};
+
+// Everything the lights need from the textures, fetched once per fragment rather than once per light
+struct Surface {
+	vec3 albedo;
+	float specular;
+	float shininess;
+	float occlusion;
+};
+
+struct DirLight {
+	vec3 direction;
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
+
+struct PointLight {
+	vec3 position;
+
+	float constant;
+	float linear;
+	float quadratic;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+
+};
+
+struct SpotLight{
+	vec3 position;
+	vec3 direction;
+	float cutOff;
+	float outerCutOff;
+
+	float constant;
+	float linear;
+	float quadratic;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
+
+#define NR_POINT_LIGHTS 4
+uniform PointLight pointLights[NR_POINT_LIGHTS];
+uniform DirLight dirLight;
+uniform SpotLight spotLight;
+uniform Material material;
+uniform vec3 viewPos;	
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+in vec4 Tangent;	// w is the handedness of the bitangent, 0 without tangents
+flat in ivec4 DrawMaterial;	// diffuse, normal and mask layers, -1 for the maps the mesh doesn't have, and the mask's channels
+
+// function prototypes
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 normal, vec3 viewDir);  
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir);  
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 norm,vec3 fragPos, vec3 viewDir);  
+
+void main()
+{
+	// setup fields
+	vec3 normal = normalize(Normal);
+	if (DrawMaterial.y >= 0 && Tangent.w != 0.0)
+	{
+		// MikkTSpace: the interpolated frame is used as it is, only the perturbed normal is normalized
+		vec3 bitangent = Tangent.w * cross(Normal, Tangent.xyz);
+		// Only x and y are read, z is rebuilt: cooked normal maps are BC5 and only keep two channels
+		vec3 tangentNormal;
+		tangentNormal.xy = texture(material.normalLayers, vec3(TexCoords, DrawMaterial.y)).xy * 2.0 - 1.0;
+		tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
+		normal = normalize(tangentNormal.x * Tangent.xyz + tangentNormal.y * bitangent + tangentNormal.z * Normal);
+	}
+	vec3 viewDir = normalize(viewPos - FragPos);
+
+	Surface surface;
+	surface.albedo = DrawMaterial.x >= 0 ? texture(material.diffuseLayers, vec3(TexCoords, DrawMaterial.x)).rgb : vec3(1.0);
+	// The stored maps one after the other in the mask's channels, the others at their default, like
+	// TexturePacker::MaskChannelMatrix and MaskChannelDefaults
+	vec4 mask = vec4(1.0, 1.0, 1.0, 0.0);
+	if (DrawMaterial.z >= 0)
+	{
+		vec4 texel = texture(material.maskLayers, vec3(TexCoords, DrawMaterial.z));
+		int stored = 0;
+		for (int c = 0; c < 4; c++)
+		{
+			if ((DrawMaterial.w & (1 << c)) != 0)
+				mask[c] = texel[stored++];
+		}
+	}
+	surface.specular = mask.r;
+	surface.shininess = max(material.shininess * mask.g, 1.0);
+	surface.occlusion = mask.b;
+
+	// Phase I : Directional Light
+	vec3 result = CalcDirLight(dirLight, surface, normal, viewDir);
+	// Phase II : Point Lights
+	for (int i = 0 ; i < NR_POINT_LIGHTS ; i ++)
+		result += CalcPointLight(pointLights[i], surface, normal, FragPos, viewDir);
+	// Phase III : Spotlight Light
+    result += CalcSpotLight(spotLight, surface, normal, FragPos, viewDir);    
+
+	FragColor = vec4(result, 1.0);
+}
+
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 normal, vec3 viewDir){
+
+	vec3 lightDir = normalize(-light.direction);
+	// Diffuse shading	
+	float diff = max(dot(normal,lightDir),0.0); 
+	// Specular Shading
+	vec3 reflectDir = reflect(-lightDir,normal);
+	float spec = pow(max(dot(viewDir,reflectDir),0.0), surface.shininess);
+	// combine regions
+	vec3 ambient = light.ambient * surface.albedo * surface.occlusion;
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
+	return (ambient + diffuse + specular);
+};
+
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir){
+
+	vec3 lightDir = normalize(light.position - fragPos);
+	// Diffuse shading	
+	float diff = max(dot(normal,lightDir),0.0); 
+	// Specular Shading
+	vec3 reflectDir = reflect(-lightDir,normal);
+	float spec = pow(max(dot(viewDir,reflectDir),0.0), surface.shininess);
+
+	// Attenuation
+	float distance	= length(light.position - fragPos);
+	float attenuation = 1.0/(light.constant + light.linear*distance + light.quadratic*(distance*distance));
+
+	// combine regions
+	vec3 ambient = light.ambient * surface.albedo * surface.occlusion;
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
+	ambient *= attenuation;
+	diffuse *= attenuation;
+	specular *= attenuation;
+	return (ambient + diffuse + specular);
+
+};
+
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 normal,vec3 fragPos, vec3 viewDir){
+
+
+	vec3 lightDir = normalize(light.position - fragPos);
+	// Diffuse shading	
+	float diff = max(dot(normal,lightDir),0.0); 
+	// Specular Shading
+	vec3 reflectDir = reflect(-lightDir,normal);
+	float spec = pow(max(dot(viewDir,reflectDir),0.0), surface.shininess);
+
+	// Attenuation
+	float distance	= length(light.position - fragPos);
+	float attenuation = 1.0/(light.constant + light.linear*distance + light.quadratic*(distance*distance));
+
+	// Intensity of spot light
+	float tetha = dot(lightDir,normalize(-light.direction));
+	float epsilon = light.cutOff - light.outerCutOff;
+	float intensity = clamp((tetha - light.outerCutOff)/epsilon, 0.0,1.0);
+
+	// combine regions
+	vec3 ambient = light.ambient * surface.albedo * surface.occlusion;
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
+	ambient *= attenuation * intensity;
+	diffuse *= attenuation * intensity;
+	specular *= attenuation * intensity;
+	return (ambient + diffuse + specular);
+};
\ No newline at end of file
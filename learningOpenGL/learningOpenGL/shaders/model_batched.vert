@@ -0,0 +1,29 @@
+#version 440 core
+
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+layout(location = 3) in mat4 aDrawModel; // per draw, takes locations 3 to 6
+layout(location = 9) in vec4 aTangent; // w is the handedness of the bitangent
+layout(location = 10) in ivec4 aMaterial; // per draw: diffuse, normal and mask layers (-1 without), mask channels
+
+uniform mat4 view;
+uniform mat4 projection;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out vec4 Tangent;
+flat out ivec4 DrawMaterial;
+
+void main()
+{
+	FragPos = vec3(aDrawModel * vec4(aPos,1.0)); // Retrieve the world position of the fragment
+	Normal = mat3(transpose(inverse(aDrawModel))) * aNormal; // this ensures that uneven scaling won't distort the normal vector, but is costly to do on shader.
+
+	Tangent = vec4(mat3(aDrawModel) * aTangent.xyz, aTangent.w);
+
+	gl_Position = projection * view * vec4(FragPos,1.0);
+	TexCoords = aTexCoords;
+	DrawMaterial = aMaterial;
+}
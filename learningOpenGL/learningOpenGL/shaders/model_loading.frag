@@ -4,10 +4,23 @@ out vec4 FragColor;
 
 struct Material{
 	sampler2D texture_diffuse1;
-	sampler2D texture_specular1;
+	sampler2D texture_normal1;	// tangent space, only sampled when hasNormalMap
+	sampler2D texture_mask1;	// specular, gloss, occlusion and height maps packed together, only sampled when hasMask
+	bool hasNormalMap;
+	bool hasMask;
+	mat4 maskChannels;	// moves the maps the mask holds to their place (see TexturePacker)
+	vec4 maskDefaults;	// the maps the material doesn't have
 	float shininess;
 };
 
+// Everything the lights need from the textures, fetched once per fragment rather than once per light
+struct Surface {
+	vec3 albedo;
+	float specular;
+	float shininess;
+	float occlusion;
+};
+
 struct DirLight {
 	vec3 direction;
 	vec3 ambient;
@@ -52,61 +65,81 @@ uniform vec3 viewPos;
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+in vec4 Tangent;	// w is the handedness of the bitangent, 0 without tangents
 
 // function prototypes
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);  
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);  
-vec3 CalcSpotLight(SpotLight light, vec3 norm,vec3 fragPos, vec3 viewDir);  
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 normal, vec3 viewDir);  
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir);  
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 norm,vec3 fragPos, vec3 viewDir);  
 
 void main()
 {
 	// setup fields
 	vec3 normal = normalize(Normal);
+	if (material.hasNormalMap && Tangent.w != 0.0)
+	{
+		// MikkTSpace: the interpolated frame is used as it is, only the perturbed normal is normalized
+		vec3 bitangent = Tangent.w * cross(Normal, Tangent.xyz);
+		// Only x and y are read, z is rebuilt: cooked normal maps are BC5 and only keep two channels
+		vec3 tangentNormal;
+		tangentNormal.xy = texture(material.texture_normal1, TexCoords).xy * 2.0 - 1.0;
+		tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
+		normal = normalize(tangentNormal.x * Tangent.xyz + tangentNormal.y * bitangent + tangentNormal.z * Normal);
+	}
 	vec3 viewDir = normalize(viewPos - FragPos);
 
+	Surface surface;
+	surface.albedo = texture(material.texture_diffuse1, TexCoords).rgb;
+	vec4 mask = material.maskDefaults;
+	if (material.hasMask)
+		mask += material.maskChannels * texture(material.texture_mask1, TexCoords);
+	surface.specular = mask.r;
+	surface.shininess = max(material.shininess * mask.g, 1.0);
+	surface.occlusion = mask.b;
+
 	// Phase I : Directional Light
-	vec3 result = CalcDirLight(dirLight, normal, viewDir);
+	vec3 result = CalcDirLight(dirLight, surface, normal, viewDir);
 	// Phase II : Point Lights
 	for (int i = 0 ; i < NR_POINT_LIGHTS ; i ++)
-		result += CalcPointLight(pointLights[i], normal, FragPos, viewDir);
+		result += CalcPointLight(pointLights[i], surface, normal, FragPos, viewDir);
 	// Phase III : Spotlight Light
-    result += CalcSpotLight(spotLight, normal, FragPos, viewDir);    
+    result += CalcSpotLight(spotLight, surface, normal, FragPos, viewDir);    
 
 	FragColor = vec4(result, 1.0);
 }
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir){
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 normal, vec3 viewDir){
 
 	vec3 lightDir = normalize(-light.direction);
 	// Diffuse shading	
 	float diff = max(dot(normal,lightDir),0.0); 
 	// Specular Shading
 	vec3 reflectDir = reflect(-lightDir,normal);
-	float spec = pow(max(dot(viewDir,reflectDir),0.0), material.shininess);
+	float spec = pow(max(dot(viewDir,reflectDir),0.0), surface.shininess);
 	// combine regions
-	vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1,TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1,TexCoords));
-	vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1,TexCoords));
+	vec3 ambient = light.ambient * surface.albedo * surface.occlusion;
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
 	return (ambient + diffuse + specular);
 };
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir){
 
 	vec3 lightDir = normalize(light.position - fragPos);
 	// Diffuse shading	
 	float diff = max(dot(normal,lightDir),0.0); 
 	// Specular Shading
 	vec3 reflectDir = reflect(-lightDir,normal);
-	float spec = pow(max(dot(viewDir,reflectDir),0.0), material.shininess);
+	float spec = pow(max(dot(viewDir,reflectDir),0.0), surface.shininess);
 
 	// Attenuation
 	float distance	= length(light.position - fragPos);
 	float attenuation = 1.0/(light.constant + light.linear*distance + light.quadratic*(distance*distance));
 
 	// combine regions
-	vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1,TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1,TexCoords));
-	vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1,TexCoords));
+	vec3 ambient = light.ambient * surface.albedo * surface.occlusion;
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
 	ambient *= attenuation;
 	diffuse *= attenuation;
 	specular *= attenuation;
@@ -114,7 +147,7 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
 
 };
 
-vec3 CalcSpotLight(SpotLight light, vec3 normal,vec3 fragPos, vec3 viewDir){
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 normal,vec3 fragPos, vec3 viewDir){
 
 
 	vec3 lightDir = normalize(light.position - fragPos);
@@ -122,7 +155,7 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal,vec3 fragPos, vec3 viewDir){
 	float diff = max(dot(normal,lightDir),0.0); 
 	// Specular Shading
 	vec3 reflectDir = reflect(-lightDir,normal);
-	float spec = pow(max(dot(viewDir,reflectDir),0.0), material.shininess);
+	float spec = pow(max(dot(viewDir,reflectDir),0.0), surface.shininess);
 
 	// Attenuation
 	float distance	= length(light.position - fragPos);
@@ -134,9 +167,9 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal,vec3 fragPos, vec3 viewDir){
 	float intensity = clamp((tetha - light.outerCutOff)/epsilon, 0.0,1.0);
 
 	// combine regions
-	vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1,TexCoords));
-	vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1,TexCoords));
-	vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1,TexCoords));
+	vec3 ambient = light.ambient * surface.albedo * surface.occlusion;
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
 	ambient *= attenuation * intensity;
 	diffuse *= attenuation * intensity;
 	specular *= attenuation * intensity;
@@ -0,0 +1,42 @@
+#version 440 core
+
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+layout(location = 7) in uvec4 aJoints;
+layout(location = 8) in vec4 aWeights;
+layout(location = 9) in vec4 aTangent; // w is the handedness of the bitangent
+
+// Palettes of every animated character, back to back (see Animator::SampleAll)
+layout(std430, binding = 5) readonly buffer BonePalettes { mat4 bones[]; };
+
+uniform uint paletteOffset; // first bone of this character's palette
+uniform bool skinned;
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out vec4 Tangent;
+
+void main()
+{
+	mat4 skin = mat4(1.0);
+	if (skinned)
+	{
+		skin = aWeights.x * bones[paletteOffset + aJoints.x]
+			+ aWeights.y * bones[paletteOffset + aJoints.y]
+			+ aWeights.z * bones[paletteOffset + aJoints.z]
+			+ aWeights.w * bones[paletteOffset + aJoints.w];
+	}
+	mat4 skinnedModel = model * skin;
+
+	FragPos = vec3(skinnedModel * vec4(aPos, 1.0));
+	Normal = mat3(transpose(inverse(skinnedModel))) * aNormal;
+	Tangent = vec4(mat3(skinnedModel) * aTangent.xyz, aTangent.w);
+
+	gl_Position = projection * view * vec4(FragPos, 1.0);
+	TexCoords = aTexCoords;
+}
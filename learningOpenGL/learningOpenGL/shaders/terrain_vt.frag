@@ -0,0 +1,44 @@
+#version 440 core
+
+out vec4 FragColor;
+
+struct VirtualTexture {
+	sampler2D atlas;		// pages with their borders, atlasPages per side
+	usampler2D indirection;	// per page of every level: atlas slot x, y and level of the page actually resident
+	int pagesPerSide;		// at level 0
+	int levelCount;
+	int pageSize;
+	int border;
+	int atlasPages;
+	float lodBias;
+};
+
+uniform VirtualTexture virtualTexture;
+in vec2 TexCoords;
+
+vec4 sampleVirtual(vec2 uv)
+{
+	// The level the feedback asked for (see shaders/vt_feedback.frag)
+	vec2 texel = uv * float(virtualTexture.pagesPerSide * virtualTexture.pageSize);
+	float lod = 0.5 * log2(max(dot(dFdx(texel), dFdx(texel)), dot(dFdy(texel), dFdy(texel)))) + virtualTexture.lodBias;
+	int level = clamp(int(floor(lod)), 0, virtualTexture.levelCount - 1);
+
+	uv = clamp(uv, 0.0, 1.0);
+	int pages = virtualTexture.pagesPerSide >> level;
+	ivec2 page = min(ivec2(uv * float(pages)), ivec2(pages - 1));
+	uvec4 entry = texelFetch(virtualTexture.indirection, page, level);
+
+	// Until it streams in, the page is stood in for by its finest resident ancestor
+	int residentLevel = int(entry.z);
+	ivec2 residentPage = page >> (residentLevel - level);
+	vec2 inPage = uv * float(virtualTexture.pagesPerSide >> residentLevel) - vec2(residentPage);
+
+	float storedSize = float(virtualTexture.pageSize + 2 * virtualTexture.border);
+	vec2 atlasTexel = vec2(entry.xy) * storedSize + float(virtualTexture.border) + inPage * float(virtualTexture.pageSize);
+	return textureLod(virtualTexture.atlas, atlasTexel / (storedSize * float(virtualTexture.atlasPages)), 0.0);
+}
+
+void main()
+{
+	FragColor = vec4(sampleVirtual(TexCoords).rgb, 1.0);
+}
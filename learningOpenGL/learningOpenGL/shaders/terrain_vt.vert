@@ -0,0 +1,16 @@
+#version 440 core
+
+layout(location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec2 uvScale;	// from the terrain's grid positions to virtual texture coordinates
+
+out vec2 TexCoords;
+
+void main()
+{
+	TexCoords = aPos.xz * uvScale;
+	gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
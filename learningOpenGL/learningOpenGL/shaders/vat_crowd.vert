@@ -0,0 +1,71 @@
+#version 440 core
+
+layout(location = 2) in vec2 aTexCoords;
+
+// Instances of the crowd (see CrowdInstance)
+struct CrowdInstance
+{
+	mat4 model;
+	uint clip;
+	float timeOffset;
+	float speed;
+	float padding;
+};
+layout(std430, binding = 6) readonly buffer CrowdInstances { CrowdInstance instances[]; };
+
+// Frames of each clip in the baked textures (see VATClip)
+struct VATClip
+{
+	uint firstFrame;
+	uint frameCount;
+	float framesPerSecond;
+	float padding;
+};
+layout(std430, binding = 7) readonly buffer VATClips { VATClip clips[]; };
+
+uniform sampler2D vatPositions;
+uniform sampler2D vatNormals;
+uniform uint vatVertexCount;	// vertices of all meshes of the model
+uniform uint vatVertexBase;		// first vertex of this mesh
+uniform float time;				// in seconds
+uniform mat4 view;
+uniform mat4 projection;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out vec4 Tangent;
+
+// Texel = frame * vatVertexCount + vertex, wrapping every row of the texture
+ivec2 texelOf(uint frame)
+{
+	uint texel = frame * vatVertexCount + vatVertexBase + uint(gl_VertexID);
+	uint width = uint(textureSize(vatPositions, 0).x);
+	return ivec2(texel % width, texel / width);
+}
+
+void main()
+{
+	CrowdInstance instance = instances[gl_InstanceID];
+	VATClip clip = clips[instance.clip];
+
+	// Every clip loops, blend the two baked frames around the instance's time
+	float frame = mod((time * instance.speed + instance.timeOffset) * clip.framesPerSecond, float(clip.frameCount));
+	uint frame0 = min(uint(frame), clip.frameCount - 1);
+	uint frame1 = (frame0 + 1) % clip.frameCount;
+	float blend = fract(frame);
+
+	ivec2 texel0 = texelOf(clip.firstFrame + frame0);
+	ivec2 texel1 = texelOf(clip.firstFrame + frame1);
+	vec3 position = mix(texelFetch(vatPositions, texel0, 0).xyz, texelFetch(vatPositions, texel1, 0).xyz, blend);
+	vec3 normal = mix(texelFetch(vatNormals, texel0, 0).xyz, texelFetch(vatNormals, texel1, 0).xyz, blend);
+
+	FragPos = vec3(instance.model * vec4(position, 1.0));
+	Normal = mat3(transpose(inverse(instance.model))) * normal;
+
+	// The baked frames have no tangents, a zero tangent makes the fragment shader keep the vertex normal
+	Tangent = vec4(0.0);
+
+	gl_Position = projection * view * vec4(FragPos, 1.0);
+	TexCoords = aTexCoords;
+}
@@ -0,0 +1,28 @@
+#version 440 core
+
+// Page and level of the virtual texture this pixel samples, the alpha is cleared to 0 where nothing is drawn
+layout(location = 0) out uvec4 FragColor;
+
+struct VirtualTexture {
+	int pagesPerSide;	// at level 0
+	int levelCount;
+	int pageSize;
+	int border;
+	int atlasPages;
+	float lodBias;		// makes up for the lower resolution of the feedback
+};
+
+uniform VirtualTexture virtualTexture;
+in vec2 TexCoords;
+
+void main()
+{
+	// Same level as shaders/terrain_vt.frag picks
+	vec2 texel = TexCoords * float(virtualTexture.pagesPerSide * virtualTexture.pageSize);
+	float lod = 0.5 * log2(max(dot(dFdx(texel), dFdx(texel)), dot(dFdy(texel), dFdy(texel)))) + virtualTexture.lodBias;
+	int level = clamp(int(floor(lod)), 0, virtualTexture.levelCount - 1);
+
+	int pages = virtualTexture.pagesPerSide >> level;
+	ivec2 page = min(ivec2(clamp(TexCoords, 0.0, 1.0) * float(pages)), ivec2(pages - 1));
+	FragColor = uvec4(page, level, 255);
+}
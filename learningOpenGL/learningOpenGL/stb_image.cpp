@@ -1,2 +1,7 @@
 #define STB_IMAGE_IMPLEMENTATION
+// Decoding allocates from the calling thread's arena (see ImageDecoder)
+#include "ImageDecoder.h"
+#define STBI_MALLOC(size) ImageDecoder::Allocate(size)
+#define STBI_REALLOC_SIZED(pointer, oldSize, newSize) ImageDecoder::Reallocate(pointer, oldSize, newSize)
+#define STBI_FREE(pointer) ImageDecoder::Free(pointer)
 #include "stb_image.h"